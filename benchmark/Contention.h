@@ -0,0 +1 @@
+../lib/Contention.h
\ No newline at end of file
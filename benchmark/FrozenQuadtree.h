@@ -0,0 +1 @@
+../lib/FrozenQuadtree.h
\ No newline at end of file
@@ -0,0 +1 @@
+../lib/LearnedIndex.h
\ No newline at end of file
@@ -12,6 +12,50 @@ Benchmarking suite for 2D data structures
 
 #define COUNT_ALL
 
+// Queries may be answered by a read-only snapshot of the populated tree instead of the tree itself.
+#ifdef SNAPSHOT
+#define QUERY_ROOT snapshot
+#define QUERY_FUNCTION SNAPSHOT_QUERY
+#else
+#define QUERY_ROOT root
+#define QUERY_FUNCTION QUERY
+#endif
+
+// Points are drawn around CLUSTERS random centers if it is defined, and uniformly otherwise. Each
+// cluster is a box 1 / CLUSTER_SPREAD the side of the tree.
+#ifdef CLUSTERS
+#ifndef CLUSTER_SPREAD
+#define CLUSTER_SPREAD 64
+#endif
+static Point cluster_centers[CLUSTERS];
+#endif
+
+/**
+ * random_point
+ *
+ * Draws a random point, from the clusters if CLUSTERS is defined.
+ *
+ * p_min - the point with the smallest coordinate values
+ * p_max - the point with the largest coordinate values
+ *
+ * Returns a point between p_min and p_max.
+ */
+static Point random_point(const Point p_min, const Point p_max) {
+    Point p;
+    register uint64_t i;
+#ifdef CLUSTERS
+    const Point center = cluster_centers[(uint64_t)(CLUSTERS * random())];
+    for (i = 0; i < D; i++) {
+        p.data[i] = center.data[i] + (random() - 0.5) * (p_max.data[i] - p_min.data[i]) / CLUSTER_SPREAD;
+    }
+#else
+    for (i = 0; i < D; i++) {
+        p.data[i] = p_min.data[i] + random() * (p_max.data[i] - p_min.data[i]);
+    }
+#endif
+    return p;
+}
+
 /**
  * OperationPacket
  *
@@ -22,50 +66,249 @@ Benchmarking suite for 2D data structures
  * and the bounds of the points to be generated
  *
  * root - the first node to start at
+ * snapshot - the read-only snapshot to answer queries with, if SNAPSHOT is defined
  * p_min - the point with the smallest coordinate values
  * p_max - the point with the largest coordinate values
  * inserts - buffer for number of inserts processed
  * queries - buffer for number of queries processed
  * deletes - buffer for number of deletes processed
+ * latency - buffer for the total time spent in operations, in nanoseconds, if LATENCY is defined,
+ *     or between sending operations and receiving their replies if ASYNC_SIZE is defined
  * vid - the virtual ID for the thread
  * actives - buffer for already-active points
  * active_size - size of active points buffer
  * ready - the bit for the thread to say it's ready
+ * rlu - the thread's RLU data, freed by the parent once every thread has finished with RLU
  */
 typedef volatile struct {
     TYPE *root;
+#ifdef SNAPSHOT
+    SNAPSHOT_TYPE *snapshot;
+#endif
     Point p_min, p_max;
     uint64_t inserts, queries, deletes;
+    uint64_t latency;
     uint64_t vid;
     Point *actives;
     uint64_t active_size;
     bool ready;
+    rlu_thread_data_t *rlu;
 } OperationPacket;
 
+// Counters are sampled every STATS_INTERVAL milliseconds if STATS_FORMAT_json or STATS_FORMAT_csv
+// is defined, and written to stderr, one line per thread and one for every thread per sample. With
+// TREE_STATS, every line also carries the size, height and node count of the tree at the sample.
+#if defined(STATS_FORMAT_json) || defined(STATS_FORMAT_csv)
+#define SAMPLE_STATS
+#ifndef STATS_INTERVAL
+#define STATS_INTERVAL 1000
+#endif
+
+/**
+ * print_sample
+ *
+ * Prints the counters of one thread, or of every thread, as a JSON object or a CSV row.
+ *
+ * seconds - the time since benchmarking began
+ * thread - the virtual ID of the thread, or -1 for every thread
+ * inserts - the number of inserts processed so far
+ * queries - the number of queries processed so far
+ * deletes - the number of deletes processed so far
+ * stats - the RLU counters
+ * tree - the counts of the tree, printed if TREE_STATS is defined
+ */
+static void print_sample(const float64_t seconds, const int64_t thread, const uint64_t inserts,
+        const uint64_t queries, const uint64_t deletes, const rlu_stats_t * const stats,
+        const QuadtreeStats * const tree) {
+#ifdef STATS_FORMAT_json
+    fprintf(stderr, "{\"time\": %.3lf, \"thread\": %lld, \"inserts\": %llu, \"queries\": %llu, "
+        "\"deletes\": %llu, \"rlu_starts\": %ld, \"rlu_finish\": %ld, \"rlu_writers\": %ld, "
+        "\"rlu_aborts\": %ld, \"rlu_steals\": %ld, \"rlu_writer_sync_waits\": %ld, "
+        "\"rlu_writeback_q_iters\": %ld, \"rlu_sync_requests\": %ld, "
+        "\"rlu_sync_and_writeback\": %ld, \"rlu_writeback_bytes\": %ld, "
+        "\"rlu_q_sleeps\": %ld, \"rlu_q_shared\": %ld",
+#else
+    fprintf(stderr, "%.3lf,%lld,%llu,%llu,%llu,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld",
+#endif
+        seconds, (long long)thread, (unsigned long long)inserts, (unsigned long long)queries,
+        (unsigned long long)deletes, stats->n_starts, stats->n_finish, stats->n_writers,
+        stats->n_aborts, stats->n_steals, stats->n_writer_sync_waits, stats->n_writeback_q_iters,
+        stats->n_sync_requests, stats->n_sync_and_writeback, stats->n_writeback_bytes,
+        stats->n_q_sleeps, stats->n_q_shared);
+#ifdef TREE_STATS
+#ifdef STATS_FORMAT_json
+    fprintf(stderr, ", \"tree_size\": %llu, \"tree_height\": %llu, \"tree_nodes\": %llu",
+#else
+    fprintf(stderr, ",%llu,%llu,%llu",
+#endif
+        (unsigned long long)tree->size, (unsigned long long)tree->height,
+        (unsigned long long)tree->nodes);
+#else
+    (void)tree;
+#endif
+#ifdef STATS_FORMAT_json
+    fprintf(stderr, "}\n");
+#else
+    fprintf(stderr, "\n");
+#endif
+}
+#endif
+
+// Operations may be sent without waiting for them to be applied, with up to ASYNC_SIZE of them in
+// flight per thread, each timed from being sent until its reply is received.
+#ifdef ASYNC_SIZE
+#ifdef TXN_SIZE
+#error "ASYNC and TXN cannot be combined"
+#endif
+#ifdef LATENCY
+#error "ASYNC reports the send-receive latency, so LATENCY cannot be combined with it"
+#endif
+
+/**
+ * AsyncOperation
+ *
+ * An operation that has been sent and whose reply has not been received yet.
+ *
+ * operation - the operation
+ * point - the point it was sent for
+ * sent - when it was sent
+ */
+typedef struct {
+    QuadtreeOperation operation;
+    Point point;
+    struct timespec sent;
+} AsyncOperation;
+
+/**
+ * AsyncWindow
+ *
+ * The operations a thread has in flight, oldest first.
+ *
+ * operations - the operations
+ * size - the number of operations
+ */
+typedef struct {
+    AsyncOperation operations[ASYNC_SIZE];
+    uint64_t size;
+} AsyncWindow;
+
+/**
+ * async_receive
+ *
+ * Receives the replies that are ready, and counts and times the operations they answer.
+ *
+ * root - the tree the operations were sent to
+ * window - the operations in flight
+ * packet - the packet of the thread, whose counters and latency are advanced
+ *
+ * Returns the number of replies received.
+ */
+static uint64_t async_receive(TYPE * const root, AsyncWindow * const window,
+        OperationPacket * const packet) {
+    REPLY_TYPE replies[ASYNC_SIZE];
+    const uint64_t nreplies = RECEIVE(root, replies, ASYNC_SIZE);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    uint64_t i, j;
+    for (i = 0; i < nreplies; i++) {
+        // Replies for one point come back in the order their operations were sent, so the oldest
+        // operation on the point is the one answered.
+        for (j = 0; j < window->size && (window->operations[j].operation != replies[i].operation ||
+                memcmp(&window->operations[j].point, &replies[i].point, sizeof(Point))); j++);
+        assert(j < window->size);
+        const struct timespec sent = window->operations[j].sent;
+        packet->latency += (now.tv_sec - sent.tv_sec) * 1000000000LL + (now.tv_nsec - sent.tv_nsec);
+        memmove(window->operations + j, window->operations + j + 1,
+            sizeof(*window->operations) * (window->size - j - 1));
+        window->size--;
+
+#ifdef COUNT_ALL
+        const uint64_t counted = 1;
+#else
+        const uint64_t counted = replies[i].result;
+#endif
+        switch (replies[i].operation) {
+        case SEND_INSERT:
+            packet->inserts += counted;
+            break;
+        case SEND_QUERY:
+            packet->queries += counted;
+            break;
+        case SEND_DELETE:
+            packet->deletes += counted;
+            break;
+        }
+    }
+    return nreplies;
+}
+
+/**
+ * async_send
+ *
+ * Sends an operation, first receiving replies until there is room for it, and letting the owners
+ * run while none are ready.
+ *
+ * root - the tree to send the operation to
+ * operation - the operation
+ * point - the point to apply it to
+ * window - the operations in flight, which the operation joins
+ * packet - the packet of the thread
+ */
+static void async_send(TYPE * const root, const QuadtreeOperation operation, const Point point,
+        AsyncWindow * const window, OperationPacket * const packet) {
+    while (ASYNC_SIZE == window->size || !SEND(root, operation, point)) {
+        if (0 == async_receive(root, window, packet)) {
+            sched_yield();
+        }
+    }
+    AsyncOperation * const sent = window->operations + window->size++;
+    sent->operation = operation;
+    sent->point = point;
+    clock_gettime(CLOCK_MONOTONIC, &sent->sent);
+}
+#endif
+
 static volatile bool STARTED = false, ACTIVE = true;
 void* execute(void *op) {
     OperationPacket *packet = (OperationPacket*)op;
 
     // read initialization information from OperationPacket
     TYPE *root = packet->root;
+#ifdef SNAPSHOT
+    SNAPSHOT_TYPE *snapshot = packet->snapshot;
+#endif
     Point p_min = packet->p_min, p_max = packet->p_max;
 	srand(rand() + packet->vid * packet->vid);
 	srand(rand() + packet->vid);
     packet->inserts = 0;
     packet->queries = 0;
     packet->deletes = 0;
+    packet->latency = 0;
 
     // prepare point buffer
     const uint64_t npoints = min(2 * packet->active_size, 1000);
     Point *pbuffer = (Point*)malloc(sizeof(*pbuffer) * npoints);  // ``active" points
     uint64_t head = 0, tail = 0;
-    for (head = 0; head < npoints; head++) {
+    // the ring holds at most npoints - 1 points, since head == tail means empty
+    for (head = 0; head + 1 < npoints; head++) {
         pbuffer[head] = packet->actives[head];
     }
 
     // set up RLU
     rlu_self = (rlu_thread_data_t*)malloc(sizeof(*rlu_self));
     RLU_THREAD_INIT(rlu_self);
+    packet->rlu = rlu_self;
+
+#ifdef TXN_SIZE
+    // updates are collected into transactions of TXN_SIZE updates, each committed at once
+    TXN_TYPE *txn = TXN_BEGIN(root);
+    uint64_t txn_size = 0;
+#endif
+
+#ifdef ASYNC_SIZE
+    AsyncWindow window = { .size = 0 };
+#endif
 
     packet->ready = true;
 
@@ -77,6 +320,11 @@ void* execute(void *op) {
     */
 
     while (ACTIVE) {
+#ifdef LATENCY
+        struct timespec before, after;
+        clock_gettime(CLOCK_MONOTONIC, &before);
+#endif
+
         // writes vs reads
         if (head == tail || random() < WRATIO) {
             // deletes vs inserts
@@ -84,7 +332,12 @@ void* execute(void *op) {
                 Point p = pbuffer[tail];
                 tail = (tail + 1) % npoints;
 
-#ifdef COUNT_ALL
+#if defined(ASYNC_SIZE)
+                async_send(root, SEND_DELETE, p, &window, packet);
+#elif defined(TXN_SIZE)
+                TXN_DELETE(txn, p);
+                packet->deletes++;
+#elif defined(COUNT_ALL)
                 DELETE(root, p);
                 packet->deletes++;
 #else
@@ -92,10 +345,7 @@ void* execute(void *op) {
 #endif
             }
             else {
-                Point p;
-                register uint64_t i;
-                for (i = 0; i < D; i++)
-                    p.data[i] = p_min.data[i] + random() * (p_max.data[i] - p_min.data[i]);
+                Point p = random_point(p_min, p_max);
 
                 // within buffer
                 if ((head + 1) % npoints != tail) {
@@ -103,43 +353,133 @@ void* execute(void *op) {
                     head = (head + 1) % npoints;
                 }
 
-#ifdef COUNT_ALL
+#if defined(ASYNC_SIZE)
+                async_send(root, SEND_INSERT, p, &window, packet);
+#elif defined(TXN_SIZE)
+                TXN_INSERT(txn, p);
+                packet->inserts++;
+#elif defined(COUNT_ALL)
                 INSERT(root, p);
                 packet->inserts++;
 #else
                 packet->inserts += INSERT(root, p);
 #endif
             }
+#ifdef TXN_SIZE
+            if (TXN_SIZE == ++txn_size) {
+                TXN_COMMIT(txn);
+                txn = TXN_BEGIN(root);
+                txn_size = 0;
+            }
+#endif
         }
         else {
             uint64_t size = (head + npoints - tail) % npoints;
             uint64_t index = (uint64_t)(size * random());
 
-#ifdef COUNT_ALL
-            QUERY(root, pbuffer[(tail + index) % npoints]);
+#if defined(ASYNC_SIZE)
+            async_send(root, SEND_QUERY, pbuffer[(tail + index) % npoints], &window, packet);
+#elif defined(COUNT_ALL)
+            QUERY_FUNCTION(QUERY_ROOT, pbuffer[(tail + index) % npoints]);
             packet->queries++;
 #else
-            packet->queries += QUERY(root, pbuffer[(tail + index) % npoints]);
+            packet->queries += QUERY_FUNCTION(QUERY_ROOT, pbuffer[(tail + index) % npoints]);
 #endif
         }
+
+#ifdef LATENCY
+        clock_gettime(CLOCK_MONOTONIC, &after);
+        packet->latency += (after.tv_sec - before.tv_sec) * 1000000000LL +
+            (after.tv_nsec - before.tv_nsec);
+#endif
     }
 
     /*
     ** BENCHMARKING ENDS
     */
 
+#ifdef TXN_SIZE
+    TXN_COMMIT(txn);
+#endif
+
+#ifdef ASYNC_SIZE
+    // collect the replies still in flight, so that every operation counted was timed
+    while (0 < window.size) {
+        if (0 == async_receive(root, &window, packet)) {
+            sched_yield();
+        }
+    }
+#endif
+
     // clear out the point buffer
     free(pbuffer);
 
-    // end RLU on thread
+    // end RLU on thread; RLU keeps reading the data of finished threads, so the parent frees it
     RLU_THREAD_FINISH(rlu_self);
-    free(rlu_self);
 
     // ensure thread exits
     pthread_exit(0);
     return NULL;
 }
 
+#ifdef SAMPLE_STATS
+/**
+ * sample_stats
+ *
+ * Prints the counters of every thread every STATS_INTERVAL milliseconds until the time is up.
+ * With TREE_STATS, the tree is also walked at every sample; the main thread is registered with
+ * RLU only for the walk, so that a single benchmark thread still runs alone in between. Finishing
+ * gives the RLU id back, so every sample takes the same id rather than a new one.
+ *
+ * root - the tree being benchmarked
+ * packets - the packets of the threads, which have all set up RLU
+ * nthreads - the number of threads
+ * seconds - the time to run for
+ */
+static void sample_stats(TYPE * const root, OperationPacket * const packets,
+        const uint64_t nthreads, const uint64_t seconds) {
+#ifdef STATS_FORMAT_csv
+    fprintf(stderr, "time,thread,inserts,queries,deletes,rlu_starts,rlu_finish,rlu_writers,"
+        "rlu_aborts,rlu_steals,rlu_writer_sync_waits,rlu_writeback_q_iters,rlu_sync_requests,"
+        "rlu_sync_and_writeback,rlu_writeback_bytes,rlu_q_sleeps,rlu_q_shared%s\n",
+#ifdef TREE_STATS
+        ",tree_size,tree_height,tree_nodes"
+#else
+        ""
+#endif
+        );
+#endif
+    uint64_t elapsed = 0, i;
+    while (elapsed < seconds * 1000) {
+        const uint64_t interval = min(STATS_INTERVAL, seconds * 1000 - elapsed);
+        usleep(interval * 1000);
+        elapsed += interval;
+
+        QuadtreeStats tree = {0, 0, 0};
+#ifdef TREE_STATS
+        RLU_THREAD_INIT(rlu_self);
+        tree = TREE_STATS(root);
+        RLU_THREAD_FINISH(rlu_self);
+#else
+        (void)root;
+#endif
+
+        uint64_t inserts = 0, queries = 0, deletes = 0;
+        rlu_stats_t stats;
+        for (i = 0; i < nthreads; i++) {
+            rlu_get_thread_stats(packets[i].rlu->uniq_id, &stats);
+            print_sample(elapsed * 1e-3, i, packets[i].inserts, packets[i].queries,
+                packets[i].deletes, &stats, &tree);
+            inserts += packets[i].inserts;
+            queries += packets[i].queries;
+            deletes += packets[i].deletes;
+        }
+        rlu_get_stats(&stats);
+        print_sample(elapsed * 1e-3, -1, inserts, queries, deletes, &stats, &tree);
+    }
+}
+#endif
+
 void test_random(const uint64_t seconds) {
     // seed the RNG based on time to run
     srand(seconds % ((1LL << 32) - 1));
@@ -195,22 +535,52 @@ void test_random(const uint64_t seconds) {
     // initialize RLU
 
     // type: FINE/COARSE, max_write_sets: 1 if COARSE
-    RLU_INIT(RLU_TYPE_FINE_GRAINED, nthreads + 1);
+#ifdef RLU_WRITE_SETS
+    RLU_INIT(RLU_TYPE_FINE_GRAINED, RLU_WRITE_SETS);
+#else
+    RLU_INIT(RLU_TYPE_FINE_GRAINED, RLU_DEFAULT_MAX_WRITE_SETS);
+#endif
 
     rlu_self = (rlu_thread_data_t*)malloc(sizeof(*rlu_self));
 
-    RLU_THREAD_INIT(rlu_self);
-    Point *initial_actives = (Point*)malloc(sizeof(*initial_actives) * initial_population);
-    for (i = 0; i < initial_population; i++) {
+    Point p_min, p_max;
+    for (i = 0; i < D; i++) {
+        p_min.data[i] = root_point.data[i] - 0.5 * length;
+        p_max.data[i] = root_point.data[i] + 0.5 * length;
+    }
+
+#ifdef CLUSTERS
+    // keep every cluster inside the tree
+    for (i = 0; i < CLUSTERS; i++) {
         register uint64_t j;
         for (j = 0; j < D; j++) {
-            initial_actives[i].data[j] = (random() - 0.5) * length;
+            const float64_t spread = (p_max.data[j] - p_min.data[j]) / CLUSTER_SPREAD;
+            cluster_centers[i].data[j] = p_min.data[j] + 0.5 * spread +
+                random() * (p_max.data[j] - p_min.data[j] - spread);
         }
+    }
+#ifdef VERBOSE
+    printf("Points drawn from %llu clusters\n", (unsigned long long)CLUSTERS);
+#endif
+#endif
+
+    RLU_THREAD_INIT(rlu_self);
+    Point *initial_actives = (Point*)malloc(sizeof(*initial_actives) * initial_population);
+    for (i = 0; i < initial_population; i++) {
+        initial_actives[i] = random_point(p_min, p_max);
         INSERT(root, initial_actives[i]);
     }
     RLU_THREAD_FINISH(rlu_self);
 
-    free(rlu_self);
+#ifdef SNAPSHOT
+#ifdef FLUSH
+    FLUSH(root);
+#endif
+    SNAPSHOT_TYPE *snapshot = SNAPSHOT(root);
+#if defined(VERBOSE) && defined(SNAPSHOT_MEMORY)
+    printf("Snapshot for queries: %llu bytes\n", (unsigned long long)SNAPSHOT_MEMORY(snapshot));
+#endif
+#endif
 
 #ifdef VERBOSE
     printf("Running for %llu seconds\n", (unsigned long long)seconds);
@@ -223,24 +593,24 @@ void test_random(const uint64_t seconds) {
 
     // prepare initialization for each thread
     OperationPacket packets[nthreads];
-    Point p_min, p_max;
-    for (i = 0; i < D; i++) {
-        p_min.data[i] = root_point.data[i] - 0.5 * length;
-        p_max.data[i] = root_point.data[i] + 0.5 * length;
-    }
     const uint64_t actives_per_thread = min(100000, initial_population / nthreads);
     for (i = 0; i < nthreads; i++) {
         packets[i] = (OperationPacket) {
             .root = root,
+#ifdef SNAPSHOT
+            .snapshot = snapshot,
+#endif
             .p_min = p_min,
             .p_max = p_max,
             .inserts = 0,
             .queries = 0,
             .deletes = 0,
+            .latency = 0,
             .vid = i,
             .actives = initial_actives + i * actives_per_thread,
             .active_size = actives_per_thread,
-            .ready = false
+            .ready = false,
+            .rlu = NULL
         };
     }
 
@@ -271,7 +641,11 @@ void test_random(const uint64_t seconds) {
 
     STARTED = true;  // threads can start now
 
+#ifdef SAMPLE_STATS
+    sample_stats(root, packets, nthreads, seconds);
+#else
     sleep(seconds);
+#endif
 
     ACTIVE = false;  // threads should stop now
 
@@ -293,11 +667,12 @@ void test_random(const uint64_t seconds) {
     float64_t total_seconds = time_seconds + time_microseconds * 1e-6;
 
     // aggregate data
-    uint64_t inserts = 0, queries = 0, deletes = 0;
+    uint64_t inserts = 0, queries = 0, deletes = 0, latency = 0;
     for (i = 0; i < nthreads; i++) {
         inserts += packets[i].inserts;
         queries += packets[i].queries;
         deletes += packets[i].deletes;
+        latency += packets[i].latency;
     }
     uint64_t total = inserts + queries + deletes;
 
@@ -310,6 +685,34 @@ void test_random(const uint64_t seconds) {
     printf("Number of deletes:  %10llu\n", (unsigned long long)deletes);
     printf("Total real time:    %17.6lf s\n", total_seconds);
     printf("Total throughput:   %17.6lf ops/s\n", total / total_seconds);
+#if defined(ASYNC_SIZE)
+    printf("Mean send-receive:  %17.6lf ns (up to %llu in flight per thread)\n",
+        (float64_t)latency / total, (unsigned long long)ASYNC_SIZE);
+#elif defined(LATENCY)
+    printf("Mean latency:       %17.6lf ns\n", (float64_t)latency / total);
+#endif
+#ifdef SHARD_STATS
+    const QuadtreeShardStats shard_stats = SHARD_STATS(root);
+    const float64_t shard_mean = (float64_t)shard_stats.points / shard_stats.shards;
+    printf("Number of shards:   %10llu\n", (unsigned long long)shard_stats.shards);
+    printf("Points per shard:   %10llu min, %.1lf mean, %llu max\n",
+        (unsigned long long)shard_stats.min, shard_mean, (unsigned long long)shard_stats.max);
+    printf("Shard imbalance:    %17.6lf (max / mean)\n",
+        shard_stats.points ? shard_stats.max / shard_mean : 1.0);
+#endif
+#ifdef NUMA_STATS
+    const NumaPoolStats numa_stats = NUMA_STATS();
+    printf("NUMA allocations:   %10llu local, %llu remote, %llu interleaved, %llu unpooled\n",
+        (unsigned long long)numa_stats.local, (unsigned long long)numa_stats.remote,
+        (unsigned long long)numa_stats.interleaved, (unsigned long long)numa_stats.unpooled);
+    printf("NUMA remote frees:  %10llu\n", (unsigned long long)numa_stats.remote_frees);
+#endif
+#ifdef CONTENTION_REPORT
+    CONTENTION_REPORT(stdout, CONTENTION_TOP);
+#endif
+#ifdef RLU_STATS
+    rlu_print_stats();
+#endif
 #else
     printf("%llu, %llu, %llu, %lf, %llu, %llu, %llu, %llu", (unsigned long long)nthreads, (unsigned long long)D,
         (unsigned long long)total, total_seconds, (unsigned long long)initial_population,
@@ -317,12 +720,22 @@ void test_random(const uint64_t seconds) {
     printf("\n");
 #endif
 
+#ifdef SNAPSHOT
+    SNAPSHOT_DESTRUCTOR(snapshot);
+#endif
+
     DESTRUCTOR(root);
 
 #ifdef CLEANUP
     CLEANUP();
 #endif
 
+    for (i = 0; i < nthreads; i++) {
+        free(packets[i].rlu);
+    }
+    free(rlu_self);
+    rlu_self = NULL;
+
     free(initial_actives);
     pthread_mutex_attr_destroy();
     pthread_exit(0);
@@ -371,7 +784,17 @@ int main(int argc, char* argv[]) {
     printf("-DDESTRUCTOR (the datatype destructor)\n");
     printf("\nOptional:\n");
     printf("-DCLEANUP (the cleanup function, takes no argument)\n");
+    printf("-DFLUSH (function applying deferred updates, called before -DSNAPSHOT)\n");
+    printf("-DSNAPSHOT (function taking a read-only snapshot of the populated tree to query)\n");
+    printf("-DSNAPSHOT_TYPE, -DSNAPSHOT_QUERY, -DSNAPSHOT_DESTRUCTOR, optionally -DSNAPSHOT_MEMORY (with -DSNAPSHOT)\n");
     printf("-DINITIAL (initial population, defaults to 1,000,000 nodes)\n");
+    printf("-DCLUSTERS (draw points around this many random centers instead of uniformly)\n");
+    printf("-DCLUSTER_SPREAD (with -DCLUSTERS, the side of the tree over the side of a cluster, defaults to 64)\n");
+    printf("-DLATENCY (measure the mean latency of operations)\n");
+    printf("-DASYNC_SIZE (send operations without waiting, up to this many in flight per thread, and measure the send-receive latency), with -DSEND, -DRECEIVE, -DREPLY_TYPE, -DSEND_INSERT, -DSEND_QUERY, -DSEND_DELETE\n");
+    printf("-DSHARD_STATS (function returning the QuadtreeShardStats of a sharded tree, to report imbalance)\n");
+    printf("-DNUMA_STATS (function returning the NumaPoolStats of the NUMA pools, to report locality)\n");
+    printf("-DTREE_STATS (function returning the QuadtreeStats of the tree, sampled with -DSTATS_FORMAT_json/csv)\n");
     printf("-DMTRACE (define to enable mtrace)\n");
     printf("-DPARALLEL (use pthreads to run in parallel; serial otherwise)\n");
     printf("-DNTHREADS (number of threads to use, defaults to 1)\n");
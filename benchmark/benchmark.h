@@ -23,6 +23,10 @@ Benchmarking suite utilities header
 #define READY_TO_RUN
 
 #include HEADER
+
+#ifdef SNAPSHOT_HEADER
+#include SNAPSHOT_HEADER
+#endif
 #endif
 
 #define rand Marsaglia_rand
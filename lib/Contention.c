@@ -0,0 +1,172 @@
+/**
+Profiling where the updates of concurrent trees get in each other's way
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "Contention.h"
+#include "Quadtree.h"
+
+// Number of squares that conflicts can be counted for, a power of two; conflicts over further
+// squares are only counted by level.
+#define CONTENTION_SLOTS 4096
+// Number of slots looked at for a square before giving up on it.
+#define CONTENTION_PROBES 64
+
+// The states of a slot: free, being claimed for a square, and holding a square.
+#define SLOT_FREE 0
+#define SLOT_CLAIMED 1
+#define SLOT_READY 2
+
+/*
+ * struct ContentionSlot_t
+ *
+ * The conflicts counted over one square.
+ *
+ * state - SLOT_FREE, SLOT_CLAIMED or SLOT_READY; the square is only read once it is SLOT_READY
+ * level - the level of the square
+ * length - the side length of the square
+ * center - the center of the square
+ * conflicts - the number of conflicts over the square
+ */
+typedef struct ContentionSlot_t {
+    volatile uint64_t state;
+    uint64_t level;
+    float64_t length;
+    Point center;
+    volatile uint64_t conflicts;
+} ContentionSlot;
+
+// The squares conflicts were counted over, as an open-addressing hash table, and the conflicts on
+// every level, including those over squares that found no slot.
+static ContentionSlot contention_slots[CONTENTION_SLOTS];
+static volatile uint64_t contention_levels[QUADTREE_LEVELS];
+static volatile uint64_t contention_untracked = 0;
+
+/*
+ * hash
+ *
+ * Returns the hash of a square, mixing the bits of its level, length and center.
+ */
+static uint64_t hash(const uint64_t level, const float64_t length, const Point * const center) {
+    uint64_t h = level * 0x9E3779B97F4A7C15ULL, bits, i;
+    for (i = 0; i <= D; i++) {
+        const float64_t value = (i < D ? center->data[i] : length);
+        memcpy(&bits, &value, sizeof(bits));
+        h ^= bits + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+    }
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/*
+ * same_slot
+ *
+ * Returns whether a slot holds the square.
+ */
+static inline bool same_slot(const ContentionSlot * const slot, const uint64_t level,
+        const float64_t length, const Point * const center) {
+    uint64_t i;
+    if (slot->level != level || slot->length != length) {
+        return false;
+    }
+    for (i = 0; i < D; i++) {
+        if (slot->center.data[i] != center->data[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Contention_record(const uint64_t level, const float64_t length, const Point * const center) {
+    __sync_fetch_and_add(&contention_levels[min(level, QUADTREE_LEVELS - 1)], 1);
+
+    const uint64_t h = hash(level, length, center);
+    uint64_t i;
+    for (i = 0; i < CONTENTION_PROBES; i++) {
+        ContentionSlot * const slot = contention_slots + ((h + i) & (CONTENTION_SLOTS - 1));
+        if (SLOT_FREE == slot->state &&
+                __sync_bool_compare_and_swap(&slot->state, SLOT_FREE, SLOT_CLAIMED)) {
+            slot->level = level;
+            slot->length = length;
+            slot->center = *center;
+            __atomic_store_n(&slot->state, SLOT_READY, __ATOMIC_RELEASE);
+        }
+
+        // A slot being claimed may be claimed for this very square.
+        while (SLOT_CLAIMED == __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE));
+        if (same_slot(slot, level, length, center)) {
+            __sync_fetch_and_add(&slot->conflicts, 1);
+            return;
+        }
+    }
+    __sync_fetch_and_add(&contention_untracked, 1);
+}
+
+/*
+ * compare_slots
+ *
+ * Orders slots by their number of conflicts, most first.
+ */
+static int compare_slots(const void * const a, const void * const b) {
+    const uint64_t x = (*(const ContentionSlot* const*)a)->conflicts;
+    const uint64_t y = (*(const ContentionSlot* const*)b)->conflicts;
+    return (x < y) - (x > y);
+}
+
+void Contention_report(FILE * const out, const uint64_t top) {
+    uint64_t total = 0, nslots = 0, i;
+    for (i = 0; i < QUADTREE_LEVELS; i++) {
+        total += contention_levels[i];
+    }
+    fprintf(out, "Conflicts:          %10llu\n", (unsigned long long)total);
+    if (0 == total) {
+        return;
+    }
+
+    for (i = QUADTREE_LEVELS; i-- > 0;) {
+        if (0 < contention_levels[i]) {
+            fprintf(out, "  level %2llu:        %10llu (%5.2lf%%)\n", (unsigned long long)i,
+                (unsigned long long)contention_levels[i], 100.0 * contention_levels[i] / total);
+        }
+    }
+
+    const ContentionSlot **slots =
+        (const ContentionSlot**)malloc(sizeof(*slots) * CONTENTION_SLOTS);
+    for (i = 0; i < CONTENTION_SLOTS; i++) {
+        if (SLOT_READY == contention_slots[i].state) {
+            slots[nslots++] = contention_slots + i;
+        }
+    }
+    qsort(slots, nslots, sizeof(*slots), compare_slots);
+
+    fprintf(out, "Hottest squares:\n");
+    char buffer[64 * D];
+    for (i = 0; i < nslots && i < top; i++) {
+        Point_string(&slots[i]->center, buffer);
+        fprintf(out, "  %3llu. level %2llu, length %lf, center %s: %llu (%5.2lf%%)\n",
+            (unsigned long long)i + 1, (unsigned long long)slots[i]->level, slots[i]->length,
+            buffer, (unsigned long long)slots[i]->conflicts, 100.0 * slots[i]->conflicts / total);
+    }
+    if (0 < contention_untracked) {
+        fprintf(out, "  (%llu conflicts over squares that did not fit in the table)\n",
+            (unsigned long long)contention_untracked);
+    }
+    free(slots);
+}
+
+void Contention_reset() {
+    uint64_t i;
+    for (i = 0; i < CONTENTION_SLOTS; i++) {
+        contention_slots[i].conflicts = 0;
+        contention_slots[i].state = SLOT_FREE;
+    }
+    for (i = 0; i < QUADTREE_LEVELS; i++) {
+        contention_levels[i] = 0;
+    }
+    contention_untracked = 0;
+    __sync_synchronize();
+}
@@ -0,0 +1,61 @@
+/**
+Interface for profiling where the updates of concurrent trees get in each other's way
+*/
+
+#ifndef CONTENTION_H
+#define CONTENTION_H
+
+#include <stdio.h>
+
+#include "types.h"
+#include "Point.h"
+
+/*
+ * A conflict is an update failing to take a square at once because another thread holds it: an
+ * RLU try-lock that fails in d-rlu, a lock that has to be waited for in d-lock, or a version that
+ * changed under a writer in d-seqlock and the variants built on it. With QUADTREE_CONTENTION, the
+ * variants count every conflict by the level of the square and by the square itself, so that a
+ * report can tell whether conflicts pile up on the upper levels, which every update passes through,
+ * or around a few busy regions of the space. Without it, CONTENTION_RECORD compiles to nothing.
+ *
+ * Squares are told apart by level, center and length, so a square that is collapsed and created
+ * again keeps its count. The counts are shared by every tree in the process.
+ */
+
+#ifdef QUADTREE_CONTENTION
+#define CONTENTION_RECORD(level, square) \
+    Contention_record((level), (square)->length, &(square)->center)
+#else
+#define CONTENTION_RECORD(level, square) ((void)0)
+#endif
+
+/*
+ * Contention_record
+ *
+ * Counts a conflict over a square. Safe to call from any thread.
+ *
+ * level - the level of the square
+ * length - the side length of the square
+ * center - the center of the square
+ */
+void Contention_record(const uint64_t level, const float64_t length, const Point * const center);
+
+/*
+ * Contention_report
+ *
+ * Prints the number of conflicts on each level, then the squares with the most conflicts, hottest
+ * first.
+ *
+ * out - the stream to print to
+ * top - the most squares to print
+ */
+void Contention_report(FILE * const out, const uint64_t top);
+
+/*
+ * Contention_reset
+ *
+ * Forgets every conflict counted so far. No thread may be recording conflicts meanwhile.
+ */
+void Contention_reset();
+
+#endif
@@ -0,0 +1,355 @@
+/**
+Epoch-based reclamation of memory shared between threads
+*/
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+
+#include "Epoch.h"
+#include "util.h"
+
+// Number of objects in each chunk of a limbo list.
+#define EPOCH_CHUNK 63
+// Number of retires between attempts to advance the epoch.
+#define EPOCH_ADVANCE_EVERY 64
+// Objects are recycled by size in granules, if they are at most EPOCH_RECYCLE_CLASSES long, and
+// each thread keeps at most EPOCH_RECYCLE_MAX objects of each size.
+#define EPOCH_GRANULE 16
+#define EPOCH_RECYCLE_CLASSES 32
+#define EPOCH_RECYCLE_MAX 4096
+
+/*
+ * struct EpochChunk_t
+ *
+ * A chunk of a limbo list.
+ *
+ * next - the next chunk of the list
+ * count - the number of objects in the chunk
+ * objects - the retired objects
+ * sizes - the sizes of the retired objects
+ */
+typedef struct EpochChunk_t EpochChunk;
+struct EpochChunk_t {
+    EpochChunk *next;
+    uint64_t count;
+    void *objects[EPOCH_CHUNK];
+    size_t sizes[EPOCH_CHUNK];
+};
+
+/*
+ * struct EpochList_t
+ *
+ * The objects retired by one thread during one epoch.
+ *
+ * epoch - the epoch the objects were retired during
+ * chunks - the chunks holding the objects, which there are none of if the list is empty
+ */
+typedef struct EpochList_t {
+    uint64_t epoch;
+    EpochChunk *chunks;
+} EpochList;
+
+/*
+ * struct EpochThread_t
+ *
+ * The state of a thread, which is handed over to another thread once its thread exits. Threads
+ * take a cache line each, so that announcing an epoch does not disturb other threads.
+ *
+ * announced - twice the epoch seen when the current critical section began, plus one, or 0 if the
+ *     thread is not in a critical section
+ * in_use - whether a thread owns the state
+ * nesting - the number of critical sections the thread is inside
+ * retires - the number of objects the thread retired since it last tried to advance the epoch
+ * limbo - the objects the thread retired during each of the last three epochs, by epoch modulo 3
+ * recycle - the reclaimed objects of each size in granules, linked through their first word
+ * recycled - the number of reclaimed objects of each size
+ * next - the next thread state
+ */
+typedef struct EpochThread_t EpochThread;
+struct EpochThread_t {
+    volatile uint64_t announced;
+    volatile uint64_t in_use;
+    uint64_t nesting, retires;
+    EpochList limbo[3];
+    void *recycle[EPOCH_RECYCLE_CLASSES + 1];
+    uint64_t recycled[EPOCH_RECYCLE_CLASSES + 1];
+    EpochThread *next;
+} __attribute__((aligned(64)));
+
+// The global epoch, on a cache line of its own.
+static volatile uint64_t epoch_global __attribute__((aligned(64))) = 1;
+// Every thread state ever created.
+static EpochThread * volatile epoch_threads = NULL;
+// Objects retired by threads that have exited, chained as limbo lists.
+static pthread_mutex_t epoch_orphans_lock = PTHREAD_MUTEX_INITIALIZER;
+static EpochList *epoch_orphans = NULL;
+static uint64_t epoch_norphans = 0;
+
+static pthread_once_t epoch_once = PTHREAD_ONCE_INIT;
+static pthread_key_t epoch_key;
+static __thread EpochThread *epoch_self = NULL;
+
+/*
+ * recycle
+ *
+ * Puts a reclaimed object in the recycle pool of a thread, or frees it if the pool is full.
+ *
+ * self - the thread to recycle into
+ * object - the reclaimed object
+ * size - the size of the object
+ */
+static void recycle(EpochThread * const self, void * const object, const size_t size) {
+#ifndef NUMA_POOLS
+    const uint64_t granules = (size + EPOCH_GRANULE - 1) / EPOCH_GRANULE;
+    if (granules <= EPOCH_RECYCLE_CLASSES && self->recycled[granules] < EPOCH_RECYCLE_MAX) {
+        *(void**)object = self->recycle[granules];
+        self->recycle[granules] = object;
+        self->recycled[granules]++;
+        return;
+    }
+#endif
+    node_free(object);
+}
+
+/*
+ * reclaim
+ *
+ * Reclaims every object of a limbo list, keeping its first chunk for reuse.
+ *
+ * self - the thread to recycle the objects into
+ * list - the list to empty
+ */
+static void reclaim(EpochThread * const self, EpochList * const list) {
+    EpochChunk *chunk = list->chunks;
+    while (NULL != chunk) {
+        uint64_t i;
+        for (i = 0; i < chunk->count; i++) {
+            recycle(self, chunk->objects[i], chunk->sizes[i]);
+        }
+        EpochChunk * const next = chunk->next;
+        if (chunk == list->chunks) {
+            chunk->count = 0;
+            chunk->next = NULL;
+        } else {
+            free(chunk);
+        }
+        chunk = next;
+    }
+}
+
+/*
+ * reclaim_orphans
+ *
+ * Reclaims the objects retired by threads that have exited, as far as the epoch allows.
+ *
+ * self - the thread to recycle the objects into
+ * epoch - the global epoch as last read
+ */
+static void reclaim_orphans(EpochThread * const self, const uint64_t epoch) {
+    if (0 == epoch_norphans || 0 != pthread_mutex_trylock(&epoch_orphans_lock)) {
+        return;
+    }
+    uint64_t i = 0;
+    while (i < epoch_norphans) {
+        if (epoch_orphans[i].epoch + 2 > epoch) {
+            i++;
+            continue;
+        }
+        reclaim(self, epoch_orphans + i);
+        free(epoch_orphans[i].chunks);
+        epoch_orphans[i] = epoch_orphans[--epoch_norphans];
+    }
+    pthread_mutex_unlock(&epoch_orphans_lock);
+}
+
+/*
+ * advance
+ *
+ * Advances the global epoch if every thread inside a critical section has seen it, then reclaims
+ * whatever the epoch now allows.
+ *
+ * self - the calling thread
+ */
+static void advance(EpochThread * const self) {
+    uint64_t epoch = epoch_global;
+    __sync_synchronize();
+    bool behind = false;
+    EpochThread *thread;
+    for (thread = epoch_threads; NULL != thread && !behind; thread = thread->next) {
+        const uint64_t announced = thread->announced;
+        behind = (announced & 1) && (announced >> 1) != epoch;
+    }
+    if (!behind && __sync_bool_compare_and_swap(&epoch_global, epoch, epoch + 1)) {
+        epoch++;
+    }
+
+    uint64_t i;
+    for (i = 0; i < 3; i++) {
+        if (self->limbo[i].epoch + 2 <= epoch) {
+            reclaim(self, self->limbo + i);
+        }
+    }
+    reclaim_orphans(self, epoch);
+}
+
+/*
+ * orphan
+ *
+ * Hands the objects retired by an exiting thread over to the orphans and frees its recycled
+ * objects, then releases its state for another thread to take.
+ *
+ * state - the state of the exiting thread
+ */
+static void orphan(void * const state) {
+    EpochThread * const self = (EpochThread*)state;
+    uint64_t i;
+    pthread_mutex_lock(&epoch_orphans_lock);
+    epoch_orphans = (EpochList*)realloc(epoch_orphans,
+        sizeof(*epoch_orphans) * (epoch_norphans + 3));
+    for (i = 0; i < 3; i++) {
+        if (NULL != self->limbo[i].chunks && 0 < self->limbo[i].chunks->count) {
+            epoch_orphans[epoch_norphans++] = self->limbo[i];
+        } else {
+            free(self->limbo[i].chunks);
+        }
+        self->limbo[i] = (EpochList){ .epoch = 0, .chunks = NULL };
+    }
+    pthread_mutex_unlock(&epoch_orphans_lock);
+
+    for (i = 0; i <= EPOCH_RECYCLE_CLASSES; i++) {
+        while (NULL != self->recycle[i]) {
+            void * const object = self->recycle[i];
+            self->recycle[i] = *(void**)object;
+            node_free(object);
+        }
+        self->recycled[i] = 0;
+    }
+
+    self->announced = 0;
+    self->nesting = 0;
+    self->retires = 0;
+    __atomic_store_n(&self->in_use, false, __ATOMIC_RELEASE);
+    epoch_self = NULL;
+}
+
+static void epoch_init() {
+    pthread_key_create(&epoch_key, orphan);
+}
+
+/*
+ * get_self
+ *
+ * Returns the state of the calling thread, taking a released one or creating one if the thread
+ * has none yet.
+ */
+static EpochThread* get_self() {
+    if (NULL != epoch_self) {
+        return epoch_self;
+    }
+    pthread_once(&epoch_once, epoch_init);
+
+    EpochThread *self;
+    for (self = epoch_threads; NULL != self; self = self->next) {
+        if (!self->in_use && __sync_bool_compare_and_swap(&self->in_use, false, true)) {
+            break;
+        }
+    }
+    if (NULL == self) {
+        if (0 != posix_memalign((void**)&self, 64, sizeof(*self))) {
+            abort();
+        }
+        *self = (EpochThread){ .announced = 0, .in_use = true };
+        do {
+            self->next = epoch_threads;
+        } while (!__sync_bool_compare_and_swap(&epoch_threads, self->next, self));
+    }
+
+    pthread_setspecific(epoch_key, self);
+    epoch_self = self;
+    return self;
+}
+
+void Epoch_enter() {
+    EpochThread * const self = get_self();
+    if (0 < self->nesting++) {
+        return;
+    }
+    // The announcement must be visible before any shared object is read.
+    self->announced = (epoch_global << 1) | 1;
+    __sync_synchronize();
+}
+
+void Epoch_exit() {
+    EpochThread * const self = epoch_self;
+    if (0 == --self->nesting) {
+        __atomic_store_n(&self->announced, 0, __ATOMIC_RELEASE);
+    }
+}
+
+void Epoch_retire(void * const object, const size_t size) {
+    EpochThread * const self = get_self();
+    // The unlink must be visible before the epoch is read, or a thread entering the next epoch
+    // could still reach the object once it is reclaimed.
+    __sync_synchronize();
+    const uint64_t epoch = epoch_global;
+    EpochList * const list = self->limbo + epoch % 3;
+
+    // A list left over from three epochs ago can no longer be reached.
+    if (list->epoch != epoch) {
+        reclaim(self, list);
+        list->epoch = epoch;
+    }
+    if (NULL == list->chunks || EPOCH_CHUNK == list->chunks->count) {
+        EpochChunk * const chunk = (EpochChunk*)malloc(sizeof(*chunk));
+        chunk->next = list->chunks;
+        chunk->count = 0;
+        list->chunks = chunk;
+    }
+    list->chunks->objects[list->chunks->count] = object;
+    list->chunks->sizes[list->chunks->count] = size;
+    list->chunks->count++;
+
+    if (EPOCH_ADVANCE_EVERY == ++self->retires) {
+        self->retires = 0;
+        advance(self);
+    }
+}
+
+void* Epoch_alloc(const size_t size, const uint64_t level) {
+#ifndef NUMA_POOLS
+    EpochThread * const self = epoch_self;
+    const uint64_t granules = (size + EPOCH_GRANULE - 1) / EPOCH_GRANULE;
+    if (NULL != self && granules <= EPOCH_RECYCLE_CLASSES && NULL != self->recycle[granules]) {
+        void * const object = self->recycle[granules];
+        self->recycle[granules] = *(void**)object;
+        self->recycled[granules]--;
+        return object;
+    }
+#endif
+    return node_alloc(size, level);
+}
+
+void Epoch_synchronize() {
+    EpochThread * const self = get_self();
+    const uint64_t epoch = epoch_global;
+    while (epoch_global < epoch + 2) {
+        advance(self);
+        if (epoch_global < epoch + 2) {
+            sched_yield();
+        }
+    }
+    advance(self);
+
+    // Orphans are only reclaimed if no other thread is busy with them, so wait for it.
+    while (true) {
+        pthread_mutex_lock(&epoch_orphans_lock);
+        const bool done = 0 == epoch_norphans;
+        pthread_mutex_unlock(&epoch_orphans_lock);
+        if (done) {
+            break;
+        }
+        reclaim_orphans(self, epoch_global);
+        advance(self);
+    }
+}
@@ -0,0 +1,80 @@
+/**
+Interface for epoch-based reclamation of memory shared between threads
+*/
+
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <stddef.h>
+
+#include "types.h"
+
+/*
+ * Epoch-based reclamation lets threads read shared objects without synchronizing with the threads
+ * that unlink them. Readers run inside critical sections, between Epoch_enter and Epoch_exit. An
+ * object unlinked from a shared structure is retired with Epoch_retire instead of freed, and is
+ * only reclaimed once every critical section that was running when it was retired has ended.
+ *
+ * A global epoch counts up as threads make progress. A thread entering a critical section
+ * announces the epoch it saw, and the epoch can only advance once every thread inside a critical
+ * section has seen it. An object retired during epoch e can therefore no longer be reached by
+ * anyone once the epoch has reached e + 2.
+ *
+ * Every thread keeps a limbo list of the objects it retired during each of the last three epochs.
+ * Once the epoch has moved far enough, a whole list is reclaimed at once. Every few retires, a
+ * thread also tries to advance the epoch. Reclaimed objects are kept in a recycle pool of the
+ * reclaiming thread, by size, and handed out again by Epoch_alloc; with NUMA_POOLS they go back to
+ * the NUMA pools instead, which recycle them themselves.
+ *
+ * One domain is shared by the whole process, so critical sections cover every structure using it.
+ */
+
+/*
+ * Epoch_enter
+ *
+ * Starts a critical section of the calling thread, during which no object that it can reach will
+ * be reclaimed. Critical sections may be nested.
+ */
+void Epoch_enter();
+
+/*
+ * Epoch_exit
+ *
+ * Ends a critical section of the calling thread.
+ */
+void Epoch_exit();
+
+/*
+ * Epoch_retire
+ *
+ * Hands an object that has been unlinked from every shared structure over to be reclaimed once no
+ * thread can be reading it any more. The calling thread must be inside a critical section.
+ *
+ * object - the object to retire, allocated with Epoch_alloc
+ * size - the size the object was allocated with
+ */
+void Epoch_retire(void * const object, const size_t size);
+
+/*
+ * Epoch_alloc
+ *
+ * Allocates an object, reusing one reclaimed by the calling thread if there is one of the same
+ * size.
+ *
+ * size - the size of the object
+ * level - the level of the tree the object is for, which decides its placement with NUMA_POOLS
+ *
+ * Returns the object, which may be retired with Epoch_retire or freed with node_free if no other
+ * thread could ever reach it.
+ */
+void* Epoch_alloc(const size_t size, const uint64_t level);
+
+/*
+ * Epoch_synchronize
+ *
+ * Waits until every object retired so far by the calling thread, or by threads that have exited,
+ * can be reclaimed, and reclaims it. The calling thread must not be inside a critical section.
+ */
+void Epoch_synchronize();
+
+#endif
@@ -0,0 +1,215 @@
+/**
+Read-only, flattened snapshots of a Quadtree
+*/
+
+#include <stdlib.h>
+
+#include "FrozenQuadtree.h"
+
+/*
+ * mask_rank
+ *
+ * Counts the bits of mask below bit, without relying on a popcount instruction being available.
+ *
+ * mask - the child bitmask of a square
+ * bit - the single bit of the quadrant being looked up
+ *
+ * Returns the number of set bits of mask that are less significant than bit.
+ */
+static inline uint32_t mask_rank(const FrozenMask mask, const FrozenMask bit) {
+    uint64_t x = mask & (bit - 1);
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (uint32_t)((x * 0x0101010101010101ULL) >> 56);
+}
+
+/*
+ * has_points
+ *
+ * Returns whether the subtree rooted at the given square holds any point. Squares without points
+ * are left out of the snapshot; only variants that lay out squares in advance, such as the shards
+ * of d-shard, have any below the root.
+ *
+ * node - the square to look under
+ */
+static bool has_points(const Node * const node) {
+    uint64_t i;
+    for (i = 0; i < (1LL << D); i++) {
+        const Node * const child = node->children[i];
+        if (NULL != child && (!child->is_square || has_points(child))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * count_nodes
+ *
+ * Counts the squares and points in the subtree rooted at the given square.
+ *
+ * node - the square to count from
+ * nsquares - incremented by the number of squares, including node
+ * npoints - incremented by the number of points
+ */
+static void count_nodes(const Node * const node, uint64_t * const nsquares,
+        uint64_t * const npoints) {
+    (*nsquares)++;
+    uint64_t i;
+    for (i = 0; i < (1LL << D); i++) {
+        const Node * const child = node->children[i];
+        if (NULL == child) {
+            continue;
+        } else if (child->is_square) {
+            if (has_points(child)) {
+                count_nodes(child, nsquares, npoints);
+            }
+        } else {
+            (*npoints)++;
+        }
+    }
+}
+
+/*
+ * expand
+ *
+ * Copies the square at the given index into the snapshot, reserving contiguous slots for its
+ * square children and copying its point children.
+ *
+ * frozen - the snapshot being built
+ * sources - the tree node corresponding to each reserved square slot
+ * index - the slot of the square to expand; sources[index] must be set
+ * next_square - the next free square slot, advanced past the reserved children
+ * next_point - the next free point slot, advanced past the copied points
+ */
+static void expand(FrozenQuadtree * const frozen, const Node ** const sources,
+        const uint32_t index, uint32_t * const next_square, uint32_t * const next_point) {
+    const Node * const node = sources[index];
+    FrozenSquare * const square = frozen->squares + index;
+    *square = (FrozenSquare){
+        .center = node->center,
+        .squares = 0,
+        .points = 0,
+        .first_square = *next_square,
+        .first_point = *next_point
+    };
+
+    uint64_t i;
+    for (i = 0; i < (1LL << D); i++) {
+        const Node * const child = node->children[i];
+        if (NULL == child) {
+            continue;
+        } else if (child->is_square) {
+            if (!has_points(child)) {
+                continue;
+            }
+            square->squares |= (FrozenMask)1 << i;
+            sources[(*next_square)++] = child;
+        } else {
+            square->points |= (FrozenMask)1 << i;
+            frozen->points[(*next_point)++] = child->center;
+        }
+    }
+}
+
+FrozenQuadtree* Quadtree_freeze(const Quadtree * const tree) {
+    // Only the bottom level holds every point; the upper levels are skip levels.
+    const Node *bottom = tree->root;
+    while (NULL != bottom->down) {
+        bottom = bottom->down;
+    }
+
+    uint64_t nsquares = 0, npoints = 0;
+    count_nodes(bottom, &nsquares, &npoints);
+    if (nsquares > UINT32_MAX || npoints > UINT32_MAX) {
+        return NULL;
+    }
+
+    FrozenQuadtree * const frozen = (FrozenQuadtree*)malloc(sizeof(*frozen));
+    const Node ** const sources = (const Node**)malloc(sizeof(*sources) * nsquares);
+    uint32_t * const blocks = (uint32_t*)malloc(sizeof(*blocks) * 2 * nsquares);
+    if (NULL == frozen || NULL == sources || NULL == blocks) {
+        free(frozen);
+        free(sources);
+        free(blocks);
+        return NULL;
+    }
+    *frozen = (FrozenQuadtree){
+        .nsquares = nsquares,
+        .npoints = npoints,
+        .squares = (FrozenSquare*)malloc(sizeof(*frozen->squares) * nsquares),
+        .points = (Point*)malloc(sizeof(*frozen->points) * max(npoints, 1))
+    };
+    if (NULL == frozen->squares || NULL == frozen->points) {
+        free(sources);
+        free(blocks);
+        FrozenQuadtree_free(frozen);
+        return NULL;
+    }
+
+    // Each pending block is a contiguous range [blocks[2k], blocks[2k + 1]) of sibling squares
+    // whose slots are reserved but not yet expanded. A block is expanded breadth-first for
+    // FROZEN_BLOCK_DEPTH levels, which keeps every level of the block contiguous, and the children
+    // of its last level become new blocks, which are expanded depth-first.
+    uint32_t next_square = 1, next_point = 0, nblocks = 1;
+    sources[0] = bottom;
+    blocks[0] = 0;
+    blocks[1] = 1;
+    while (nblocks > 0) {
+        nblocks--;
+        uint32_t low = blocks[2 * nblocks], high = blocks[2 * nblocks + 1];
+        uint64_t level;
+        for (level = 0; level < FROZEN_BLOCK_DEPTH && low < high; level++) {
+            const uint32_t level_end = next_square;
+            uint32_t i;
+            for (i = low; i < high; i++) {
+                const uint32_t first = next_square;
+                expand(frozen, sources, i, &next_square, &next_point);
+                if (FROZEN_BLOCK_DEPTH - 1 == level && first < next_square) {
+                    blocks[2 * nblocks] = first;
+                    blocks[2 * nblocks + 1] = next_square;
+                    nblocks++;
+                }
+            }
+            low = level_end;
+            high = next_square;
+        }
+    }
+
+    free(sources);
+    free(blocks);
+
+    return frozen;
+}
+
+bool FrozenQuadtree_search(const FrozenQuadtree * const frozen, const Point point) {
+    // No range checks are needed on the way down: a point in the snapshot lies within every one
+    // of its ancestors, and any other point ends at an empty quadrant or at an unequal point.
+    const FrozenSquare *square = frozen->squares;
+    while (true) {
+        const FrozenMask bit = (FrozenMask)1 << get_quadrant(&square->center, &point);
+        if (square->squares & bit) {
+            square = frozen->squares + square->first_square + mask_rank(square->squares, bit);
+        } else if (square->points & bit) {
+            return Point_equals(frozen->points + square->first_point +
+                mask_rank(square->points, bit), &point);
+        } else {
+            return false;
+        }
+    }
+}
+
+uint64_t FrozenQuadtree_memory(const FrozenQuadtree * const frozen) {
+    return sizeof(*frozen) + sizeof(*frozen->squares) * frozen->nsquares +
+        sizeof(*frozen->points) * frozen->npoints;
+}
+
+void FrozenQuadtree_free(FrozenQuadtree * const frozen) {
+    if (NULL == frozen) {
+        return;
+    }
+    free(frozen->squares);
+    free(frozen->points);
+    free(frozen);
+}
@@ -0,0 +1,112 @@
+/**
+Interface for read-only, flattened snapshots of a Quadtree
+*/
+
+#ifndef FROZEN_QUADTREE_H
+#define FROZEN_QUADTREE_H
+
+#include "types.h"
+#include "Point.h"
+#include "Quadtree.h"
+
+// Number of square levels packed together before the layout jumps to the next block.
+#ifndef FROZEN_BLOCK_DEPTH
+#define FROZEN_BLOCK_DEPTH 3
+#endif
+
+#if D <= 5
+typedef uint32_t FrozenMask;
+#elif D <= 6
+typedef uint64_t FrozenMask;
+#else
+#error "FrozenQuadtree supports at most 6 dimensions"
+#endif
+
+typedef struct FrozenSquare_t FrozenSquare;
+typedef struct FrozenQuadtree_t FrozenQuadtree;
+
+/*
+ * struct FrozenSquare_t
+ *
+ * A square of the bottom level of a Quadtree, stored by value in a FrozenQuadtree.
+ *
+ * The children of a square are stored contiguously, squares in the squares array and points in
+ * the points array, ordered by quadrant. The child in quadrant q is therefore found at offset
+ * first + popcount(mask & ((1 << q) - 1)) of the corresponding array. The side length is not
+ * kept, since exact-match search only needs the quadrant of the point at each square.
+ *
+ * center - center of the square
+ * squares - bitmask of the quadrants whose child is a square
+ * points - bitmask of the quadrants whose child is a point
+ * first_square - offset of the first square child in FrozenQuadtree.squares
+ * first_point - offset of the first point child in FrozenQuadtree.points
+ */
+struct FrozenSquare_t {
+    Point center;
+    FrozenMask squares, points;
+    uint32_t first_square, first_point;
+};
+
+/*
+ * struct FrozenQuadtree_t
+ *
+ * A compact, immutable copy of the bottom level of a Quadtree. The skip levels are dropped, and
+ * the squares are laid out in blocks of FROZEN_BLOCK_DEPTH levels, breadth-first within a block
+ * and depth-first across blocks, so that a descent touches few cache lines per block.
+ *
+ * nsquares - the number of squares, including the root at squares[0]
+ * npoints - the number of points
+ * squares - the squares of the snapshot
+ * points - the points of the snapshot
+ */
+struct FrozenQuadtree_t {
+    uint32_t nsquares, npoints;
+    FrozenSquare *squares;
+    Point *points;
+};
+
+/*
+ * Quadtree_freeze
+ *
+ * Creates a read-only snapshot of the points in the tree. Later updates to the tree are not
+ * reflected in the snapshot, and the tree may be freed independently of the snapshot.
+ *
+ * tree - the quadtree to take the snapshot of; must not be concurrently modified, and must be
+ *     flushed with Quadtree_flush if the variant defers updates
+ *
+ * Returns a pointer to the snapshot, or NULL if memory could not be allocated or the tree is too
+ * large to be addressed with 32-bit offsets.
+ */
+FrozenQuadtree* Quadtree_freeze(const Quadtree * const tree);
+
+/*
+ * FrozenQuadtree_search
+ *
+ * Searches for the point in the snapshot, within a certain error tolerance.
+ *
+ * frozen - the snapshot to query
+ * point - the point we're searching for
+ *
+ * Returns whether point is in the snapshot.
+ */
+bool FrozenQuadtree_search(const FrozenQuadtree * const frozen, const Point point);
+
+/*
+ * FrozenQuadtree_memory
+ *
+ * frozen - the snapshot to measure
+ *
+ * Returns the number of bytes used to represent the snapshot.
+ */
+uint64_t FrozenQuadtree_memory(const FrozenQuadtree * const frozen);
+
+/*
+ * FrozenQuadtree_free
+ *
+ * Frees the memory used by the snapshot.
+ *
+ * frozen - the snapshot to free
+ */
+void FrozenQuadtree_free(FrozenQuadtree * const frozen);
+
+#endif
@@ -0,0 +1,365 @@
+/**
+Learned point lookup over a Morton-sorted export of a Quadtree
+*/
+
+#include <stdlib.h>
+
+#include "LearnedIndex.h"
+
+#define MORTON_LIMIT ((uint64_t)~0ULL >> (64 - MORTON_BITS))
+
+/*
+ * morton_spread
+ *
+ * Spreads the low MORTON_BITS bits of value so that bit j moves to bit j * D.
+ *
+ * value - the quantized coordinate
+ *
+ * Returns the spread coordinate.
+ */
+static inline uint64_t morton_spread(uint64_t value) {
+#if 2 == D
+    value = (value | (value << 16)) & 0x0000FFFF0000FFFFULL;
+    value = (value | (value << 8)) & 0x00FF00FF00FF00FFULL;
+    value = (value | (value << 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    value = (value | (value << 2)) & 0x3333333333333333ULL;
+    value = (value | (value << 1)) & 0x5555555555555555ULL;
+    return value;
+#elif 3 == D
+    value &= 0x1FFFFFULL;
+    value = (value | (value << 32)) & 0x001F00000000FFFFULL;
+    value = (value | (value << 16)) & 0x001F0000FF0000FFULL;
+    value = (value | (value << 8)) & 0x100F00F00F00F00FULL;
+    value = (value | (value << 4)) & 0x10C30C30C30C30C3ULL;
+    value = (value | (value << 2)) & 0x1249249249249249ULL;
+    return value;
+#else
+    uint64_t spread = 0;
+    register uint64_t j;
+    for (j = 0; j < MORTON_BITS; j++) {
+        spread |= ((value >> j) & 1) << (j * D);
+    }
+    return spread;
+#endif
+}
+
+/*
+ * morton_key
+ *
+ * Computes the Morton key of p, quantizing each coordinate over the box starting at low.
+ * Coordinates outside the box are clamped to its boundary.
+ *
+ * low - the lower corner of the box
+ * scale - the number of quantization steps per unit of length
+ * p - the point to compute the key of
+ *
+ * Returns the Morton key of p.
+ */
+static inline uint64_t morton_key(const Point * const low, const float64_t scale,
+        const Point * const p) {
+    uint64_t key = 0;
+    register uint64_t i;
+    for (i = 0; i < D; i++) {
+        const float64_t steps = (p->data[i] - low->data[i]) * scale;
+        uint64_t value = 0;
+        if (steps >= (float64_t)MORTON_LIMIT) {
+            value = MORTON_LIMIT;
+        } else if (steps > 0) {
+            value = (uint64_t)steps;
+        }
+        key |= morton_spread(value) << i;
+    }
+    return key;
+}
+
+/*
+ * morton_compare
+ *
+ * Orders MortonPoints by key, for qsort.
+ */
+static int morton_compare(const void *a, const void *b) {
+    const uint64_t key_a = ((const MortonPoint*)a)->key, key_b = ((const MortonPoint*)b)->key;
+    return (key_a > key_b) - (key_a < key_b);
+}
+
+/*
+ * export_points
+ *
+ * Appends the points in the subtree rooted at the given square, in quadrant order.
+ *
+ * node - the square to export from
+ * points - the array to append to
+ * count - the number of points in the array, incremented for each appended point
+ */
+static void export_points(const Node * const node, MortonPoint * const points,
+        uint64_t * const count) {
+    uint64_t i;
+    for (i = 0; i < (1LL << D); i++) {
+        const Node * const child = node->children[i];
+        if (NULL == child) {
+            continue;
+        } else if (child->is_square) {
+            export_points(child, points, count);
+        } else {
+            points[(*count)++].point = child->center;
+        }
+    }
+}
+
+/*
+ * count_points
+ *
+ * node - the square to count from
+ *
+ * Returns the number of points in the subtree rooted at the given square.
+ */
+static uint64_t count_points(const Node * const node) {
+    uint64_t count = 0, i;
+    for (i = 0; i < (1LL << D); i++) {
+        const Node * const child = node->children[i];
+        if (NULL != child) {
+            count += child->is_square ? count_points(child) : 1;
+        }
+    }
+    return count;
+}
+
+/*
+ * tree_low
+ *
+ * Returns the lower corner of the bounding box of the tree.
+ */
+static Point tree_low(const Quadtree * const tree) {
+    Point low;
+    register uint64_t i;
+    for (i = 0; i < D; i++) {
+        low.data[i] = tree->center.data[i] - 0.5 * tree->length;
+    }
+    return low;
+}
+
+/*
+ * tree_scale
+ *
+ * Returns the number of Morton quantization steps per unit of length in the tree.
+ */
+static float64_t tree_scale(const Quadtree * const tree) {
+    return 2.0 * (float64_t)(1ULL << (MORTON_BITS - 1)) / tree->length;
+}
+
+MortonPoint* Quadtree_export_morton(const Quadtree * const tree, uint64_t * const count) {
+    // Only the bottom level holds every point; the upper levels are skip levels.
+    const Node *bottom = tree->root;
+    while (NULL != bottom->down) {
+        bottom = bottom->down;
+    }
+
+    const uint64_t npoints = count_points(bottom);
+    MortonPoint * const points = (MortonPoint*)malloc(sizeof(*points) * max(npoints, 1));
+    if (NULL == points) {
+        return NULL;
+    }
+
+    *count = 0;
+    export_points(bottom, points, count);
+
+    // Quadrant order is already Z-order, up to quantization of the keys, so the sort has little
+    // left to do.
+    const Point low = tree_low(tree);
+    const float64_t scale = tree_scale(tree);
+    uint64_t i;
+    for (i = 0; i < *count; i++) {
+        points[i].key = morton_key(&low, scale, &points[i].point);
+    }
+    qsort(points, *count, sizeof(*points), morton_compare);
+
+    return points;
+}
+
+/*
+ * build_segments
+ *
+ * Covers the sorted keys with segments such that every distinct key's first position is predicted
+ * within LEARNED_EPSILON. Each segment greedily grows while some slope still satisfies the bound
+ * for all of its keys (the shrinking cone method).
+ *
+ * index - the index whose keys are set; its segments array must hold npoints entries
+ */
+static void build_segments(LearnedIndex * const index) {
+    const uint64_t * const keys = index->keys;
+    const uint64_t n = index->npoints;
+    uint64_t i = 0;
+
+    index->nsegments = 0;
+    while (i < n) {
+        const uint64_t start = i;
+        float64_t slope_low = 0, slope_high = -1;  // high < low stands for an unbounded cone
+
+        for (i++; i < n && keys[i] == keys[start]; i++);
+        while (i < n) {
+            const float64_t dx = (float64_t)(keys[i] - keys[start]);
+            const float64_t dy = (float64_t)(i - start);
+            const float64_t low = max(slope_low, (dy - LEARNED_EPSILON) / dx);
+            const float64_t high = slope_high < slope_low ?
+                (dy + LEARNED_EPSILON) / dx : min(slope_high, (dy + LEARNED_EPSILON) / dx);
+            if (low > high) {
+                break;
+            }
+            slope_low = low;
+            slope_high = high;
+
+            const uint64_t key = keys[i];
+            for (i++; i < n && keys[i] == key; i++);
+        }
+
+        index->segments[index->nsegments++] = (LearnedSegment){
+            .key = keys[start],
+            .position = start,
+            .slope = slope_high < slope_low ? 0 : 0.5 * (slope_low + slope_high)
+        };
+    }
+}
+
+/*
+ * build_radix
+ *
+ * Builds the radix table mapping the top bits of a key to the first segment with those bits.
+ *
+ * index - the index whose segments are set
+ *
+ * Returns whether the table could be allocated.
+ */
+static bool build_radix(LearnedIndex * const index) {
+    const uint64_t key_bits = MORTON_BITS * D;
+    const uint64_t radix_bits = min(LEARNED_RADIX_BITS, key_bits);
+    const uint64_t size = 1ULL << radix_bits;
+
+    index->radix_shift = key_bits - radix_bits;
+    index->radix = (uint32_t*)malloc(sizeof(*index->radix) * (size + 1));
+    if (NULL == index->radix) {
+        return false;
+    }
+
+    uint64_t bucket, segment = 0;
+    for (bucket = 0; bucket <= size; bucket++) {
+        while (segment < index->nsegments &&
+                (index->segments[segment].key >> index->radix_shift) < bucket) {
+            segment++;
+        }
+        index->radix[bucket] = segment;
+    }
+    return true;
+}
+
+LearnedIndex* Quadtree_learn(const Quadtree * const tree) {
+    uint64_t count = 0;
+    MortonPoint * const exported = Quadtree_export_morton(tree, &count);
+    LearnedIndex * const index = (LearnedIndex*)malloc(sizeof(*index));
+    if (NULL == exported || NULL == index || count > UINT32_MAX) {
+        free(exported);
+        free(index);
+        return NULL;
+    }
+
+    *index = (LearnedIndex){
+        .npoints = count,
+        .nsegments = 0,
+        .low = tree_low(tree),
+        .scale = tree_scale(tree),
+        .keys = (uint64_t*)malloc(sizeof(*index->keys) * max(count, 1)),
+        .points = (Point*)malloc(sizeof(*index->points) * max(count, 1)),
+        .segments = (LearnedSegment*)malloc(sizeof(*index->segments) * max(count, 1)),
+        .radix = NULL
+    };
+    if (NULL == index->keys || NULL == index->points || NULL == index->segments) {
+        free(exported);
+        LearnedIndex_free(index);
+        return NULL;
+    }
+
+    uint64_t i;
+    for (i = 0; i < count; i++) {
+        index->keys[i] = exported[i].key;
+        index->points[i] = exported[i].point;
+    }
+    free(exported);
+
+    build_segments(index);
+    LearnedSegment * const segments = (LearnedSegment*)realloc(index->segments,
+        sizeof(*index->segments) * max(index->nsegments, 1));
+    if (NULL != segments) {
+        index->segments = segments;
+    }
+
+    if (!build_radix(index)) {
+        LearnedIndex_free(index);
+        return NULL;
+    }
+
+    return index;
+}
+
+bool LearnedIndex_search(const LearnedIndex * const index, const Point point) {
+    if (0 == index->nsegments) {
+        return false;
+    }
+
+    const uint64_t key = morton_key(&index->low, index->scale, &point);
+
+    // Find the last segment starting at or before the key among the radix table candidates.
+    const uint64_t bucket = key >> index->radix_shift;
+    uint64_t low = index->radix[bucket], high = index->radix[bucket + 1];
+    if (low > 0) {
+        low--;
+    }
+    while (high - low > 1) {
+        const uint64_t mid = (low + high) / 2;
+        if (index->segments[mid].key <= key) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    const LearnedSegment * const segment = index->segments + low;
+    if (key < segment->key) {
+        return false;
+    }
+
+    // Predict the position, allowing one extra slot each way for rounding.
+    const float64_t predicted = segment->position + segment->slope * (float64_t)(key - segment->key);
+    low = predicted > LEARNED_EPSILON + 1 ? (uint64_t)predicted - LEARNED_EPSILON - 1 : 0;
+    high = min((uint64_t)predicted + LEARNED_EPSILON + 2, index->npoints);
+
+    // Find the first occurrence of the key in the window, then check the points sharing it.
+    while (low < high) {
+        const uint64_t mid = (low + high) / 2;
+        if (index->keys[mid] < key) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    for (; low < index->npoints && index->keys[low] == key; low++) {
+        if (Point_equals(index->points + low, &point)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint64_t LearnedIndex_memory(const LearnedIndex * const index) {
+    return sizeof(*index) + (sizeof(*index->keys) + sizeof(*index->points)) * index->npoints +
+        sizeof(*index->segments) * index->nsegments +
+        sizeof(*index->radix) * ((1ULL << (MORTON_BITS * D - index->radix_shift)) + 1);
+}
+
+void LearnedIndex_free(LearnedIndex * const index) {
+    if (NULL == index) {
+        return;
+    }
+    free(index->keys);
+    free(index->points);
+    free(index->segments);
+    free(index->radix);
+    free(index);
+}
@@ -0,0 +1,144 @@
+/**
+Interface for learned point lookup over a Morton-sorted export of a Quadtree
+*/
+
+#ifndef LEARNED_INDEX_H
+#define LEARNED_INDEX_H
+
+#include "types.h"
+#include "Point.h"
+#include "Quadtree.h"
+
+// Maximum distance between the predicted and the actual position of a key.
+#ifndef LEARNED_EPSILON
+#define LEARNED_EPSILON 32
+#endif
+
+// Maximum number of key bits used to index the table of segments.
+#ifndef LEARNED_RADIX_BITS
+#define LEARNED_RADIX_BITS 16
+#endif
+
+// Number of bits each coordinate is quantized to in a Morton key.
+#define MORTON_BITS (64 / D)
+
+typedef struct MortonPoint_t MortonPoint;
+typedef struct LearnedSegment_t LearnedSegment;
+typedef struct LearnedIndex_t LearnedIndex;
+
+/*
+ * struct MortonPoint_t
+ *
+ * A point along with its Morton (Z-order) key. The key interleaves the coordinates quantized to
+ * MORTON_BITS bits over the bounding box of the tree, with the first dimension in the least
+ * significant bit of each group, which matches the quadrant numbering of get_quadrant.
+ *
+ * key - the Morton key of the point
+ * point - the point
+ */
+struct MortonPoint_t {
+    uint64_t key;
+    Point point;
+};
+
+/*
+ * struct LearnedSegment_t
+ *
+ * A linear model predicting the position of the keys in [key, next segment's key).
+ *
+ * key - the first key covered by the segment
+ * position - the position of key in the sorted keys
+ * slope - the predicted increase in position per unit of key
+ */
+struct LearnedSegment_t {
+    uint64_t key;
+    uint64_t position;
+    float64_t slope;
+};
+
+/*
+ * struct LearnedIndex_t
+ *
+ * A piecewise-linear model over the Morton-sorted points of a tree. A lookup reads the radix
+ * table entry for the top bits of the key, picks the segment, predicts the position of the key,
+ * and searches at most 2 * (LEARNED_EPSILON + 1) keys around the prediction.
+ *
+ * npoints - the number of points
+ * nsegments - the number of segments
+ * radix_shift - the shift that takes a key to its radix table entry
+ * low - the lower corner of the bounding box of the tree
+ * scale - the number of quantization steps per unit of length
+ * keys - the sorted Morton keys
+ * points - the points, in the same order as keys
+ * segments - the segments, sorted by key
+ * radix - radix[b] is the first segment whose key has top bits >= b, for b in [0, 2^bits]
+ */
+struct LearnedIndex_t {
+    uint64_t npoints, nsegments, radix_shift;
+    Point low;
+    float64_t scale;
+    uint64_t *keys;
+    Point *points;
+    LearnedSegment *segments;
+    uint32_t *radix;
+};
+
+/*
+ * Quadtree_export_morton
+ *
+ * Exports the points in the tree as an array sorted by Morton key.
+ *
+ * tree - the quadtree to export; must not be concurrently modified, and must be flushed with
+ *     Quadtree_flush if the variant defers updates
+ * count - set to the number of exported points
+ *
+ * Returns a pointer to the array, to be released with free, or NULL on allocation failure.
+ */
+MortonPoint* Quadtree_export_morton(const Quadtree * const tree, uint64_t * const count);
+
+/*
+ * Quadtree_learn
+ *
+ * Builds a LearnedIndex over the points in the tree. Later updates to the tree are not reflected
+ * in the index.
+ *
+ * tree - the quadtree to index; must not be concurrently modified, and must be flushed with
+ *     Quadtree_flush if the variant defers updates
+ *
+ * Returns a pointer to the index, or NULL on allocation failure.
+ */
+LearnedIndex* Quadtree_learn(const Quadtree * const tree);
+
+/*
+ * LearnedIndex_search
+ *
+ * Searches for the point in the index. A match must have the same Morton key and be equal up to
+ * precision error, so points within PRECISION of each other but on opposite sides of a
+ * quantization boundary are not matched.
+ *
+ * index - the index to query
+ * point - the point we're searching for
+ *
+ * Returns whether point is in the index.
+ */
+bool LearnedIndex_search(const LearnedIndex * const index, const Point point);
+
+/*
+ * LearnedIndex_memory
+ *
+ * index - the index to measure
+ *
+ * Returns the number of bytes used to represent the index.
+ */
+uint64_t LearnedIndex_memory(const LearnedIndex * const index);
+
+/*
+ * LearnedIndex_free
+ *
+ * Frees the memory used by the index.
+ *
+ * index - the index to free
+ */
+void LearnedIndex_free(LearnedIndex * const index);
+
+#endif
@@ -10,7 +10,7 @@ Point Point_from_array(float64_t data[D]) {
     return p;
 }
 
-int8_t Point_compare(const Point *a, const Point *b) {
+safe int8_t Point_compare(const Point *a, const Point *b) {
     register uint64_t i;
     for (i = 0; i < D; i++) {
         if (abs(a->data[D - i - 1] - b->data[D - i - 1]) > PRECISION) {
@@ -19,7 +19,7 @@ int8_t Point_compare(const Point *a, const Point *b) {
     }
 }
 
-bool Point_equals(const Point *a, const Point *b) {
+safe bool Point_equals(const Point *a, const Point *b) {
     register uint64_t i;
     for (i = 0; i < D; i++) {
         if (abs(a->data[i] - b->data[i]) > PRECISION) {
@@ -29,6 +29,6 @@ bool Point_equals(const Point *a, const Point *b) {
     return true;
 }
 
-void Point_copy(const Point* from, Point* to) {
+safe void Point_copy(const Point* from, Point* to) {
     memcpy(&to->data, &from->data, sizeof(from->data));
 }
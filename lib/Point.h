@@ -63,7 +63,7 @@ Point Point_from_array(float64_t data[D]);
  *
  * Returns a value < 0 if a < b, = 0 if a == b, and > 0 if a > b.
  */
-int8_t Point_compare(const Point *a, const Point *b);
+safe int8_t Point_compare(const Point *a, const Point *b);
 
 /**
  * Point_equals
@@ -75,7 +75,7 @@ int8_t Point_compare(const Point *a, const Point *b);
  *
  * Returns true if the two points are equal, up to precision error, and false otherwise.
  */
-bool Point_equals(const Point *a, const Point *b);
+safe bool Point_equals(const Point *a, const Point *b);
 
 /**
  * Point_copy
@@ -85,7 +85,7 @@ bool Point_equals(const Point *a, const Point *b);
  * from - the point to copy from
  * to - the point to copy to
  */
-void Point_copy(const Point *from, Point *to);
+safe void Point_copy(const Point *from, Point *to);
 
 static void Point_string(const Point *p, char *buffer) {
     sprintf(buffer, "Point(%lf", p->data[0]);
@@ -13,10 +13,21 @@ Interface for Quadtree data structure
 #include "types.h"
 #include "util.h"
 #include "Point.h"
+#include "Contention.h"
+
+// Number of levels in variants that derive the levels of a point from its coordinates.
+#ifndef QUADTREE_LEVELS
+#define QUADTREE_LEVELS 32
+#endif
 
 typedef struct SkipQuadtreeNode_t Node;
 typedef struct Quadtree_t Quadtree;
 
+// The RLU thread data of the calling thread. Every thread must set it up with RLU_THREAD_INIT
+// before it first uses a tree, and tear it down with RLU_THREAD_FINISH once done, whatever the
+// variant: while only one thread is registered, d-lock, d-lockfree, d-seqlock, d-shard, d-fc and
+// the variants built on them run its operations as RLU exclusive sections, skipping their locks
+// and fences, which an unregistered thread using the tree at the same time would race with.
 extern __thread rlu_thread_data_t *rlu_self;
 
 /*
@@ -77,6 +88,89 @@ typedef struct QuadtreeFreeResult_t {
     uint64_t total, clean, leaf, levels;
 } QuadtreeFreeResult;
 
+/*
+ * struct QuadtreeShardStats_t
+ *
+ * Contains information about how the points of a sharded tree are spread over its shards.
+ *
+ * shards - the number of shards
+ * points - the total number of points
+ * min - the number of points in the emptiest shard
+ * max - the number of points in the fullest shard
+ */
+typedef struct QuadtreeShardStats_t {
+    uint64_t shards, points, min, max;
+} QuadtreeShardStats;
+
+/*
+ * struct QuadtreeStats_t
+ *
+ * Contains information about the shape of a tree, as counted by Quadtree_stats.
+ *
+ * size - the number of points in the tree
+ * height - the highest level that a point has been added to, or 0 for single-level trees
+ * nodes - the number of nodes on every level, squares and points alike, roots included
+ */
+typedef struct QuadtreeStats_t {
+    uint64_t size, height, nodes;
+} QuadtreeStats;
+
+/*
+ * struct QuadtreeSnapshot_t
+ *
+ * A read-only version of a copy-on-write tree, which stays as it was when it was taken, however
+ * the tree changes afterwards.
+ *
+ * root - the root square of the version, whose subtree is a compressed quadtree of its points
+ * size - the number of points in the version
+ */
+typedef struct QuadtreeSnapshot_t {
+    const Node *root;
+    uint64_t size;
+} QuadtreeSnapshot;
+
+/*
+ * enum QuadtreeOperation_t
+ *
+ * An operation sent to a delegating tree with Quadtree_send.
+ */
+typedef enum QuadtreeOperation_t {
+    QUADTREE_SEARCH, QUADTREE_ADD, QUADTREE_REMOVE
+} QuadtreeOperation;
+
+/*
+ * struct QuadtreeReply_t
+ *
+ * The reply to an operation sent with Quadtree_send.
+ *
+ * operation - the operation
+ * point - the point it was applied to
+ * result - what Quadtree_search, Quadtree_add or Quadtree_remove would have returned for it
+ */
+typedef struct QuadtreeReply_t {
+    QuadtreeOperation operation;
+    Point point;
+    bool result;
+} QuadtreeReply;
+
+/*
+ * struct QuadtreeTxn_t
+ *
+ * A group of adds and removes, collected by Quadtree_txn_add and Quadtree_txn_remove, that
+ * Quadtree_txn_commit applies to the tree at once: a search sees either every update of the group
+ * or none of them.
+ *
+ * tree - the tree the updates are for
+ * updates - the updates, in the order they were collected; their results are set by the commit
+ * size - the number of updates
+ * capacity - the number of updates there is room for
+ */
+typedef struct QuadtreeTxn_t {
+    Quadtree *tree;
+    QuadtreeReply *updates;
+    uint64_t size, capacity;
+} QuadtreeTxn;
+
 #ifdef QUADTREE_TEST
 /*
  * Node_init
@@ -154,6 +248,15 @@ bool Quadtree_add(Quadtree * const tree, const Point point);
  */
 bool Quadtree_remove(Quadtree * const tree, const Point point);
 
+/*
+ * Quadtree_flush
+ *
+ * Applies any updates that the variant has deferred, so that the nodes reachable from tree->root
+ * reflect every completed add and remove. Variants that apply updates immediately do nothing.
+ *
+ * tree - the tree to flush
+ */
+void Quadtree_flush(Quadtree * const tree);
 
 /*
  * Quadtree_free
@@ -167,6 +270,159 @@ bool Quadtree_remove(Quadtree * const tree, const Point point);
  */
 QuadtreeFreeResult Quadtree_free(Quadtree * const tree);
 
+// The Makefile defines QUADTREE_SHARDED for the variants in SHARDED_VARIANTS.
+#ifdef QUADTREE_SHARDED
+/*
+ * Quadtree_shard_stats
+ *
+ * Counts the points in every shard of the tree. Only defined by the sharded variants, d-shard and
+ * d-delegate.
+ *
+ * tree - the tree to count the points of
+ *
+ * Returns a QuadtreeShardStats.
+ */
+QuadtreeShardStats Quadtree_shard_stats(const Quadtree * const tree);
+#endif
+
+/*
+ * Quadtree_stats
+ *
+ * Counts the points and nodes of the tree by walking every level of it, with the same protection
+ * that searches use, so that it can run alongside updates; the counts then need not match the tree
+ * at any single moment. Updates that have not been flushed are not counted.
+ *
+ * tree - the tree to count the points and nodes of
+ *
+ * Returns a QuadtreeStats.
+ */
+QuadtreeStats Quadtree_stats(const Quadtree * const tree);
+
+// The Makefile defines QUADTREE_COW for the variants in COW_VARIANTS.
+#ifdef QUADTREE_COW
+/*
+ * Quadtree_snapshot
+ *
+ * Takes a snapshot of the current version of the tree, without copying it. The snapshot may be
+ * used from any thread, even after the tree is freed, until it is freed with QuadtreeSnapshot_free.
+ * Only defined by the copy-on-write variant, d-cow.
+ *
+ * tree - the tree to take a snapshot of
+ *
+ * Returns the snapshot.
+ */
+QuadtreeSnapshot* Quadtree_snapshot(const Quadtree * const tree);
+
+/*
+ * QuadtreeSnapshot_search
+ *
+ * Searches for the point in the snapshot, within a certain error tolerance.
+ *
+ * snapshot - the snapshot to query
+ * point - the point we're searching for
+ *
+ * Returns whether point was in the tree when the snapshot was taken.
+ */
+bool QuadtreeSnapshot_search(const QuadtreeSnapshot * const snapshot, const Point point);
+
+/*
+ * QuadtreeSnapshot_free
+ *
+ * Releases a snapshot, freeing the nodes of its version that no other version uses any more.
+ *
+ * snapshot - the snapshot to release
+ */
+void QuadtreeSnapshot_free(QuadtreeSnapshot * const snapshot);
+#endif
+
+// The Makefile defines QUADTREE_ASYNC for the variants in ASYNC_VARIANTS.
+#ifdef QUADTREE_ASYNC
+/*
+ * Quadtree_send
+ *
+ * Sends an operation to the thread that owns the point, without waiting for it to be applied.
+ * Operations sent by one thread to one owner are applied in the order they were sent. Only
+ * defined by the delegating variant, d-delegate.
+ *
+ * d-delegate gives every thread that uses a tree, with this or any other operation, a client of
+ * the tree of its own, which it keeps until it exits. A tree has QUADTREE_CLIENTS of them (64 by
+ * default), and the program is aborted when one more thread uses it.
+ *
+ * tree - the tree to apply the operation to
+ * operation - the operation to apply
+ * point - the point to apply it to
+ *
+ * Returns false if the operation could not be sent because too many replies from the owner are
+ * waiting to be received, in which case Quadtree_receive must be called first, or because the
+ * point is out of range, in which case it never will be.
+ */
+bool Quadtree_send(Quadtree * const tree, const QuadtreeOperation operation, const Point point);
+
+/*
+ * Quadtree_receive
+ *
+ * Collects the replies to operations sent by this thread with Quadtree_send that have been
+ * applied, without waiting for any others. Only defined by the delegating variant, d-delegate.
+ *
+ * tree - the tree the operations were sent to
+ * replies - filled with the replies
+ * max - the most replies to collect
+ *
+ * Returns the number of replies collected.
+ */
+uint64_t Quadtree_receive(Quadtree * const tree, QuadtreeReply * const replies, const uint64_t max);
+#endif
+
+// The Makefile defines QUADTREE_TXN for the variants in TXN_VARIANTS. The other variants link the
+// Quadtree_txn_begin of QuadtreeTxn.c too, but cannot commit what it begins.
+#ifdef QUADTREE_TXN
+/*
+ * Quadtree_txn_begin
+ *
+ * Starts collecting a group of updates to the tree, to be applied together by Quadtree_txn_commit.
+ *
+ * tree - the tree to update
+ *
+ * Returns the empty transaction.
+ */
+QuadtreeTxn* Quadtree_txn_begin(Quadtree * const tree);
+
+/*
+ * Quadtree_txn_add
+ *
+ * Adds an add of the point to the transaction. Nothing is applied until the transaction commits.
+ *
+ * txn - the transaction to add to
+ * point - the point to add to the tree
+ */
+void Quadtree_txn_add(QuadtreeTxn * const txn, const Point point);
+
+/*
+ * Quadtree_txn_remove
+ *
+ * Adds a remove of the point to the transaction. Nothing is applied until the transaction commits.
+ *
+ * txn - the transaction to add to
+ * point - the point to remove from the tree
+ */
+void Quadtree_txn_remove(QuadtreeTxn * const txn, const Point point);
+
+/*
+ * Quadtree_txn_commit
+ *
+ * Applies the updates of the transaction in the order they were collected, each one as
+ * Quadtree_add or Quadtree_remove would, so that no search sees only some of them, then frees the
+ * transaction. Only defined by the variants that can apply several updates at once, listed in
+ * TXN_VARIANTS in the Makefile: d-rlu, in one RLU section; d-tm, in one transaction; d-cow, as one
+ * version; d-shard, with every shard it touches locked; and d-fc, as one batch of the combiner.
+ *
+ * txn - the transaction to commit
+ *
+ * Returns the number of updates that changed the tree.
+ */
+uint64_t Quadtree_txn_commit(QuadtreeTxn * const txn);
+#endif
+
 /*
  * Node_valid
  *
@@ -177,7 +433,7 @@ QuadtreeFreeResult Quadtree_free(Quadtree * const tree);
  *
  * Returns whether the node is valid for use.
  */
-static inline bool Node_valid(const Node * const node) {
+safe static inline bool Node_valid(const Node * const node) {
     return NULL != node;
 }
 
@@ -193,7 +449,7 @@ static inline bool Node_valid(const Node * const node) {
  *
  * Returns whether p is within the boundaries of n.
  */
-static bool in_range(const Node * const n, const Point * const p) {
+safe static bool in_range(const Node * const n, const Point * const p) {
     register float64_t bound = n->length * 0.5;
     register uint64_t i;
     for (i = 0; i < D; i++) {
@@ -209,6 +465,10 @@ static bool in_range(const Node * const n, const Point * const p) {
  *
  * Returns the quadrant [0,2^D) that p is in, relative to the origin point.
  *
+ * A coordinate equal to the origin's goes to the upper half, with no allowance for precision, so
+ * that the quadrant is the one whose square in_range says holds p. A point just below the origin
+ * must not be routed to a square that does not hold it, or it is added where searches never look.
+ *
  * Let b = quadrant id in binary, with b[0] being the least significant bit. Then, b[0] corresponds
  * to the first dimension, b[1] corresponds to the second, etc. such that b[i] corresponds to the
  * (i + 1)th dimension.
@@ -218,11 +478,11 @@ static bool in_range(const Node * const n, const Point * const p) {
  *
  * Returns the quadrant that p is in, relative to origin.
  */
-static uint64_t get_quadrant(const Point * const origin, const Point * const p) {
+safe static uint64_t get_quadrant(const Point * const origin, const Point * const p) {
     register uint64_t i;
     uint64_t quadrant = 0;
     for (i = 0; i < D; i++) {
-        quadrant |= ((p->data[i] >= origin->data[i] - PRECISION) & 1) << i;
+        quadrant |= ((p->data[i] >= origin->data[i]) & 1) << i;
     }
     return quadrant;
 }
@@ -238,7 +498,7 @@ static uint64_t get_quadrant(const Point * const origin, const Point * const p)
  *
  * Returns the center point for the given quadrant of node.
  */
-static Point get_new_center(const Node * const node, const uint64_t quadrant) {
+safe static Point get_new_center(const Node * const node, const uint64_t quadrant) {
     Point point;
     register uint64_t i;
     for (i = 0; i < D; i++) {
@@ -247,6 +507,37 @@ static Point get_new_center(const Node * const node, const uint64_t quadrant) {
     return point;
 }
 
+/*
+ * get_level
+ *
+ * Returns the highest level [0, QUADTREE_LEVELS) that p appears on, for variants that fix the
+ * levels of a point when it is added instead of rebalancing skip lists around it. As in a
+ * randomized skip quadtree, each level holds about half of the points of the level below, but the
+ * level is derived from a hash of the coordinates, so it is the same on every run.
+ *
+ * p - the point to find the level of
+ *
+ * Returns the level of p.
+ */
+safe static uint64_t get_level(const Point * const p) {
+    uint64_t hash = 0;
+    register uint64_t i;
+    for (i = 0; i < D; i++) {
+        const union { float64_t value; uint64_t bits; } coordinate = { .value = p->data[i] };
+        hash = (hash ^ coordinate.bits) * 0x9E3779B97F4A7C15ULL;
+    }
+    hash ^= hash >> 29;
+    hash *= 0xBF58476D1CE4E5B9ULL;
+    hash ^= hash >> 32;
+
+    uint64_t level = 0;
+    while ((hash & 1) && level < QUADTREE_LEVELS - 1) {
+        hash >>= 1;
+        level++;
+    }
+    return level;
+}
+
 #ifdef QUADTREE_TEST
 /*
  * Node_string
@@ -0,0 +1,52 @@
+/**
+Groups of Quadtree updates, collected to be committed together by the variants that support it
+*/
+
+#include <stdlib.h>
+
+#include "Quadtree.h"
+
+// Number of updates a transaction has room for when it begins; it doubles whenever it fills up.
+#define QUADTREE_TXN_INITIAL_CAPACITY 8
+
+QuadtreeTxn* Quadtree_txn_begin(Quadtree * const tree) {
+    QuadtreeTxn * const txn = (QuadtreeTxn*)malloc(sizeof(*txn));
+    *txn = (QuadtreeTxn){
+        .tree = tree,
+        .updates = (QuadtreeReply*)malloc(sizeof(*txn->updates) * QUADTREE_TXN_INITIAL_CAPACITY),
+        .size = 0,
+        .capacity = QUADTREE_TXN_INITIAL_CAPACITY
+    };
+    return txn;
+}
+
+/*
+ * append
+ *
+ * Appends an update to the transaction, making room for it if the transaction is full.
+ *
+ * txn - the transaction to append to
+ * operation - QUADTREE_ADD or QUADTREE_REMOVE
+ * point - the point to apply the update to
+ */
+static void append(QuadtreeTxn * const txn, const QuadtreeOperation operation,
+        const Point point) {
+    if (txn->size == txn->capacity) {
+        txn->capacity *= 2;
+        txn->updates = (QuadtreeReply*)realloc(txn->updates,
+            sizeof(*txn->updates) * txn->capacity);
+    }
+    txn->updates[txn->size++] = (QuadtreeReply){
+        .operation = operation,
+        .point = point,
+        .result = false
+    };
+}
+
+void Quadtree_txn_add(QuadtreeTxn * const txn, const Point point) {
+    append(txn, QUADTREE_ADD, point);
+}
+
+void Quadtree_txn_remove(QuadtreeTxn * const txn, const Point point) {
+    append(txn, QUADTREE_REMOVE, point);
+}
@@ -0,0 +1,537 @@
+/**
+Persistent compressed quadtree whose updates copy the paths they change, so that snapshots of it
+are immutable and cost nothing to take
+*/
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "../types.h"
+#include "../Epoch.h"
+#include "../Quadtree.h"
+#include "../Point.h"
+
+// rlu_self, included to make compiler happy
+__thread rlu_thread_data_t *rlu_self = NULL;
+
+// quadtree counter
+#ifdef QUADTREE_TEST
+uint64_t QUADTREE_NODE_COUNT = 0;
+#endif
+
+#define valid_node(n) Node_valid((Node*)(n))
+
+#define references_of(n) (((CowNode*)(n))->references)
+
+/*
+ * struct CowNode_t
+ *
+ * A container that wraps around the Node type to count the references to it. Nodes are never
+ * changed once they are linked into a version, so versions share every node that an update did
+ * not copy, and a node is referenced by every square holding it, in any version, and by every
+ * version it is the root of. A node left without references is retired, since searches may still
+ * be reading the version it was last in.
+ *
+ * treenode - the Node that this CowNode wraps around
+ * references - the number of references to the node
+ */
+typedef struct CowNode_t {
+    Node treenode;
+    volatile uint64_t references;
+} CowNode;
+
+/*
+ * struct CowVersion_t
+ *
+ * A version of the tree, as handed out by Quadtree_snapshot.
+ *
+ * snapshot - the public part of the version, first so that a CowVersion can be used as a
+ *     QuadtreeSnapshot
+ * references - the number of snapshots of the version, plus one while it is the current version;
+ *     searches read the current version inside an epoch critical section without a reference
+ */
+typedef struct CowVersion_t {
+    QuadtreeSnapshot snapshot;
+    volatile uint64_t references;
+} CowVersion;
+
+/*
+ * struct CowQuadtree_t
+ *
+ * A quadtree made of immutable versions. Updates are serialized by a lock; each one copies the
+ * squares on the path to the point it changes, leaving the rest of the tree shared with the
+ * previous version, and publishes the copy of the root as a new version. Readers never wait for
+ * writers, nor write anything shared: they search whichever version is current when they start,
+ * inside an epoch critical section that keeps its nodes from being reclaimed.
+ *
+ * A skip quadtree's squares are also pointed to by their twins on the level above, which would
+ * have to be copied along with them, so the tree keeps a single level.
+ *
+ * tree - the header, first so that a CowQuadtree can be used as a Quadtree; tree.root is the root
+ *     of the current version, which is freed once the version is replaced and released, so bounds
+ *     are checked against tree.center and tree.length instead
+ * writer - held by updates
+ * current - the current version, replaced only by updates
+ */
+typedef struct CowQuadtree_t {
+    Quadtree tree;
+    pthread_mutex_t writer;
+    CowVersion * volatile current;
+} CowQuadtree;
+
+Node* Node_init(const float64_t length, const Point center) {
+    CowNode *node = (CowNode*)Epoch_alloc(sizeof(*node), 0);
+    *node = (CowNode){
+        .treenode = (Node){
+            .is_square = false,
+            .length = length,
+            .center = center,
+            .down = NULL
+#ifdef QUADTREE_TEST
+            ,.id = QUADTREE_NODE_COUNT++
+#endif
+        },
+        .references = 1
+    };
+    uint64_t i;
+    for (i = 0; i < (1LL << D); i++) {
+        node->treenode.children[i] = NULL;
+    }
+    return (Node*)node;
+}
+
+/*
+ * Node_free_internal
+ *
+ * Frees the memory used to represent this node immediately, inlined for internal use. Only nodes
+ * that no other thread can reach may be freed this way.
+ *
+ * node - the node to be freed
+ */
+static inline void Node_free_internal(const Node * const node) {
+    node_free((CowNode*)node);
+}
+
+void Node_free(const Node * const node) {
+    Node_free_internal(node);
+}
+
+/*
+ * reference
+ *
+ * Adds a reference to the node, if there is one.
+ *
+ * Returns node.
+ */
+static inline Node* reference(Node * const node) {
+    if (valid_node(node)) {
+        __sync_fetch_and_add(&references_of(node), 1);
+    }
+    return node;
+}
+
+/*
+ * release
+ *
+ * Drops a reference to the node, retiring it and releasing its children once none are left. The
+ * calling thread must be inside a critical section.
+ *
+ * result - if not NULL, the result object to record freed nodes onto
+ * node - the node to release, which may be NULL
+ */
+static void release(QuadtreeFreeResult * const result, const Node * const node) {
+    if (!valid_node(node) || 0 != __sync_sub_and_fetch(&references_of(node), 1)) {
+        return;
+    }
+
+    uint64_t i;
+    bool is_leaf = true;
+    for (i = 0; i < (1LL << D); i++) {
+        if (valid_node(node->children[i])) {
+            is_leaf = false;
+            release(result, node->children[i]);
+        }
+    }
+    Epoch_retire((CowNode*)node, sizeof(CowNode));
+    if (NULL != result) {
+        result->total++;
+        result->leaf += is_leaf;
+    }
+}
+
+/*
+ * Version_release
+ *
+ * Drops a reference to the version, releasing its root once none are left.
+ *
+ * result - if not NULL, the result object to record freed nodes onto
+ * version - the version to release
+ */
+static void Version_release(QuadtreeFreeResult * const result, CowVersion * const version) {
+    if (0 == __sync_sub_and_fetch(&version->references, 1)) {
+        Epoch_enter();
+        release(result, version->snapshot.root);
+        Epoch_retire(version, sizeof(*version));
+        Epoch_exit();
+    }
+}
+
+/*
+ * get_current
+ *
+ * Returns the current version of the tree, which stays readable until the calling thread leaves
+ * the critical section it must be in.
+ */
+static inline CowVersion* get_current(const CowQuadtree * const tree) {
+    return __atomic_load_n(&tree->current, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * acquire
+ *
+ * Returns the current version of the tree, with a reference added for the caller.
+ */
+static CowVersion* acquire(const CowQuadtree * const tree) {
+    Epoch_enter();
+    CowVersion *version;
+    uint64_t references;
+    // A version whose last reference is gone has been replaced, so the new one is taken instead.
+    do {
+        version = get_current(tree);
+        references = version->references;
+    } while (0 == references ||
+        !__sync_bool_compare_and_swap(&version->references, references, references + 1));
+    Epoch_exit();
+    return version;
+}
+
+/*
+ * publish
+ *
+ * Makes a new version the current version of the tree. The caller must hold the writer lock.
+ *
+ * tree - the tree to publish the version of
+ * root - the root of the new version, whose reference passes to the version
+ * size - the number of points in the new version
+ *
+ * Returns the previous version, whose reference from the tree the caller must release.
+ */
+static CowVersion* publish(CowQuadtree * const tree, const Node * const root, const uint64_t size) {
+    CowVersion * const version = (CowVersion*)Epoch_alloc(sizeof(*version), 0);
+    *version = (CowVersion){
+        .snapshot = (QuadtreeSnapshot){ .root = root, .size = size },
+        .references = 1
+    };
+
+    CowVersion * const previous = tree->current;
+    tree->tree.root = (Node*)root;
+    __atomic_store_n(&tree->current, version, __ATOMIC_RELEASE);
+    return previous;
+}
+
+Quadtree* Quadtree_init(const float64_t length, const Point center) {
+    CowQuadtree *tree = (CowQuadtree*)malloc(sizeof(*tree));
+    Node * const root = Node_init(length, center);
+    root->is_square = true;
+    pthread_mutex_init(&tree->writer, pthread_mutex_attr());
+    tree->current = NULL;
+    tree->tree = (Quadtree){
+        .height = 0,
+        .root = root,
+        .center = center,
+        .length = length
+    };
+    publish(tree, root, 0);
+    return (Quadtree*)tree;
+}
+
+/*
+ * search
+ *
+ * Searches for the point in the version with the given root, which must hold it in range.
+ */
+static bool search(const Node * const root, const Point * const point) {
+    const Node *square = root;
+    while (true) {
+        const Node * const child = square->children[get_quadrant(&square->center, point)];
+        if (!valid_node(child)) {
+            return false;
+        } else if (!child->is_square) {
+            return Point_equals(&child->center, point);
+        } else if (!in_range(child, point)) {
+            return false;
+        }
+        square = child;
+    }
+}
+
+/*
+ * in_tree
+ *
+ * in_range for the root square, computed from the center and length of the tree, which never
+ * change, rather than from a root that another thread may be replacing and freeing.
+ */
+static inline bool in_tree(const CowQuadtree * const tree, const Point * const point) {
+    const float64_t bound = tree->tree.length * 0.5;
+    uint64_t i;
+    for (i = 0; i < D; i++) {
+        if (tree->tree.center.data[i] - bound > point->data[i] ||
+                tree->tree.center.data[i] + bound <= point->data[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Quadtree_search(const Quadtree * const node, const Point point) {
+    CowQuadtree * const tree = (CowQuadtree*)node;
+    if (!in_tree(tree, &point)) {
+        return false;
+    }
+
+    Epoch_enter();
+    const bool found = search(get_current(tree)->snapshot.root, &point);
+    Epoch_exit();
+    return found;
+}
+
+/*
+ * copy
+ *
+ * Copies a square with the child in one quadrant replaced, adding a reference to every child
+ * that the copy shares with the square.
+ *
+ * square - the square to copy
+ * quadrant - the quadrant to replace the child in
+ * replacement - the new child, which may be NULL, and whose reference passes to the copy
+ *
+ * Returns the copy.
+ */
+static Node* copy(const Node * const square, const uint8_t quadrant, Node * const replacement) {
+    Node * const new_square = Node_init(square->length, square->center);
+    new_square->is_square = true;
+    uint64_t i;
+    for (i = 0; i < (1LL << D); i++) {
+        new_square->children[i] = (quadrant == i ? replacement : reference(square->children[i]));
+    }
+    return new_square;
+}
+
+/*
+ * add
+ *
+ * Adds the point to the subtree rooted at the square, copying the squares on the way to it.
+ *
+ * square - the square to add the point under, which holds it in range
+ * point - the point to add
+ *
+ * Returns the copy of square holding the point, or NULL if the point is already there.
+ */
+static Node* add(const Node * const square, const Point * const point) {
+    const uint8_t quadrant = get_quadrant(&square->center, point);
+    Node * const child = square->children[quadrant];
+    if (valid_node(child) && child->is_square && in_range(child, point)) {
+        Node * const new_child = add(child, point);
+        return (NULL == new_child ? NULL : copy(square, quadrant, new_child));
+    } else if (valid_node(child) && !child->is_square && Point_equals(&child->center, point)) {
+        return NULL;
+    }
+
+    Node * const new_node = Node_init(0, *point);
+    if (!valid_node(child)) {
+        return copy(square, quadrant, new_node);
+    }
+
+    // Compute the smallest square separating the point from the child.
+    Node * const new_square = Node_init(square->length, square->center);
+    new_square->is_square = true;
+    uint8_t n_quadrant = quadrant, c_quadrant;
+    do {
+        new_square->center = get_new_center(new_square, n_quadrant);
+        new_square->length *= 0.5;
+        n_quadrant = get_quadrant(&new_square->center, point);
+        c_quadrant = get_quadrant(&new_square->center, &child->center);
+    } while (n_quadrant == c_quadrant);
+    new_square->children[n_quadrant] = new_node;
+    new_square->children[c_quadrant] = reference(child);
+    return copy(square, quadrant, new_square);
+}
+
+bool Quadtree_add(Quadtree * const node, const Point point) {
+    CowQuadtree * const tree = (CowQuadtree*)node;
+    if (!in_tree(tree, &point)) {
+        return false;
+    }
+
+    pthread_mutex_lock(&tree->writer);
+    const QuadtreeSnapshot current = tree->current->snapshot;
+    Node * const root = add(current.root, &point);
+    CowVersion * const previous = (NULL == root ? NULL : publish(tree, root, current.size + 1));
+    pthread_mutex_unlock(&tree->writer);
+
+    if (NULL == previous) {
+        return false;
+    }
+    Version_release(NULL, previous);
+    return true;
+}
+
+/*
+ * remove_point
+ *
+ * Removes the point from the subtree rooted at the square, copying the squares on the way to it.
+ *
+ * square - the square to remove the point from under, which holds it in range
+ * point - the point to remove
+ * is_root - whether square is the root, which is never collapsed
+ * replacement - set to what replaces square: its copy, or its only other child if it is left with
+ *     a single child, with a reference for the caller
+ *
+ * Returns whether the point was removed.
+ */
+static bool remove_point(const Node * const square, const Point * const point, const bool is_root,
+        Node ** const replacement) {
+    const uint8_t quadrant = get_quadrant(&square->center, point);
+    Node * const child = square->children[quadrant];
+    if (valid_node(child) && child->is_square && in_range(child, point)) {
+        Node *new_child;
+        if (!remove_point(child, point, false, &new_child)) {
+            return false;
+        }
+        *replacement = copy(square, quadrant, new_child);
+        return true;
+    } else if (!valid_node(child) || child->is_square || !Point_equals(&child->center, point)) {
+        return false;
+    }
+
+    Node *remaining = NULL;
+    uint64_t i, nchildren = 0;
+    for (i = 0; i < (1LL << D); i++) {
+        if (quadrant != i && valid_node(square->children[i])) {
+            remaining = square->children[i];
+            nchildren++;
+        }
+    }
+    *replacement = (!is_root && 1 == nchildren ?
+        reference(remaining) : copy(square, quadrant, NULL));
+    return true;
+}
+
+bool Quadtree_remove(Quadtree * const node, const Point point) {
+    CowQuadtree * const tree = (CowQuadtree*)node;
+    if (!in_tree(tree, &point)) {
+        return false;
+    }
+
+    pthread_mutex_lock(&tree->writer);
+    const QuadtreeSnapshot current = tree->current->snapshot;
+    Node *root;
+    CowVersion * const previous = (remove_point(current.root, &point, true, &root) ?
+        publish(tree, root, current.size - 1) : NULL);
+    pthread_mutex_unlock(&tree->writer);
+
+    if (NULL == previous) {
+        return false;
+    }
+    Version_release(NULL, previous);
+    return true;
+}
+
+uint64_t Quadtree_txn_commit(QuadtreeTxn * const txn) {
+    CowQuadtree * const tree = (CowQuadtree*)txn->tree;
+
+    // Every update copies the root left by the one before, and only the last copy is published, so
+    // no version holds some of the updates and not others. The copies in between are released as
+    // soon as they are replaced, which frees whatever the next copy does not share.
+    pthread_mutex_lock(&tree->writer);
+    Epoch_enter();
+    const QuadtreeSnapshot current = tree->current->snapshot;
+    Node *root = reference((Node*)current.root);
+    uint64_t size = current.size, applied = 0, i;
+    for (i = 0; i < txn->size; i++) {
+        QuadtreeReply * const update = txn->updates + i;
+        Node *new_root = NULL;
+        if (!in_range(root, &update->point)) {
+            // Out of bounds, so the update changes nothing.
+        } else if (QUADTREE_ADD == update->operation) {
+            new_root = add(root, &update->point);
+            size += (NULL != new_root);
+        } else if (remove_point(root, &update->point, true, &new_root)) {
+            size--;
+        }
+        update->result = (NULL != new_root);
+        if (update->result) {
+            release(NULL, root);
+            root = new_root;
+            applied++;
+        }
+    }
+    CowVersion * const previous = (0 < applied ? publish(tree, root, size) : NULL);
+    pthread_mutex_unlock(&tree->writer);
+
+    if (NULL == previous) {
+        release(NULL, root);
+    } else {
+        Version_release(NULL, previous);
+    }
+    Epoch_exit();
+    free(txn->updates);
+    free(txn);
+    return applied;
+}
+
+void Quadtree_flush(Quadtree * const tree) {
+    // Updates are published as a new version before they return.
+}
+
+QuadtreeSnapshot* Quadtree_snapshot(const Quadtree * const tree) {
+    return (QuadtreeSnapshot*)acquire((CowQuadtree*)tree);
+}
+
+bool QuadtreeSnapshot_search(const QuadtreeSnapshot * const snapshot, const Point point) {
+    return in_range(snapshot->root, &point) && search(snapshot->root, &point);
+}
+
+void QuadtreeSnapshot_free(QuadtreeSnapshot * const snapshot) {
+    Version_release(NULL, (CowVersion*)snapshot);
+}
+
+/*
+ * Quadtree_stats_internal
+ *
+ * Returns the number of nodes in the subtree of a node, itself included.
+ */
+static uint64_t Quadtree_stats_internal(const Node * const node) {
+    uint64_t i, nodes = 1;
+    for (i = 0; i < (1LL << D); i++) {
+        if (valid_node(node->children[i])) {
+            nodes += Quadtree_stats_internal(node->children[i]);
+        }
+    }
+    return nodes;
+}
+
+QuadtreeStats Quadtree_stats(const Quadtree * const tree) {
+    // The current version never changes, so its counts are exact; the tree has a single level.
+    Epoch_enter();
+    const CowVersion * const version = get_current((CowQuadtree*)tree);
+    const QuadtreeStats stats = (QuadtreeStats){
+        .size = version->snapshot.size,
+        .height = 0,
+        .nodes = Quadtree_stats_internal(version->snapshot.root)
+    };
+    Epoch_exit();
+    return stats;
+}
+
+QuadtreeFreeResult Quadtree_free(Quadtree * const node) {
+    CowQuadtree * const tree = (CowQuadtree*)node;
+    QuadtreeFreeResult result = (QuadtreeFreeResult){ .total = 0, .leaf = 0, .levels = 1 };
+
+    // Nodes still used by snapshots outlive the tree.
+    Version_release(&result, tree->current);
+    pthread_mutex_destroy(&tree->writer);
+    free(tree);
+
+    return result;
+}
@@ -0,0 +1,525 @@
+/**
+Compressed skip quadtree whose spatial partitions are each owned by a single thread, which applies
+every operation on them on behalf of the other threads
+
+No more than QUADTREE_CLIENTS threads may use one tree at once; the program is aborted otherwise.
+*/
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../types.h"
+#include "../Quadtree.h"
+#include "../Point.h"
+
+// The base tree is the sharded implementation, with its entry points renamed so that they do not
+// clash with the delegating interface below. Owners apply operations to their shards directly,
+// without taking the shards' locks.
+#define Quadtree_init Base_init
+#define Quadtree_search Base_search
+#define Quadtree_add Base_add
+#define Quadtree_remove Base_remove
+#define Quadtree_flush Base_flush
+#define Quadtree_free Base_free
+#define Quadtree_txn_commit Base_txn_commit
+#define Quadtree_stats Base_stats
+#include "../d-shard/Quadtree.c"
+#undef Quadtree_init
+#undef Quadtree_search
+#undef Quadtree_add
+#undef Quadtree_remove
+#undef Quadtree_flush
+#undef Quadtree_free
+#undef Quadtree_txn_commit
+#undef Quadtree_stats
+
+// Number of owner threads, each of which owns an equal run of consecutive shards.
+#ifndef QUADTREE_OWNERS
+#define QUADTREE_OWNERS 2
+#endif
+
+#if QUADTREE_OWNERS < 1 || QUADTREE_OWNERS > NSHARDS
+#error "QUADTREE_OWNERS must be between 1 and the number of shards"
+#endif
+
+// Number of threads that can send operations to one tree.
+#ifndef QUADTREE_CLIENTS
+#define QUADTREE_CLIENTS 64
+#endif
+
+// Number of operations that one thread can have in flight to one owner.
+#ifndef QUADTREE_RING_SIZE
+#define QUADTREE_RING_SIZE 64
+#endif
+
+// Number of times a thread checks for work or a reply before yielding its CPU.
+#define SPINS 1024
+
+/*
+ * struct RingEntry_t
+ *
+ * An operation in a ring.
+ *
+ * operation - the operation
+ * synchronous - whether the sender waits for the reply itself, so that Quadtree_receive skips it
+ * result - the result of the operation, once it has been applied
+ * point - the point to apply the operation to
+ */
+typedef struct RingEntry_t {
+    QuadtreeOperation operation;
+    bool synchronous, result;
+    Point point;
+} RingEntry;
+
+/*
+ * struct Ring_t
+ *
+ * A single-producer, single-consumer ring of operations from one thread to one owner. Entries
+ * move from sent to applied to received in order: the sender owns those from received up to sent,
+ * and the owner those from applied up to sent. The counters only grow, and index the entries
+ * modulo QUADTREE_RING_SIZE. Each counter written by a different thread has its own cache line.
+ *
+ * A synchronous operation that finds the ring full of replies that have not been received moves
+ * them out of the way, into the stash, where Quadtree_receive finds them first. Replies in the
+ * ring and in the stash together never number more than QUADTREE_RING_SIZE.
+ *
+ * sent - the number of operations sent, written by the sender
+ * received - the number of entries taken out of the ring, written by the sender
+ * stashed - the number of replies in the stash
+ * applied - the number of operations applied, written by the owner
+ * entries - the operations
+ * stash - replies taken out of the ring before they were received, oldest first
+ */
+typedef struct Ring_t {
+    volatile uint64_t sent __attribute__((aligned(64)));
+    uint64_t received, stashed;
+    volatile uint64_t applied __attribute__((aligned(64)));
+    RingEntry entries[QUADTREE_RING_SIZE] __attribute__((aligned(64)));
+    QuadtreeReply stash[QUADTREE_RING_SIZE];
+} Ring;
+
+/*
+ * struct Owner_t
+ *
+ * A thread that owns a run of shards.
+ *
+ * thread - the thread
+ * tree - the tree the shards are in
+ * index - which owner this is, [0, QUADTREE_OWNERS)
+ * requested - the number of times the owner has been asked to count its shards
+ * counted - the number of times the owner has counted its shards, written by the owner
+ * stats - what the owner counted the last time
+ */
+typedef struct Owner_t {
+    pthread_t thread;
+    struct DelegateQuadtree_t *tree;
+    uint64_t index;
+    volatile uint64_t requested, counted;
+    QuadtreeStats stats;
+} Owner;
+
+/*
+ * struct DelegateQuadtree_t
+ *
+ * A sharded tree whose shards are never touched by more than one thread. The shards, which are
+ * numbered along a Z-order curve, are split into QUADTREE_OWNERS runs of consecutive shards, each
+ * of which is a compact region of the tree owned by an owner thread. Every other thread sends its
+ * operations to the owner of the point, through a ring of its own, and the owner applies them in
+ * turn, so no node ever moves between the caches of different threads.
+ *
+ * tree - the base tree, first so that a DelegateQuadtree can be used as a Quadtree
+ * id - a number that tells this tree apart from every other tree created, so that a thread can
+ *     remember which client it is of the last tree it used
+ * running - cleared to stop the owners
+ * nclients - the number of threads that have sent operations to this tree
+ * clients - the thread that each client is, so that a thread is the same client of the tree every
+ *     time it comes back to it
+ * counting - held by the thread asking the owners to count their shards, one at a time
+ * owners - the owner threads
+ * rings - the ring from each client to each owner, owner major
+ */
+typedef struct DelegateQuadtree_t {
+    ShardedQuadtree tree;
+    uint64_t id;
+    volatile bool running;
+    volatile uint64_t nclients;
+    pthread_t clients[QUADTREE_CLIENTS];
+    pthread_mutex_t counting;
+    Owner owners[QUADTREE_OWNERS];
+    Ring *rings;
+} DelegateQuadtree;
+
+// Every tree created so far, and the client that this thread is of the last tree it used.
+static uint64_t delegate_trees = 0;
+static __thread uint64_t client_tree = UINT64_MAX, client_index;
+
+/*
+ * get_ring
+ *
+ * Returns the ring from the client to the owner.
+ */
+static inline Ring* get_ring(const DelegateQuadtree * const tree, const uint64_t owner,
+        const uint64_t client) {
+    return tree->rings + owner * QUADTREE_CLIENTS + client;
+}
+
+/*
+ * backoff
+ *
+ * Lets other threads run once a thread has waited for a while.
+ *
+ * spins - the number of times the thread has waited so far, which is advanced
+ */
+static inline void backoff(uint64_t * const spins) {
+    if (0 == ++*spins % SPINS) {
+        sched_yield();
+    }
+}
+
+/*
+ * apply
+ *
+ * Applies an operation to the shard holding the point. Only the owner of the shard may call it.
+ */
+static bool apply(DelegateQuadtree * const tree, const QuadtreeOperation operation,
+        const Point * const point) {
+    Shard * const shard = get_shard(&tree->tree, point);
+    switch (operation) {
+    case QUADTREE_SEARCH:
+        return search(shard, point);
+    case QUADTREE_ADD: {
+        if (!add(shard, point)) {
+            return false;
+        }
+        uint64_t height = tree->tree.tree.height;
+        while (height < shard->height &&
+                !__sync_bool_compare_and_swap(&tree->tree.tree.height, height, shard->height)) {
+            height = tree->tree.tree.height;
+        }
+        return true;
+    }
+    case QUADTREE_REMOVE:
+        return remove_point(shard, point);
+    }
+    return false;
+}
+
+/*
+ * count_owned
+ *
+ * Counts the shards of an owner, if it has been asked to. Only the owner may call it.
+ */
+static void count_owned(Owner * const owner) {
+    const uint64_t requested = __atomic_load_n(&owner->requested, __ATOMIC_ACQUIRE);
+    if (owner->counted == requested) {
+        return;
+    }
+    owner->stats = (QuadtreeStats){ .size = 0, .height = 0, .nodes = 0 };
+    uint64_t i;
+    for (i = 0; i < NSHARDS; i++) {
+        if (i * QUADTREE_OWNERS / NSHARDS == owner->index) {
+            count(owner->tree->tree.shards + i, &owner->stats);
+        }
+    }
+    __atomic_store_n(&owner->counted, requested, __ATOMIC_RELEASE);
+}
+
+/*
+ * own
+ *
+ * The body of an owner thread, which applies the operations in its rings, and counts its shards
+ * when asked to, until the tree is freed.
+ *
+ * argument - the Owner
+ */
+static void* own(void * const argument) {
+    Owner * const owner = (Owner*)argument;
+    DelegateQuadtree * const tree = owner->tree;
+    uint64_t spins = 0;
+    while (tree->running) {
+        bool idle = true;
+        const uint64_t nclients = tree->nclients;
+        uint64_t i;
+        for (i = 0; i < nclients; i++) {
+            Ring * const ring = get_ring(tree, owner->index, i);
+            const uint64_t sent = __atomic_load_n(&ring->sent, __ATOMIC_ACQUIRE);
+            uint64_t applied = ring->applied;
+            if (applied == sent) {
+                continue;
+            }
+            for (; applied < sent; applied++) {
+                RingEntry * const entry = ring->entries + applied % QUADTREE_RING_SIZE;
+                entry->result = apply(tree, entry->operation, &entry->point);
+            }
+            __atomic_store_n(&ring->applied, applied, __ATOMIC_RELEASE);
+            idle = false;
+        }
+        count_owned(owner);
+        if (idle) {
+            backoff(&spins);
+        }
+    }
+    return NULL;
+}
+
+Quadtree* Quadtree_init(const float64_t length, const Point center) {
+    DelegateQuadtree * const tree = (DelegateQuadtree*)sharded_init(sizeof(DelegateQuadtree),
+        length, center);
+    tree->id = __sync_fetch_and_add(&delegate_trees, 1);
+    tree->running = true;
+    tree->nclients = 0;
+    pthread_mutex_init(&tree->counting, NULL);
+    if (0 != posix_memalign((void**)&tree->rings, 64,
+            sizeof(*tree->rings) * QUADTREE_OWNERS * QUADTREE_CLIENTS)) {
+        Base_free((Quadtree*)tree);
+        return NULL;
+    }
+    uint64_t i;
+    // No thread has the id 0, so a client that is still being added is never mistaken for another.
+    for (i = 0; i < QUADTREE_CLIENTS; i++) {
+        tree->clients[i] = (pthread_t)0;
+    }
+    for (i = 0; i < QUADTREE_OWNERS * QUADTREE_CLIENTS; i++) {
+        tree->rings[i].sent = 0;
+        tree->rings[i].received = 0;
+        tree->rings[i].stashed = 0;
+        tree->rings[i].applied = 0;
+    }
+    for (i = 0; i < QUADTREE_OWNERS; i++) {
+        tree->owners[i] = (Owner){ .tree = tree, .index = i, .requested = 0, .counted = 0 };
+        pthread_create(&tree->owners[i].thread, NULL, own, tree->owners + i);
+    }
+    return (Quadtree*)tree;
+}
+
+/*
+ * get_client
+ *
+ * Returns which client of the tree the calling thread is, making it a new client if it has not
+ * used the tree before. A thread remembers which client it is of the last tree it used, and looks
+ * itself up among the clients of any other tree, so a thread that switches between trees keeps
+ * one client of each. A thread that exits leaves its client to the next thread given its id.
+ *
+ * Aborts if QUADTREE_CLIENTS threads are already clients of the tree.
+ */
+static uint64_t get_client(DelegateQuadtree * const tree) {
+    if (client_tree == tree->id) {
+        return client_index;
+    }
+
+    const pthread_t self = pthread_self();
+    uint64_t i, nclients = tree->nclients;
+    for (i = 0; i < nclients && !pthread_equal(tree->clients[i], self); i++);
+    if (i == nclients) {
+        // Only this thread can add itself, so no other client is for this thread.
+        do {
+            nclients = tree->nclients;
+            if (QUADTREE_CLIENTS == nclients) {
+                fprintf(stderr, "d-delegate: more than QUADTREE_CLIENTS (%d) threads used one tree\n",
+                    QUADTREE_CLIENTS);
+                abort();
+            }
+        } while (!__sync_bool_compare_and_swap(&tree->nclients, nclients, nclients + 1));
+        tree->clients[nclients] = self;
+        i = nclients;
+    }
+    client_tree = tree->id;
+    client_index = i;
+    return client_index;
+}
+
+/*
+ * get_owner
+ *
+ * Returns the owner of the shard holding the point.
+ */
+static inline uint64_t get_owner(const DelegateQuadtree * const tree, const Point * const point) {
+    return (get_shard(&tree->tree, point) - tree->tree.shards) * QUADTREE_OWNERS / NSHARDS;
+}
+
+/*
+ * post
+ *
+ * Puts an operation in the ring to the owner of the point.
+ *
+ * tree - the tree to apply the operation to
+ * operation - the operation
+ * point - the point, which must be in range of the tree
+ * synchronous - whether the caller waits for the reply itself
+ * ring - set to the ring the operation was put in
+ *
+ * Returns the position of the operation in the ring, or UINT64_MAX if the ring is full.
+ */
+static uint64_t post(DelegateQuadtree * const tree, const QuadtreeOperation operation,
+        const Point * const point, const bool synchronous, Ring ** const ring) {
+    *ring = get_ring(tree, get_owner(tree, point), get_client(tree));
+    const uint64_t sent = (*ring)->sent;
+    if (sent - (*ring)->received + (synchronous ? 0 : (*ring)->stashed) >= QUADTREE_RING_SIZE) {
+        return UINT64_MAX;
+    }
+    (*ring)->entries[sent % QUADTREE_RING_SIZE] = (RingEntry){
+        .operation = operation,
+        .synchronous = synchronous,
+        .point = *point
+    };
+    __atomic_store_n(&(*ring)->sent, sent + 1, __ATOMIC_RELEASE);
+    return sent;
+}
+
+/*
+ * take
+ *
+ * Takes the oldest entry out of a ring once it has been applied, keeping its reply in the stash
+ * unless its sender has already taken the reply.
+ *
+ * ring - the ring to take the entry from
+ *
+ * Returns whether there was an applied entry to take.
+ */
+static bool take(Ring * const ring) {
+    if (__atomic_load_n(&ring->applied, __ATOMIC_ACQUIRE) == ring->received) {
+        return false;
+    }
+    const RingEntry * const entry = ring->entries + ring->received % QUADTREE_RING_SIZE;
+    if (!entry->synchronous) {
+        ring->stash[ring->stashed++] = (QuadtreeReply){
+            .operation = entry->operation,
+            .point = entry->point,
+            .result = entry->result
+        };
+    }
+    ring->received++;
+    return true;
+}
+
+/*
+ * call
+ *
+ * Sends an operation to the owner of the point and waits for the reply.
+ *
+ * tree - the tree to apply the operation to
+ * operation - the operation
+ * point - the point
+ *
+ * Returns the result of the operation.
+ */
+static bool call(DelegateQuadtree * const tree, const QuadtreeOperation operation,
+        const Point * const point) {
+    if (!in_range(tree->tree.tree.root, point)) {
+        return false;
+    }
+
+    Ring *ring;
+    uint64_t position, spins = 0;
+    while (UINT64_MAX == (position = post(tree, operation, point, true, &ring))) {
+        if (!take(ring)) {
+            backoff(&spins);
+        }
+    }
+    while (__atomic_load_n(&ring->applied, __ATOMIC_ACQUIRE) <= position) {
+        backoff(&spins);
+    }
+
+    const bool result = ring->entries[position % QUADTREE_RING_SIZE].result;
+    // Replies to earlier sends that are still to be received are ahead of this one, in which case
+    // Quadtree_receive skips it.
+    if (ring->received == position) {
+        ring->received++;
+    }
+    return result;
+}
+
+bool Quadtree_search(const Quadtree * const tree, const Point point) {
+    return call((DelegateQuadtree*)tree, QUADTREE_SEARCH, &point);
+}
+
+bool Quadtree_add(Quadtree * const tree, const Point point) {
+    return call((DelegateQuadtree*)tree, QUADTREE_ADD, &point);
+}
+
+bool Quadtree_remove(Quadtree * const tree, const Point point) {
+    return call((DelegateQuadtree*)tree, QUADTREE_REMOVE, &point);
+}
+
+bool Quadtree_send(Quadtree * const node, const QuadtreeOperation operation, const Point point) {
+    DelegateQuadtree * const tree = (DelegateQuadtree*)node;
+    if (!in_range(tree->tree.tree.root, &point)) {
+        return false;
+    }
+
+    Ring *ring;
+    return UINT64_MAX != post(tree, operation, &point, false, &ring);
+}
+
+uint64_t Quadtree_receive(Quadtree * const node, QuadtreeReply * const replies,
+        const uint64_t max) {
+    DelegateQuadtree * const tree = (DelegateQuadtree*)node;
+    const uint64_t client = get_client(tree);
+    uint64_t i, count = 0;
+    for (i = 0; i < QUADTREE_OWNERS && count < max; i++) {
+        Ring * const ring = get_ring(tree, i, client);
+        while (count < max && (0 < ring->stashed || take(ring))) {
+            // Replies pass through the stash, which synchronous operations may have filled.
+            const uint64_t n = min(ring->stashed, max - count);
+            memcpy(replies + count, ring->stash, sizeof(*replies) * n);
+            memmove(ring->stash, ring->stash + n, sizeof(*replies) * (ring->stashed - n));
+            ring->stashed -= n;
+            count += n;
+        }
+    }
+    return count;
+}
+
+void Quadtree_flush(Quadtree * const node) {
+    // Wait for the owners to apply every operation this thread has sent.
+    DelegateQuadtree * const tree = (DelegateQuadtree*)node;
+    const uint64_t client = get_client(tree);
+    uint64_t i, spins = 0;
+    for (i = 0; i < QUADTREE_OWNERS; i++) {
+        Ring * const ring = get_ring(tree, i, client);
+        while (__atomic_load_n(&ring->applied, __ATOMIC_ACQUIRE) < ring->sent) {
+            backoff(&spins);
+        }
+    }
+}
+
+QuadtreeStats Quadtree_stats(const Quadtree * const node) {
+    DelegateQuadtree * const tree = (DelegateQuadtree*)node;
+
+    // Only owners may read their shards, so each of them is asked to count its own, between the
+    // operations it applies, and the counts are added up once every owner has answered.
+    pthread_mutex_lock(&tree->counting);
+    uint64_t i, spins = 0;
+    for (i = 0; i < QUADTREE_OWNERS; i++) {
+        __atomic_store_n(&tree->owners[i].requested, tree->owners[i].requested + 1,
+            __ATOMIC_RELEASE);
+    }
+    QuadtreeStats stats = (QuadtreeStats){
+        .size = 0,
+        .height = tree->tree.tree.height,
+        .nodes = NDISPATCH
+    };
+    for (i = 0; i < QUADTREE_OWNERS; i++) {
+        Owner * const owner = tree->owners + i;
+        while (__atomic_load_n(&owner->counted, __ATOMIC_ACQUIRE) != owner->requested) {
+            backoff(&spins);
+        }
+        stats.size += owner->stats.size;
+        stats.nodes += owner->stats.nodes;
+    }
+    pthread_mutex_unlock(&tree->counting);
+    return stats;
+}
+
+QuadtreeFreeResult Quadtree_free(Quadtree * const node) {
+    DelegateQuadtree * const tree = (DelegateQuadtree*)node;
+    tree->running = false;
+    uint64_t i;
+    for (i = 0; i < QUADTREE_OWNERS; i++) {
+        pthread_join(tree->owners[i].thread, NULL);
+    }
+    free(tree->rings);
+    pthread_mutex_destroy(&tree->counting);
+    return Base_free(node);
+}
@@ -0,0 +1,345 @@
+/**
+Concurrent compressed skip quadtree whose updates are applied in batches by flat combining
+
+A thread that is the only one registered with RLU applies its updates itself, without the combiner
+lock, so every thread using the tree must be registered.
+*/
+
+#include <assert.h>
+#include <sched.h>
+#include <stdlib.h>
+
+#include "../types.h"
+#include "../Quadtree.h"
+#include "../Point.h"
+
+// The base tree is the seqlock implementation, with its entry points renamed so that they do not
+// clash with the combining interface below. Its searches never block, and a single combiner
+// applying its updates never has to start one over.
+#define Quadtree_init Base_init
+#define Quadtree_search Base_search
+#define Quadtree_add Base_add
+#define Quadtree_remove Base_remove
+#define Quadtree_flush Base_flush
+#define Quadtree_free Base_free
+#include "../d-seqlock/Quadtree.c"
+#undef Quadtree_init
+#undef Quadtree_search
+#undef Quadtree_add
+#undef Quadtree_remove
+#undef Quadtree_flush
+#undef Quadtree_free
+
+// Number of publication slots; threads beyond this many share slots.
+#ifndef QUADTREE_FC_SLOTS
+#define QUADTREE_FC_SLOTS 64
+#endif
+
+// States of a publication slot.
+#define SLOT_FREE 0
+#define SLOT_CLAIMED 1
+#define SLOT_ADD 2
+#define SLOT_REMOVE 3
+#define SLOT_DONE 4
+#define SLOT_TXN 5
+
+/*
+ * struct Publication_t
+ *
+ * A publication slot, through which a thread hands an update to the combiner. A thread claims a
+ * free slot, fills in the point, and publishes the update by setting the state to SLOT_ADD or
+ * SLOT_REMOVE, or fills in a transaction and publishes it with SLOT_TXN; the combiner sets the
+ * result and the state to SLOT_DONE, after which the thread reads the result and frees the slot.
+ * Slots take a cache line each, so that threads waiting on their own slots do not disturb each
+ * other.
+ *
+ * state - one of the SLOT_ states
+ * point - the point being added or removed
+ * txn - the transaction being committed, with SLOT_TXN
+ * result - whether the update succeeded, once the state is SLOT_DONE
+ */
+typedef struct Publication_t {
+    volatile uint64_t state;
+    Point point;
+    QuadtreeTxn *txn;
+    bool result;
+} __attribute__((aligned(64))) Publication;
+
+/*
+ * struct FcQuadtree_t
+ *
+ * A seqlock tree whose updates are all applied by whichever thread holds the combiner lock. The
+ * combiner collects every published update, sorts them along a Z-order curve so that consecutive
+ * updates descend mostly the same squares, which are then still in its cache, and applies them
+ * one after another. Searches go straight to the base tree.
+ *
+ * A transaction is applied by the combiner as one batch, after the single updates, bracketed by
+ * groups like a seqlock: odd while the batch is being applied, so that searches wait for it and
+ * start over if it changed under them, which keeps them from seeing only some of its updates.
+ * Single updates leave groups alone, so searches only ever start over because of transactions.
+ *
+ * tree - the base tree, first so that a FcQuadtree can be used as a Quadtree
+ * combining - the combiner lock
+ * groups - twice the number of transactions applied, plus one while one is being applied
+ * slots - the publication slots
+ */
+typedef struct FcQuadtree_t {
+    SeqQuadtree tree;
+    volatile uint64_t combining;
+    volatile uint64_t groups;
+    Publication *slots;
+} FcQuadtree;
+
+// The slot each thread tries first, handed out in the order threads first update a tree.
+static uint64_t fc_threads = 0;
+static __thread uint64_t fc_slot = UINT64_MAX;
+
+/*
+ * struct BatchEntry_t
+ *
+ * An update collected by the combiner.
+ *
+ * key - the position of the point along the Z-order curve
+ * slot - the slot holding the update
+ */
+typedef struct BatchEntry_t {
+    uint64_t key;
+    Publication *slot;
+} BatchEntry;
+
+Quadtree* Quadtree_init(const float64_t length, const Point center) {
+    FcQuadtree * const tree = (FcQuadtree*)realloc(Base_init(length, center), sizeof(*tree));
+    tree->combining = 0;
+    tree->groups = 0;
+    if (0 != posix_memalign((void**)&tree->slots, sizeof(*tree->slots),
+            sizeof(*tree->slots) * QUADTREE_FC_SLOTS)) {
+        Base_free((Quadtree*)tree);
+        return NULL;
+    }
+    uint64_t i;
+    for (i = 0; i < QUADTREE_FC_SLOTS; i++) {
+        tree->slots[i].state = SLOT_FREE;
+    }
+    return (Quadtree*)tree;
+}
+
+bool Quadtree_search(const Quadtree * const node, const Point point) {
+    const FcQuadtree * const tree = (FcQuadtree*)node;
+    while (true) {
+        const uint64_t groups = __atomic_load_n(&tree->groups, __ATOMIC_ACQUIRE);
+        if (1 == (groups & 1)) {
+            sched_yield();
+            continue;
+        }
+        const bool found = Base_search(node, point);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (groups == tree->groups) {
+            return found;
+        }
+    }
+}
+
+/*
+ * z_order
+ *
+ * Computes the position of a point along the Z-order curve over the tree, which interleaves the
+ * bits of its coordinates scaled to the tree, most significant first, in the order get_quadrant
+ * uses them. Each coordinate gets at most 32 bits.
+ *
+ * tree - the tree the point is in range of
+ * point - the point to compute the position of
+ *
+ * Returns the position of the point.
+ */
+static uint64_t z_order(const Quadtree * const tree, const Point * const point) {
+    const uint64_t bits = min(64 / D, 32);
+    uint64_t scaled[D];
+    uint64_t i;
+    int64_t bit;
+    for (i = 0; i < D; i++) {
+        const float64_t offset = (point->data[i] - tree->center.data[i]) / tree->length + 0.5;
+        scaled[i] = min((uint64_t)(offset * (float64_t)(1ULL << bits)), (1ULL << bits) - 1);
+    }
+
+    uint64_t key = 0;
+    for (bit = bits - 1; bit >= 0; bit--) {
+        for (i = 0; i < D; i++) {
+            key = (key << 1) | ((scaled[i] >> bit) & 1);
+        }
+    }
+    return key;
+}
+
+/*
+ * BatchEntry_compare
+ *
+ * Orders batch entries by their positions along the Z-order curve, for qsort.
+ */
+static int BatchEntry_compare(const void * const a, const void * const b) {
+    const uint64_t key_a = ((const BatchEntry*)a)->key, key_b = ((const BatchEntry*)b)->key;
+    return (key_a > key_b) - (key_a < key_b);
+}
+
+/*
+ * apply_txn
+ *
+ * Applies the updates of a transaction in order, setting their results; updates out of range of
+ * the tree fail like single ones. The caller must hold the combiner lock, or run as an exclusive
+ * section.
+ *
+ * tree - the tree to apply the updates to
+ * txn - the transaction to apply
+ */
+static void apply_txn(FcQuadtree * const tree, QuadtreeTxn * const txn) {
+    uint64_t i;
+    for (i = 0; i < txn->size; i++) {
+        QuadtreeReply * const update = txn->updates + i;
+        update->result = (QUADTREE_ADD == update->operation ?
+            Base_add((Quadtree*)tree, update->point) : Base_remove((Quadtree*)tree, update->point));
+    }
+}
+
+/*
+ * combine
+ *
+ * Applies every published update, then every published transaction. The caller must hold the
+ * combiner lock.
+ *
+ * tree - the tree to apply the updates to
+ */
+static void combine(FcQuadtree * const tree) {
+    BatchEntry batch[QUADTREE_FC_SLOTS];
+    Publication *txns[QUADTREE_FC_SLOTS];
+    uint64_t i, size = 0, ntxns = 0;
+    for (i = 0; i < QUADTREE_FC_SLOTS; i++) {
+        Publication * const slot = tree->slots + i;
+        const uint64_t state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+        if (SLOT_ADD == state || SLOT_REMOVE == state) {
+            batch[size++] = (BatchEntry){
+                .key = z_order((Quadtree*)tree, &slot->point),
+                .slot = slot
+            };
+        } else if (SLOT_TXN == state) {
+            txns[ntxns++] = slot;
+        }
+    }
+    qsort(batch, size, sizeof(*batch), BatchEntry_compare);
+
+    for (i = 0; i < size; i++) {
+        Publication * const slot = batch[i].slot;
+        slot->result = (SLOT_ADD == slot->state ?
+            Base_add((Quadtree*)tree, slot->point) : Base_remove((Quadtree*)tree, slot->point));
+        __atomic_store_n(&slot->state, SLOT_DONE, __ATOMIC_RELEASE);
+    }
+
+    if (0 == ntxns) {
+        return;
+    }
+    __sync_fetch_and_add(&tree->groups, 1);
+    for (i = 0; i < ntxns; i++) {
+        apply_txn(tree, txns[i]->txn);
+    }
+    __sync_fetch_and_add(&tree->groups, 1);
+    for (i = 0; i < ntxns; i++) {
+        __atomic_store_n(&txns[i]->state, SLOT_DONE, __ATOMIC_RELEASE);
+    }
+}
+
+/*
+ * update
+ *
+ * Publishes an update or a transaction and waits for it to be applied, applying it and everything
+ * else published itself if no other thread is combining. While the calling thread is the only one
+ * registered with RLU, nothing else can be published, so it is applied directly.
+ *
+ * tree - the tree to update
+ * point - the point to add or remove, which must be in range of the tree, or NULL with SLOT_TXN
+ * txn - the transaction to commit with SLOT_TXN, or NULL
+ * state - SLOT_ADD, SLOT_REMOVE or SLOT_TXN
+ *
+ * Returns whether the update succeeded; the results of a transaction are set in it instead.
+ */
+static bool update(FcQuadtree * const tree, const Point * const point, QuadtreeTxn * const txn,
+        const uint64_t state) {
+    if (RLU_EXCLUSIVE_LOCK(rlu_self)) {
+        bool result = false;
+        if (SLOT_TXN == state) {
+            apply_txn(tree, txn);
+        } else {
+            result = (SLOT_ADD == state ?
+                Base_add((Quadtree*)tree, *point) : Base_remove((Quadtree*)tree, *point));
+        }
+        RLU_EXCLUSIVE_UNLOCK(rlu_self);
+        return result;
+    }
+
+    if (UINT64_MAX == fc_slot) {
+        fc_slot = __sync_fetch_and_add(&fc_threads, 1) % QUADTREE_FC_SLOTS;
+    }
+
+    // Claim the thread's own slot, or the next free one if another thread shares it.
+    uint64_t i = fc_slot;
+    while (!__sync_bool_compare_and_swap(&tree->slots[i].state, SLOT_FREE, SLOT_CLAIMED)) {
+        i = (i + 1) % QUADTREE_FC_SLOTS;
+    }
+    Publication * const slot = tree->slots + i;
+    if (SLOT_TXN == state) {
+        slot->txn = txn;
+    } else {
+        slot->point = *point;
+    }
+    __atomic_store_n(&slot->state, state, __ATOMIC_RELEASE);
+
+    while (SLOT_DONE != __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE)) {
+        if (0 == tree->combining && __sync_bool_compare_and_swap(&tree->combining, 0, 1)) {
+            combine(tree);
+            __atomic_store_n(&tree->combining, 0, __ATOMIC_RELEASE);
+        } else {
+            sched_yield();
+        }
+    }
+
+    const bool result = slot->result;
+    __atomic_store_n(&slot->state, SLOT_FREE, __ATOMIC_RELEASE);
+    return result;
+}
+
+bool Quadtree_add(Quadtree * const node, const Point point) {
+    FcQuadtree * const tree = (FcQuadtree*)node;
+    if (!in_range(tree->tree.roots[0], &point)) {
+        return false;
+    }
+    return update(tree, &point, NULL, SLOT_ADD);
+}
+
+bool Quadtree_remove(Quadtree * const node, const Point point) {
+    FcQuadtree * const tree = (FcQuadtree*)node;
+    if (!in_range(tree->tree.roots[0], &point)) {
+        return false;
+    }
+    return update(tree, &point, NULL, SLOT_REMOVE);
+}
+
+uint64_t Quadtree_txn_commit(QuadtreeTxn * const txn) {
+    FcQuadtree * const tree = (FcQuadtree*)txn->tree;
+    update(tree, NULL, txn, SLOT_TXN);
+
+    uint64_t i, applied = 0;
+
+    for (i = 0; i < txn->size; i++) {
+        applied += txn->updates[i].result;
+    }
+    free(txn->updates);
+    free(txn);
+    return applied;
+}
+
+void Quadtree_flush(Quadtree * const tree) {
+    // Updates are applied before they return.
+}
+
+QuadtreeFreeResult Quadtree_free(Quadtree * const node) {
+    FcQuadtree * const tree = (FcQuadtree*)node;
+    free(tree->slots);
+    return Base_free(node);
+}
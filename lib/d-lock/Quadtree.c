@@ -0,0 +1,660 @@
+/**
+Concurrent compressed skip quadtree synchronized with per-square locks and lock coupling
+
+Locks are skipped while a single thread is registered with RLU, so every thread using the tree must
+be registered.
+*/
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "../types.h"
+#include "../Quadtree.h"
+#include "../Point.h"
+
+// rlu_self, set up with RLU_THREAD_INIT by every thread that uses the tree
+__thread rlu_thread_data_t *rlu_self = NULL;
+
+// quadtree counter
+#ifdef QUADTREE_TEST
+uint64_t QUADTREE_NODE_COUNT = 0;
+#endif
+
+#define valid_node(n) Node_valid((Node*)(n))
+
+// Squares are locked with mutexes using the attributes from pthread_mutex_attr_init, or with
+// spinlocks if QUADTREE_SPINLOCK is defined.
+#ifdef QUADTREE_SPINLOCK
+typedef pthread_spinlock_t NodeLock;
+#define NodeLock_init(l) pthread_spin_init((l), PTHREAD_PROCESS_PRIVATE)
+#define NodeLock_lock(l) pthread_spin_lock(l)
+#define NodeLock_trylock(l) pthread_spin_trylock(l)
+#define NodeLock_unlock(l) pthread_spin_unlock(l)
+#define NodeLock_destroy(l) pthread_spin_destroy(l)
+#else
+typedef pthread_mutex_t NodeLock;
+#define NodeLock_init(l) pthread_mutex_init((l), pthread_mutex_attr())
+#define NodeLock_lock(l) pthread_mutex_lock(l)
+#define NodeLock_trylock(l) pthread_mutex_trylock(l)
+#define NodeLock_unlock(l) pthread_mutex_unlock(l)
+#define NodeLock_destroy(l) pthread_mutex_destroy(l)
+#endif
+
+/*
+ * struct LockNode_t
+ *
+ * A container that wraps around the Node type to give it a lock. The lock of a square guards its
+ * children; points are never locked, and are read under the lock of their parent.
+ *
+ * treenode - the Node that this LockNode wraps around
+ * lock - the lock of the node
+ * level - the level of the node, kept with QUADTREE_CONTENTION to count the waits for its lock
+ */
+typedef struct LockNode_t {
+    Node treenode;
+    NodeLock lock;
+#ifdef QUADTREE_CONTENTION
+    uint64_t level;
+#endif
+} LockNode;
+
+/*
+ * lock
+ *
+ * Locks a node, waiting for it if another thread holds it; with QUADTREE_CONTENTION, a wait is
+ * counted as a conflict over the node. Nothing is locked while the operation runs as an exclusive
+ * section, with no other thread registered with RLU.
+ */
+static inline void lock(Node * const node) {
+    if (RLU_IS_EXCLUSIVE(rlu_self)) {
+        return;
+    }
+    NodeLock * const node_lock = &((LockNode*)node)->lock;
+#ifdef QUADTREE_CONTENTION
+    if (0 == NodeLock_trylock(node_lock)) {
+        return;
+    }
+    CONTENTION_RECORD(((LockNode*)node)->level, node);
+#endif
+    NodeLock_lock(node_lock);
+}
+
+/*
+ * unlock
+ *
+ * Unlocks a node locked with lock.
+ */
+static inline void unlock(Node * const node) {
+    if (!RLU_IS_EXCLUSIVE(rlu_self)) {
+        NodeLock_unlock(&((LockNode*)node)->lock);
+    }
+}
+
+/*
+ * struct LockQuadtree_t
+ *
+ * A quadtree whose levels are fixed in advance, as in d-rlu: a point appears on every level up to
+ * get_level(point), so an update only locks the squares on its own path.
+ *
+ * This is not d-serial's deterministic 1-2-3 skip list. There are no skip-list gap nodes, and no
+ * promote or demote that rebalances the gaps next to an update, so there are no gap-node locks
+ * either: the levels of a point come from a hash of its coordinates, and every lock is a square's.
+ * A rebalancing update locks squares on its neighbours' paths as well as its own, so regions that
+ * share a gap would be updated one at a time; in exchange, levels here are balanced only in
+ * expectation, and a point set that hashes badly can make a level much fuller than half of the
+ * one below.
+ *
+ * Every operation locks squares from the top level down and, within a level, from the root down,
+ * releasing a square only once the next one is locked, so that no two operations deadlock and no
+ * square is freed under a thread that is about to lock it. Updates keep the squares they change
+ * locked until they are done.
+ *
+ * tree - the header, first so that a LockQuadtree can be used as a Quadtree; tree.root is the root
+ *     of the top level, and tree.height is the highest level that a point has been added to
+ * roots - the root square of each level, which spans the whole tree and is never collapsed
+ */
+typedef struct LockQuadtree_t {
+    Quadtree tree;
+    Node *roots[QUADTREE_LEVELS];
+} LockQuadtree;
+
+/*
+ * struct Locks_t
+ *
+ * The squares an update keeps locked until it is done.
+ *
+ * nodes - the locked squares
+ * count - the number of locked squares
+ */
+typedef struct Locks_t {
+    Node *nodes[3 * QUADTREE_LEVELS];
+    uint64_t count;
+} Locks;
+
+/*
+ * Locks_pass
+ *
+ * Moves on from a locked square, either keeping it locked in locks or unlocking it.
+ */
+static inline void Locks_pass(Locks * const locks, Node * const node, const bool keep) {
+    if (keep) {
+        locks->nodes[locks->count++] = node;
+    } else {
+        unlock(node);
+    }
+}
+
+/*
+ * Locks_release
+ *
+ * Unlocks every square in locks.
+ */
+static inline void Locks_release(Locks * const locks) {
+    uint64_t i;
+    for (i = 0; i < locks->count; i++) {
+        unlock(locks->nodes[i]);
+    }
+    locks->count = 0;
+}
+
+/*
+ * Node_init_level
+ *
+ * Creates a node on the given level of the tree, whose memory may be placed differently from that
+ * of lower levels (see node_alloc).
+ *
+ * length - the side length of the node
+ * center - the center of the node
+ * level - the level of the node
+ *
+ * Returns the node.
+ */
+static Node* Node_init_level(const float64_t length, const Point center, const uint64_t level) {
+    LockNode *node = (LockNode*)node_alloc(sizeof(*node), level);
+    node->treenode = (Node){
+        .is_square = false,
+        .length = length,
+        .center = center,
+        .down = NULL
+#ifdef QUADTREE_TEST
+        ,.id = QUADTREE_NODE_COUNT++
+#endif
+    };
+    uint64_t i;
+    for (i = 0; i < (1LL << D); i++) {
+        node->treenode.children[i] = NULL;
+    }
+    NodeLock_init(&node->lock);
+#ifdef QUADTREE_CONTENTION
+    node->level = level;
+#endif
+    return (Node*)node;
+}
+
+Node* Node_init(const float64_t length, const Point center) {
+    return Node_init_level(length, center, 0);
+}
+
+/*
+ * Node_free_internal
+ *
+ * Frees the memory used to represent this node, inlined for internal use. The node must be
+ * unlocked, and no other thread may be able to reach it.
+ *
+ * node - the node to be freed
+ */
+static inline void Node_free_internal(const Node * const node) {
+    NodeLock_destroy(&((LockNode*)node)->lock);
+    node_free((LockNode*)node);
+}
+
+void Node_free(const Node * const node) {
+    Node_free_internal(node);
+}
+
+Quadtree* Quadtree_init(const float64_t length, const Point center) {
+    LockQuadtree *tree = (LockQuadtree*)malloc(sizeof(*tree));
+    uint64_t i;
+    for (i = 0; i < QUADTREE_LEVELS; i++) {
+        tree->roots[i] = Node_init_level(length, center, i);
+        tree->roots[i]->is_square = true;
+        tree->roots[i]->down = (0 == i ? NULL : tree->roots[i - 1]);
+    }
+    tree->tree = (Quadtree){
+        .height = 0,
+        .root = tree->roots[QUADTREE_LEVELS - 1],
+        .center = center,
+        .length = length
+    };
+    return (Quadtree*)tree;
+}
+
+/*
+ * same_square
+ *
+ * Returns whether the square has the given side length and center.
+ */
+static inline bool same_square(const Node * const square, const float64_t length,
+        const Point * const center) {
+    return square->length == length && Point_equals(&square->center, center);
+}
+
+/*
+ * separate
+ *
+ * Computes the smallest square inside the parent that separates the point from the node in its
+ * quadrant of the parent.
+ *
+ * parent - the square containing both
+ * point - the point
+ * sibling - the node in the quadrant of parent containing the point, which is not a square
+ *     containing the point
+ * square - set to the side length and center of the separating square
+ */
+static void separate(const Node * const parent, const Point * const point,
+        const Node * const sibling, Node * const square) {
+    square->length = parent->length;
+    square->center = parent->center;
+    uint8_t quadrant = get_quadrant(&parent->center, point);
+    do {
+        square->center = get_new_center(square, quadrant);
+        square->length *= 0.5;
+        quadrant = get_quadrant(&square->center, point);
+    } while (quadrant == get_quadrant(&square->center, &sibling->center));
+}
+
+/*
+ * search_point
+ *
+ * Quadtree_search, with the locks skipped in an exclusive section.
+ */
+static bool search_point(const Quadtree * const node, const Point point) {
+    const LockQuadtree * const tree = (LockQuadtree*)node;
+    if (!in_range(tree->roots[0], &point)) {
+        return false;
+    }
+
+    // Descend each level as far as it goes, then drop to the same square on the level below.
+    bool found = false;
+    Node *square = tree->roots[tree->tree.height];
+    lock(square);
+    while (true) {
+        Node * const child = square->children[get_quadrant(&square->center, &point)];
+        Node *next = NULL;
+        if (!valid_node(child)) {
+            // Fall through to the level below.
+        } else if (child->is_square && in_range(child, &point)) {
+            next = child;
+        } else if (!child->is_square && Point_equals(&child->center, &point)) {
+            found = true;
+            break;
+        }
+
+        if (NULL == next) {
+            next = square->down;
+            if (!valid_node(next)) {
+                break;
+            }
+        }
+        lock(next);
+        unlock(square);
+        square = next;
+    }
+    unlock(square);
+
+    return found;
+}
+
+/*
+ * add_point
+ *
+ * Quadtree_add, with the locks skipped in an exclusive section.
+ */
+static bool add_point(Quadtree * const node, const Point point) {
+    LockQuadtree * const tree = (LockQuadtree*)node;
+    if (!in_range(tree->roots[0], &point)) {
+        return false;
+    }
+
+    const int64_t level = get_level(&point);
+    const int64_t top = max(level, (int64_t)tree->tree.height);
+    Locks locks = { .count = 0 };
+
+    // parents[l] is the square the point goes in on level l, and twins[l] the square on level l
+    // that the square created on level l + 1, if any, points down to.
+    Node *parents[QUADTREE_LEVELS], *twins[QUADTREE_LEVELS];
+    uint8_t quadrants[QUADTREE_LEVELS];
+    Node target = { .length = -1 };
+
+    Node *parent = tree->roots[top];
+    lock(parent);
+    int64_t l;
+    for (l = top; l >= 0; l--) {
+        // Walk down the level, keeping the twin of the square created on the level above locked.
+        bool keep = l < level && same_square(parent, target.length, &target.center);
+        twins[l] = keep ? parent : NULL;
+        uint8_t quadrant;
+        Node *child;
+        while (true) {
+            quadrant = get_quadrant(&parent->center, &point);
+            child = parent->children[quadrant];
+            if (!valid_node(child) || !child->is_square || !in_range(child, &point)) {
+                break;
+            }
+            lock(child);
+            Locks_pass(&locks, parent, keep);
+            parent = child;
+            keep = l < level && same_square(parent, target.length, &target.center);
+            if (keep) {
+                twins[l] = parent;
+            }
+        }
+
+        if (valid_node(child) && !child->is_square && Point_equals(&child->center, &point)) {
+            unlock(parent);
+            Locks_release(&locks);
+            return false;
+        }
+
+        if (l <= level) {
+            parents[l] = parent;
+            quadrants[l] = quadrant;
+            target.length = -1;
+            if (valid_node(child)) {
+                separate(parent, &point, child, &target);
+            }
+        }
+
+        if (l > 0) {
+            Node * const down = parent->down;
+            lock(down);
+            Locks_pass(&locks, parent, keep || l <= level);
+            parent = down;
+        } else {
+            Locks_pass(&locks, parent, true);
+        }
+    }
+
+    // Every square that changes is locked, so the point can be linked in from the bottom up.
+    Node *below = NULL;
+    for (l = 0; l <= level; l++) {
+        Node * const parent = parents[l];
+        const uint8_t quadrant = quadrants[l];
+        Node * const sibling = parent->children[quadrant];
+
+        Node * const new_node = Node_init_level(0, point, l);
+        new_node->down = below;
+        below = new_node;
+
+        if (!valid_node(sibling)) {
+            parent->children[quadrant] = new_node;
+            continue;
+        }
+
+        Node * const new_square = Node_init_level(0, point, l);
+        new_square->is_square = true;
+        separate(parent, &point, sibling, new_square);
+        new_square->children[get_quadrant(&new_square->center, &point)] = new_node;
+        new_square->children[get_quadrant(&new_square->center, &sibling->center)] = sibling;
+        if (l > 0) {
+            assert(valid_node(twins[l - 1]) &&
+                same_square(twins[l - 1], new_square->length, &new_square->center));
+            new_square->down = twins[l - 1];
+        }
+        parent->children[quadrant] = new_square;
+
+        // Unless the square already existed on this level, the new square is its twin.
+        if (l < level && !valid_node(twins[l])) {
+            twins[l] = new_square;
+        }
+    }
+
+    uint64_t height = tree->tree.height;
+    while (height < (uint64_t)level &&
+            !__sync_bool_compare_and_swap(&tree->tree.height, height, level)) {
+        height = tree->tree.height;
+    }
+
+    Locks_release(&locks);
+
+    return true;
+}
+
+/*
+ * remove_point
+ *
+ * Quadtree_remove, with the locks skipped in an exclusive section.
+ */
+static bool remove_point(Quadtree * const node, const Point point) {
+    LockQuadtree * const tree = (LockQuadtree*)node;
+    if (!in_range(tree->roots[0], &point)) {
+        return false;
+    }
+
+    Locks locks;
+    Node *parents[QUADTREE_LEVELS], *grandparents[QUADTREE_LEVELS];
+    uint8_t quadrants[QUADTREE_LEVELS], parent_quadrants[QUADTREE_LEVELS];
+    int64_t found, l, top;
+    const Node *removed = NULL;
+    while (true) {
+        locks.count = 0;
+        found = -1;
+        top = tree->tree.height;
+
+        // Walk each level keeping the parent and grandparent locked, since removing the point may
+        // collapse the parent into the grandparent.
+        Node *parent = tree->roots[top];
+        lock(parent);
+        for (l = top; l >= 0; l--) {
+            Node *grandparent = NULL, *child;
+            uint8_t quadrant, parent_quadrant = 0;
+            while (true) {
+                quadrant = get_quadrant(&parent->center, &point);
+                child = parent->children[quadrant];
+                if (!valid_node(child) || !child->is_square || !in_range(child, &point)) {
+                    break;
+                }
+                lock(child);
+                if (valid_node(grandparent)) {
+                    unlock(grandparent);
+                }
+                grandparent = parent;
+                parent_quadrant = quadrant;
+                parent = child;
+            }
+
+            // The point's own coordinates fix its level, but a point equal to it up to precision
+            // error may hash differently, so the level is the highest one the point was found on.
+            if (0 > found && valid_node(child) && !child->is_square &&
+                    Point_equals(&child->center, &point)) {
+                found = l;
+                removed = child;
+            }
+            parents[l] = parent;
+            grandparents[l] = grandparent;
+            quadrants[l] = quadrant;
+            parent_quadrants[l] = parent_quadrant;
+
+            // Enter the level below at the twin of the grandparent, so that the grandparent of
+            // every non-root parent is known there too. The twin is read and locked while the
+            // entry is still locked, since once it is unlocked a concurrent remove may free it.
+            Node * const entry = valid_node(grandparent) ? grandparent : parent;
+            Node * const down = entry->down;
+            if (l > 0) {
+                lock(down);
+            }
+            if (valid_node(grandparent)) {
+                Locks_pass(&locks, grandparent, 0 <= found);
+            }
+            Locks_pass(&locks, parent, 0 <= found);
+            parent = down;
+        }
+
+        // A point added to a level above the one the walk started at is not removed from it, so
+        // the walk is retried if the tree grew in the meantime. Adds grow the tree before they
+        // unlock, so no add that the walk saw the effects of is missed. A walk can also overtake
+        // an add of the point through a down pointer and find it on fewer levels than the point
+        // hashes to, and removing it from those alone would leave squares above pointing down to
+        // collapsed ones, so the walk is retried then too.
+        if (0 > found || ((int64_t)tree->tree.height == top &&
+                found >= (int64_t)get_level(&removed->center))) {
+            break;
+        }
+        Locks_release(&locks);
+    }
+
+    if (0 > found) {
+        return false;
+    }
+
+    // Remove from the top down, collapsing every parent that is left with a single child.
+    Node *garbage[2 * QUADTREE_LEVELS];
+    uint64_t ngarbage = 0;
+    for (l = found; l >= 0; l--) {
+        Node * const parent = parents[l];
+        garbage[ngarbage++] = parent->children[quadrants[l]];
+        parent->children[quadrants[l]] = NULL;
+
+        // Roots are never collapsed.
+        if (!valid_node(grandparents[l])) {
+            continue;
+        }
+
+        Node *remaining = NULL;
+        uint64_t i, nchildren = 0;
+        for (i = 0; i < (1LL << D); i++) {
+            if (valid_node(parent->children[i])) {
+                remaining = parent->children[i];
+                nchildren++;
+            }
+        }
+        if (1 == nchildren) {
+            grandparents[l]->children[parent_quadrants[l]] = remaining;
+            garbage[ngarbage++] = parent;
+        }
+    }
+
+    Locks_release(&locks);
+
+    // Any thread about to lock an unlinked square would have had to hold a square locked above.
+    uint64_t i;
+    for (i = 0; i < ngarbage; i++) {
+        Node_free_internal(garbage[i]);
+    }
+
+    return true;
+}
+
+// While the calling thread is the only one registered with RLU, every operation runs as an
+// exclusive section, in which lock and unlock do nothing.
+
+bool Quadtree_search(const Quadtree * const node, const Point point) {
+    const bool exclusive = RLU_EXCLUSIVE_LOCK(rlu_self);
+    const bool found = search_point(node, point);
+    if (exclusive) {
+        RLU_EXCLUSIVE_UNLOCK(rlu_self);
+    }
+    return found;
+}
+
+bool Quadtree_add(Quadtree * const node, const Point point) {
+    const bool exclusive = RLU_EXCLUSIVE_LOCK(rlu_self);
+    const bool added = add_point(node, point);
+    if (exclusive) {
+        RLU_EXCLUSIVE_UNLOCK(rlu_self);
+    }
+    return added;
+}
+
+bool Quadtree_remove(Quadtree * const node, const Point point) {
+    const bool exclusive = RLU_EXCLUSIVE_LOCK(rlu_self);
+    const bool removed = remove_point(node, point);
+    if (exclusive) {
+        RLU_EXCLUSIVE_UNLOCK(rlu_self);
+    }
+    return removed;
+}
+
+void Quadtree_flush(Quadtree * const tree) {
+    // Updates are applied in place.
+}
+
+/*
+ * Quadtree_stats_internal
+ *
+ * Counts a locked square and every node below it on the same level, locking each square below it
+ * before reading its children and unlocking it once they are counted. Squares are locked from the
+ * root down, as updates lock them, so the walk cannot deadlock with them.
+ *
+ * stats - the stats to count onto
+ * square - the locked square to count from
+ * bottom - whether the square is on the bottom level, whose points are the points of the tree
+ */
+static void Quadtree_stats_internal(QuadtreeStats * const stats, Node * const square,
+        const bool bottom) {
+    uint64_t i;
+    for (i = 0; i < (1LL << D); i++) {
+        Node * const child = square->children[i];
+        if (!valid_node(child)) {
+            continue;
+        }
+        if (child->is_square) {
+            lock(child);
+            Quadtree_stats_internal(stats, child, bottom);
+            unlock(child);
+        } else {
+            stats->nodes++;
+            stats->size += bottom;
+        }
+    }
+    stats->nodes++;
+}
+
+QuadtreeStats Quadtree_stats(const Quadtree * const node) {
+    const LockQuadtree * const tree = (LockQuadtree*)node;
+    QuadtreeStats stats = (QuadtreeStats){ .size = 0, .height = tree->tree.height, .nodes = 0 };
+
+    // Levels are counted from the top down, each under the lock of its root.
+    int64_t i;
+    for (i = QUADTREE_LEVELS - 1; i >= 0; i--) {
+        lock(tree->roots[i]);
+        Quadtree_stats_internal(&stats, tree->roots[i], 0 == i);
+        unlock(tree->roots[i]);
+    }
+    return stats;
+}
+
+/*
+ * Quadtree_free_internal
+ *
+ * result - the result object to record data onto
+ * node - the node to recursively free
+ */
+void Quadtree_free_internal(QuadtreeFreeResult * result, const Node * const node) {
+    uint64_t i;
+    bool is_leaf = true;
+    for (i = 0; i < (1LL << D); i++) {
+        if (valid_node(node->children[i])) {
+            is_leaf = false;
+            Quadtree_free_internal(result, node->children[i]);
+        }
+    }
+    Node_free_internal(node);
+    result->total++;
+    result->leaf += is_leaf;
+}
+
+QuadtreeFreeResult Quadtree_free(Quadtree * const node) {
+    LockQuadtree * const tree = (LockQuadtree*)node;
+    QuadtreeFreeResult result = (QuadtreeFreeResult){ .total = 0, .leaf = 0, .levels = 0 };
+
+    int64_t i;
+    for (i = QUADTREE_LEVELS - 1; i >= 0; i--) {
+        Quadtree_free_internal(&result, tree->roots[i]);
+        result.levels++;
+    }
+
+    free(tree);
+
+    return result;
+}
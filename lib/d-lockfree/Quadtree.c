@@ -0,0 +1,735 @@
+/**
+Lock-free concurrent compressed skip quadtree using CAS on child pointers
+
+Operations enter no epoch while their thread is the only one registered with RLU, so threads that
+have not registered must not use the tree.
+*/
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "../types.h"
+#include "../Epoch.h"
+#include "../Quadtree.h"
+#include "../Point.h"
+
+// rlu_self, set up with RLU_THREAD_INIT by every thread that uses the tree
+__thread rlu_thread_data_t *rlu_self = NULL;
+
+// quadtree counter
+#ifdef QUADTREE_TEST
+uint64_t QUADTREE_NODE_COUNT = 0;
+#endif
+
+#define valid_node(n) Node_valid((Node*)(n))
+
+// A child pointer with its low bit set belongs to a square that is being frozen, and can no
+// longer be changed.
+#define marked(n) ((uintptr_t)(n) & 1)
+#define mark(n) ((Node*)((uintptr_t)(n) | 1))
+#define unmark(n) ((Node*)((uintptr_t)(n) & ~(uintptr_t)1))
+
+// Reads a child pointer that other threads may be changing.
+#define load(p) (*(Node * volatile *)&(p))
+
+#define CAS(p, old, new) __sync_bool_compare_and_swap(&(p), (old), (new))
+
+#define refs_of(n) (((LockFreeNode*)(n))->refs)
+
+// Set in the refs of a square once it has been unlinked from its level.
+#define UNLINKED (1ULL << 63)
+
+/*
+ * struct LockFreeNode_t
+ *
+ * A container that wraps around the Node type to count the squares pointing down to it. A square
+ * unlinked from its level is only retired once no square on the level above points down to it, so
+ * that a search dropping into it through a down pointer never reads freed memory.
+ *
+ * treenode - the Node that this LockFreeNode wraps around
+ * refs - the number of squares pointing down to the node, with UNLINKED set once it has been
+ *     unlinked; only counted for squares
+ */
+typedef struct LockFreeNode_t LockFreeNode;
+struct LockFreeNode_t {
+    Node treenode;
+    volatile uint64_t refs;
+};
+
+/*
+ * struct LockFreeQuadtree_t
+ *
+ * A quadtree whose levels are fixed in advance, as in d-rlu: a point appears on every level up to
+ * get_level(point).
+ *
+ * Level 0 alone decides whether a point is in the tree: adds and removes take effect with a
+ * single CAS on level 0, and the levels above only guide searches to a square of level 0 to start
+ * from. A point may therefore linger on the levels above after it has been removed from level 0,
+ * until a later remove of the same point clears it.
+ *
+ * A square is collapsed by freezing it, marking every one of its child pointers, and then
+ * swapping it in its parent for its only child, or for NULL or an unfrozen copy if updates raced
+ * with the freeze. Any update that needs to change a frozen square helps finish the collapse
+ * first, so that no thread waits on another. Searches ignore marks, since a frozen square keeps
+ * the children it had when it was frozen; they only check that a square reached through a down
+ * pointer is not frozen, and otherwise start the level over from its root, so they are wait-free.
+ *
+ * Unlinked nodes may still be read by other threads, so every operation runs in an epoch critical
+ * section, and unlinked nodes are retired to be freed once those that were running have ended. An
+ * unlinked square may still be pointed down to from the level above, so it is only retired once
+ * the last such square is retired too. Its children may have been retired long before, so a
+ * square reached through a down pointer is only read past once one of its children is seen
+ * unmarked, which shows that it had not been unlinked yet.
+ *
+ * tree - the header, first so that a LockFreeQuadtree can be used as a Quadtree; tree.root is the
+ *     root of the top level, and tree.height is the highest level that a point has been added to
+ * roots - the root square of each level, which spans the whole tree and is never frozen
+ */
+typedef struct LockFreeQuadtree_t {
+    Quadtree tree;
+    Node *roots[QUADTREE_LEVELS];
+} LockFreeQuadtree;
+
+/*
+ * Node_init_level
+ *
+ * Creates a node on the given level of the tree, whose memory may be placed differently from that
+ * of lower levels (see node_alloc).
+ *
+ * length - the side length of the node
+ * center - the center of the node
+ * level - the level of the node
+ *
+ * Returns the node.
+ */
+static Node* Node_init_level(const float64_t length, const Point center, const uint64_t level) {
+    LockFreeNode *node = (LockFreeNode*)Epoch_alloc(sizeof(*node), level);
+    *node = (LockFreeNode){
+        .treenode = (Node){
+            .is_square = false,
+            .length = length,
+            .center = center,
+            .down = NULL
+#ifdef QUADTREE_TEST
+            ,.id = QUADTREE_NODE_COUNT++
+#endif
+        },
+        .refs = 0
+    };
+    uint64_t i;
+    for (i = 0; i < (1LL << D); i++) {
+        node->treenode.children[i] = NULL;
+    }
+    return (Node*)node;
+}
+
+Node* Node_init(const float64_t length, const Point center) {
+    return Node_init_level(length, center, 0);
+}
+
+/*
+ * Node_free_internal
+ *
+ * Frees the memory used to represent this node immediately, inlined for internal use. Only nodes
+ * that no other thread can reach may be freed this way.
+ *
+ * node - the node to be freed
+ */
+static inline void Node_free_internal(const Node * const node) {
+    node_free((LockFreeNode*)node);
+}
+
+void Node_free(const Node * const node) {
+    Node_free_internal(node);
+}
+
+/*
+ * retire
+ *
+ * Hands a node that has just been unlinked from the tree over to be freed once no other thread can
+ * be reading it. An exclusive section is not an epoch critical section, so the retire runs in one
+ * of its own; inside any other operation, it merely nests.
+ */
+static inline void retire(Node * const node) {
+    Epoch_enter();
+    Epoch_retire((LockFreeNode*)node, sizeof(LockFreeNode));
+    Epoch_exit();
+}
+
+/*
+ * acquire
+ *
+ * Counts a new square pointing down to the square, unless it has already been unlinked.
+ *
+ * Returns whether the square was counted, and so may be pointed down to.
+ */
+static bool acquire(Node * const square) {
+    uint64_t refs = refs_of(square);
+    while (!(refs & UNLINKED)) {
+        if (CAS(refs_of(square), refs, refs + 1)) {
+            return true;
+        }
+        refs = refs_of(square);
+    }
+    return false;
+}
+
+static void release(Node * const square);
+
+/*
+ * retire_square
+ *
+ * Retires a square that is unlinked and pointed down to by no square, then releases the square it
+ * points down to.
+ */
+static void retire_square(Node * const square) {
+    Node * const down = square->down;
+    retire(square);
+    if (valid_node(down)) {
+        release(down);
+    }
+}
+
+/*
+ * release
+ *
+ * Uncounts a square that pointed down to the square, retiring it if it was the last one and the
+ * square has been unlinked.
+ */
+static void release(Node * const square) {
+    if (UNLINKED == __sync_sub_and_fetch(&refs_of(square), 1)) {
+        retire_square(square);
+    }
+}
+
+/*
+ * unlink_square
+ *
+ * Marks a square that has just been unlinked from its level, retiring it if no square points down
+ * to it.
+ */
+static void unlink_square(Node * const square) {
+    if (UNLINKED == __sync_or_and_fetch(&refs_of(square), UNLINKED)) {
+        retire_square(square);
+    }
+}
+
+/*
+ * discard
+ *
+ * Frees a square that was never published, releasing the square it points down to.
+ */
+static void discard(Node * const square) {
+    if (valid_node(square->down)) {
+        release(square->down);
+    }
+    Node_free_internal(square);
+}
+
+/*
+ * enter
+ *
+ * Checks that a square reached through a down pointer may be read past, because its child on the
+ * way to the point is unmarked, and otherwise falls back to the root of its level.
+ *
+ * tree - the tree the square is in
+ * level - the level of the square
+ * square - the square reached
+ * point - the point being searched for
+ *
+ * Returns the square to continue from.
+ */
+static inline Node* enter(const LockFreeQuadtree * const tree, const uint64_t level,
+        Node * const square, const Point * const point) {
+    if (marked(load(square->children[get_quadrant(&square->center, point)]))) {
+        return tree->roots[level];
+    }
+    return square;
+}
+
+Quadtree* Quadtree_init(const float64_t length, const Point center) {
+    LockFreeQuadtree *tree = (LockFreeQuadtree*)malloc(sizeof(*tree));
+    uint64_t i;
+    for (i = 0; i < QUADTREE_LEVELS; i++) {
+        tree->roots[i] = Node_init_level(length, center, i);
+        tree->roots[i]->is_square = true;
+        tree->roots[i]->down = (0 == i ? NULL : tree->roots[i - 1]);
+        if (0 < i) {
+            acquire(tree->roots[i - 1]);
+        }
+    }
+    tree->tree = (Quadtree){
+        .height = 0,
+        .root = tree->roots[QUADTREE_LEVELS - 1],
+        .center = center,
+        .length = length
+    };
+    return (Quadtree*)tree;
+}
+
+/*
+ * twin
+ *
+ * Finds the square on a level that a new square on the level above should point down to: the
+ * square with the same center and side length if there is one, or the smallest one containing it.
+ * The square found is counted as pointed down to.
+ *
+ * tree - the tree the squares are in
+ * level - the level to search
+ * start - a square on the level containing the new square, reached through a down pointer
+ * square - the new square
+ *
+ * Returns the square to point down to.
+ */
+static Node* twin(const LockFreeQuadtree * const tree, const uint64_t level, Node *start,
+        const Node * const square) {
+    Node *found;
+    do {
+        found = enter(tree, level, start, &square->center);
+        while (found->length > square->length) {
+            Node * const child = unmark(load(found->children[get_quadrant(&found->center,
+                &square->center)]));
+            if (!valid_node(child) || !child->is_square || child->length < square->length ||
+                    !in_range(child, &square->center)) {
+                break;
+            }
+            found = child;
+        }
+
+        // A square unlinked since it was found can no longer be pointed down to, so the level is
+        // searched again from its root.
+        start = tree->roots[level];
+    } while (!acquire(found));
+    return found;
+}
+
+/*
+ * collapse
+ *
+ * Freezes the square and swaps it in its parent for what is left of it, or helps another thread
+ * that has started to do so.
+ *
+ * tree - the tree the square is in
+ * level - the level of the square
+ * parent - the square holding square
+ * quadrant - the quadrant of parent holding square
+ * square - the square to collapse, which must not be a root
+ */
+static void collapse(LockFreeQuadtree * const tree, const uint64_t level, Node * const parent,
+        const uint8_t quadrant, Node * const square) {
+    Node *remaining = NULL;
+    uint64_t i, nchildren = 0;
+    for (i = 0; i < (1LL << D); i++) {
+        Node *child = load(square->children[i]);
+        while (!marked(child) && !CAS(square->children[i], child, mark(child))) {
+            child = load(square->children[i]);
+        }
+        if (valid_node(unmark(child))) {
+            remaining = unmark(child);
+            nchildren++;
+        }
+    }
+
+    // An update that got in before the freeze leaves too many children to collapse, so the
+    // square is replaced by a copy that can be changed again.
+    if (1 < nchildren) {
+        remaining = Node_init_level(square->length, square->center, level);
+        remaining->is_square = true;
+        if (valid_node(square->down)) {
+            remaining->down = twin(tree, level - 1, square->down, remaining);
+        }
+        for (i = 0; i < (1LL << D); i++) {
+            remaining->children[i] = unmark(square->children[i]);
+        }
+    }
+
+    if (CAS(parent->children[quadrant], square, remaining)) {
+        unlink_square(square);
+    } else if (1 < nchildren) {
+        discard(remaining);
+    }
+}
+
+/*
+ * locate
+ *
+ * Finds a square to start from on each level, without checking that they are still in the tree.
+ * Each level is entered at the square the grandparent on the level above points down to, as in
+ * d-rlu, so that the grandparent of the parent found on a level from its start is known, and the
+ * parent can be collapsed.
+ *
+ * tree - the tree to search
+ * point - the point to search for, must be within the bounds of the tree
+ * top - the level to start searching at
+ * starts - starts[l] is set to the square that level l was entered at
+ */
+static void locate(const LockFreeQuadtree * const tree, const Point * const point,
+        const uint64_t top, Node ** const starts) {
+    Node *start = tree->roots[top];
+    int64_t level;
+    for (level = top; level >= 0; level--) {
+        Node *grandparent = NULL, *parent = start;
+        while (true) {
+            Node * const child = unmark(load(parent->children[get_quadrant(&parent->center,
+                point)]));
+            if (!valid_node(child) || !child->is_square || !in_range(child, point)) {
+                break;
+            }
+            grandparent = parent;
+            parent = child;
+        }
+        starts[level] = start;
+        if (0 < level) {
+            start = enter(tree, level - 1, (valid_node(grandparent) ? grandparent : parent)->down,
+                point);
+        }
+    }
+}
+
+/*
+ * search
+ *
+ * Searches for a point, inside a critical section.
+ *
+ * tree - the tree to search
+ * point - the point to search for, must be within the bounds of the tree
+ *
+ * Returns whether the point is in the tree.
+ */
+static bool search(const LockFreeQuadtree * const tree, const Point point) {
+    int64_t level = tree->tree.height;
+    const Node *square = tree->roots[level];
+    while (true) {
+        const Node *child = load(square->children[get_quadrant(&square->center, &point)]);
+        if (!valid_node(unmark(child)) || !unmark(child)->is_square ||
+                !in_range(unmark(child), &point)) {
+            if (0 == level) {
+                child = unmark(child);
+                return valid_node(child) && !child->is_square && Point_equals(&child->center, &point);
+            }
+
+            // Drop to the level below. A square that was frozen before this search reached it may
+            // be missing later updates, so the level is started over from its root.
+            level--;
+            square = enter(tree, level, square->down, &point);
+            continue;
+        }
+        square = unmark(child);
+    }
+}
+
+/*
+ * begin_operation
+ *
+ * Starts an operation as an epoch critical section, or, while the calling thread is the only one
+ * registered with RLU, as an exclusive section, which needs no fence since no other thread can be
+ * reading the nodes that the operation retires.
+ *
+ * Returns whether the operation runs exclusively, to be passed to end_operation.
+ */
+static inline bool begin_operation() {
+    if (RLU_EXCLUSIVE_LOCK(rlu_self)) {
+        return true;
+    }
+    Epoch_enter();
+    return false;
+}
+
+/*
+ * end_operation
+ *
+ * Ends an operation started with begin_operation.
+ */
+static inline void end_operation(const bool exclusive) {
+    if (exclusive) {
+        RLU_EXCLUSIVE_UNLOCK(rlu_self);
+    } else {
+        Epoch_exit();
+    }
+}
+
+bool Quadtree_search(const Quadtree * const node, const Point point) {
+    const LockFreeQuadtree * const tree = (LockFreeQuadtree*)node;
+    if (!in_range(tree->roots[0], &point)) {
+        return false;
+    }
+
+    const bool exclusive = begin_operation();
+    const bool found = search(tree, point);
+    end_operation(exclusive);
+    return found;
+}
+
+/*
+ * add_level
+ *
+ * Adds the point to one level.
+ *
+ * tree - the tree to add to
+ * level - the level to add to
+ * point - the point to add
+ * start - the square on the level to start searching from
+ * below - the node for the point on the level below, NULL on level 0
+ * added - set to whether the point was added, or was already on the level
+ *
+ * Returns the node for the point on the level.
+ */
+static Node* add_level(LockFreeQuadtree * const tree, const uint64_t level,
+        const Point * const point, Node *start, Node * const below, bool * const added) {
+    Node * const new_node = Node_init_level(0, *point, level);
+    new_node->down = below;
+
+    Node *grandparent = NULL, *parent = start;
+    uint8_t parent_quadrant = 0;
+    while (true) {
+        const uint8_t quadrant = get_quadrant(&parent->center, point);
+        Node * const child = load(parent->children[quadrant]);
+        if (marked(child)) {
+            // Finish freezing the parent, then start the level over from its root, since the
+            // grandparent may have been frozen too.
+            if (valid_node(grandparent)) {
+                collapse(tree, level, grandparent, parent_quadrant, parent);
+            }
+            grandparent = NULL;
+            parent = tree->roots[level];
+            continue;
+        } else if (valid_node(child) && child->is_square && in_range(child, point)) {
+            grandparent = parent;
+            parent_quadrant = quadrant;
+            parent = child;
+            continue;
+        } else if (valid_node(child) && !child->is_square && Point_equals(&child->center, point)) {
+            Node_free_internal(new_node);
+            *added = false;
+            return child;
+        }
+
+        Node *replacement = new_node;
+        if (valid_node(child)) {
+            // Join the point and the node already in its quadrant under the smallest square
+            // separating them.
+            replacement = Node_init_level(parent->length, parent->center, level);
+            replacement->is_square = true;
+            uint8_t n_quadrant = quadrant, c_quadrant;
+            do {
+                replacement->center = get_new_center(replacement, n_quadrant);
+                replacement->length *= 0.5;
+                n_quadrant = get_quadrant(&replacement->center, point);
+                c_quadrant = get_quadrant(&replacement->center, &child->center);
+            } while (n_quadrant == c_quadrant);
+            replacement->children[n_quadrant] = new_node;
+            replacement->children[c_quadrant] = child;
+            if (valid_node(parent->down)) {
+                replacement->down = twin(tree, level - 1, parent->down, replacement);
+            }
+        }
+
+        if (CAS(parent->children[quadrant], child, replacement)) {
+            *added = true;
+            return new_node;
+        } else if (replacement != new_node) {
+            discard(replacement);
+        }
+    }
+}
+
+bool Quadtree_add(Quadtree * const node, const Point point) {
+    LockFreeQuadtree * const tree = (LockFreeQuadtree*)node;
+    if (!in_range(tree->roots[0], &point)) {
+        return false;
+    }
+
+    const uint64_t level = get_level(&point);
+    Node *starts[QUADTREE_LEVELS];
+    const bool exclusive = begin_operation();
+    locate(tree, &point, max(level, tree->tree.height), starts);
+
+    // The add takes effect on level 0; the levels above are added from the bottom up, so that
+    // every new square has a square to point down to.
+    bool added;
+    Node *below = add_level(tree, 0, &point, starts[0], NULL, &added);
+    if (!added) {
+        end_operation(exclusive);
+        return false;
+    }
+    uint64_t i;
+    for (i = 1; i <= level; i++) {
+        below = add_level(tree, i, &point, starts[i], below, &added);
+    }
+    end_operation(exclusive);
+
+    uint64_t height = tree->tree.height;
+    while (height < level && !CAS(tree->tree.height, height, level)) {
+        height = tree->tree.height;
+    }
+
+    return true;
+}
+
+/*
+ * remove_level
+ *
+ * Removes the point from one level, collapsing its parent if it is left with a single child.
+ *
+ * tree - the tree to remove from
+ * level - the level to remove from
+ * point - the point to remove
+ * start - the square on the level to start searching from
+ *
+ * Returns whether the point was on the level.
+ */
+static bool remove_level(LockFreeQuadtree * const tree, const uint64_t level,
+        const Point * const point, Node * const start) {
+    Node *grandparent = NULL, *parent = start;
+    uint8_t parent_quadrant = 0;
+    while (true) {
+        const uint8_t quadrant = get_quadrant(&parent->center, point);
+        Node * const child = load(parent->children[quadrant]);
+        if (marked(child)) {
+            if (valid_node(grandparent)) {
+                collapse(tree, level, grandparent, parent_quadrant, parent);
+            }
+            grandparent = NULL;
+            parent = tree->roots[level];
+            continue;
+        } else if (valid_node(child) && child->is_square && in_range(child, point)) {
+            grandparent = parent;
+            parent_quadrant = quadrant;
+            parent = child;
+            continue;
+        } else if (!valid_node(child) || child->is_square || !Point_equals(&child->center, point)) {
+            return false;
+        } else if (!CAS(parent->children[quadrant], child, NULL)) {
+            continue;
+        }
+        retire(child);
+
+        // Roots are never collapsed. The level was entered above the parent, so any other
+        // parent has a known grandparent.
+        if (valid_node(grandparent)) {
+            uint64_t i, nchildren = 0;
+            for (i = 0; i < (1LL << D); i++) {
+                nchildren += valid_node(unmark(load(parent->children[i])));
+            }
+            if (1 >= nchildren) {
+                collapse(tree, level, grandparent, parent_quadrant, parent);
+            }
+        }
+        return true;
+    }
+}
+
+bool Quadtree_remove(Quadtree * const node, const Point point) {
+    LockFreeQuadtree * const tree = (LockFreeQuadtree*)node;
+    if (!in_range(tree->roots[0], &point)) {
+        return false;
+    }
+
+    const uint64_t top = tree->tree.height;
+    Node *starts[QUADTREE_LEVELS];
+    const bool exclusive = begin_operation();
+    locate(tree, &point, top, starts);
+
+    // Remove from the top down; the remove takes effect on level 0.
+    int64_t i;
+    for (i = top; i > 0; i--) {
+        remove_level(tree, i, &point, starts[i]);
+    }
+    const bool removed = remove_level(tree, 0, &point, starts[0]);
+    end_operation(exclusive);
+    return removed;
+}
+
+void Quadtree_flush(Quadtree * const tree) {
+    // Updates are applied in place.
+}
+
+/*
+ * Quadtree_stats_internal
+ *
+ * Counts a square and every node below it on the same level. Marks are ignored, as in searches,
+ * so a square that is being collapsed is counted with the children it was frozen with.
+ *
+ * stats - the stats to count onto
+ * square - the square to count from
+ * bottom - whether the square is on the bottom level, whose points are the points of the tree
+ */
+static void Quadtree_stats_internal(QuadtreeStats * const stats, const Node * const square,
+        const bool bottom) {
+    uint64_t i;
+    for (i = 0; i < (1LL << D); i++) {
+        const Node * const child = unmark(load(square->children[i]));
+        if (!valid_node(child)) {
+            continue;
+        }
+        if (child->is_square) {
+            Quadtree_stats_internal(stats, child, bottom);
+        } else {
+            stats->nodes++;
+            stats->size += bottom;
+        }
+    }
+    stats->nodes++;
+}
+
+QuadtreeStats Quadtree_stats(const Quadtree * const node) {
+    const LockFreeQuadtree * const tree = (LockFreeQuadtree*)node;
+    QuadtreeStats stats = (QuadtreeStats){ .size = 0, .height = tree->tree.height, .nodes = 0 };
+
+    // Unlinked nodes are only kept from being freed while inside a critical section.
+    const bool exclusive = begin_operation();
+    uint64_t i;
+    for (i = 0; i < QUADTREE_LEVELS; i++) {
+        Quadtree_stats_internal(&stats, tree->roots[i], 0 == i);
+    }
+    end_operation(exclusive);
+    return stats;
+}
+
+/*
+ * Quadtree_free_internal
+ *
+ * result - the result object to record data onto
+ * node - the node to recursively free
+ */
+void Quadtree_free_internal(QuadtreeFreeResult * result, const Node * const node) {
+    uint64_t i;
+    bool is_leaf = true;
+    for (i = 0; i < (1LL << D); i++) {
+        const Node * const child = unmark(node->children[i]);
+        if (valid_node(child)) {
+            is_leaf = false;
+            Quadtree_free_internal(result, child);
+        }
+    }
+    // Squares unlinked but still pointed down to are retired once the squares above are freed.
+    if (node->is_square && valid_node(node->down)) {
+        release((Node*)node->down);
+    }
+    Node_free_internal(node);
+    result->total++;
+    result->leaf += is_leaf;
+}
+
+QuadtreeFreeResult Quadtree_free(Quadtree * const node) {
+    LockFreeQuadtree * const tree = (LockFreeQuadtree*)node;
+    QuadtreeFreeResult result = (QuadtreeFreeResult){ .total = 0, .leaf = 0, .levels = 0 };
+
+    // Levels are freed from the top down, so that every square is freed after those pointing down to
+    // it. Releasing them retires squares, which must be done inside a critical section.
+    Epoch_enter();
+    int64_t i;
+    for (i = QUADTREE_LEVELS - 1; i >= 0; i--) {
+        Quadtree_free_internal(&result, tree->roots[i]);
+        result.levels++;
+    }
+    Epoch_exit();
+
+    free(tree);
+
+    // Reclaim the nodes this thread unlinked, so that none are left over once the tree is gone.
+    Epoch_synchronize();
+
+    return result;
+}
@@ -0,0 +1,709 @@
+/**
+Sharded compressed skip quadtree with buffered (LSM-style) updates
+*/
+
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "../types.h"
+#include "../Quadtree.h"
+#include "../Point.h"
+
+// The base tree is the sharded implementation, with its entry points renamed so that they do not
+// clash with the buffered interface below. Buffers are kept per shard under the shard's lock, and
+// merges work on the shards directly. Quadtree_stats is the base tree's own, which counts only
+// what has been merged.
+#define Quadtree_init Base_init
+#define Quadtree_search Base_search
+#define Quadtree_add Base_add
+#define Quadtree_remove Base_remove
+#define Quadtree_flush Base_flush
+#define Quadtree_free Base_free
+#define Quadtree_shard_stats Base_shard_stats
+#define Quadtree_txn_commit Base_txn_commit
+#include "../d-shard/Quadtree.c"
+#undef Quadtree_init
+#undef Quadtree_search
+#undef Quadtree_add
+#undef Quadtree_remove
+#undef Quadtree_flush
+#undef Quadtree_free
+#undef Quadtree_shard_stats
+#undef Quadtree_txn_commit
+
+// Number of buffered updates to a shard that triggers a merge of the shard into the base tree.
+#ifndef LSM_BUFFER_SIZE
+#define LSM_BUFFER_SIZE 128
+#endif
+
+// Side length of the cells that the filters hash points by. Points equal up to PRECISION are in
+// the same cell or in neighboring ones, and the cells are wide enough that they rarely straddle two.
+#define LSM_CELL (64 * PRECISION)
+
+// Number of filter counters set by every point, and number of counters kept per point of a shard.
+#define LSM_FILTER_HASHES 3
+#define LSM_FILTER_RATIO 16
+
+// Number of counters a filter starts with.
+#define LSM_FILTER_MIN 1024
+
+// Number of squares a merge can descend through on one level, more than there are between the
+// side length of a shard and PRECISION.
+#define LSM_MAX_DEPTH 128
+
+/*
+ * struct BufferEntry_t
+ *
+ * A buffered update.
+ *
+ * point - the point being updated; for a removal, the point as the base tree holds it
+ * tombstone - true if the point was removed from the base tree, false if it was added
+ * cancelled - true if a later update to the point undid this one
+ */
+typedef struct BufferEntry_t {
+    Point point;
+    bool tombstone, cancelled;
+} BufferEntry;
+
+/*
+ * struct LsmShard_t
+ *
+ * The updates buffered for one shard of the base tree, guarded by the lock of the shard.
+ *
+ * The buffer is a log in arrival order, with cancelled entries left in place until the next merge.
+ * Lookups go through an index of the live entries sorted by buffer_compare, which holds at most
+ * one entry per point, so merges may apply the live entries in any order.
+ *
+ * Points not in the buffer are checked against a counting Bloom filter over the points merged into
+ * the shard, so that most updates and searches of points that the shard does not hold never search
+ * the shard itself. Every point of the shard has incremented the LSM_FILTER_HASHES counters its
+ * cell hashes to; counters that reach 255 stay there.
+ *
+ * used - the number of log entries, including cancelled ones
+ * size - the number of live entries, all of which are in sorted
+ * log - the buffered updates, in arrival order
+ * sorted - the indices into log of the live entries, sorted by point
+ * counters - the counters of the filter
+ * ncounters - the number of counters, a power of 2
+ */
+typedef struct LsmShard_t {
+    uint64_t used, size;
+    BufferEntry log[LSM_BUFFER_SIZE];
+    uint32_t sorted[LSM_BUFFER_SIZE];
+    uint8_t *counters;
+    uint64_t ncounters;
+} LsmShard;
+
+/*
+ * struct LsmQuadtree_t
+ *
+ * A base tree with a small buffer of updates per shard that have not yet been applied to it.
+ *
+ * base - the base tree, first so that a LsmQuadtree can be used as a Quadtree
+ * buffers - the buffer of each shard, in the order of the shards
+ */
+typedef struct LsmQuadtree_t {
+    ShardedQuadtree base;
+    LsmShard buffers[NSHARDS];
+} LsmQuadtree;
+
+Quadtree* Quadtree_init(const float64_t length, const Point center) {
+    LsmQuadtree * const tree = (LsmQuadtree*)sharded_init(sizeof(LsmQuadtree), length, center);
+    uint64_t i;
+    for (i = 0; i < NSHARDS; i++) {
+        LsmShard * const buffer = tree->buffers + i;
+        buffer->used = 0;
+        buffer->size = 0;
+        buffer->ncounters = LSM_FILTER_MIN;
+        buffer->counters = (uint8_t*)calloc(buffer->ncounters, sizeof(*buffer->counters));
+    }
+    return (Quadtree*)tree;
+}
+
+/*
+ * buffer_entry
+ *
+ * Returns the live entry at the given position of the sorted index.
+ */
+static inline BufferEntry* buffer_entry(const LsmShard * const buffer, const uint64_t index) {
+    return (BufferEntry*)buffer->log + buffer->sorted[index];
+}
+
+/*
+ * buffer_compare
+ *
+ * Orders points by their coordinates, highest dimension first, as Point_compare does, but returns
+ * 0 for points within PRECISION of each other in every dimension, so that the sorted index has a
+ * well-defined order and never holds two entries for the same point.
+ *
+ * Returns a value < 0 if a < b, 0 if a == b, and > 0 if a > b.
+ */
+static int8_t buffer_compare(const Point * const a, const Point * const b) {
+    uint64_t i;
+    for (i = D; i-- > 0;) {
+        if (fabs(a->data[i] - b->data[i]) > PRECISION) {
+            return a->data[i] > b->data[i] ? 1 : -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * buffer_find
+ *
+ * Binary searches the buffer for the point.
+ *
+ * buffer - the buffer to search
+ * point - the point to search for
+ *
+ * Returns the position in the sorted index of the entry for the point if there is one, or the
+ * position at which it would be inserted otherwise.
+ */
+static uint64_t buffer_find(const LsmShard * const buffer, const Point * const point) {
+    uint64_t low = 0, high = buffer->size;
+    while (low < high) {
+        const uint64_t mid = (low + high) / 2;
+        if (0 > buffer_compare(&buffer_entry(buffer, mid)->point, point)) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/*
+ * buffer_has
+ *
+ * Returns whether the position returned by buffer_find refers to an entry for the point.
+ */
+static inline bool buffer_has(const LsmShard * const buffer, const uint64_t index,
+        const Point * const point) {
+    return index < buffer->size && Point_equals(&buffer_entry(buffer, index)->point, point);
+}
+
+/*
+ * buffer_insert
+ *
+ * Appends an entry to the log and inserts it at the given position of the sorted index, which
+ * must come from buffer_find; the log must not be full.
+ */
+static void buffer_insert(LsmShard * const buffer, const uint64_t index, const Point * const point,
+        const bool tombstone) {
+    buffer->log[buffer->used] = (BufferEntry){
+        .point = *point,
+        .tombstone = tombstone,
+        .cancelled = false
+    };
+    memmove(buffer->sorted + index + 1, buffer->sorted + index,
+        sizeof(*buffer->sorted) * (buffer->size - index));
+    buffer->sorted[index] = buffer->used;
+    buffer->used++;
+    buffer->size++;
+}
+
+/*
+ * buffer_cancel
+ *
+ * Cancels the entry at the given position of the sorted index.
+ */
+static void buffer_cancel(LsmShard * const buffer, const uint64_t index) {
+    buffer_entry(buffer, index)->cancelled = true;
+    buffer->size--;
+    memmove(buffer->sorted + index, buffer->sorted + index + 1,
+        sizeof(*buffer->sorted) * (buffer->size - index));
+}
+
+/*
+ * filter_counter
+ *
+ * Returns the i-th counter that a cell with the given hash sets in the filter.
+ */
+static inline uint8_t* filter_counter(const LsmShard * const buffer, const uint64_t hash,
+        const uint64_t i) {
+    return buffer->counters + ((hash + i * ((hash >> 32) | 1)) & (buffer->ncounters - 1));
+}
+
+/*
+ * filter_hash
+ *
+ * Returns the hash of the cell with the given coordinates, in units of LSM_CELL.
+ */
+static uint64_t filter_hash(const int64_t * const cell) {
+    uint64_t hash = 0;
+    uint64_t i;
+    for (i = 0; i < D; i++) {
+        hash = (hash ^ (uint64_t)cell[i]) * 0x9E3779B97F4A7C15ULL;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+
+/*
+ * filter_cell
+ *
+ * Returns the coordinate of the cell holding a coordinate, in units of LSM_CELL.
+ */
+static inline int64_t filter_cell(const float64_t coordinate) {
+    const float64_t cells = coordinate / LSM_CELL;
+    const int64_t cell = (int64_t)cells;
+    return cell - (cells < cell);
+}
+
+/*
+ * filter_update
+ *
+ * Counts a point merged into the shard in the filter, or uncounts one removed from it.
+ *
+ * buffer - the buffer whose filter to update
+ * point - the point, as it is stored in the shard
+ * add - whether the point was merged in rather than removed
+ */
+static void filter_update(LsmShard * const buffer, const Point * const point, const bool add) {
+    int64_t cell[D];
+    uint64_t i;
+    for (i = 0; i < D; i++) {
+        cell[i] = filter_cell(point->data[i]);
+    }
+    const uint64_t hash = filter_hash(cell);
+    for (i = 0; i < LSM_FILTER_HASHES; i++) {
+        uint8_t * const counter = filter_counter(buffer, hash, i);
+        if (UINT8_MAX != *counter) {
+            *counter += (add ? 1 : -1);
+        }
+    }
+}
+
+/*
+ * filter_may_hold
+ *
+ * Checks the filter for the point. A point equal to it may be in a neighboring cell along every
+ * dimension where it lies close to the edge of its cell, so every such cell is checked.
+ *
+ * buffer - the buffer whose filter to check
+ * point - the point to check for
+ *
+ * Returns false if no point equal to it has been merged into the shard, and true if one may have.
+ */
+static bool filter_may_hold(const LsmShard * const buffer, const Point * const point) {
+    int64_t cell[D], neighbor[D];
+    uint64_t i, j;
+    for (i = 0; i < D; i++) {
+        cell[i] = filter_cell(point->data[i]);
+        const float64_t offset = point->data[i] - cell[i] * LSM_CELL;
+        neighbor[i] = (offset <= 2 * PRECISION ? -1 : (LSM_CELL - offset <= 2 * PRECISION ? 1 : 0));
+    }
+
+    uint64_t combination;
+    for (combination = 0; combination < (1ULL << D); combination++) {
+        int64_t candidate[D];
+        for (i = 0; i < D; i++) {
+            const bool moved = (combination >> i) & 1;
+            if (moved && 0 == neighbor[i]) {
+                break;
+            }
+            candidate[i] = cell[i] + (moved ? neighbor[i] : 0);
+        }
+        if (i < D) {
+            continue;
+        }
+
+        const uint64_t hash = filter_hash(candidate);
+        for (j = 0; j < LSM_FILTER_HASHES && 0 != *filter_counter(buffer, hash, j); j++);
+        if (LSM_FILTER_HASHES == j) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * filter_fill
+ *
+ * Counts every point below a square of the bottom level of a shard in the filter.
+ */
+static void filter_fill(LsmShard * const buffer, const Node * const square) {
+    uint64_t i;
+    for (i = 0; i < (1LL << D); i++) {
+        const Node * const child = square->children[i];
+        if (!valid_node(child)) {
+            continue;
+        } else if (child->is_square) {
+            filter_fill(buffer, child);
+        } else {
+            filter_update(buffer, &child->center, true);
+        }
+    }
+}
+
+/*
+ * filter_resize
+ *
+ * Rebuilds the filter of a shard with LSM_FILTER_RATIO counters for each of its points, once it has
+ * grown past twice that, so that false positives stay rare as the shard grows.
+ */
+static void filter_resize(const Shard * const shard, LsmShard * const buffer) {
+    if (LSM_FILTER_RATIO * shard->size <= 2 * buffer->ncounters) {
+        return;
+    }
+    while (buffer->ncounters < LSM_FILTER_RATIO * shard->size) {
+        buffer->ncounters *= 2;
+    }
+    free(buffer->counters);
+    buffer->counters = (uint8_t*)calloc(buffer->ncounters, sizeof(*buffer->counters));
+    filter_fill(buffer, shard->roots[0]);
+}
+
+/*
+ * quadrant_before
+ *
+ * Orders points by the order in which a traversal of the square's quadrants, in the order of
+ * get_quadrant, visits them, which is their Z-order within the square.
+ *
+ * square - the square holding both points
+ * a - the first point
+ * b - the second point
+ *
+ * Returns whether a comes strictly before b.
+ */
+static bool quadrant_before(const Node * const square, const Point * const a,
+        const Point * const b) {
+    Node box = *square;
+    while (box.length > PRECISION) {
+        const uint64_t a_quadrant = get_quadrant(&box.center, a);
+        const uint64_t b_quadrant = get_quadrant(&box.center, b);
+        if (a_quadrant != b_quadrant) {
+            return a_quadrant < b_quadrant;
+        }
+        box.center = get_new_center(&box, a_quadrant);
+        box.length *= 0.5;
+    }
+    return false;
+}
+
+/*
+ * struct Finger_t
+ *
+ * The squares leading from the root of one level of a shard to the square a merge last worked in,
+ * so that the next point, which is close to it in Z-order, is found by backing up only as far as
+ * the smallest of them that holds it.
+ *
+ * squares - squares[0] is the root of the level, and squares[i + 1] is a child of squares[i]
+ * quadrants - quadrants[i + 1] is the quadrant of squares[i] holding squares[i + 1]
+ * depth - the index of the last square
+ */
+typedef struct Finger_t {
+    Node *squares[LSM_MAX_DEPTH];
+    uint8_t quadrants[LSM_MAX_DEPTH];
+    uint64_t depth;
+} Finger;
+
+/*
+ * finger_move
+ *
+ * Moves a finger to the smallest square on its level holding the point.
+ *
+ * finger - the finger to move
+ * point - the point
+ *
+ * Returns the quadrant of that square holding the point.
+ */
+static uint8_t finger_move(Finger * const finger, const Point * const point) {
+    while (0 < finger->depth && !in_range(finger->squares[finger->depth], point)) {
+        finger->depth--;
+    }
+    while (true) {
+        const Node * const square = finger->squares[finger->depth];
+        const uint8_t quadrant = get_quadrant(&square->center, point);
+        Node * const child = square->children[quadrant];
+        if (!valid_node(child) || !child->is_square || !in_range(child, point)) {
+            return quadrant;
+        }
+        assert(finger->depth + 1 < LSM_MAX_DEPTH);
+        finger->depth++;
+        finger->squares[finger->depth] = child;
+        finger->quadrants[finger->depth] = quadrant;
+    }
+}
+
+/*
+ * remove_run
+ *
+ * Removes points from one level of a shard, in a single pass over them, collapsing every square
+ * left with a single child. Points not on the level are skipped.
+ *
+ * shard - the shard to remove from
+ * buffer - the buffer of the shard, whose filter uncounts the points removed from the bottom level
+ * level - the level to remove from
+ * points - the points to remove, in Z-order
+ * npoints - the number of points
+ */
+static void remove_run(Shard * const shard, LsmShard * const buffer, const uint64_t level,
+        const Point * const * const points, const uint64_t npoints) {
+    Finger finger;
+    finger.squares[0] = shard->roots[level];
+    finger.depth = 0;
+    uint64_t i, j;
+    for (i = 0; i < npoints; i++) {
+        const uint8_t quadrant = finger_move(&finger, points[i]);
+        Node * const parent = finger.squares[finger.depth];
+        Node * const child = parent->children[quadrant];
+        if (!valid_node(child) || child->is_square || !Point_equals(&child->center, points[i])) {
+            continue;
+        }
+
+        if (0 == level) {
+            filter_update(buffer, &child->center, false);
+            shard->size--;
+        }
+        Node_free_internal(child);
+        parent->children[quadrant] = NULL;
+
+        // Roots are never collapsed.
+        if (0 == finger.depth) {
+            continue;
+        }
+        Node *remaining = NULL;
+        uint64_t nchildren = 0;
+        for (j = 0; j < (1LL << D); j++) {
+            if (valid_node(parent->children[j])) {
+                remaining = parent->children[j];
+                nchildren++;
+            }
+        }
+        if (1 == nchildren) {
+            finger.squares[finger.depth - 1]->children[finger.quadrants[finger.depth]] = remaining;
+            Node_free_internal(parent);
+            finger.depth--;
+        }
+    }
+}
+
+/*
+ * add_run
+ *
+ * Adds points to one level of a shard, in a single pass over them. Points not on the level are
+ * skipped. Every point on the level must already be on the level below, and none may be in the
+ * shard yet.
+ *
+ * shard - the shard to add to
+ * buffer - the buffer of the shard, whose filter counts the points added to the bottom level
+ * level - the level to add to
+ * points - the points to add, in Z-order
+ * npoints - the number of points
+ * below - below[i] is the node for points[i] on the level below, NULL on level 0, and is set to
+ *     its node on this level
+ */
+static void add_run(Shard * const shard, LsmShard * const buffer, const uint64_t level,
+        const Point * const * const points, const uint64_t npoints, Node ** const below) {
+    Finger finger;
+    finger.squares[0] = shard->roots[level];
+    finger.depth = 0;
+    uint64_t i;
+    for (i = 0; i < npoints; i++) {
+        const Point * const point = points[i];
+        if (get_level(point) < level) {
+            continue;
+        }
+
+        const uint8_t quadrant = finger_move(&finger, point);
+        Node * const parent = finger.squares[finger.depth];
+        Node * const sibling = parent->children[quadrant];
+
+        Node * const new_node = Node_init_internal(0, *point);
+        new_node->down = below[i];
+        below[i] = new_node;
+        if (0 == level) {
+            filter_update(buffer, point, true);
+            shard->size++;
+        }
+
+        if (!valid_node(sibling)) {
+            parent->children[quadrant] = new_node;
+            continue;
+        }
+
+        // Compute the smallest square separating the point from its sibling.
+        Node * const new_square = Node_init_internal(parent->length, parent->center);
+        new_square->is_square = true;
+        uint8_t n_quadrant = quadrant, s_quadrant;
+        do {
+            new_square->center = get_new_center(new_square, n_quadrant);
+            new_square->length *= 0.5;
+            n_quadrant = get_quadrant(&new_square->center, point);
+            s_quadrant = get_quadrant(&new_square->center, &sibling->center);
+        } while (n_quadrant == s_quadrant);
+
+        // The same square exists on the level below, whose run has already been added.
+        if (valid_node(parent->down)) {
+            Node *down_square = parent->down;
+            while (down_square->length != new_square->length) {
+                down_square = down_square->children[get_quadrant(&down_square->center,
+                    &new_square->center)];
+            }
+            new_square->down = down_square;
+        }
+
+        new_square->children[n_quadrant] = new_node;
+        new_square->children[s_quadrant] = sibling;
+        parent->children[quadrant] = new_square;
+    }
+}
+
+/*
+ * merge
+ *
+ * Applies every live buffered update of a shard to it and empties the buffer. The shard must be
+ * locked for writing.
+ *
+ * No update needs to be checked against the shard, since every one was known to change it when it
+ * was buffered, and the buffer holds at most one update per point. Removes are applied before adds,
+ * level by level from the top down, and adds level by level from the bottom up, as single adds and
+ * removes are, so that every square pointed down to exists. Each level is merged in one pass over
+ * the updates in Z-order, which finds each point from the square of the point before it.
+ *
+ * shard - the shard to merge into
+ * buffer - the buffer of the shard
+ */
+static void merge(Shard * const shard, LsmShard * const buffer) {
+    const Point *adds[LSM_BUFFER_SIZE], *removes[LSM_BUFFER_SIZE];
+    Node *below[LSM_BUFFER_SIZE];
+    uint64_t nadds = 0, nremoves = 0, top = 0, i, j;
+
+    // Insertion sort of the live entries into Z-order, which is cheap for so few of them.
+    for (i = 0; i < buffer->size; i++) {
+        const BufferEntry * const entry = buffer_entry(buffer, i);
+        const Point ** const run = (entry->tombstone ? removes : adds);
+        uint64_t * const count = (entry->tombstone ? &nremoves : &nadds);
+        for (j = *count; 0 < j && quadrant_before(shard->roots[0], &entry->point, run[j - 1]); j--) {
+            run[j] = run[j - 1];
+        }
+        run[j] = &entry->point;
+        (*count)++;
+        if (!entry->tombstone) {
+            top = max(top, get_level(&entry->point));
+        }
+    }
+
+    int64_t level;
+    for (level = shard->height; level >= 0 && 0 < nremoves; level--) {
+        remove_run(shard, buffer, level, removes, nremoves);
+    }
+    for (i = 0; i < nadds; i++) {
+        below[i] = NULL;
+    }
+    for (level = 0; level <= (int64_t)top && 0 < nadds; level++) {
+        add_run(shard, buffer, level, adds, nadds, below);
+    }
+
+    shard->height = max(shard->height, (0 < nadds ? top : 0));
+    buffer->used = 0;
+    buffer->size = 0;
+    filter_resize(shard, buffer);
+}
+
+/*
+ * update
+ *
+ * Buffers an add or a remove of a point, unless it would not change the tree.
+ *
+ * tree - the tree to update
+ * point - the point to add or remove
+ * tombstone - true to remove the point, false to add it
+ *
+ * Returns whether the update changes the tree.
+ */
+static bool update(LsmQuadtree * const tree, const Point * const point, const bool tombstone) {
+    if (!in_range(tree->base.tree.root, point)) {
+        return false;
+    }
+
+    Shard * const shard = get_shard(&tree->base, point);
+    LsmShard * const buffer = tree->buffers + (shard - tree->base.shards);
+    const bool exclusive = shard_lock(shard, true);
+
+    bool changed;
+    uint64_t index = buffer_find(buffer, point);
+    if (buffer_has(buffer, index, point)) {
+        // The buffer holds the most recent update to the point, which an opposite update cancels.
+        changed = (buffer_entry(buffer, index)->tombstone != tombstone);
+        if (changed) {
+            buffer_cancel(buffer, index);
+        }
+    } else {
+        const Node * const found = (filter_may_hold(buffer, point) ? find(shard, point) : NULL);
+        changed = (valid_node(found) == tombstone);
+        // Adding a point the shard holds, or removing one it does not, changes nothing. A removal
+        // is buffered with the point as the shard holds it, which may differ from the point given
+        // by up to PRECISION, so that the merge finds it by the same path on every level.
+        if (changed) {
+            const Point stored = (tombstone ? found->center : *point);
+            if (LSM_BUFFER_SIZE == buffer->used) {
+                merge(shard, buffer);
+                index = 0;
+            }
+            buffer_insert(buffer, index, &stored, tombstone);
+        }
+    }
+
+    const uint64_t height = shard->height;
+    shard_unlock(shard, exclusive);
+    raise_height(&tree->base, height);
+    return changed;
+}
+
+bool Quadtree_search(const Quadtree * const node, const Point point) {
+    const LsmQuadtree * const tree = (LsmQuadtree*)node;
+    if (!in_range(tree->base.tree.root, &point)) {
+        return false;
+    }
+
+    Shard * const shard = get_shard(&tree->base, &point);
+    const LsmShard * const buffer = tree->buffers + (shard - tree->base.shards);
+    const bool exclusive = shard_lock(shard, false);
+
+    // The buffer holds the most recent update to a point, if there is one.
+    bool found;
+    const uint64_t index = buffer_find(buffer, &point);
+    if (buffer_has(buffer, index, &point)) {
+        found = !buffer_entry(buffer, index)->tombstone;
+    } else {
+        found = filter_may_hold(buffer, &point) && search(shard, &point);
+    }
+
+    shard_unlock(shard, exclusive);
+    return found;
+}
+
+bool Quadtree_add(Quadtree * const node, const Point point) {
+    return update((LsmQuadtree*)node, &point, false);
+}
+
+bool Quadtree_remove(Quadtree * const node, const Point point) {
+    return update((LsmQuadtree*)node, &point, true);
+}
+
+void Quadtree_flush(Quadtree * const node) {
+    LsmQuadtree * const tree = (LsmQuadtree*)node;
+    uint64_t i;
+    for (i = 0; i < NSHARDS; i++) {
+        Shard * const shard = tree->base.shards + i;
+        const bool exclusive = shard_lock(shard, true);
+        merge(shard, tree->buffers + i);
+        const uint64_t height = shard->height;
+        shard_unlock(shard, exclusive);
+        raise_height(&tree->base, height);
+    }
+}
+
+QuadtreeFreeResult Quadtree_free(Quadtree * const node) {
+    LsmQuadtree * const tree = (LsmQuadtree*)node;
+    uint64_t i;
+    for (i = 0; i < NSHARDS; i++) {
+        free(tree->buffers[i].counters);
+    }
+
+    // The buffers live in the same allocation as the base tree header.
+    return Base_free(node);
+}
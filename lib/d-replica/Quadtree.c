@@ -0,0 +1,404 @@
+/**
+Concurrent compressed skip quadtree whose top levels are replicated to every thread that searches it
+*/
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "../types.h"
+#include "../Quadtree.h"
+#include "../Point.h"
+
+// Number of levels replicated, counted down from the highest level in use; level 0 holds every
+// point and is never replicated.
+#ifndef QUADTREE_REPLICA_LEVELS
+#define QUADTREE_REPLICA_LEVELS 8
+#endif
+
+#if QUADTREE_REPLICA_LEVELS < 1
+#error "QUADTREE_REPLICA_LEVELS must be at least 1"
+#endif
+
+struct SeqQuadtree_t;
+static void Replica_level_changed(struct SeqQuadtree_t * const tree, const int64_t level);
+
+// The base tree is the seqlock implementation, which tells the replicas which levels its writers
+// change. Its entry points are renamed so that they do not clash with the interface below.
+#define level_changed Replica_level_changed
+#define Quadtree_init Base_init
+#define Quadtree_search Base_search
+#define Quadtree_add Base_add
+#define Quadtree_remove Base_remove
+#define Quadtree_flush Base_flush
+#define Quadtree_free Base_free
+#include "../d-seqlock/Quadtree.c"
+#undef Quadtree_init
+#undef Quadtree_search
+#undef Quadtree_add
+#undef Quadtree_remove
+#undef Quadtree_flush
+#undef Quadtree_free
+
+/*
+ * struct LevelVersion_t
+ *
+ * The version of a level, which grows every time a writer changes the level. Versions take a cache
+ * line each, so that writers on the busy lower levels do not disturb readers of the upper ones.
+ *
+ * version - the version of the level
+ */
+typedef struct LevelVersion_t {
+    volatile uint64_t version;
+} __attribute__((aligned(64))) LevelVersion;
+
+/*
+ * struct Replica_t
+ *
+ * A private copy of the top levels of a tree, used by one thread. The copied squares on the lowest
+ * replicated level point down to the squares of the tree itself, where descents carry on.
+ *
+ * owner - the thread using the replica
+ * height - the highest level in use when the replica was copied
+ * low - the lowest replicated level; no level is replicated if it is above height
+ * versions - the version of each replicated level when it was copied
+ * roots - the copy of the root of each replicated level, and NULL on every other level
+ * next - the next replica of the same tree
+ */
+typedef struct Replica_t Replica;
+struct Replica_t {
+    pthread_t owner;
+    uint64_t height, low;
+    uint64_t versions[QUADTREE_LEVELS];
+    Node *roots[QUADTREE_LEVELS];
+    Replica *next;
+};
+
+/*
+ * struct ReplicaQuadtree_t
+ *
+ * A seqlock tree whose top levels, which change far less often than they are read, are copied by
+ * every thread that searches the tree, so that descents start in memory local to the thread instead
+ * of in the squares every other thread descends through. A replica is copied again whenever a
+ * writer changes one of the levels it holds, or the tree grows.
+ *
+ * tree - the base tree, first so that a ReplicaQuadtree can be used as a Quadtree
+ * id - the tree's number among every tree created so far
+ * replicas - the replicas of the tree
+ * levels - the version of each level
+ */
+typedef struct ReplicaQuadtree_t {
+    SeqQuadtree tree;
+    uint64_t id;
+    Replica *replicas;
+    LevelVersion *levels;
+} ReplicaQuadtree;
+
+// Every tree created so far, and the replica this thread uses of the last tree it searched.
+static uint64_t replica_trees = 0;
+static __thread uint64_t replica_tree = UINT64_MAX;
+static __thread Replica *replica_self = NULL;
+
+static void Replica_level_changed(struct SeqQuadtree_t * const tree, const int64_t level) {
+    // Level 0 is never replicated.
+    if (level > 0) {
+        __sync_fetch_and_add(&((ReplicaQuadtree*)tree)->levels[level].version, 1);
+    }
+}
+
+Quadtree* Quadtree_init(const float64_t length, const Point center) {
+    ReplicaQuadtree * const tree =
+        (ReplicaQuadtree*)realloc(Base_init(length, center), sizeof(*tree));
+    tree->id = __sync_fetch_and_add(&replica_trees, 1);
+    tree->replicas = NULL;
+    if (0 != posix_memalign((void**)&tree->levels, sizeof(*tree->levels),
+            sizeof(*tree->levels) * QUADTREE_LEVELS)) {
+        Base_free((Quadtree*)tree);
+        return NULL;
+    }
+    uint64_t i;
+    for (i = 0; i < QUADTREE_LEVELS; i++) {
+        tree->levels[i].version = 0;
+    }
+    return (Quadtree*)tree;
+}
+
+/*
+ * Replica_free_internal
+ *
+ * Frees a copied node and every copied node below it on its level.
+ *
+ * node - the node to free, which may be NULL
+ */
+static void Replica_free_internal(Node * const node) {
+    if (!valid_node(node)) {
+        return;
+    }
+    uint64_t i;
+    for (i = 0; i < (1LL << D); i++) {
+        Replica_free_internal(node->children[i]);
+    }
+    free(node);
+}
+
+/*
+ * Replica_clear
+ *
+ * Frees every copied level of a replica.
+ */
+static void Replica_clear(Replica * const replica) {
+    uint64_t l;
+    for (l = 0; l < QUADTREE_LEVELS; l++) {
+        Replica_free_internal(replica->roots[l]);
+        replica->roots[l] = NULL;
+    }
+}
+
+/*
+ * copy_node
+ *
+ * Copies a square of the tree and everything below it on its level, as it was at some instant.
+ *
+ * square - the square to copy
+ * below - the copy of the level below, or NULL if the square is on the lowest replicated level, in
+ *     which case the copy points down to the square's own twin
+ * copy - set to the copy, which holds whatever was copied even if the copy fails
+ *
+ * Returns false if a writer got in the way and the copy must start over.
+ */
+static bool copy_node(const Node * const square, const Node * const below, Node ** const copy) {
+    Node * const new_square = (Node*)malloc(sizeof(*new_square));
+    *new_square = (Node){
+        .is_square = true,
+        .length = square->length,
+        .center = square->center,
+        .down = square->down
+    };
+    uint64_t i, j;
+    for (i = 0; i < (1LL << D); i++) {
+        new_square->children[i] = NULL;
+    }
+    *copy = new_square;
+
+    uint64_t version;
+    if (!read_version(square, &version)) {
+        return false;
+    }
+    for (i = 0; i < (1LL << D); i++) {
+        const Node * const child = load(square->children[i]);
+        if (!valid_node(child)) {
+            continue;
+        } else if (child->is_square) {
+            if (!copy_node(child, below, new_square->children + i)) {
+                return false;
+            }
+        } else {
+            Node * const new_point = (Node*)malloc(sizeof(*new_point));
+            *new_point = (Node){
+                .is_square = false,
+                .length = 0,
+                .center = child->center,
+                .down = NULL
+            };
+            for (j = 0; j < (1LL << D); j++) {
+                new_point->children[j] = NULL;
+            }
+            new_square->children[i] = new_point;
+        }
+    }
+    if (!validate(square, version)) {
+        return false;
+    }
+
+    // Above the lowest replicated level, point down to the copy of the twin instead.
+    if (NULL != below) {
+        const Node *twin = below;
+        while (valid_node(twin) && twin->is_square &&
+                !same_square(twin, square->length, &square->center)) {
+            twin = twin->children[get_quadrant(&twin->center, &square->center)];
+        }
+        if (!valid_node(twin) || !twin->is_square) {
+            return false;
+        }
+        new_square->down = (Node*)twin;
+    }
+    return true;
+}
+
+/*
+ * current
+ *
+ * Returns whether the replica still matches the tree: no replicated level has changed, and the tree
+ * has not grown, since it was copied.
+ */
+static bool current(const ReplicaQuadtree * const tree, const Replica * const replica) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (tree->tree.tree.height != replica->height) {
+        return false;
+    }
+    uint64_t l;
+    for (l = replica->low; l <= replica->height; l++) {
+        if (tree->levels[l].version != replica->versions[l]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * refresh
+ *
+ * Copies the top levels of the tree into the replica again, unless it still matches the tree.
+ *
+ * tree - the tree the replica is of
+ * replica - the replica to refresh
+ */
+static void refresh(ReplicaQuadtree * const tree, Replica * const replica) {
+    while (!current(tree, replica)) {
+        Replica_clear(replica);
+        const uint64_t height = __atomic_load_n(&tree->tree.tree.height, __ATOMIC_ACQUIRE);
+        const uint64_t low = (height >= QUADTREE_REPLICA_LEVELS ?
+            height - QUADTREE_REPLICA_LEVELS + 1 : 1);
+        replica->height = height;
+        replica->low = low;
+
+        // Writers change the versions of their levels before they release their squares, so a copy
+        // that saw any of a change sees the version change once it is done.
+        uint64_t l;
+        for (l = low; l <= height; l++) {
+            replica->versions[l] = __atomic_load_n(&tree->levels[l].version, __ATOMIC_ACQUIRE);
+        }
+        bool copied = true;
+        for (l = low; copied && l <= height; l++) {
+            copied = copy_node(tree->tree.roots[l], l == low ? NULL : replica->roots[l - 1],
+                replica->roots + l);
+        }
+        if (!copied) {
+            replica->height = UINT64_MAX;
+        }
+    }
+}
+
+/*
+ * get_replica
+ *
+ * Returns the replica of the tree used by the calling thread, creating it if the thread has not
+ * searched the tree before.
+ */
+static Replica* get_replica(ReplicaQuadtree * const tree) {
+    if (replica_tree == tree->id) {
+        return replica_self;
+    }
+
+    const pthread_t self = pthread_self();
+    Replica *replica;
+    for (replica = tree->replicas; NULL != replica; replica = replica->next) {
+        if (pthread_equal(replica->owner, self)) {
+            break;
+        }
+    }
+    if (NULL == replica) {
+        replica = (Replica*)malloc(sizeof(*replica));
+        replica->owner = self;
+        replica->height = UINT64_MAX;
+        replica->low = 0;
+        uint64_t l;
+        for (l = 0; l < QUADTREE_LEVELS; l++) {
+            replica->roots[l] = NULL;
+        }
+        do {
+            replica->next = tree->replicas;
+        } while (!__sync_bool_compare_and_swap(&tree->replicas, replica->next, replica));
+    }
+
+    replica_tree = tree->id;
+    replica_self = replica;
+    return replica;
+}
+
+/*
+ * search_replica
+ *
+ * Descends the replicated levels towards the point.
+ *
+ * replica - the replica to descend, which has at least one level
+ * point - the point to search for
+ * found - set to true if the point is on a replicated level
+ *
+ * Returns the square of the tree to carry on from, or NULL if the point was found.
+ */
+static const Node* search_replica(const Replica * const replica, const Point * const point,
+        bool * const found) {
+    const Node *square = replica->roots[replica->height];
+    uint64_t level = replica->height;
+    while (true) {
+        const Node * const child = square->children[get_quadrant(&square->center, point)];
+        if (valid_node(child) && child->is_square && in_range(child, point)) {
+            square = child;
+            continue;
+        } else if (valid_node(child) && !child->is_square && Point_equals(&child->center, point)) {
+            *found = true;
+            return NULL;
+        }
+
+        if (level == replica->low) {
+            return square->down;
+        }
+        square = square->down;
+        level--;
+    }
+}
+
+bool Quadtree_search(const Quadtree * const node, const Point point) {
+    ReplicaQuadtree * const tree = (ReplicaQuadtree*)node;
+    if (!in_range(tree->tree.roots[0], &point)) {
+        return false;
+    }
+
+    // The squares the replica points down to, and the ones copied, are only kept from being freed
+    // while inside a critical section, or an exclusive section.
+    Replica * const replica = get_replica(tree);
+    bool found = false;
+    const bool exclusive = begin_operation();
+    while (true) {
+        refresh(tree, replica);
+        if (replica->low > replica->height) {
+            found = Base_search(node, point);
+            break;
+        }
+
+        // The square the descent carries on from is the twin of a replicated square, so it stays in
+        // the tree for as long as the replicated level does not change.
+        found = false;
+        const Node * const square = search_replica(replica, &point, &found);
+        if ((NULL == square || search(square, &point, &found)) && current(tree, replica)) {
+            break;
+        }
+    }
+    end_operation(exclusive);
+    return found;
+}
+
+bool Quadtree_add(Quadtree * const tree, const Point point) {
+    return Base_add(tree, point);
+}
+
+bool Quadtree_remove(Quadtree * const tree, const Point point) {
+    return Base_remove(tree, point);
+}
+
+void Quadtree_flush(Quadtree * const tree) {
+    Base_flush(tree);
+}
+
+QuadtreeFreeResult Quadtree_free(Quadtree * const node) {
+    ReplicaQuadtree * const tree = (ReplicaQuadtree*)node;
+    while (NULL != tree->replicas) {
+        Replica * const replica = tree->replicas;
+        tree->replicas = replica->next;
+        Replica_clear(replica);
+        free(replica);
+    }
+    free(tree->levels);
+    return Base_free(node);
+}
@@ -0,0 +1,625 @@
+/**
+Concurrent compressed skip quadtree synchronized with read-log-update (RLU)
+*/
+
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "../types.h"
+#include "../Quadtree.h"
+#include "../Point.h"
+
+// rlu_self, set up with RLU_THREAD_INIT by every thread that uses the tree
+__thread rlu_thread_data_t *rlu_self = NULL;
+
+// quadtree counter
+#ifdef QUADTREE_TEST
+uint64_t QUADTREE_NODE_COUNT = 0;
+#endif
+
+#define valid_node(n) Node_valid((Node*)(n))
+
+// The version of n visible to the current RLU section: the thread's own copy if it locked n, a
+// committed copy if one is visible to the section, and n itself otherwise.
+#define deref(n) ((Node*)RLU_DEREF(rlu_self, (n)))
+
+/*
+ * struct RluQuadtree_t
+ *
+ * A quadtree whose levels are fixed in advance. A point appears on every level up to
+ * get_level(point), so no skip lists need to be rebalanced and an update only touches the squares
+ * on its own path, which is what lets disjoint updates proceed in parallel.
+ *
+ * tree - the header, first so that a RluQuadtree can be used as a Quadtree; tree.root is the root
+ *     of the top level, and tree.height is the highest level that a point has been added to
+ * roots - the root square of each level, which spans the whole tree and is never collapsed
+ */
+typedef struct RluQuadtree_t {
+    Quadtree tree;
+    Node *roots[QUADTREE_LEVELS];
+} RluQuadtree;
+
+/*
+ * struct Path_t
+ *
+ * The squares leading to a point on each level, from the top level searched down to level 0.
+ *
+ * parents - parents[k] is the smallest square on level k containing the point
+ * grandparents - grandparents[k] is the square holding parents[k], or NULL for a root
+ * quadrants - quadrants[k] is the quadrant of parents[k] containing the point
+ * parent_quadrants - parent_quadrants[k] is the quadrant of grandparents[k] holding parents[k]
+ */
+typedef struct Path_t {
+    Node *parents[QUADTREE_LEVELS], *grandparents[QUADTREE_LEVELS];
+    uint8_t quadrants[QUADTREE_LEVELS], parent_quadrants[QUADTREE_LEVELS];
+} Path;
+
+/*
+ * Node_init_level
+ *
+ * Creates a node on the given level of the tree, whose memory may be placed differently from that
+ * of lower levels (see node_alloc).
+ *
+ * length - the side length of the node
+ * center - the center of the node
+ * level - the level of the node
+ *
+ * Returns the node.
+ */
+static Node* Node_init_level(const float64_t length, const Point center, const uint64_t level) {
+    Node *node = (Node*)RLU_ALLOC_LEVEL(sizeof(*node), level);
+    *node = (Node){
+        .is_square = false,
+        .length = length,
+        .center = center,
+        .down = NULL
+#ifdef QUADTREE_TEST
+        ,.id = QUADTREE_NODE_COUNT++
+#endif
+    };
+    uint64_t i;
+    for (i = 0; i < (1LL << D); i++) {
+        node->children[i] = NULL;
+    }
+    return node;
+}
+
+Node* Node_init(const float64_t length, const Point center) {
+    return Node_init_level(length, center, 0);
+}
+
+/*
+ * Node_free_internal
+ *
+ * Frees the memory used to represent this node immediately, inlined for internal use. Only nodes
+ * that no other thread can reach may be freed this way.
+ *
+ * node - the node to be freed
+ */
+static inline void Node_free_internal(const Node * const node) {
+    RLU_FREE(NULL, node);
+}
+
+void Node_free(const Node * const node) {
+    Node_free_internal(node);
+}
+
+Quadtree* Quadtree_init(const float64_t length, const Point center) {
+    RluQuadtree *tree = (RluQuadtree*)malloc(sizeof(*tree));
+    uint64_t i;
+    for (i = 0; i < QUADTREE_LEVELS; i++) {
+        tree->roots[i] = Node_init_level(length, center, i);
+        tree->roots[i]->is_square = true;
+        tree->roots[i]->down = (0 == i ? NULL : tree->roots[i - 1]);
+    }
+    tree->tree = (Quadtree){
+        .height = 0,
+        .root = tree->roots[QUADTREE_LEVELS - 1],
+        .center = center,
+        .length = length
+    };
+    return (Quadtree*)tree;
+}
+
+/*
+ * locate
+ *
+ * Finds the squares leading to the point on every level from top down to 0, inside an RLU
+ * section. Each level is entered at the copy of the grandparent found on the level above, so that
+ * the grandparent of every non-root parent is known.
+ *
+ * tree - the tree to search
+ * point - the point to search for, must be within the bounds of the tree
+ * top - the level to start searching at
+ * path - filled with the squares leading to the point on levels [0, top]
+ *
+ * Returns the highest level containing the point, or -1 if the point is not in the tree.
+ */
+static int64_t locate(const RluQuadtree * const tree, const Point * const point,
+        const uint64_t top, Path * const path) {
+    int64_t found = -1, level;
+    Node *start = tree->roots[top];
+    for (level = top; level >= 0; level--) {
+        Node *grandparent = NULL, *parent = start, *child = NULL;
+        uint8_t quadrant = 0, parent_quadrant = 0;
+        while (true) {
+            const Node * const square = deref(parent);
+            quadrant = get_quadrant(&square->center, point);
+            child = square->children[quadrant];
+            if (!valid_node(child) || !deref(child)->is_square || !in_range(deref(child), point)) {
+                break;
+            }
+            grandparent = parent;
+            parent_quadrant = quadrant;
+            parent = child;
+        }
+
+        path->parents[level] = parent;
+        path->grandparents[level] = grandparent;
+        path->quadrants[level] = quadrant;
+        path->parent_quadrants[level] = parent_quadrant;
+
+        if (0 > found && valid_node(child) && !deref(child)->is_square &&
+                Point_equals(&deref(child)->center, point)) {
+            found = level;
+        }
+
+        start = deref(valid_node(grandparent) ? grandparent : parent)->down;
+    }
+    return found;
+}
+
+bool Quadtree_search(const Quadtree * const node, const Point point) {
+    const RluQuadtree * const tree = (RluQuadtree*)node;
+    if (!in_range(tree->roots[0], &point)) {
+        return false;
+    }
+
+    RLU_READER_LOCK(rlu_self);
+
+    // Descend each level as far as it goes, then drop to the same square on the level below.
+    bool found = false;
+    const Node *square = deref(tree->roots[tree->tree.height]);
+    while (true) {
+        const Node * const child = deref(square->children[get_quadrant(&square->center, &point)]);
+        if (!valid_node(child)) {
+            // Fall through to the level below.
+        } else if (child->is_square && in_range(child, &point)) {
+            square = child;
+            continue;
+        } else if (!child->is_square && Point_equals(&child->center, &point)) {
+            found = true;
+            break;
+        }
+
+        if (!valid_node(square->down)) {
+            break;
+        }
+        square = deref(square->down);
+    }
+
+    RLU_READER_UNLOCK(rlu_self);
+
+    return found;
+}
+
+/*
+ * add_level
+ *
+ * Adds the point to one level, inside an RLU section, as the child of path->parents[level] or of
+ * a new square joining it with the node already in its quadrant. The point must already be on
+ * every level below.
+ *
+ * path - the squares leading to the point, as filled by locate
+ * level - the level to add to
+ * point - the point to add
+ * below - the node for the point on the level below, NULL on level 0
+ * fresh - nodes allocated by the add, appended to so that they can be freed if the section aborts
+ * nfresh - the number of nodes in fresh
+ *
+ * Returns the new node for the point, or NULL if a lock could not be taken.
+ */
+static Node* add_level(const Path * const path, const uint64_t level, const Point * const point,
+        Node * const below, Node ** const fresh, uint64_t * const nfresh) {
+    Node *parent = path->parents[level];
+    if (!RLU_TRY_LOCK(rlu_self, &parent)) {
+        CONTENTION_RECORD(level, deref(parent));
+        return NULL;
+    }
+
+    const uint8_t quadrant = path->quadrants[level];
+    Node * const sibling = parent->children[quadrant];
+
+    Node * const new_node = Node_init_level(0, *point, level);
+    new_node->down = below;
+    fresh[(*nfresh)++] = new_node;
+
+    if (!valid_node(sibling)) {
+        parent->children[quadrant] = new_node;
+        return new_node;
+    }
+
+    // Compute the smallest square separating the point from its sibling.
+    Node * const new_square = Node_init_level(parent->length, parent->center, level);
+    new_square->is_square = true;
+    fresh[(*nfresh)++] = new_square;
+    const Point * const sibling_center = &deref(sibling)->center;
+    uint8_t n_quadrant = quadrant, s_quadrant;
+    do {
+        new_square->center = get_new_center(new_square, n_quadrant);
+        new_square->length *= 0.5;
+        n_quadrant = get_quadrant(&new_square->center, point);
+        s_quadrant = get_quadrant(&new_square->center, sibling_center);
+    } while (n_quadrant == s_quadrant);
+
+    // The same square exists on the level below, since both of its children are there. Locking it
+    // keeps a concurrent remove from collapsing it while the new square points down to it.
+    if (valid_node(parent->down)) {
+        Node *down_square = parent->down;
+        while (fabs(deref(down_square)->length - new_square->length) > PRECISION ||
+                !Point_equals(&deref(down_square)->center, &new_square->center)) {
+            const Node * const square = deref(down_square);
+            down_square = square->children[get_quadrant(&square->center, &new_square->center)];
+        }
+        new_square->down = down_square;
+        if (!RLU_TRY_LOCK(rlu_self, &down_square)) {
+            CONTENTION_RECORD(level - 1, deref(down_square));
+            return NULL;
+        }
+    }
+
+    new_square->children[n_quadrant] = new_node;
+    new_square->children[s_quadrant] = sibling;
+    parent->children[quadrant] = new_square;
+    return new_node;
+}
+
+/*
+ * add_point
+ *
+ * Adds the point to every level up to its own, inside an RLU section.
+ *
+ * tree - the tree to add to
+ * point - the point to add, which must be within the bounds of the tree
+ * top - the highest level a point has been added to, as seen by the section
+ * fresh - nodes allocated by the add, appended to so that they can be freed if the section aborts
+ * nfresh - the number of nodes in fresh
+ *
+ * Returns 1 if the point was added, 0 if it was already in the tree, and -1 if a lock could not be
+ * taken, in which case the section must abort.
+ */
+static int8_t add_point(const RluQuadtree * const tree, const Point * const point,
+        const uint64_t top, Node ** const fresh, uint64_t * const nfresh) {
+    const uint64_t level = get_level(point);
+    Path path;
+    if (0 <= locate(tree, point, max(level, top), &path)) {
+        return 0;
+    }
+
+    // Add from the bottom up, so that every new square has a square to point down to.
+    uint64_t i;
+    Node *below = NULL;
+    for (i = 0; i <= level; i++) {
+        below = add_level(&path, i, point, below, fresh, nfresh);
+        if (NULL == below) {
+            return -1;
+        }
+    }
+    return 1;
+}
+
+/*
+ * raise_height
+ *
+ * Raises the height of the tree to the level, unless it is already as high.
+ */
+static inline void raise_height(RluQuadtree * const tree, const uint64_t level) {
+    uint64_t height = tree->tree.height;
+    while (height < level && !__sync_bool_compare_and_swap(&tree->tree.height, height, level)) {
+        height = tree->tree.height;
+    }
+}
+
+bool Quadtree_add(Quadtree * const node, const Point point) {
+    RluQuadtree * const tree = (RluQuadtree*)node;
+    if (!in_range(tree->roots[0], &point)) {
+        return false;
+    }
+
+    Node *fresh[2 * QUADTREE_LEVELS];
+    while (true) {
+        RLU_READER_LOCK(rlu_self);
+
+        uint64_t nfresh = 0, i;
+        const int8_t added = add_point(tree, &point, tree->tree.height, fresh, &nfresh);
+        if (0 == added) {
+            RLU_READER_UNLOCK(rlu_self);
+            return false;
+        } else if (0 < added) {
+            break;
+        }
+
+        // Nothing allocated by the aborted attempt was published, so it can be freed right away.
+        RLU_ABORT(rlu_self);
+        for (i = 0; i < nfresh; i++) {
+            Node_free_internal(fresh[i]);
+        }
+    }
+
+    raise_height(tree, get_level(&point));
+
+    RLU_READER_UNLOCK(rlu_self);
+
+    return true;
+}
+
+/*
+ * remove_level
+ *
+ * Removes the point from one level, inside an RLU section, collapsing its parent into the
+ * grandparent if the parent is left with a single child. The point must not be on any level above.
+ *
+ * path - the squares leading to the point, as filled by locate
+ * level - the level to remove from
+ * garbage - nodes unlinked by the remove, appended to so that they are only freed once every lock
+ *     has been taken
+ * ngarbage - the number of nodes in garbage
+ *
+ * Returns whether the locks could be taken.
+ */
+static bool remove_level(const Path * const path, const uint64_t level, Node ** const garbage,
+        uint64_t * const ngarbage) {
+    Node *parent = path->parents[level];
+    if (!RLU_TRY_LOCK(rlu_self, &parent)) {
+        CONTENTION_RECORD(level, deref(parent));
+        return false;
+    }
+
+    const uint8_t quadrant = path->quadrants[level];
+    garbage[(*ngarbage)++] = parent->children[quadrant];
+    parent->children[quadrant] = NULL;
+
+    // Roots are never collapsed.
+    Node *grandparent = path->grandparents[level];
+    if (!valid_node(grandparent)) {
+        return true;
+    }
+
+    Node *remaining = NULL;
+    uint64_t i;
+    for (i = 0; i < (1LL << D); i++) {
+        if (!valid_node(parent->children[i])) {
+            continue;
+        } else if (valid_node(remaining)) {
+            return true;
+        }
+        remaining = parent->children[i];
+    }
+
+    if (!RLU_TRY_LOCK(rlu_self, &grandparent)) {
+        CONTENTION_RECORD(level, deref(grandparent));
+        return false;
+    }
+    grandparent->children[path->parent_quadrants[level]] = remaining;
+    garbage[(*ngarbage)++] = path->parents[level];
+    return true;
+}
+
+/*
+ * remove_point
+ *
+ * Removes the point from every level it is on, inside an RLU section.
+ *
+ * tree - the tree to remove from
+ * point - the point to remove, which must be within the bounds of the tree
+ * top - the highest level a point has been added to, as seen by the section
+ * garbage - nodes unlinked by the remove, appended to so that they are only freed once the section
+ *     can no longer abort
+ * ngarbage - the number of nodes in garbage
+ *
+ * Returns 1 if the point was removed, 0 if it was not in the tree, and -1 if a lock could not be
+ * taken, in which case the section must abort.
+ */
+static int8_t remove_point(const RluQuadtree * const tree, const Point * const point,
+        const uint64_t top, Node ** const garbage, uint64_t * const ngarbage) {
+    // The point's own coordinates fix its level, but a point equal to it up to precision error
+    // may hash differently, so the level is the highest one the point was found on.
+    Path path;
+    const int64_t found = locate(tree, point, top, &path);
+    if (0 > found) {
+        return 0;
+    }
+
+    // Remove from the top down, so that no square that is pointed down to is collapsed.
+    int64_t i;
+    for (i = found; i >= 0; i--) {
+        if (!remove_level(&path, i, garbage, ngarbage)) {
+            return -1;
+        }
+    }
+    return 1;
+}
+
+bool Quadtree_remove(Quadtree * const node, const Point point) {
+    RluQuadtree * const tree = (RluQuadtree*)node;
+    if (!in_range(tree->roots[0], &point)) {
+        return false;
+    }
+
+    Node *garbage[2 * QUADTREE_LEVELS];
+    uint64_t ngarbage;
+    while (true) {
+        RLU_READER_LOCK(rlu_self);
+
+        ngarbage = 0;
+        const int8_t removed = remove_point(tree, &point, tree->tree.height, garbage, &ngarbage);
+        if (0 == removed) {
+            RLU_READER_UNLOCK(rlu_self);
+            return false;
+        } else if (0 < removed) {
+            break;
+        }
+
+        RLU_ABORT(rlu_self);
+    }
+
+    // Unlinked nodes are reclaimed once every section that might still see them has finished.
+    uint64_t i;
+    for (i = 0; i < ngarbage; i++) {
+        RLU_FREE(rlu_self, garbage[i]);
+    }
+
+    RLU_READER_UNLOCK(rlu_self);
+
+    return true;
+}
+
+uint64_t Quadtree_txn_commit(QuadtreeTxn * const txn) {
+    RluQuadtree * const tree = (RluQuadtree*)txn->tree;
+
+    // Every update runs in the same section, so its changes are only seen by other sections once
+    // the whole section commits, and a lock that cannot be taken aborts and retries all of them.
+    // Later updates see the copies locked by earlier ones.
+    const uint64_t capacity = 2 * QUADTREE_LEVELS * max(txn->size, 1);
+    Node ** const fresh = (Node**)malloc(sizeof(*fresh) * capacity);
+    Node ** const garbage = (Node**)malloc(sizeof(*garbage) * capacity);
+    uint64_t nfresh, ngarbage, height, applied, i;
+    while (true) {
+        RLU_READER_LOCK(rlu_self);
+
+        nfresh = 0;
+        ngarbage = 0;
+        applied = 0;
+        height = tree->tree.height;
+        int8_t result = 0;
+        for (i = 0; i < txn->size && 0 <= result; i++) {
+            QuadtreeReply * const update = txn->updates + i;
+            result = 0;
+            if (!in_range(tree->roots[0], &update->point)) {
+                // Out of bounds, so the update changes nothing.
+            } else if (QUADTREE_ADD == update->operation) {
+                result = add_point(tree, &update->point, height, fresh, &nfresh);
+                if (0 < result) {
+                    height = max(height, get_level(&update->point));
+                }
+            } else {
+                result = remove_point(tree, &update->point, height, garbage, &ngarbage);
+            }
+            update->result = (0 < result);
+            applied += update->result;
+        }
+        if (0 <= result) {
+            break;
+        }
+
+        // Nodes added by earlier updates were only linked from copies or from each other, so
+        // nothing allocated by the aborted attempt was published.
+        RLU_ABORT(rlu_self);
+        for (i = 0; i < nfresh; i++) {
+            Node_free_internal(fresh[i]);
+        }
+    }
+
+    raise_height(tree, height);
+
+    for (i = 0; i < ngarbage; i++) {
+        RLU_FREE(rlu_self, garbage[i]);
+    }
+
+    RLU_READER_UNLOCK(rlu_self);
+
+    free(fresh);
+    free(garbage);
+    free(txn->updates);
+    free(txn);
+    return applied;
+}
+
+void Quadtree_flush(Quadtree * const tree) {
+    // Write back the write sets this thread has deferred; other threads write theirs back in
+    // RLU_THREAD_FINISH.
+    if (NULL != rlu_self) {
+        rlu_force_sync(rlu_self);
+    }
+}
+
+/*
+ * Quadtree_stats_internal
+ *
+ * Counts a square and every node below it on the same level, inside an RLU section.
+ *
+ * stats - the stats to count onto
+ * square - the square to count from
+ * bottom - whether the square is on the bottom level, whose points are the points of the tree
+ */
+static void Quadtree_stats_internal(QuadtreeStats * const stats, const Node * const square,
+        const bool bottom) {
+    uint64_t i;
+    for (i = 0; i < (1LL << D); i++) {
+        const Node * const child = deref(square->children[i]);
+        if (!valid_node(child)) {
+            continue;
+        }
+        if (child->is_square) {
+            Quadtree_stats_internal(stats, child, bottom);
+        } else {
+            stats->nodes++;
+            stats->size += bottom;
+        }
+    }
+    stats->nodes++;
+}
+
+QuadtreeStats Quadtree_stats(const Quadtree * const node) {
+    const RluQuadtree * const tree = (RluQuadtree*)node;
+    QuadtreeStats stats = (QuadtreeStats){ .size = 0, .height = 0, .nodes = 0 };
+
+    RLU_READER_LOCK(rlu_self);
+    stats.height = tree->tree.height;
+    uint64_t i;
+    for (i = 0; i < QUADTREE_LEVELS; i++) {
+        Quadtree_stats_internal(&stats, deref(tree->roots[i]), 0 == i);
+    }
+    RLU_READER_UNLOCK(rlu_self);
+
+    return stats;
+}
+
+/*
+ * Quadtree_free_internal
+ *
+ * result - the result object to record data onto
+ * node - the node to recursively free
+ */
+void Quadtree_free_internal(QuadtreeFreeResult * result, const Node * const node) {
+    uint64_t i;
+    bool is_leaf = true;
+    for (i = 0; i < (1LL << D); i++) {
+        if (valid_node(node->children[i])) {
+            is_leaf = false;
+            Quadtree_free_internal(result, node->children[i]);
+        }
+    }
+    Node_free_internal(node);
+    result->total++;
+    result->leaf += is_leaf;
+}
+
+QuadtreeFreeResult Quadtree_free(Quadtree * const node) {
+    RluQuadtree * const tree = (RluQuadtree*)node;
+    QuadtreeFreeResult result = (QuadtreeFreeResult){ .total = 0, .leaf = 0, .levels = 0 };
+
+    // Every node must have been written back before it is freed.
+    Quadtree_flush(node);
+
+    int64_t i;
+    for (i = QUADTREE_LEVELS - 1; i >= 0; i--) {
+        Quadtree_free_internal(&result, tree->roots[i]);
+        result.levels++;
+    }
+
+    free(tree);
+
+    return result;
+}
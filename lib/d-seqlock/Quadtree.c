@@ -0,0 +1,801 @@
+/**
+Concurrent compressed skip quadtree synchronized with per-square version counters (seqlocks)
+
+While one thread alone is registered with RLU, its updates write squares without taking them and its
+searches enter no epoch, so every thread must register with RLU before using the tree.
+*/
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "../types.h"
+#include "../Epoch.h"
+#include "../Quadtree.h"
+#include "../Point.h"
+
+// rlu_self, set up with RLU_THREAD_INIT by every thread that uses the tree
+__thread rlu_thread_data_t *rlu_self = NULL;
+
+// quadtree counter
+#ifdef QUADTREE_TEST
+uint64_t QUADTREE_NODE_COUNT = 0;
+#endif
+
+#define valid_node(n) Node_valid((Node*)(n))
+
+// Reads a child pointer that other threads may be changing.
+#define load(p) (*(Node * volatile *)&(p))
+
+#define version_of(n) (((SeqNode*)(n))->version)
+
+// Called by writers for every level they change, while they still hold the squares they changed
+// on it. Variants built on this one may define it to track which levels change.
+#ifndef level_changed
+#define level_changed(tree, level)
+#endif
+
+/*
+ * struct SeqNode_t
+ *
+ * A container that wraps around the Node type to give it a version. The version of a square is
+ * odd while a writer holds it, and grows by 2 every time a writer changes its children; points
+ * never change once they are in the tree.
+ *
+ * treenode - the Node that this SeqNode wraps around
+ * version - the version of the node
+ */
+typedef struct SeqNode_t SeqNode;
+struct SeqNode_t {
+    Node treenode;
+    volatile uint64_t version;
+};
+
+/*
+ * struct SeqQuadtree_t
+ *
+ * A quadtree whose levels are fixed in advance, as in d-rlu: a point appears on every level up to
+ * get_level(point).
+ *
+ * Readers write nothing shared: they read the version of a square before and after reading from
+ * it, and start over if it changed. Writers find their path the same way, then take the squares
+ * they change by moving each version from the value they read to odd, which fails if the square
+ * changed in the meantime, in which case they give every square back and start over. Once it has
+ * every square, a writer changes them all and then releases them, so that readers never see half
+ * of an update, as in d-lock.
+ *
+ * Readers may still be reading a node after it has been unlinked, so every operation runs in an
+ * epoch critical section, and unlinked nodes are retired to be freed once those that were running
+ * have ended.
+ *
+ * tree - the header, first so that a SeqQuadtree can be used as a Quadtree; tree.root is the root
+ *     of the top level, and tree.height is the highest level that a point has been added to
+ * roots - the root square of each level, which spans the whole tree and is never collapsed
+ */
+typedef struct SeqQuadtree_t {
+    Quadtree tree;
+    Node *roots[QUADTREE_LEVELS];
+} SeqQuadtree;
+
+/*
+ * struct Writes_t
+ *
+ * The squares a writer holds.
+ *
+ * nodes - the held squares
+ * versions - the versions the squares had before they were taken
+ * count - the number of held squares
+ */
+typedef struct Writes_t {
+    Node *nodes[2 * QUADTREE_LEVELS];
+    uint64_t versions[2 * QUADTREE_LEVELS];
+    uint64_t count;
+} Writes;
+
+/*
+ * read_version
+ *
+ * Reads the version of a square before reading from it.
+ *
+ * square - the square to read the version of
+ * version - set to the version
+ *
+ * Returns false if a writer holds the square, in which case the reader must start over.
+ */
+static inline bool read_version(const Node * const square, uint64_t * const version) {
+    *version = __atomic_load_n(&version_of(square), __ATOMIC_ACQUIRE);
+    return 0 == (*version & 1);
+}
+
+/*
+ * validate
+ *
+ * Returns whether the square still has the version read before reading from it, meaning that
+ * what was read is consistent.
+ */
+static inline bool validate(const Node * const square, const uint64_t version) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return version == version_of(square);
+}
+
+/*
+ * Writes_take
+ *
+ * Takes a square for writing, if it still has the version read before. A square that changed in
+ * the meantime is counted as a conflict with QUADTREE_CONTENTION. In an exclusive section, the
+ * square cannot have changed and no reader can see it being written, so it is only recorded.
+ *
+ * writes - the squares held by the writer
+ * square - the square to take
+ * version - the version read before
+ * level - the level of the square
+ *
+ * Returns whether the square is held.
+ */
+static bool Writes_take(Writes * const writes, Node * const square, const uint64_t version,
+        const uint64_t level) {
+    uint64_t i;
+    for (i = 0; i < writes->count; i++) {
+        if (writes->nodes[i] == square) {
+            return true;
+        }
+    }
+    if (!RLU_IS_EXCLUSIVE(rlu_self) &&
+            !__sync_bool_compare_and_swap(&version_of(square), version, version + 1)) {
+        CONTENTION_RECORD(level, square);
+        return false;
+    }
+    writes->nodes[writes->count] = square;
+    writes->versions[writes->count] = version;
+    writes->count++;
+    return true;
+}
+
+/*
+ * Writes_release
+ *
+ * Releases every held square.
+ *
+ * writes - the squares held by the writer
+ * changed - whether the squares were changed; if not, they get their old versions back, so that
+ *     readers that were reading them need not start over
+ */
+static void Writes_release(Writes * const writes, const bool changed) {
+    uint64_t i;
+    for (i = 0; i < writes->count; i++) {
+        __atomic_store_n(&version_of(writes->nodes[i]), writes->versions[i] + 2 * changed,
+            __ATOMIC_RELEASE);
+    }
+    writes->count = 0;
+}
+
+/*
+ * Node_init_level
+ *
+ * Creates a node on the given level of the tree, whose memory may be placed differently from that
+ * of lower levels (see node_alloc).
+ *
+ * length - the side length of the node
+ * center - the center of the node
+ * level - the level of the node
+ *
+ * Returns the node.
+ */
+static Node* Node_init_level(const float64_t length, const Point center, const uint64_t level) {
+    SeqNode *node = (SeqNode*)Epoch_alloc(sizeof(*node), level);
+    *node = (SeqNode){
+        .treenode = (Node){
+            .is_square = false,
+            .length = length,
+            .center = center,
+            .down = NULL
+#ifdef QUADTREE_TEST
+            ,.id = QUADTREE_NODE_COUNT++
+#endif
+        },
+        .version = 0
+    };
+    uint64_t i;
+    for (i = 0; i < (1LL << D); i++) {
+        node->treenode.children[i] = NULL;
+    }
+    return (Node*)node;
+}
+
+Node* Node_init(const float64_t length, const Point center) {
+    return Node_init_level(length, center, 0);
+}
+
+/*
+ * Node_free_internal
+ *
+ * Frees the memory used to represent this node immediately, inlined for internal use. Only nodes
+ * that no other thread can reach may be freed this way.
+ *
+ * node - the node to be freed
+ */
+static inline void Node_free_internal(const Node * const node) {
+    node_free((SeqNode*)node);
+}
+
+void Node_free(const Node * const node) {
+    Node_free_internal(node);
+}
+
+/*
+ * retire
+ *
+ * Hands a node that has just been unlinked from the tree over to be freed once no reader can be
+ * reading it. Epoch_retire must run in a critical section, which exclusive sections skip, so it is
+ * wrapped in one here; operations that entered their own only nest it.
+ */
+static inline void retire(Node * const node) {
+    Epoch_enter();
+    Epoch_retire((SeqNode*)node, sizeof(SeqNode));
+    Epoch_exit();
+}
+
+Quadtree* Quadtree_init(const float64_t length, const Point center) {
+    SeqQuadtree *tree = (SeqQuadtree*)malloc(sizeof(*tree));
+    uint64_t i;
+    for (i = 0; i < QUADTREE_LEVELS; i++) {
+        tree->roots[i] = Node_init_level(length, center, i);
+        tree->roots[i]->is_square = true;
+        tree->roots[i]->down = (0 == i ? NULL : tree->roots[i - 1]);
+    }
+    tree->tree = (Quadtree){
+        .height = 0,
+        .root = tree->roots[QUADTREE_LEVELS - 1],
+        .center = center,
+        .length = length
+    };
+    return (Quadtree*)tree;
+}
+
+/*
+ * same_square
+ *
+ * Returns whether the square has the given side length and center.
+ */
+static inline bool same_square(const Node * const square, const float64_t length,
+        const Point * const center) {
+    return square->length == length && Point_equals(&square->center, center);
+}
+
+/*
+ * separate
+ *
+ * Computes the smallest square inside the parent that separates the point from the node in its
+ * quadrant of the parent.
+ *
+ * parent - the square containing both
+ * point - the point
+ * sibling - the node in the quadrant of parent containing the point, which is not a square
+ *     containing the point
+ * square - set to the side length and center of the separating square
+ */
+static void separate(const Node * const parent, const Point * const point,
+        const Node * const sibling, Node * const square) {
+    square->length = parent->length;
+    square->center = parent->center;
+    uint8_t quadrant = get_quadrant(&parent->center, point);
+    do {
+        square->center = get_new_center(square, quadrant);
+        square->length *= 0.5;
+        quadrant = get_quadrant(&square->center, point);
+    } while (quadrant == get_quadrant(&square->center, &sibling->center));
+}
+
+/*
+ * search
+ *
+ * One attempt at Quadtree_search, starting from a square that holds the point in range.
+ *
+ * start - the square to start from, which must still be in the tree
+ * point - the point to search for
+ * found - set to whether the point is in the tree, if the attempt succeeds
+ *
+ * Returns false if a writer got in the way and the search must start over.
+ */
+static bool search(const Node * const start, const Point * const point, bool * const found) {
+    // Descend each level as far as it goes, then drop to the same square on the level below.
+    const Node *square = start;
+    uint64_t version, next_version;
+    if (!read_version(square, &version)) {
+        return false;
+    }
+    while (true) {
+        const Node * const child = load(square->children[get_quadrant(&square->center, point)]);
+        if (!validate(square, version)) {
+            return false;
+        }
+
+        const Node *next = NULL;
+        if (!valid_node(child)) {
+            // Fall through to the level below.
+        } else if (child->is_square && in_range(child, point)) {
+            next = child;
+        } else if (!child->is_square && Point_equals(&child->center, point)) {
+            *found = true;
+            return true;
+        }
+
+        if (NULL == next) {
+            next = square->down;
+            if (!valid_node(next)) {
+                *found = false;
+                return true;
+            }
+        }
+
+        // The square must not have changed until the next one is known to be current.
+        if (!read_version(next, &next_version) || !validate(square, version)) {
+            return false;
+        }
+        square = next;
+        version = next_version;
+    }
+}
+
+/*
+ * begin_operation
+ *
+ * Starts an operation as an epoch critical section, or, while the calling thread is the only one
+ * registered with RLU, as an exclusive section, in which squares are written without taking them
+ * (see Writes_take) and no fence is needed to announce the section.
+ *
+ * Returns whether the operation runs exclusively, to be passed to end_operation.
+ */
+static inline bool begin_operation() {
+    if (RLU_EXCLUSIVE_LOCK(rlu_self)) {
+        return true;
+    }
+    Epoch_enter();
+    return false;
+}
+
+/*
+ * end_operation
+ *
+ * Ends an operation started with begin_operation.
+ */
+static inline void end_operation(const bool exclusive) {
+    if (exclusive) {
+        RLU_EXCLUSIVE_UNLOCK(rlu_self);
+    } else {
+        Epoch_exit();
+    }
+}
+
+bool Quadtree_search(const Quadtree * const node, const Point point) {
+    const SeqQuadtree * const tree = (SeqQuadtree*)node;
+    if (!in_range(tree->roots[0], &point)) {
+        return false;
+    }
+
+    bool found = false;
+    const bool exclusive = begin_operation();
+    while (!search(tree->roots[tree->tree.height], &point, &found));
+    end_operation(exclusive);
+    return found;
+}
+
+/*
+ * struct Walk_t
+ *
+ * The squares leading to a point on one level, as read by walk.
+ *
+ * grandparent - the square holding parent, or NULL if parent is where the walk started
+ * parent - the smallest square containing the point
+ * child - the node in the quadrant of parent containing the point
+ * versions - the versions of grandparent and parent
+ * quadrants - the quadrants of grandparent and parent leading to the point
+ */
+typedef struct Walk_t {
+    Node *grandparent, *parent, *child;
+    uint64_t versions[2];
+    uint8_t quadrants[2];
+} Walk;
+
+/*
+ * walk
+ *
+ * Walks down one level to the smallest square containing the point.
+ *
+ * walk - holds the square to start from and its version in parent and versions[1], and is filled
+ *     with the squares found
+ * point - the point to walk towards
+ * target - if not NULL, a square whose side length and center are looked for along the way
+ * twin - set to the square matching target, if any, and left untouched otherwise
+ * twin_version - set to the version of twin
+ *
+ * Returns false if a writer got in the way and the walk must start over.
+ */
+static bool walk_level(Walk * const walk, const Point * const point, const Node * const target,
+        Node ** const twin, uint64_t * const twin_version) {
+    walk->grandparent = NULL;
+    while (true) {
+        Node * const parent = walk->parent;
+        if (NULL != target && same_square(parent, target->length, &target->center)) {
+            *twin = parent;
+            *twin_version = walk->versions[1];
+        }
+
+        const uint8_t quadrant = get_quadrant(&parent->center, point);
+        Node * const child = load(parent->children[quadrant]);
+        if (!validate(parent, walk->versions[1])) {
+            return false;
+        }
+        walk->child = child;
+        walk->quadrants[1] = quadrant;
+        if (!valid_node(child) || !child->is_square || !in_range(child, point)) {
+            return true;
+        }
+
+        uint64_t version;
+        if (!read_version(child, &version) || !validate(parent, walk->versions[1])) {
+            return false;
+        }
+        walk->grandparent = parent;
+        walk->versions[0] = walk->versions[1];
+        walk->quadrants[0] = quadrant;
+        walk->parent = child;
+        walk->versions[1] = version;
+    }
+}
+
+/*
+ * walk_down
+ *
+ * Moves a walk to the level below, starting at the twin of the given square.
+ *
+ * walk - the walk to move
+ * square - the square on the current level to drop down from
+ * version - the version of square
+ *
+ * Returns false if a writer got in the way and the walk must start over.
+ */
+static bool walk_down(Walk * const walk, const Node * const square, const uint64_t version) {
+    walk->parent = square->down;
+    return read_version(walk->parent, walk->versions + 1) && validate(square, version);
+}
+
+/*
+ * add
+ *
+ * One attempt at Quadtree_add.
+ *
+ * tree - the tree to add to
+ * point - the point to add
+ * added - set to whether the point was added, if the attempt succeeds
+ *
+ * Returns false if a writer got in the way and the add must start over.
+ */
+static bool add(SeqQuadtree * const tree, const Point * const point, bool * const added) {
+    const int64_t level = get_level(point);
+    const int64_t top = max(level, (int64_t)tree->tree.height);
+
+    // parents[l] is the square the point goes in on level l, and twins[l] the square on level l
+    // that the square created on level l + 1, if any, points down to.
+    Node *parents[QUADTREE_LEVELS], *twins[QUADTREE_LEVELS];
+    uint64_t parent_versions[QUADTREE_LEVELS], twin_versions[QUADTREE_LEVELS];
+    uint8_t quadrants[QUADTREE_LEVELS];
+    Node target;
+    bool has_target = false;
+
+    Walk walk = { .parent = tree->roots[top] };
+    if (!read_version(walk.parent, walk.versions + 1)) {
+        return false;
+    }
+    int64_t l;
+    for (l = top; l >= 0; l--) {
+        twins[l] = NULL;
+        if (!walk_level(&walk, point, has_target ? &target : NULL, twins + l, twin_versions + l)) {
+            return false;
+        }
+
+        Node * const child = walk.child;
+        if (valid_node(child) && !child->is_square && Point_equals(&child->center, point)) {
+            *added = false;
+            return true;
+        }
+
+        has_target = false;
+        if (l <= level) {
+            parents[l] = walk.parent;
+            parent_versions[l] = walk.versions[1];
+            quadrants[l] = walk.quadrants[1];
+            if (valid_node(child)) {
+                separate(walk.parent, point, child, &target);
+                has_target = l > 0;
+            }
+        }
+
+        if (l > 0 && !walk_down(&walk, walk.parent, walk.versions[1])) {
+            return false;
+        }
+    }
+
+    // Take every square that changes, from the top down, then link the point in from the bottom up.
+    Writes writes = { .count = 0 };
+    for (l = level; l >= 0; l--) {
+        if (!Writes_take(&writes, parents[l], parent_versions[l], l) ||
+                (l < level && valid_node(twins[l]) &&
+                 !Writes_take(&writes, twins[l], twin_versions[l], l))) {
+            Writes_release(&writes, false);
+            return false;
+        }
+    }
+
+    Node *below = NULL;
+    for (l = 0; l <= level; l++) {
+        Node * const parent = parents[l];
+        const uint8_t quadrant = quadrants[l];
+        Node * const sibling = parent->children[quadrant];
+
+        Node * const new_node = Node_init_level(0, *point, l);
+        new_node->down = below;
+        below = new_node;
+
+        if (!valid_node(sibling)) {
+            __atomic_store_n(&parent->children[quadrant], new_node, __ATOMIC_RELEASE);
+            continue;
+        }
+
+        Node * const new_square = Node_init_level(0, *point, l);
+        new_square->is_square = true;
+        separate(parent, point, sibling, new_square);
+        new_square->children[get_quadrant(&new_square->center, point)] = new_node;
+        new_square->children[get_quadrant(&new_square->center, &sibling->center)] = sibling;
+        if (l > 0) {
+            assert(valid_node(twins[l - 1]) &&
+                same_square(twins[l - 1], new_square->length, &new_square->center));
+            new_square->down = twins[l - 1];
+        }
+        __atomic_store_n(&parent->children[quadrant], new_square, __ATOMIC_RELEASE);
+
+        // Unless the square already existed on this level, the new square is its twin.
+        if (l < level && !valid_node(twins[l])) {
+            twins[l] = new_square;
+        }
+    }
+
+    for (l = 0; l <= level; l++) {
+        level_changed(tree, l);
+    }
+
+    uint64_t height = tree->tree.height;
+    while (height < (uint64_t)level &&
+            !__sync_bool_compare_and_swap(&tree->tree.height, height, level)) {
+        height = tree->tree.height;
+    }
+
+    Writes_release(&writes, true);
+
+    *added = true;
+    return true;
+}
+
+bool Quadtree_add(Quadtree * const node, const Point point) {
+    SeqQuadtree * const tree = (SeqQuadtree*)node;
+    if (!in_range(tree->roots[0], &point)) {
+        return false;
+    }
+
+    bool added = false;
+    const bool exclusive = begin_operation();
+    while (!add(tree, &point, &added));
+    end_operation(exclusive);
+    return added;
+}
+
+/*
+ * remove_point
+ *
+ * One attempt at Quadtree_remove.
+ *
+ * tree - the tree to remove from
+ * point - the point to remove
+ * removed - set to whether the point was removed, if the attempt succeeds
+ *
+ * Returns false if a writer got in the way and the remove must start over.
+ */
+static bool remove_point(SeqQuadtree * const tree, const Point * const point,
+        bool * const removed) {
+    const int64_t top = tree->tree.height;
+
+    Walk walks[QUADTREE_LEVELS];
+    Walk walk = { .parent = tree->roots[top] };
+    if (!read_version(walk.parent, walk.versions + 1)) {
+        return false;
+    }
+    int64_t found = -1, l;
+    for (l = top; l >= 0; l--) {
+        if (!walk_level(&walk, point, NULL, NULL, NULL)) {
+            return false;
+        }
+
+        // The point's own coordinates fix its level, but a point equal to it up to precision error
+        // may hash differently, so the level is the highest one the point was found on.
+        const Node * const child = walk.child;
+        if (0 > found && valid_node(child) && !child->is_square &&
+                Point_equals(&child->center, point)) {
+            found = l;
+        }
+        walks[l] = walk;
+
+        // Enter the level below at the twin of the grandparent, so that the grandparent of every
+        // non-root parent is known there too.
+        if (l > 0 && !(valid_node(walk.grandparent) ?
+                walk_down(&walk, walk.grandparent, walk.versions[0]) :
+                walk_down(&walk, walk.parent, walk.versions[1]))) {
+            return false;
+        }
+    }
+
+    if (0 > found) {
+        *removed = false;
+        return true;
+    }
+
+    Writes writes = { .count = 0 };
+    for (l = found; l >= 0; l--) {
+        if ((valid_node(walks[l].grandparent) &&
+                 !Writes_take(&writes, walks[l].grandparent, walks[l].versions[0], l)) ||
+                !Writes_take(&writes, walks[l].parent, walks[l].versions[1], l)) {
+            Writes_release(&writes, false);
+            return false;
+        }
+    }
+
+    // A point added to a level above the one the walk started at would not be removed from it, so
+    // the remove starts over if the tree grew in the meantime. Adds grow the tree before they
+    // release their squares, so no add that the walk saw the effects of is missed.
+    if ((int64_t)tree->tree.height != top) {
+        Writes_release(&writes, false);
+        return false;
+    }
+
+    // Levels above the highest one the point was found on are not taken, but the point may have
+    // been added to them after the walk read them and before it read the levels below, and would
+    // then be left there without the levels below it. Any such add changed the squares the walk
+    // ended at on those levels.
+    for (l = top; l > found; l--) {
+        if (!validate(walks[l].parent, walks[l].versions[1])) {
+            Writes_release(&writes, false);
+            return false;
+        }
+    }
+
+    // Remove from the top down, collapsing every parent that is left with a single child.
+    for (l = found; l >= 0; l--) {
+        Node * const parent = walks[l].parent;
+        Node * const child = parent->children[walks[l].quadrants[1]];
+        __atomic_store_n(&parent->children[walks[l].quadrants[1]], NULL, __ATOMIC_RELEASE);
+        retire(child);
+
+        // Roots are never collapsed.
+        if (!valid_node(walks[l].grandparent)) {
+            continue;
+        }
+
+        Node *remaining = NULL;
+        uint64_t i, nchildren = 0;
+        for (i = 0; i < (1LL << D); i++) {
+            if (valid_node(parent->children[i])) {
+                remaining = parent->children[i];
+                nchildren++;
+            }
+        }
+        if (1 == nchildren) {
+            __atomic_store_n(&walks[l].grandparent->children[walks[l].quadrants[0]], remaining,
+                __ATOMIC_RELEASE);
+            retire(parent);
+        }
+    }
+
+    for (l = found; l >= 0; l--) {
+        level_changed(tree, l);
+    }
+
+    Writes_release(&writes, true);
+
+    *removed = true;
+    return true;
+}
+
+bool Quadtree_remove(Quadtree * const node, const Point point) {
+    SeqQuadtree * const tree = (SeqQuadtree*)node;
+    if (!in_range(tree->roots[0], &point)) {
+        return false;
+    }
+
+    bool removed = false;
+    const bool exclusive = begin_operation();
+    while (!remove_point(tree, &point, &removed));
+    end_operation(exclusive);
+    return removed;
+}
+
+void Quadtree_flush(Quadtree * const tree) {
+    // Updates are applied in place.
+}
+
+/*
+ * Quadtree_stats_internal
+ *
+ * Counts a square and every node below it on the same level. Versions are not checked, so a
+ * square that a writer holds is counted with whichever children it has been given so far.
+ *
+ * stats - the stats to count onto
+ * square - the square to count from
+ * bottom - whether the square is on the bottom level, whose points are the points of the tree
+ */
+static void Quadtree_stats_internal(QuadtreeStats * const stats, const Node * const square,
+        const bool bottom) {
+    uint64_t i;
+    for (i = 0; i < (1LL << D); i++) {
+        const Node * const child = load(square->children[i]);
+        if (!valid_node(child)) {
+            continue;
+        }
+        if (child->is_square) {
+            Quadtree_stats_internal(stats, child, bottom);
+        } else {
+            stats->nodes++;
+            stats->size += bottom;
+        }
+    }
+    stats->nodes++;
+}
+
+QuadtreeStats Quadtree_stats(const Quadtree * const node) {
+    const SeqQuadtree * const tree = (SeqQuadtree*)node;
+    QuadtreeStats stats = (QuadtreeStats){ .size = 0, .height = tree->tree.height, .nodes = 0 };
+
+    // Unlinked nodes are only kept from being freed while inside a critical section.
+    const bool exclusive = begin_operation();
+    uint64_t i;
+    for (i = 0; i < QUADTREE_LEVELS; i++) {
+        Quadtree_stats_internal(&stats, tree->roots[i], 0 == i);
+    }
+    end_operation(exclusive);
+    return stats;
+}
+
+/*
+ * Quadtree_free_internal
+ *
+ * result - the result object to record data onto
+ * node - the node to recursively free
+ */
+void Quadtree_free_internal(QuadtreeFreeResult * result, const Node * const node) {
+    uint64_t i;
+    bool is_leaf = true;
+    for (i = 0; i < (1LL << D); i++) {
+        if (valid_node(node->children[i])) {
+            is_leaf = false;
+            Quadtree_free_internal(result, node->children[i]);
+        }
+    }
+    Node_free_internal(node);
+    result->total++;
+    result->leaf += is_leaf;
+}
+
+QuadtreeFreeResult Quadtree_free(Quadtree * const node) {
+    SeqQuadtree * const tree = (SeqQuadtree*)node;
+    QuadtreeFreeResult result = (QuadtreeFreeResult){ .total = 0, .leaf = 0, .levels = 0 };
+
+    int64_t i;
+    for (i = QUADTREE_LEVELS - 1; i >= 0; i--) {
+        Quadtree_free_internal(&result, tree->roots[i]);
+        result.levels++;
+    }
+
+    free(tree);
+
+    // Reclaim the nodes this thread unlinked, so that none are left over once the tree is gone.
+    Epoch_synchronize();
+
+    return result;
+}
@@ -578,6 +578,44 @@ bool Quadtree_remove(Quadtree * const node, const Point point) {
     return SUCCESS == result;
 }
 
+void Quadtree_flush(Quadtree * const tree) {
+    // Updates are applied immediately.
+}
+
+/*
+ * Quadtree_stats_internal
+ *
+ * Counts a node and every node below it on the same level.
+ *
+ * stats - the stats to count onto
+ * node - the node to count from
+ * bottom - whether the node is on the bottom level, whose points are the points of the tree
+ */
+static void Quadtree_stats_internal(QuadtreeStats * const stats, const Node * const node,
+        const bool bottom) {
+    uint64_t i;
+    for (i = 0; i < (1LL << D); i++) {
+        if (valid_node(node->children[i])) {
+            Quadtree_stats_internal(stats, node->children[i], bottom);
+        }
+    }
+    stats->nodes++;
+    stats->size += bottom && !node->is_square;
+}
+
+QuadtreeStats Quadtree_stats(const Quadtree * const tree) {
+    QuadtreeStats stats = (QuadtreeStats){ .size = 0, .height = 0, .nodes = 0 };
+
+    // Levels are only kept while they hold points, so the height is the number of levels above the
+    // bottom one.
+    const Node *root;
+    for (root = tree->root; valid_node(root); root = root->down) {
+        Quadtree_stats_internal(&stats, root, !valid_node(root->down));
+        stats.height += valid_node(root->down);
+    }
+    return stats;
+}
+
 /*
  * Quadtree_free_internal
  *
@@ -0,0 +1,658 @@
+/**
+Concurrent compressed skip quadtree split into spatial shards, each guarded by its own lock
+
+A thread that is the only one registered with RLU takes no shard lock, so threads must register
+before they use the tree.
+*/
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "../types.h"
+#include "../Quadtree.h"
+#include "../Point.h"
+
+// rlu_self, set up with RLU_THREAD_INIT by every thread that uses the tree
+__thread rlu_thread_data_t *rlu_self = NULL;
+
+// quadtree counter
+#ifdef QUADTREE_TEST
+uint64_t QUADTREE_NODE_COUNT = 0;
+#endif
+
+// The tree is split into 2^(QUADTREE_SHARD_BITS * D) shards: QUADTREE_SHARD_BITS halvings of the
+// tree along every dimension.
+#ifndef QUADTREE_SHARD_BITS
+#define QUADTREE_SHARD_BITS 2
+#endif
+
+#if QUADTREE_SHARD_BITS < 1
+#error "QUADTREE_SHARD_BITS must be at least 1"
+#endif
+
+#define NSHARDS (1LL << (QUADTREE_SHARD_BITS * D))
+
+// The dispatch squares above the shards form a complete tree with 2^D children per square and the
+// NSHARDS shards as leaves, so there are (NSHARDS - 1) / (2^D - 1) of them.
+#define NDISPATCH ((NSHARDS - 1) / ((1LL << D) - 1))
+
+#define valid_node(n) Node_valid((Node*)(n))
+
+/*
+ * struct Shard_t
+ *
+ * An independent skip quadtree over one sub-box of the tree, with levels fixed in advance as in
+ * d-rlu: a point appears on every level up to get_level(point).
+ *
+ * lock - held for reading by searches and for writing by adds and removes
+ * height - the highest level that a point has been added to
+ * size - the number of points in the shard
+ * roots - the root square of each level, which spans the sub-box and is never collapsed
+ */
+typedef struct Shard_t {
+    pthread_rwlock_t lock;
+    uint64_t height, size;
+    Node *roots[QUADTREE_LEVELS];
+} Shard;
+
+/*
+ * struct ShardedQuadtree_t
+ *
+ * A quadtree whose box is split into NSHARDS equal sub-boxes, each holding its own shard, so that
+ * writers to different sub-boxes never touch the same memory.
+ *
+ * The sub-boxes are the squares QUADTREE_SHARD_BITS quadrant splits below the root. Those squares
+ * are kept on the bottom level as a complete tree of dispatch squares, with the bottom roots of the
+ * shards in place of its leaves, so tree.root is a bottom-level tree holding every point. Points
+ * are routed to their shard with get_quadrant, by the same arithmetic the shards use themselves.
+ *
+ * tree - the header, first so that a ShardedQuadtree can be used as a Quadtree; tree.root is the
+ *     top dispatch square, and tree.height is the highest level that a point has been added to
+ * shards - the shards, in the order of the quadrants leading to them from the root
+ */
+typedef struct ShardedQuadtree_t {
+    Quadtree tree;
+    Shard shards[NSHARDS];
+} ShardedQuadtree;
+
+/*
+ * Node_init_internal
+ *
+ * Node_init, inlined for internal use.
+ */
+static inline Node* Node_init_internal(const float64_t length, const Point center) {
+    Node *node = (Node*)malloc(sizeof(*node));
+    *node = (Node){
+        .is_square = false,
+        .length = length,
+        .center = center,
+        .down = NULL
+#ifdef QUADTREE_TEST
+        ,.id = QUADTREE_NODE_COUNT++
+#endif
+    };
+    uint64_t i;
+    for (i = 0; i < (1LL << D); i++) {
+        node->children[i] = NULL;
+    }
+    return node;
+}
+
+Node* Node_init(const float64_t length, const Point center) {
+    return Node_init_internal(length, center);
+}
+
+/*
+ * Node_free_internal
+ *
+ * Frees the memory used to represent this node, inlined for internal use.
+ *
+ * node - the node to be freed
+ */
+static inline void Node_free_internal(const Node * const node) {
+    free((Node*)node);
+}
+
+void Node_free(const Node * const node) {
+    Node_free_internal(node);
+}
+
+/*
+ * dispatch_init
+ *
+ * Creates the dispatch squares below the given square, along with the shards in them.
+ *
+ * tree - the tree being created
+ * square - the dispatch square to fill in
+ * depth - the number of quadrant splits between the root and square
+ * index - the index of the first shard inside square
+ */
+static void dispatch_init(ShardedQuadtree * const tree, Node * const square, const uint64_t depth,
+        const uint64_t index) {
+    uint64_t i, j;
+    for (i = 0; i < (1LL << D); i++) {
+        const Point center = get_new_center(square, i);
+        const uint64_t child_index = (index << D) | i;
+        if (depth + 1 < QUADTREE_SHARD_BITS) {
+            Node * const child = Node_init_internal(square->length * 0.5, center);
+            child->is_square = true;
+            square->children[i] = child;
+            dispatch_init(tree, child, depth + 1, child_index);
+            continue;
+        }
+
+        Shard * const shard = tree->shards + child_index;
+        pthread_rwlock_init(&shard->lock, NULL);
+        shard->height = 0;
+        shard->size = 0;
+        for (j = 0; j < QUADTREE_LEVELS; j++) {
+            shard->roots[j] = Node_init_internal(square->length * 0.5, center);
+            shard->roots[j]->is_square = true;
+            shard->roots[j]->down = (0 == j ? NULL : shard->roots[j - 1]);
+        }
+        square->children[i] = shard->roots[0];
+    }
+}
+
+/*
+ * sharded_init
+ *
+ * Quadtree_init, allocating the given number of bytes for the tree, so that variants built on this
+ * one can keep their own state after the ShardedQuadtree without moving its locks.
+ *
+ * size - the number of bytes to allocate, at least sizeof(ShardedQuadtree)
+ * length - as for Quadtree_init
+ * center - as for Quadtree_init
+ *
+ * Returns the tree.
+ */
+static ShardedQuadtree* sharded_init(const size_t size, const float64_t length,
+        const Point center) {
+    ShardedQuadtree *tree = (ShardedQuadtree*)malloc(size);
+    Node * const root = Node_init_internal(length, center);
+    root->is_square = true;
+    tree->tree = (Quadtree){
+        .height = 0,
+        .root = root,
+        .center = center,
+        .length = length
+    };
+    dispatch_init(tree, root, 0, 0);
+    return tree;
+}
+
+Quadtree* Quadtree_init(const float64_t length, const Point center) {
+    return (Quadtree*)sharded_init(sizeof(ShardedQuadtree), length, center);
+}
+
+/*
+ * get_shard
+ *
+ * Returns the shard whose sub-box holds the point, which must be in range of the tree.
+ */
+static inline Shard* get_shard(const ShardedQuadtree * const tree, const Point * const point) {
+    const Node *square = tree->tree.root;
+    uint64_t depth, index = 0;
+    for (depth = 0; depth < QUADTREE_SHARD_BITS; depth++) {
+        const uint64_t quadrant = get_quadrant(&square->center, point);
+        index = (index << D) | quadrant;
+        square = square->children[quadrant];
+    }
+    return (Shard*)tree->shards + index;
+}
+
+/*
+ * shard_lock
+ *
+ * Locks a shard for reading or for writing, unless the calling thread is the only one registered
+ * with RLU, in which case the operation runs as an exclusive section and takes no lock at all.
+ *
+ * shard - the shard to lock
+ * write - whether to lock it for writing
+ *
+ * Returns whether the operation runs exclusively, to be passed to shard_unlock.
+ */
+static inline bool shard_lock(Shard * const shard, const bool write) {
+    if (RLU_EXCLUSIVE_LOCK(rlu_self)) {
+        return true;
+    }
+    if (write) {
+        pthread_rwlock_wrlock(&shard->lock);
+    } else {
+        pthread_rwlock_rdlock(&shard->lock);
+    }
+    return false;
+}
+
+/*
+ * shard_unlock
+ *
+ * Undoes shard_lock.
+ */
+static inline void shard_unlock(Shard * const shard, const bool exclusive) {
+    if (exclusive) {
+        RLU_EXCLUSIVE_UNLOCK(rlu_self);
+    } else {
+        pthread_rwlock_unlock(&shard->lock);
+    }
+}
+
+/*
+ * raise_height
+ *
+ * Raises the tree's height to that of a shard. The tree's height is only reported, so it is raised
+ * outside of the shard's lock.
+ */
+static inline void raise_height(ShardedQuadtree * const tree, const uint64_t height) {
+    uint64_t tree_height = tree->tree.height;
+    while (tree_height < height &&
+            !__sync_bool_compare_and_swap(&tree->tree.height, tree_height, height)) {
+        tree_height = tree->tree.height;
+    }
+}
+
+/*
+ * find
+ *
+ * Quadtree_search within one shard, without the lock.
+ *
+ * Returns the highest node found for the point, or NULL if the point is not in the shard.
+ */
+static const Node* find(const Shard * const shard, const Point * const point) {
+    // Descend each level as far as it goes, then drop to the same square on the level below.
+    const Node *square = shard->roots[shard->height];
+    while (true) {
+        const Node * const child = square->children[get_quadrant(&square->center, point)];
+        if (!valid_node(child)) {
+            // Fall through to the level below.
+        } else if (child->is_square && in_range(child, point)) {
+            square = child;
+            continue;
+        } else if (!child->is_square && Point_equals(&child->center, point)) {
+            return child;
+        }
+
+        if (!valid_node(square->down)) {
+            return NULL;
+        }
+        square = square->down;
+    }
+}
+
+/*
+ * search
+ *
+ * Returns whether find finds the point in the shard.
+ */
+static inline bool search(const Shard * const shard, const Point * const point) {
+    return valid_node(find(shard, point));
+}
+
+bool Quadtree_search(const Quadtree * const node, const Point point) {
+    const ShardedQuadtree * const tree = (ShardedQuadtree*)node;
+    if (!in_range(tree->tree.root, &point)) {
+        return false;
+    }
+
+    Shard * const shard = get_shard(tree, &point);
+    const bool exclusive = shard_lock(shard, false);
+    const bool found = search(shard, &point);
+    shard_unlock(shard, exclusive);
+    return found;
+}
+
+/*
+ * add
+ *
+ * Quadtree_add within one shard, without the lock.
+ */
+static bool add(Shard * const shard, const Point * const point) {
+    const uint64_t level = get_level(point);
+    const uint64_t top = max(level, shard->height);
+
+    // Find the square the point goes in on every level it is added to.
+    Node *parents[QUADTREE_LEVELS];
+    uint8_t quadrants[QUADTREE_LEVELS];
+    Node *parent = shard->roots[top];
+    int64_t l;
+    for (l = top; l >= 0; l--) {
+        uint8_t quadrant;
+        Node *child;
+        while (true) {
+            quadrant = get_quadrant(&parent->center, point);
+            child = parent->children[quadrant];
+            if (!valid_node(child) || !child->is_square || !in_range(child, point)) {
+                break;
+            }
+            parent = child;
+        }
+        if (valid_node(child) && !child->is_square && Point_equals(&child->center, point)) {
+            return false;
+        }
+        if (l <= (int64_t)level) {
+            parents[l] = parent;
+            quadrants[l] = quadrant;
+        }
+        parent = parent->down;
+    }
+
+    // Add from the bottom up, so that every new square has a square to point down to.
+    Node *below = NULL;
+    for (l = 0; l <= (int64_t)level; l++) {
+        Node * const parent = parents[l];
+        const uint8_t quadrant = quadrants[l];
+        Node * const sibling = parent->children[quadrant];
+
+        Node * const new_node = Node_init_internal(0, *point);
+        new_node->down = below;
+        below = new_node;
+
+        if (!valid_node(sibling)) {
+            parent->children[quadrant] = new_node;
+            continue;
+        }
+
+        // Compute the smallest square separating the point from its sibling.
+        Node * const new_square = Node_init_internal(parent->length, parent->center);
+        new_square->is_square = true;
+        uint8_t n_quadrant = quadrant, s_quadrant;
+        do {
+            new_square->center = get_new_center(new_square, n_quadrant);
+            new_square->length *= 0.5;
+            n_quadrant = get_quadrant(&new_square->center, point);
+            s_quadrant = get_quadrant(&new_square->center, &sibling->center);
+        } while (n_quadrant == s_quadrant);
+
+        // The same square exists on the level below, since both of its children are there.
+        if (valid_node(parent->down)) {
+            Node *down_square = parent->down;
+            while (down_square->length != new_square->length) {
+                down_square = down_square->children[get_quadrant(&down_square->center,
+                    &new_square->center)];
+            }
+            new_square->down = down_square;
+        }
+
+        new_square->children[n_quadrant] = new_node;
+        new_square->children[s_quadrant] = sibling;
+        parent->children[quadrant] = new_square;
+    }
+
+    if (shard->height < level) {
+        shard->height = level;
+    }
+    shard->size++;
+    return true;
+}
+
+bool Quadtree_add(Quadtree * const node, const Point point) {
+    ShardedQuadtree * const tree = (ShardedQuadtree*)node;
+    if (!in_range(tree->tree.root, &point)) {
+        return false;
+    }
+
+    Shard * const shard = get_shard(tree, &point);
+    const bool exclusive = shard_lock(shard, true);
+    const bool added = add(shard, &point);
+    const uint64_t height = shard->height;
+    shard_unlock(shard, exclusive);
+    raise_height(tree, height);
+    return added;
+}
+
+/*
+ * remove_point
+ *
+ * Quadtree_remove within one shard, without the lock.
+ */
+static bool remove_point(Shard * const shard, const Point * const point) {
+    const int64_t top = shard->height;
+
+    // Find the parent and grandparent of the point on every level, entering each level at the
+    // twin of the grandparent on the level above, so that the grandparent of every non-root parent
+    // is known.
+    Node *parents[QUADTREE_LEVELS], *grandparents[QUADTREE_LEVELS];
+    uint8_t quadrants[QUADTREE_LEVELS], parent_quadrants[QUADTREE_LEVELS];
+    int64_t found = -1, l;
+    Node *start = shard->roots[top];
+    for (l = top; l >= 0; l--) {
+        Node *grandparent = NULL, *parent = start, *child;
+        uint8_t quadrant, parent_quadrant = 0;
+        while (true) {
+            quadrant = get_quadrant(&parent->center, point);
+            child = parent->children[quadrant];
+            if (!valid_node(child) || !child->is_square || !in_range(child, point)) {
+                break;
+            }
+            grandparent = parent;
+            parent_quadrant = quadrant;
+            parent = child;
+        }
+        if (0 > found && valid_node(child) && !child->is_square &&
+                Point_equals(&child->center, point)) {
+            found = l;
+        }
+        parents[l] = parent;
+        grandparents[l] = grandparent;
+        quadrants[l] = quadrant;
+        parent_quadrants[l] = parent_quadrant;
+        start = (valid_node(grandparent) ? grandparent : parent)->down;
+    }
+
+    if (0 > found) {
+        return false;
+    }
+
+    // Remove from the top down, collapsing every parent that is left with a single child.
+    for (l = found; l >= 0; l--) {
+        Node * const parent = parents[l];
+        Node_free_internal(parent->children[quadrants[l]]);
+        parent->children[quadrants[l]] = NULL;
+
+        // Roots are never collapsed.
+        if (!valid_node(grandparents[l])) {
+            continue;
+        }
+
+        Node *remaining = NULL;
+        uint64_t i, nchildren = 0;
+        for (i = 0; i < (1LL << D); i++) {
+            if (valid_node(parent->children[i])) {
+                remaining = parent->children[i];
+                nchildren++;
+            }
+        }
+        if (1 == nchildren) {
+            grandparents[l]->children[parent_quadrants[l]] = remaining;
+            Node_free_internal(parent);
+        }
+    }
+    shard->size--;
+    return true;
+}
+
+bool Quadtree_remove(Quadtree * const node, const Point point) {
+    ShardedQuadtree * const tree = (ShardedQuadtree*)node;
+    if (!in_range(tree->tree.root, &point)) {
+        return false;
+    }
+
+    Shard * const shard = get_shard(tree, &point);
+    const bool exclusive = shard_lock(shard, true);
+    const bool removed = remove_point(shard, &point);
+    shard_unlock(shard, exclusive);
+    return removed;
+}
+
+uint64_t Quadtree_txn_commit(QuadtreeTxn * const txn) {
+    ShardedQuadtree * const tree = (ShardedQuadtree*)txn->tree;
+    bool touched[NSHARDS] = { false };
+    uint64_t height = 0, applied = 0, i;
+    for (i = 0; i < txn->size; i++) {
+        const Point * const point = &txn->updates[i].point;
+        if (in_range(tree->tree.root, point)) {
+            touched[get_shard(tree, point) - tree->shards] = true;
+        }
+    }
+
+    // Every shard the group touches stays locked for writing until the whole group is applied, so
+    // no search sees only some of it. Shards are locked in index order, so that two commits
+    // touching the same shards never wait for each other.
+    const bool exclusive = RLU_EXCLUSIVE_LOCK(rlu_self);
+    for (i = 0; i < NSHARDS && !exclusive; i++) {
+        if (touched[i]) {
+            pthread_rwlock_wrlock(&tree->shards[i].lock);
+        }
+    }
+    for (i = 0; i < txn->size; i++) {
+        QuadtreeReply * const update = txn->updates + i;
+        if (!in_range(tree->tree.root, &update->point)) {
+            update->result = false;
+            continue;
+        }
+        Shard * const shard = get_shard(tree, &update->point);
+        update->result = (QUADTREE_ADD == update->operation ?
+            add(shard, &update->point) : remove_point(shard, &update->point));
+        height = max(height, shard->height);
+        applied += update->result;
+    }
+    for (i = 0; i < NSHARDS && !exclusive; i++) {
+        if (touched[i]) {
+            pthread_rwlock_unlock(&tree->shards[i].lock);
+        }
+    }
+    if (exclusive) {
+        RLU_EXCLUSIVE_UNLOCK(rlu_self);
+    }
+    raise_height(tree, height);
+
+    free(txn->updates);
+    free(txn);
+    return applied;
+}
+
+void Quadtree_flush(Quadtree * const tree) {
+    // Updates are applied in place.
+}
+
+QuadtreeShardStats Quadtree_shard_stats(const Quadtree * const node) {
+    ShardedQuadtree * const tree = (ShardedQuadtree*)node;
+    QuadtreeShardStats stats = (QuadtreeShardStats){
+        .shards = NSHARDS,
+        .points = 0,
+        .min = UINT64_MAX,
+        .max = 0
+    };
+
+    uint64_t i;
+    for (i = 0; i < NSHARDS; i++) {
+        Shard * const shard = tree->shards + i;
+        pthread_rwlock_rdlock(&shard->lock);
+        const uint64_t size = shard->size;
+        pthread_rwlock_unlock(&shard->lock);
+
+        stats.points += size;
+        stats.min = min(stats.min, size);
+        stats.max = max(stats.max, size);
+    }
+    return stats;
+}
+
+/*
+ * Quadtree_stats_internal
+ *
+ * Counts a square and every node below it on the same level.
+ *
+ * stats - the stats to count onto
+ * square - the square to count from
+ * bottom - whether the square is on the bottom level, whose points are the points of the tree
+ */
+static void Quadtree_stats_internal(QuadtreeStats * const stats, const Node * const square,
+        const bool bottom) {
+    uint64_t i;
+    for (i = 0; i < (1LL << D); i++) {
+        const Node * const child = square->children[i];
+        if (!valid_node(child)) {
+            continue;
+        }
+        if (child->is_square) {
+            Quadtree_stats_internal(stats, child, bottom);
+        } else {
+            stats->nodes++;
+            stats->size += bottom;
+        }
+    }
+    stats->nodes++;
+}
+
+/*
+ * count
+ *
+ * Quadtree_stats within one shard, without the lock: counts every level of the shard onto stats.
+ */
+static void count(const Shard * const shard, QuadtreeStats * const stats) {
+    uint64_t i;
+    for (i = 0; i < QUADTREE_LEVELS; i++) {
+        Quadtree_stats_internal(stats, shard->roots[i], 0 == i);
+    }
+}
+
+QuadtreeStats Quadtree_stats(const Quadtree * const node) {
+    ShardedQuadtree * const tree = (ShardedQuadtree*)node;
+    QuadtreeStats stats = (QuadtreeStats){
+        .size = 0,
+        .height = tree->tree.height,
+        .nodes = NDISPATCH
+    };
+
+    uint64_t i;
+    for (i = 0; i < NSHARDS; i++) {
+        Shard * const shard = tree->shards + i;
+        const bool exclusive = shard_lock(shard, false);
+        count(shard, &stats);
+        shard_unlock(shard, exclusive);
+    }
+    return stats;
+}
+
+/*
+ * Quadtree_free_internal
+ *
+ * result - the result object to record data onto
+ * node - the node to recursively free
+ */
+void Quadtree_free_internal(QuadtreeFreeResult * result, const Node * const node) {
+    uint64_t i;
+    bool is_leaf = true;
+    for (i = 0; i < (1LL << D); i++) {
+        if (valid_node(node->children[i])) {
+            is_leaf = false;
+            Quadtree_free_internal(result, node->children[i]);
+        }
+    }
+    Node_free_internal(node);
+    result->total++;
+    result->leaf += is_leaf;
+}
+
+QuadtreeFreeResult Quadtree_free(Quadtree * const node) {
+    ShardedQuadtree * const tree = (ShardedQuadtree*)node;
+    QuadtreeFreeResult result = (QuadtreeFreeResult){ .total = 0, .leaf = 0, .levels = 0 };
+
+    // The bottom roots of the shards are freed along with the dispatch squares.
+    uint64_t i;
+    int64_t j;
+    for (i = 0; i < NSHARDS; i++) {
+        Shard * const shard = tree->shards + i;
+        for (j = QUADTREE_LEVELS - 1; j > 0; j--) {
+            Quadtree_free_internal(&result, shard->roots[j]);
+        }
+        pthread_rwlock_destroy(&shard->lock);
+    }
+    Quadtree_free_internal(&result, tree->tree.root);
+    result.levels = QUADTREE_LEVELS;
+
+    free(tree);
+
+    return result;
+}
@@ -0,0 +1,421 @@
+/**
+Concurrent compressed skip quadtree synchronized with GCC transactional memory
+*/
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "../types.h"
+#include "../Quadtree.h"
+#include "../Point.h"
+
+// rlu_self, included to make compiler happy
+__thread rlu_thread_data_t *rlu_self = NULL;
+
+// quadtree counter
+#ifdef QUADTREE_TEST
+uint64_t QUADTREE_NODE_COUNT = 0;
+#endif
+
+#define valid_node(n) Node_valid((Node*)(n))
+
+/*
+ * struct TmQuadtree_t
+ *
+ * A quadtree whose levels are fixed in advance, as in d-rlu: a point appears on every level up to
+ * get_level(point). Every operation runs as a single atomic transaction over the serial
+ * algorithm, so the transactions of updates to disjoint regions only conflict on the levels'
+ * roots and on tree.height.
+ *
+ * tree - the header, first so that a TmQuadtree can be used as a Quadtree; tree.root is the root
+ *     of the top level, and tree.height is the highest level that a point has been added to
+ * roots - the root square of each level, which spans the whole tree and is never collapsed
+ */
+typedef struct TmQuadtree_t {
+    Quadtree tree;
+    Node *roots[QUADTREE_LEVELS];
+} TmQuadtree;
+
+/*
+ * Node_init_internal
+ *
+ * Node_init, inlined for internal use inside transactions.
+ */
+safe static inline Node* Node_init_internal(const float64_t length, const Point center) {
+    Node *node = (Node*)malloc(sizeof(*node));
+    *node = (Node){
+        .is_square = false,
+        .length = length,
+        .center = center,
+        .down = NULL
+#ifdef QUADTREE_TEST
+        ,.id = QUADTREE_NODE_COUNT++
+#endif
+    };
+    uint64_t i;
+    for (i = 0; i < (1LL << D); i++) {
+        node->children[i] = NULL;
+    }
+    return node;
+}
+
+Node* Node_init(const float64_t length, const Point center) {
+    return Node_init_internal(length, center);
+}
+
+/*
+ * Node_free_internal
+ *
+ * Frees the memory used to represent this node, inlined for internal use. Inside a transaction,
+ * the memory is only released once the transaction commits.
+ *
+ * node - the node to be freed
+ */
+safe static inline void Node_free_internal(const Node * const node) {
+    free((Node*)node);
+}
+
+void Node_free(const Node * const node) {
+    Node_free_internal(node);
+}
+
+Quadtree* Quadtree_init(const float64_t length, const Point center) {
+    TmQuadtree *tree = (TmQuadtree*)malloc(sizeof(*tree));
+    uint64_t i;
+    for (i = 0; i < QUADTREE_LEVELS; i++) {
+        tree->roots[i] = Node_init(length, center);
+        tree->roots[i]->is_square = true;
+        tree->roots[i]->down = (0 == i ? NULL : tree->roots[i - 1]);
+    }
+    tree->tree = (Quadtree){
+        .height = 0,
+        .root = tree->roots[QUADTREE_LEVELS - 1],
+        .center = center,
+        .length = length
+    };
+    return (Quadtree*)tree;
+}
+
+/*
+ * search
+ *
+ * Quadtree_search, without the transaction.
+ */
+safe static bool search(const TmQuadtree * const tree, const Point * const point) {
+    // Descend each level as far as it goes, then drop to the same square on the level below.
+    const Node *square = tree->roots[tree->tree.height];
+    while (true) {
+        const Node * const child = square->children[get_quadrant(&square->center, point)];
+        if (!valid_node(child)) {
+            // Fall through to the level below.
+        } else if (child->is_square && in_range(child, point)) {
+            square = child;
+            continue;
+        } else if (!child->is_square && Point_equals(&child->center, point)) {
+            return true;
+        }
+
+        if (!valid_node(square->down)) {
+            return false;
+        }
+        square = square->down;
+    }
+}
+
+bool Quadtree_search(const Quadtree * const node, const Point point) {
+    const TmQuadtree * const tree = (TmQuadtree*)node;
+    if (!in_range(tree->roots[0], &point)) {
+        return false;
+    }
+
+    bool found;
+    __transaction_atomic {
+        found = search(tree, &point);
+    }
+    return found;
+}
+
+/*
+ * add
+ *
+ * Quadtree_add, without the transaction.
+ */
+safe static bool add(TmQuadtree * const tree, const Point * const point) {
+    const uint64_t level = get_level(point);
+    const uint64_t top = max(level, tree->tree.height);
+
+    // Find the square the point goes in on every level it is added to.
+    Node *parents[QUADTREE_LEVELS];
+    uint8_t quadrants[QUADTREE_LEVELS];
+    Node *parent = tree->roots[top];
+    int64_t l;
+    for (l = top; l >= 0; l--) {
+        uint8_t quadrant;
+        Node *child;
+        while (true) {
+            quadrant = get_quadrant(&parent->center, point);
+            child = parent->children[quadrant];
+            if (!valid_node(child) || !child->is_square || !in_range(child, point)) {
+                break;
+            }
+            parent = child;
+        }
+        if (valid_node(child) && !child->is_square && Point_equals(&child->center, point)) {
+            return false;
+        }
+        if (l <= (int64_t)level) {
+            parents[l] = parent;
+            quadrants[l] = quadrant;
+        }
+        parent = parent->down;
+    }
+
+    // Add from the bottom up, so that every new square has a square to point down to.
+    Node *below = NULL;
+    for (l = 0; l <= (int64_t)level; l++) {
+        Node * const parent = parents[l];
+        const uint8_t quadrant = quadrants[l];
+        Node * const sibling = parent->children[quadrant];
+
+        Node * const new_node = Node_init_internal(0, *point);
+        new_node->down = below;
+        below = new_node;
+
+        if (!valid_node(sibling)) {
+            parent->children[quadrant] = new_node;
+            continue;
+        }
+
+        // Compute the smallest square separating the point from its sibling.
+        Node * const new_square = Node_init_internal(parent->length, parent->center);
+        new_square->is_square = true;
+        uint8_t n_quadrant = quadrant, s_quadrant;
+        do {
+            new_square->center = get_new_center(new_square, n_quadrant);
+            new_square->length *= 0.5;
+            n_quadrant = get_quadrant(&new_square->center, point);
+            s_quadrant = get_quadrant(&new_square->center, &sibling->center);
+        } while (n_quadrant == s_quadrant);
+
+        // The same square exists on the level below, since both of its children are there.
+        if (valid_node(parent->down)) {
+            Node *down_square = parent->down;
+            while (down_square->length != new_square->length) {
+                down_square = down_square->children[get_quadrant(&down_square->center,
+                    &new_square->center)];
+            }
+            new_square->down = down_square;
+        }
+
+        new_square->children[n_quadrant] = new_node;
+        new_square->children[s_quadrant] = sibling;
+        parent->children[quadrant] = new_square;
+    }
+
+    if (tree->tree.height < level) {
+        tree->tree.height = level;
+    }
+    return true;
+}
+
+bool Quadtree_add(Quadtree * const node, const Point point) {
+    TmQuadtree * const tree = (TmQuadtree*)node;
+    if (!in_range(tree->roots[0], &point)) {
+        return false;
+    }
+
+    bool added;
+    __transaction_atomic {
+        added = add(tree, &point);
+    }
+    return added;
+}
+
+/*
+ * remove_point
+ *
+ * Quadtree_remove, without the transaction.
+ */
+safe static bool remove_point(TmQuadtree * const tree, const Point * const point) {
+    const int64_t top = tree->tree.height;
+
+    // Find the parent and grandparent of the point on every level, entering each level at the
+    // twin of the grandparent on the level above, so that the grandparent of every non-root parent
+    // is known.
+    Node *parents[QUADTREE_LEVELS], *grandparents[QUADTREE_LEVELS];
+    uint8_t quadrants[QUADTREE_LEVELS], parent_quadrants[QUADTREE_LEVELS];
+    int64_t found = -1, l;
+    Node *start = tree->roots[top];
+    for (l = top; l >= 0; l--) {
+        Node *grandparent = NULL, *parent = start, *child;
+        uint8_t quadrant, parent_quadrant = 0;
+        while (true) {
+            quadrant = get_quadrant(&parent->center, point);
+            child = parent->children[quadrant];
+            if (!valid_node(child) || !child->is_square || !in_range(child, point)) {
+                break;
+            }
+            grandparent = parent;
+            parent_quadrant = quadrant;
+            parent = child;
+        }
+        if (0 > found && valid_node(child) && !child->is_square &&
+                Point_equals(&child->center, point)) {
+            found = l;
+        }
+        parents[l] = parent;
+        grandparents[l] = grandparent;
+        quadrants[l] = quadrant;
+        parent_quadrants[l] = parent_quadrant;
+        start = (valid_node(grandparent) ? grandparent : parent)->down;
+    }
+
+    if (0 > found) {
+        return false;
+    }
+
+    // Remove from the top down, collapsing every parent that is left with a single child.
+    for (l = found; l >= 0; l--) {
+        Node * const parent = parents[l];
+        Node_free_internal(parent->children[quadrants[l]]);
+        parent->children[quadrants[l]] = NULL;
+
+        // Roots are never collapsed.
+        if (!valid_node(grandparents[l])) {
+            continue;
+        }
+
+        Node *remaining = NULL;
+        uint64_t i, nchildren = 0;
+        for (i = 0; i < (1LL << D); i++) {
+            if (valid_node(parent->children[i])) {
+                remaining = parent->children[i];
+                nchildren++;
+            }
+        }
+        if (1 == nchildren) {
+            grandparents[l]->children[parent_quadrants[l]] = remaining;
+            Node_free_internal(parent);
+        }
+    }
+    return true;
+}
+
+bool Quadtree_remove(Quadtree * const node, const Point point) {
+    TmQuadtree * const tree = (TmQuadtree*)node;
+    if (!in_range(tree->roots[0], &point)) {
+        return false;
+    }
+
+    bool removed;
+    __transaction_atomic {
+        removed = remove_point(tree, &point);
+    }
+    return removed;
+}
+
+uint64_t Quadtree_txn_commit(QuadtreeTxn * const txn) {
+    TmQuadtree * const tree = (TmQuadtree*)txn->tree;
+
+    // The updates run as one transaction, so none of them is seen until all of them are.
+    uint64_t applied = 0, i;
+    __transaction_atomic {
+        for (i = 0; i < txn->size; i++) {
+            QuadtreeReply * const update = txn->updates + i;
+            if (!in_range(tree->roots[0], &update->point)) {
+                update->result = false;
+            } else if (QUADTREE_ADD == update->operation) {
+                update->result = add(tree, &update->point);
+            } else {
+                update->result = remove_point(tree, &update->point);
+            }
+            applied += update->result;
+        }
+    }
+
+    free(txn->updates);
+    free(txn);
+    return applied;
+}
+
+void Quadtree_flush(Quadtree * const tree) {
+    // Updates are applied in place.
+}
+
+/*
+ * Quadtree_stats_internal
+ *
+ * Counts a square and every node below it on the same level, without the transaction.
+ *
+ * stats - the stats to count onto
+ * square - the square to count from
+ * bottom - whether the square is on the bottom level, whose points are the points of the tree
+ */
+safe static void Quadtree_stats_internal(QuadtreeStats * const stats, const Node * const square,
+        const bool bottom) {
+    uint64_t i;
+    for (i = 0; i < (1LL << D); i++) {
+        const Node * const child = square->children[i];
+        if (!valid_node(child)) {
+            continue;
+        }
+        if (child->is_square) {
+            Quadtree_stats_internal(stats, child, bottom);
+        } else {
+            stats->nodes++;
+            stats->size += bottom;
+        }
+    }
+    stats->nodes++;
+}
+
+QuadtreeStats Quadtree_stats(const Quadtree * const node) {
+    const TmQuadtree * const tree = (TmQuadtree*)node;
+    QuadtreeStats stats = (QuadtreeStats){ .size = 0, .height = 0, .nodes = 0 };
+
+    // Each level is counted in a transaction of its own, so that an update that conflicts with the
+    // walk only makes it count that level again.
+    uint64_t i;
+    for (i = 0; i < QUADTREE_LEVELS; i++) {
+        __transaction_atomic {
+            stats.height = tree->tree.height;
+            Quadtree_stats_internal(&stats, tree->roots[i], 0 == i);
+        }
+    }
+    return stats;
+}
+
+/*
+ * Quadtree_free_internal
+ *
+ * result - the result object to record data onto
+ * node - the node to recursively free
+ */
+void Quadtree_free_internal(QuadtreeFreeResult * result, const Node * const node) {
+    uint64_t i;
+    bool is_leaf = true;
+    for (i = 0; i < (1LL << D); i++) {
+        if (valid_node(node->children[i])) {
+            is_leaf = false;
+            Quadtree_free_internal(result, node->children[i]);
+        }
+    }
+    Node_free_internal(node);
+    result->total++;
+    result->leaf += is_leaf;
+}
+
+QuadtreeFreeResult Quadtree_free(Quadtree * const node) {
+    TmQuadtree * const tree = (TmQuadtree*)node;
+    QuadtreeFreeResult result = (QuadtreeFreeResult){ .total = 0, .leaf = 0, .levels = 0 };
+
+    int64_t i;
+    for (i = QUADTREE_LEVELS - 1; i >= 0; i--) {
+        Quadtree_free_internal(&result, tree->roots[i]);
+        result.levels++;
+    }
+
+    free(tree);
+
+    return result;
+}
@@ -9,9 +9,14 @@
 /////////////////////////////////////////////////////////////////////////////////////////
 
 #ifndef KERNEL
+# include <linux/futex.h>
+# include <linux/membarrier.h>
 # include <stdio.h>
 # include <stdlib.h>
 # include <string.h>
+# include <sys/syscall.h>
+# include <time.h>
+# include <unistd.h>
 # define likely(x) __builtin_expect ((x), 1)
 # define unlikely(x) __builtin_expect ((x), 0)
 #else /* KERNEL */
@@ -25,9 +30,24 @@
 # define fprintf(arg, ...) pr_err(__VA_ARGS__)
 # define free(ptr) kfree(ptr)
 # define malloc(size) kmalloc(size, GFP_KERNEL)
+# define node_alloc(size, level) malloc(size)
+# define node_free(ptr) free(ptr)
 #endif /* KERNEL */
 
 #include "rlu.h"
+#ifndef KERNEL
+# include "util.h"
+#endif /* KERNEL */
+
+// The NUMA node pools already recycle objects by size, and the kernel has its own slab caches
+#if !defined(KERNEL) && !defined(NUMA_POOLS)
+# define RLU_POOLS
+#endif
+
+// Exclusive sections need membarrier to stay fence-free; RLU_NO_EXCLUSIVE turns them off
+#if !defined(KERNEL) && !defined(RLU_NO_EXCLUSIVE)
+# define RLU_EXCLUSIVE
+#endif
 
 /////////////////////////////////////////////////////////////////////////////////////////
 // DEFINES - GENERAL
@@ -37,7 +57,7 @@
 
 #define LOCK_ID(th_id) (th_id + 1)
 
-#define WS_INDEX(ws_counter) ((ws_counter) % RLU_MAX_WRITE_SETS)
+#define WS_INDEX(self, ws_counter) ((ws_counter) % (self)->n_write_sets)
 
 #define ALIGN_NUMBER (8)
 #define ALIGN_MASK (ALIGN_NUMBER-1)
@@ -141,6 +161,14 @@
 
 #define Q_ITERS_LIMIT (100000000)
 
+// A pooled object is preceded by a granule whose first word holds its size class, or 0 if it is
+// not pooled. A whole granule keeps objects at the 16-byte alignment of the allocator.
+#define POOL_PREFIX_SIZE (RLU_POOL_GRANULE)
+#define POOL_H_TO_BLOCK(p_h_obj) ((intptr_t *)MOVE_PTR_BACK(p_h_obj, POOL_PREFIX_SIZE))
+#define POOL_BLOCK_TO_H(p_block) ((intptr_t *)MOVE_PTR_FORWARD(p_block, POOL_PREFIX_SIZE))
+// A free block is linked to the next one through the word after its prefix
+#define POOL_NEXT(p_block) (*(intptr_t **)POOL_BLOCK_TO_H(p_block))
+
 /////////////////////////////////////////////////////////////////////////////////////////
 // TYPES
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -156,9 +184,48 @@ typedef struct rlu_data {
 	volatile long n_aborts;
 	volatile long n_sync_requests;
 	volatile long n_sync_and_writeback;
+	volatile long n_writeback_bytes;
+	volatile long n_writeback_skipped_bytes;
+
+	volatile long n_threads;
+	volatile long n_thread_memory;
+	volatile long n_max_thread_memory;
+
+	volatile long n_pool_hits;
+	volatile long n_pool_misses;
+
+	volatile long n_q_sleeps;
+	volatile long n_q_shared;
+
+	volatile long n_writer_sync_waits;
+
+	volatile long n_exclusive;
 
 } rlu_data_t;
 
+#define LIVE_GROUP_WORDS ((RLU_MAX_THREAD_GROUPS + 63) / 64)
+
+// A group of registered threads. Scans for quiescence skip whole groups, and the threads of a
+// group that have finished, without touching their data.
+typedef struct rlu_thread_group {
+	volatile unsigned long live_mask;
+	volatile rlu_thread_data_t *threads[RLU_THREAD_GROUP_SIZE];
+} rlu_thread_group_t;
+
+typedef struct rlu_pool {
+	int is_active;
+	intptr_t *p_free[RLU_POOL_CLASSES + 1];
+	long n_free[RLU_POOL_CLASSES + 1];
+	long n_hits;
+	long n_misses;
+} rlu_pool_t;
+
+typedef struct rlu_pool_depot {
+	volatile long lock;
+	long n_batches;
+	intptr_t *batches[RLU_POOL_DEPOT_BATCHES];
+} rlu_pool_depot_t;
+
 /////////////////////////////////////////////////////////////////////////////////////////
 // GLOBALS
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -167,15 +234,39 @@ static volatile rlu_data_t g_rlu_data = {0,};
 static volatile int g_rlu_type = 0;
 static volatile int g_rlu_max_write_sets = 0;
 
+// Ids are handed out lowest first and given back when threads finish, so this is the most threads
+// ever registered at once rather than the number of threads ever registered
 static volatile long g_rlu_cur_threads = 0;
-static volatile rlu_thread_data_t *g_rlu_threads[RLU_MAX_THREADS] = {0,};
+static int g_rlu_is_exclusive_enabled = 0;
+static rlu_thread_group_t * volatile g_rlu_thread_groups[RLU_MAX_THREAD_GROUPS] = {0,};
+// One bit per group with a live thread, so that scans skip the groups with none
+static volatile unsigned long g_rlu_live_groups[LIVE_GROUP_WORDS] = {0,};
+// Held while a thread takes or gives back an id, which changes the live masks
+static volatile long g_rlu_registry_lock = 0;
 
 static volatile long g_rlu_writer_locks[RLU_MAX_WRITER_LOCKS] = {0,};
 
 static volatile long g_rlu_array[RLU_CACHE_LINE_SIZE * 64] = {0,};
 
+#ifdef RLU_POOLS
+static __thread rlu_pool_t g_rlu_pool;
+static rlu_pool_depot_t g_rlu_pool_depot[RLU_POOL_CLASSES + 1];
+#endif /* RLU_POOLS */
+
 #define g_rlu_writer_version g_rlu_array[RLU_CACHE_LINE_SIZE * 2]
 #define g_rlu_commit_version g_rlu_array[RLU_CACHE_LINE_SIZE * 4]
+// Every section that started before this writer version has ended
+#define g_rlu_quiescent_version g_rlu_array[RLU_CACHE_LINE_SIZE * 6]
+// Threads between rlu_thread_init and rlu_thread_finish
+#define g_rlu_live_threads g_rlu_array[RLU_CACHE_LINE_SIZE * 8]
+// The thread whose sections may run exclusively, or -1, and whether one is running
+#define g_rlu_exclusive_owner g_rlu_array[RLU_CACHE_LINE_SIZE * 10]
+#define g_rlu_exclusive_section g_rlu_array[RLU_CACHE_LINE_SIZE * 10 + 1]
+
+#define GROUP_OF(th_id) (g_rlu_thread_groups[(th_id) / RLU_THREAD_GROUP_SIZE])
+#define GROUP_BIT(group_id) (1UL << ((group_id) % 64))
+#define THREAD_BIT(th_id) (1UL << ((th_id) % RLU_THREAD_GROUP_SIZE))
+#define GET_THREAD(th_id) (GROUP_OF(th_id)->threads[(th_id) % RLU_THREAD_GROUP_SIZE])
 
 /////////////////////////////////////////////////////////
 // HELPER FUNCTIONS
@@ -253,19 +344,82 @@ static void rlu_reset(rlu_thread_data_t *self) {
 }
 
 static void rlu_reset_write_set(rlu_thread_data_t *self, long ws_counter) {
-	long ws_id = WS_INDEX(ws_counter);
-
-	self->obj_write_set[ws_id].num_of_objs = 0;
-	self->obj_write_set[ws_id].p_cur = (intptr_t *)&(self->obj_write_set[ws_id].buffer[0]);
+	long ws_id = WS_INDEX(self, ws_counter);
+	volatile obj_list_t *p_ws = &self->obj_write_set[ws_id];
+
+	p_ws->num_of_objs = 0;
+	p_ws->p_cur_chunk = p_ws->p_first_chunk;
+	if (p_ws->p_first_chunk != NULL) {
+		p_ws->p_first_chunk->p_end = NULL;
+		p_ws->p_cur = (intptr_t *)&(p_ws->p_first_chunk->buffer[0]);
+	} else {
+		p_ws->p_cur = NULL;
+	}
 	
 	rlu_reset_writer_locks(self, ws_id);
 }
 
+static void rlu_reserve_write_set(rlu_thread_data_t *self, obj_size_t obj_size) {
+	volatile obj_list_t *p_ws;
+	ws_chunk_t *p_chunk;
+	ws_chunk_t *p_next;
+	obj_size_t needed;
+	obj_size_t size;
+
+	p_ws = &self->obj_write_set[self->ws_cur_id];
+	p_chunk = p_ws->p_cur_chunk;
+	needed = WS_OBJ_HEADER_SIZE + OBJ_HEADER_SIZE + ALIGN_OBJ_SIZE(obj_size);
+
+	if ((p_chunk != NULL) &&
+		((long)p_ws->p_cur + needed <= (long)&(p_chunk->buffer[p_chunk->size]))) {
+		return;
+	}
+
+	// Objects never straddle chunks: close the current chunk and move on to the next one,
+	// reusing it if it is large enough
+	if ((p_chunk != NULL) && (p_chunk->p_next != NULL) && (p_chunk->p_next->size >= needed)) {
+		p_next = p_chunk->p_next;
+	} else {
+		size = needed > RLU_WRITE_SET_CHUNK_SIZE ? needed : RLU_WRITE_SET_CHUNK_SIZE;
+		p_next = (ws_chunk_t *)malloc(sizeof(ws_chunk_t) + size);
+		RLU_ASSERT(p_next != NULL);
+		p_next->size = size;
+
+		TRACE_3(self, "new write-set chunk of size %zu.\n", size);
+
+		if (p_chunk == NULL) {
+			p_next->p_next = NULL;
+			p_ws->p_first_chunk = p_next;
+		} else {
+			p_next->p_next = p_chunk->p_next;
+			p_chunk->p_next = p_next;
+		}
+	}
+
+	if (p_chunk != NULL) {
+		p_chunk->p_end = p_ws->p_cur;
+	}
+	p_next->p_end = NULL;
+	p_ws->p_cur_chunk = p_next;
+	p_ws->p_cur = (intptr_t *)&(p_next->buffer[0]);
+}
+
+static intptr_t *rlu_next_ws_obj(ws_chunk_t **p_p_chunk, intptr_t *p_cur) {
+	while (p_cur == (*p_p_chunk)->p_end) {
+		*p_p_chunk = (*p_p_chunk)->p_next;
+		p_cur = (intptr_t *)&((*p_p_chunk)->buffer[0]);
+	}
+
+	return p_cur;
+}
+
 static intptr_t *rlu_add_ws_obj_header_to_write_set(rlu_thread_data_t *self, intptr_t *p_obj, obj_size_t obj_size) {
 	intptr_t *p_cur;
 	rlu_ws_obj_header_t *p_ws_obj_h;
 	rlu_obj_header_t *p_obj_h;
 
+	rlu_reserve_write_set(self, obj_size);
+
 	p_cur = (intptr_t *)self->obj_write_set[self->ws_cur_id].p_cur;
 
 	p_ws_obj_h = (rlu_ws_obj_header_t *)p_cur;
@@ -301,8 +455,43 @@ static void rlu_add_obj_copy_to_write_set(rlu_thread_data_t *self, intptr_t *p_o
 	self->obj_write_set[self->ws_cur_id].p_cur = p_cur;
 	self->obj_write_set[self->ws_cur_id].num_of_objs++;
 
-	cur_ws_size = (long)p_cur - (long)self->obj_write_set[self->ws_cur_id].buffer;
-	RLU_ASSERT(cur_ws_size < RLU_MAX_WRITE_SET_BUFFER_SIZE);
+	cur_ws_size = (long)p_cur - (long)self->obj_write_set[self->ws_cur_id].p_cur_chunk->buffer;
+	RLU_ASSERT(cur_ws_size <= (long)self->obj_write_set[self->ws_cur_id].p_cur_chunk->size);
+}
+
+// Writes back only the words of a large object that its copy changed, so that the cache lines of
+// the object that were not written stay shared with readers. The object itself cannot have changed
+// since it was copied, since it has been locked ever since.
+static void rlu_writeback_obj(rlu_thread_data_t *self, intptr_t *p_obj_actual, intptr_t *p_obj_copy,
+		obj_size_t obj_size) {
+	long i;
+	long n_words;
+	long n_written;
+
+	if (obj_size < RLU_FIELD_WRITEBACK_MIN_SIZE) {
+		memcpy((unsigned char *)p_obj_actual, (unsigned char *)p_obj_copy, obj_size);
+		self->n_writeback_bytes += obj_size;
+		return;
+	}
+
+	n_words = obj_size / sizeof(intptr_t);
+	n_written = 0;
+	for (i = 0; i < n_words; i++) {
+		if (p_obj_actual[i] != p_obj_copy[i]) {
+			p_obj_actual[i] = p_obj_copy[i];
+			n_written++;
+		}
+	}
+	n_written *= sizeof(intptr_t);
+
+	if (obj_size > n_words * sizeof(intptr_t)) {
+		memcpy((unsigned char *)&p_obj_actual[n_words], (unsigned char *)&p_obj_copy[n_words],
+			obj_size - n_words * sizeof(intptr_t));
+		n_written += obj_size - n_words * sizeof(intptr_t);
+	}
+
+	self->n_writeback_bytes += n_written;
+	self->n_writeback_skipped_bytes += obj_size - n_written;
 }
 
 static void rlu_writeback_write_set(rlu_thread_data_t *self, long ws_counter) {
@@ -314,13 +503,16 @@ static void rlu_writeback_write_set(rlu_thread_data_t *self, long ws_counter) {
 	intptr_t *p_obj_actual;
 	rlu_ws_obj_header_t *p_ws_obj_h;
 	rlu_obj_header_t *p_obj_h;
+	ws_chunk_t *p_chunk;
 
-	ws_id = WS_INDEX(ws_counter);
+	ws_id = WS_INDEX(self, ws_counter);
 
-	p_cur = (intptr_t *)&(self->obj_write_set[ws_id].buffer[0]);
+	p_chunk = self->obj_write_set[ws_id].p_first_chunk;
+	p_cur = (p_chunk != NULL) ? (intptr_t *)&(p_chunk->buffer[0]) : NULL;
 
 	for (i = 0; i < self->obj_write_set[ws_id].num_of_objs; i++) {
 
+		p_cur = rlu_next_ws_obj(&p_chunk, p_cur);
 		p_ws_obj_h = (rlu_ws_obj_header_t *)p_cur;
 
 		p_obj_actual = (intptr_t *)p_ws_obj_h->p_obj_actual;
@@ -338,7 +530,7 @@ static void rlu_writeback_write_set(rlu_thread_data_t *self, long ws_counter) {
 		TRACE_2(self, "[%ld] rlu_writeback_and_unlock: copy [%p] <- [%p] [%zu]\n",
 			self->writer_version, p_obj_actual, p_obj_copy, obj_size);
 
-		memcpy((unsigned char *)p_obj_actual, (unsigned char *)p_obj_copy, obj_size);
+		rlu_writeback_obj(self, p_obj_actual, p_obj_copy, obj_size);
 
 		p_cur = MOVE_PTR_FORWARD(p_cur, ALIGN_OBJ_SIZE(obj_size));
 
@@ -383,13 +575,16 @@ static void rlu_unlock_objs(rlu_thread_data_t *self, int ws_counter) {
 	intptr_t *p_obj_actual;
 	rlu_ws_obj_header_t *p_ws_obj_h;
 	rlu_obj_header_t *p_obj_h;
+	ws_chunk_t *p_chunk;
 
-	ws_id = WS_INDEX(ws_counter);
+	ws_id = WS_INDEX(self, ws_counter);
 
-	p_cur = (intptr_t *)&(self->obj_write_set[ws_id].buffer[0]);
+	p_chunk = self->obj_write_set[ws_id].p_first_chunk;
+	p_cur = (p_chunk != NULL) ? (intptr_t *)&(p_chunk->buffer[0]) : NULL;
 
 	for (i = 0; i < self->obj_write_set[ws_id].num_of_objs; i++) {
 
+		p_cur = rlu_next_ws_obj(&p_chunk, p_cur);
 		p_ws_obj_h = (rlu_ws_obj_header_t *)p_cur;
 
 		p_obj_actual = (intptr_t *)p_ws_obj_h->p_obj_actual;
@@ -429,15 +624,202 @@ static void rlu_register_thread(rlu_thread_data_t *self) {
 	self->local_commit_version = g_rlu_commit_version;
 }
 
+static void rlu_wake_sleepers(rlu_thread_data_t *self);
+
 static void rlu_unregister_thread(rlu_thread_data_t *self) {
 	RLU_ASSERT((self->run_counter & 0x1) != 0);
 
 	self->run_counter++;
+
+	if (unlikely(self->q_waiters != 0)) {
+		rlu_wake_sleepers(self);
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Object pools
+/////////////////////////////////////////////////////////////////////////////////////////
+#ifdef RLU_POOLS
+static void rlu_pool_lock_depot(rlu_pool_depot_t *p_depot) {
+	while ((p_depot->lock != 0) || (CAS(&p_depot->lock, 0, 1) != 0)) {
+		CPU_RELAX();
+	}
+}
+
+static void rlu_pool_unlock_depot(rlu_pool_depot_t *p_depot) {
+	MEMBARSTLD();
+	p_depot->lock = 0;
+}
+
+static void rlu_pool_free_batch(intptr_t *p_block) {
+	intptr_t *p_next;
+
+	while (p_block != NULL) {
+		p_next = POOL_NEXT(p_block);
+		node_free(p_block);
+		p_block = p_next;
+	}
+}
+
+// Moves up to RLU_POOL_BATCH objects of a size class from the thread pool to the depot
+static void rlu_pool_spill(long cls) {
+	rlu_pool_depot_t *p_depot = &g_rlu_pool_depot[cls];
+	intptr_t *p_batch;
+	intptr_t *p_last;
+	long n_objs;
+
+	p_batch = g_rlu_pool.p_free[cls];
+	p_last = p_batch;
+	for (n_objs = 1; (n_objs < RLU_POOL_BATCH) && (POOL_NEXT(p_last) != NULL); n_objs++) {
+		p_last = POOL_NEXT(p_last);
+	}
+	g_rlu_pool.p_free[cls] = POOL_NEXT(p_last);
+	g_rlu_pool.n_free[cls] -= n_objs;
+	POOL_NEXT(p_last) = NULL;
+
+	rlu_pool_lock_depot(p_depot);
+	if (p_depot->n_batches < RLU_POOL_DEPOT_BATCHES) {
+		p_depot->batches[p_depot->n_batches++] = p_batch;
+		p_batch = NULL;
+	}
+	rlu_pool_unlock_depot(p_depot);
+
+	rlu_pool_free_batch(p_batch);
+}
+
+// Takes a batch of objects of a size class from the depot into the empty thread pool
+static void rlu_pool_refill(long cls) {
+	rlu_pool_depot_t *p_depot = &g_rlu_pool_depot[cls];
+	intptr_t *p_block;
+	long n_objs;
+
+	if (p_depot->n_batches == 0) {
+		return;
+	}
+
+	rlu_pool_lock_depot(p_depot);
+	p_block = p_depot->n_batches > 0 ? p_depot->batches[--p_depot->n_batches] : NULL;
+	rlu_pool_unlock_depot(p_depot);
+
+	g_rlu_pool.p_free[cls] = p_block;
+	for (n_objs = 0; p_block != NULL; p_block = POOL_NEXT(p_block)) {
+		n_objs++;
+	}
+	g_rlu_pool.n_free[cls] = n_objs;
+}
+
+static intptr_t *rlu_pool_alloc(obj_size_t size, unsigned long level) {
+	long cls;
+	intptr_t *p_block;
+
+	cls = (POOL_PREFIX_SIZE + size + RLU_POOL_GRANULE - 1) / RLU_POOL_GRANULE;
+	if (cls > RLU_POOL_CLASSES) {
+		p_block = (intptr_t *)node_alloc(POOL_PREFIX_SIZE + size, level);
+		if (p_block == NULL) {
+			return NULL;
+		}
+		*p_block = 0;
+		return POOL_BLOCK_TO_H(p_block);
+	}
+
+	p_block = NULL;
+	if (g_rlu_pool.is_active) {
+		if (g_rlu_pool.p_free[cls] == NULL) {
+			rlu_pool_refill(cls);
+		}
+		p_block = g_rlu_pool.p_free[cls];
+	}
+
+	if (p_block != NULL) {
+		g_rlu_pool.p_free[cls] = POOL_NEXT(p_block);
+		g_rlu_pool.n_free[cls]--;
+		g_rlu_pool.n_hits++;
+	} else {
+		p_block = (intptr_t *)node_alloc(cls * RLU_POOL_GRANULE, level);
+		if (p_block == NULL) {
+			return NULL;
+		}
+		*p_block = cls;
+		g_rlu_pool.n_misses++;
+	}
+
+	return POOL_BLOCK_TO_H(p_block);
+}
+
+// Objects are only freed once no reader can reach them, and go to the pool of the freeing thread
+// if it is registered; the pool of any other thread would never be flushed
+static void rlu_pool_free(intptr_t *p_h_obj) {
+	intptr_t *p_block;
+	long cls;
+
+	p_block = POOL_H_TO_BLOCK(p_h_obj);
+	cls = *p_block;
+	if ((cls == 0) || !g_rlu_pool.is_active) {
+		node_free(p_block);
+		return;
+	}
+
+	POOL_NEXT(p_block) = g_rlu_pool.p_free[cls];
+	g_rlu_pool.p_free[cls] = p_block;
+	g_rlu_pool.n_free[cls]++;
+
+	if (g_rlu_pool.n_free[cls] > RLU_POOL_MAX_OBJS) {
+		rlu_pool_spill(cls);
+	}
 }
 
+// Lets the registering thread keep objects in its pool until it finishes
+static void rlu_pool_start() {
+	g_rlu_pool.is_active = 1;
+}
+
+// Hands every object of the thread pool over to the depot, as the thread finishes
+static void rlu_pool_flush(rlu_thread_data_t *self) {
+	long cls;
+
+	for (cls = 1; cls <= RLU_POOL_CLASSES; cls++) {
+		while (g_rlu_pool.p_free[cls] != NULL) {
+			rlu_pool_spill(cls);
+		}
+	}
+
+	self->n_pool_hits += g_rlu_pool.n_hits;
+	self->n_pool_misses += g_rlu_pool.n_misses;
+	g_rlu_pool.n_hits = 0;
+	g_rlu_pool.n_misses = 0;
+	g_rlu_pool.is_active = 0;
+}
+#else /* RLU_POOLS */
+# define rlu_pool_alloc(size, level) ((intptr_t *)node_alloc(size, level))
+# define rlu_pool_free(p_h_obj) node_free(p_h_obj)
+# define rlu_pool_start()
+# define rlu_pool_flush(self)
+#endif /* RLU_POOLS */
+
 /////////////////////////////////////////////////////////////////////////////////////////
 // Free buffer processing
 /////////////////////////////////////////////////////////////////////////////////////////
+static void rlu_grow_free_nodes(rlu_thread_data_t *self) {
+	long capacity;
+	intptr_t **free_nodes;
+
+	capacity = self->free_nodes_capacity == 0 ?
+		RLU_INIT_FREE_NODES : self->free_nodes_capacity * 2;
+
+	free_nodes = (intptr_t **)malloc(sizeof(intptr_t *) * capacity);
+	RLU_ASSERT(free_nodes != NULL);
+
+	if (self->free_nodes != NULL) {
+		memcpy(free_nodes, self->free_nodes, sizeof(intptr_t *) * self->free_nodes_size);
+		free(self->free_nodes);
+	}
+
+	TRACE_3(self, "grew free_nodes to %ld.\n", capacity);
+
+	self->free_nodes = free_nodes;
+	self->free_nodes_capacity = capacity;
+}
+
 static void rlu_process_free(rlu_thread_data_t *self) {
 	int i;
 	intptr_t *p_obj;
@@ -454,7 +836,7 @@ static void rlu_process_free(rlu_thread_data_t *self) {
 		TRACE_3(self, "freeing: p_obj = %p, p_actual = %p\n",
 			p_obj, (intptr_t *)OBJ_TO_H(p_obj));
 
-		free((intptr_t *)OBJ_TO_H(p_obj));
+		rlu_pool_free((intptr_t *)OBJ_TO_H(p_obj));
 	}
 
 	self->free_nodes_size = 0;
@@ -465,68 +847,159 @@ static void rlu_process_free(rlu_thread_data_t *self) {
 // Sync
 /////////////////////////////////////////////////////////////////////////////////////////
 static void rlu_init_quiescence(rlu_thread_data_t *self) {
-	int th_id;
+	long th_id;
+	long group_id;
+	long word;
+	long cur_threads;
+	unsigned long group_mask;
+	unsigned long live_mask;
+	rlu_thread_group_t *p_group;
+	volatile rlu_thread_data_t *p_th;
+	wait_entry_t *p_entry;
 
 	MEMBARSTLD();
 
-	for (th_id = 0; th_id < g_rlu_cur_threads; th_id++) {
-
-		self->q_threads[th_id].is_wait = 0;
+	cur_threads = g_rlu_cur_threads;
+	if (cur_threads > self->q_threads_capacity) {
+		free(self->q_threads);
+		self->q_threads_capacity = 2 * cur_threads;
+		self->q_threads = (wait_entry_t *)malloc(sizeof(wait_entry_t) * self->q_threads_capacity);
+		RLU_ASSERT(self->q_threads != NULL);
+	}
+	self->q_threads_size = 0;
+
+	// Only groups with a live thread, and only threads that have not finished, can be running
+	for (word = 0; word * 64 * RLU_THREAD_GROUP_SIZE < cur_threads; word++) {
+		group_mask = g_rlu_live_groups[word];
+		while (group_mask != 0) {
+			group_id = word * 64 + __builtin_ctzl(group_mask);
+			group_mask &= group_mask - 1;
+
+			p_group = g_rlu_thread_groups[group_id];
+			if (p_group == NULL) {
+				// No need to wait for uninitialized threads
+				continue;
+			}
 
-		if (th_id == self->uniq_id) {
-			// No need to wait for myself
-			continue;
-		}
+			live_mask = p_group->live_mask;
+			while (live_mask != 0) {
+				th_id = group_id * RLU_THREAD_GROUP_SIZE + __builtin_ctzl(live_mask);
+				live_mask &= live_mask - 1;
 
-		if (g_rlu_threads[th_id] == NULL) {
-			// No need to wait for uninitialized threads
-			continue;
-		}
+				if ((th_id == self->uniq_id) || (th_id >= cur_threads)) {
+					// No need to wait for myself
+					continue;
+				}
 
-		self->q_threads[th_id].run_counter = g_rlu_threads[th_id]->run_counter;
+				p_th = p_group->threads[th_id % RLU_THREAD_GROUP_SIZE];
+				if (p_th == NULL) {
+					continue;
+				}
 
-		if (self->q_threads[th_id].run_counter & 0x1) {
-			// The other thread is running -> wait for the thread
-			self->q_threads[th_id].is_wait = 1;	
+				// Only the threads that are running need to be waited for
+				p_entry = &self->q_threads[self->q_threads_size];
+				p_entry->run_counter = p_th->run_counter;
+				if (p_entry->run_counter & 0x1) {
+					p_entry->th_id = th_id;
+					p_entry->p_th = p_th;
+					p_entry->is_wait = 1;
+					self->q_threads_size++;
+				}
+			}
 		}
 	}
 }
 
+// Sleeps until the other thread leaves the section it was in when the wait began. A reader only
+// checks for sleepers after it leaves, without a barrier, so the sleep is bounded in case the
+// reader missed this one.
+static void rlu_sleep_on_thread(rlu_thread_data_t *self, volatile rlu_thread_data_t *p_th,
+		unsigned long run_counter) {
+#ifndef KERNEL
+	struct timespec timeout = { .tv_sec = 0, .tv_nsec = RLU_Q_SLEEP_NS };
+	int futex;
+
+	FETCH_AND_ADD(&p_th->q_waiters, 1);
+	futex = p_th->q_futex;
+	if (p_th->run_counter == run_counter) {
+		syscall(SYS_futex, &p_th->q_futex, FUTEX_WAIT_PRIVATE, futex, &timeout, NULL, 0);
+		self->n_q_sleeps++;
+	}
+	FETCH_AND_ADD(&p_th->q_waiters, -1);
+#else /* KERNEL */
+	CPU_RELAX();
+#endif /* KERNEL */
+}
+
+static void rlu_wake_sleepers(rlu_thread_data_t *self) {
+#ifndef KERNEL
+	FETCH_AND_ADD(&self->q_futex, 1);
+	syscall(SYS_futex, &self->q_futex, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#endif /* KERNEL */
+}
+
 static long rlu_wait_for_quiescence(rlu_thread_data_t *self, long version_limit) {
-	int th_id;
+	long q_id;
+	long th_id;
 	long iters;
-	long cur_threads;
+	long spins;
+	long quiescent_version;
+	volatile rlu_thread_data_t *p_th;
+	wait_entry_t *p_entry;
 
 	iters = 0;
-	cur_threads = g_rlu_cur_threads;
-	for (th_id = 0; th_id < cur_threads; th_id++) {
+	for (q_id = 0; q_id < self->q_threads_size; q_id++) {
+
+		p_entry = &self->q_threads[q_id];
+		th_id = p_entry->th_id;
+		p_th = p_entry->p_th;
+		spins = 0;
 
-		while (self->q_threads[th_id].is_wait) {
+		while (p_entry->is_wait) {
 			iters++;
 
-			if (self->q_threads[th_id].run_counter != g_rlu_threads[th_id]->run_counter) {
-				self->q_threads[th_id].is_wait = 0;
+			if (p_entry->run_counter != p_th->run_counter) {
+				p_entry->is_wait = 0;
 				break;
 			}
 
 			if (version_limit) {
-				if (g_rlu_threads[th_id]->local_version >= version_limit) {
-					self->q_threads[th_id].is_wait = 0;
+				if (p_th->local_version >= version_limit) {
+					p_entry->is_wait = 0;
 					break;
 				}
+
+				// A writer with the same or a later version has already waited for every
+				// section this one is waiting for
+				if (g_rlu_quiescent_version >= version_limit) {
+					self->n_q_shared++;
+					return iters;
+				}
 			}
 
 			if (iters > Q_ITERS_LIMIT) {
 				iters = 0;
-				printf("[%ld] waiting for [%d] with: local_version = %ld , run_cnt = %ld\n", self->uniq_id, th_id,
-					g_rlu_threads[th_id]->local_version, g_rlu_threads[th_id]->run_counter);
+				printf("[%ld] waiting for [%ld] with: local_version = %ld , run_cnt = %ld\n", self->uniq_id, th_id,
+					p_th->local_version, p_th->run_counter);
 			}
 
-			CPU_RELAX();
+			if (++spins < RLU_Q_SPIN_ITERS) {
+				CPU_RELAX();
+			} else {
+				rlu_sleep_on_thread(self, p_th, p_entry->run_counter);
+				spins = 0;
+			}
 
 		}
 	}
 
+	// Let writers that are still waiting for an earlier version stop
+	if (version_limit) {
+		quiescent_version = g_rlu_quiescent_version;
+		while (quiescent_version < version_limit) {
+			quiescent_version = CAS(&g_rlu_quiescent_version, quiescent_version, version_limit);
+		}
+	}
 
 	return iters;
 }
@@ -538,6 +1011,8 @@ static void rlu_synchronize(rlu_thread_data_t *self) {
 		return;
 	}
 
+	self->n_writer_sync_waits++;
+
 	rlu_init_quiescence(self);
 
 	q_iters = rlu_wait_for_quiescence(self, self->writer_version);
@@ -585,7 +1060,7 @@ static void rlu_sync_and_writeback(rlu_thread_data_t *self) {
 }
 
 static void rlu_send_sync_request(int other_th_id) {
-	g_rlu_threads[other_th_id]->is_sync++;
+	GET_THREAD(other_th_id)->is_sync++;
 	MEMBARSTLD();
 }
 
@@ -595,18 +1070,131 @@ static void rlu_commit_write_set(rlu_thread_data_t *self) {
 
 	// Move to the next write-set
 	self->ws_tail_counter++;
-	self->ws_cur_id = WS_INDEX(self->ws_tail_counter);
+	self->ws_cur_id = WS_INDEX(self, self->ws_tail_counter);
 
 	// Sync and writeback when:
 	// (1) All write-sets are full
 	// (2) Aggregared MAX_ACTUAL_WRITE_SETS
-	if ((WS_INDEX(self->ws_tail_counter) == WS_INDEX(self->ws_head_counter)) ||
+	if ((WS_INDEX(self, self->ws_tail_counter) == WS_INDEX(self, self->ws_head_counter)) ||
 		((self->ws_tail_counter - self->ws_wb_counter) >= self->max_write_sets)) {
 		rlu_sync_and_writeback(self);
 	}
 
 	RLU_ASSERT(self->ws_tail_counter > self->ws_head_counter);
-	RLU_ASSERT(WS_INDEX(self->ws_tail_counter) != WS_INDEX(self->ws_head_counter));
+	RLU_ASSERT(WS_INDEX(self, self->ws_tail_counter) != WS_INDEX(self, self->ws_head_counter));
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Memory statistics
+/////////////////////////////////////////////////////////////////////////////////////////
+static void rlu_record_thread_memory(rlu_thread_data_t *self) {
+	long ws_counter;
+	long memory;
+	long max_memory;
+	ws_chunk_t *p_chunk;
+
+	memory = sizeof(rlu_thread_data_t);
+	memory += sizeof(obj_list_t) * self->n_write_sets;
+	memory += sizeof(intptr_t *) * self->free_nodes_capacity;
+
+	for (ws_counter = 0; ws_counter < self->n_write_sets; ws_counter++) {
+		p_chunk = self->obj_write_set[ws_counter].p_first_chunk;
+		for (; p_chunk != NULL; p_chunk = p_chunk->p_next) {
+			memory += sizeof(ws_chunk_t) + p_chunk->size;
+		}
+	}
+
+	FETCH_AND_ADD(&g_rlu_data.n_threads, 1);
+	FETCH_AND_ADD(&g_rlu_data.n_thread_memory, memory);
+
+	max_memory = g_rlu_data.n_max_thread_memory;
+	while (max_memory < memory) {
+		max_memory = CAS(&g_rlu_data.n_max_thread_memory, max_memory, memory);
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Exclusive sections
+/////////////////////////////////////////////////////////////////////////////////////////
+// The owner announces a section and then checks that it is still alone, while a registering
+// thread counts itself and then waits for any announced section. Neither side fences: the
+// registering thread makes the owner fence with membarrier instead, so that exclusive sections
+// cost no atomic at all.
+
+static void rlu_init_exclusive(void) {
+	g_rlu_exclusive_owner = -1;
+	g_rlu_exclusive_section = 0;
+#ifdef RLU_EXCLUSIVE
+	g_rlu_is_exclusive_enabled =
+		(syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0);
+#endif /* RLU_EXCLUSIVE */
+}
+
+static void rlu_wait_for_exclusive_section(void) {
+#ifdef RLU_EXCLUSIVE
+	if (!g_rlu_is_exclusive_enabled) {
+		return;
+	}
+
+	syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0);
+
+	while (g_rlu_exclusive_section) {
+		CPU_RELAX();
+	}
+#endif /* RLU_EXCLUSIVE */
+}
+
+static void rlu_release_exclusive(rlu_thread_data_t *self) {
+	if (self->is_exclusive_owner) {
+		self->is_exclusive_owner = 0;
+		g_rlu_exclusive_owner = -1;
+	}
+}
+
+static int rlu_enter_exclusive(rlu_thread_data_t *self) {
+	if (likely(g_rlu_live_threads != 1)) {
+		rlu_release_exclusive(self);
+		return 0;
+	}
+
+	if (unlikely(!self->is_exclusive_owner)) {
+		if (!g_rlu_is_exclusive_enabled || (self->type != RLU_TYPE_FINE_GRAINED)) {
+			return 0;
+		}
+
+		// Objects locked by deferred write-sets must be written back before they are written in
+		// place
+		if (self->ws_tail_counter != self->ws_wb_counter) {
+			rlu_sync_and_writeback(self);
+		}
+
+		if (CAS(&g_rlu_exclusive_owner, -1, self->uniq_id) != -1) {
+			return 0;
+		}
+		self->is_exclusive_owner = 1;
+	}
+
+	g_rlu_exclusive_section = 1;
+	__asm__ __volatile__("" : : : "memory");
+
+	if (unlikely(g_rlu_live_threads != 1)) {
+		g_rlu_exclusive_section = 0;
+		rlu_release_exclusive(self);
+		return 0;
+	}
+
+	self->is_exclusive = 1;
+	self->is_write_detected = 0;
+	self->is_check_locks = 0;
+	self->n_exclusive++;
+
+	return 1;
+}
+
+static void rlu_leave_exclusive(rlu_thread_data_t *self) {
+	self->is_exclusive = 0;
+	__asm__ __volatile__("" : : : "memory");
+	g_rlu_exclusive_section = 0;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -615,6 +1203,8 @@ static void rlu_commit_write_set(rlu_thread_data_t *self) {
 void rlu_init(int type, int max_write_sets) {
 	g_rlu_writer_version = 0;
 	g_rlu_commit_version = 0;
+	g_rlu_quiescent_version = 0;
+	rlu_init_exclusive();
 	
 	if (type == RLU_TYPE_COARSE_GRAINED) {
 		g_rlu_type = RLU_TYPE_COARSE_GRAINED;
@@ -631,13 +1221,121 @@ void rlu_init(int type, int max_write_sets) {
 		abort();
 	}
 
-	RLU_ASSERT(RLU_MAX_WRITE_SETS >= 2);	
 	RLU_ASSERT(max_write_sets >= 1);
-	RLU_ASSERT(max_write_sets * 2 <= RLU_MAX_WRITE_SETS);
 }
 
 void rlu_finish(void) { }
 
+long rlu_get_n_threads(void) {
+	return g_rlu_cur_threads;
+}
+
+static void rlu_add_thread_stats(rlu_stats_t *p_stats, volatile rlu_thread_data_t *p_th) {
+	p_stats->n_starts += p_th->n_starts;
+	p_stats->n_finish += p_th->n_finish;
+	p_stats->n_writers += p_th->n_writers;
+	p_stats->n_writer_writeback += p_th->n_writer_writeback;
+	p_stats->n_pure_readers += p_th->n_pure_readers;
+	p_stats->n_aborts += p_th->n_aborts;
+	p_stats->n_steals += p_th->n_steals;
+	p_stats->n_writer_sync_waits += p_th->n_writer_sync_waits;
+	p_stats->n_writeback_q_iters += p_th->n_writeback_q_iters;
+	p_stats->n_sync_requests += p_th->n_sync_requests;
+	p_stats->n_sync_and_writeback += p_th->n_sync_and_writeback;
+	p_stats->n_writeback_bytes += p_th->n_writeback_bytes;
+	p_stats->n_writeback_skipped_bytes += p_th->n_writeback_skipped_bytes;
+	p_stats->n_pool_hits += p_th->n_pool_hits;
+	p_stats->n_pool_misses += p_th->n_pool_misses;
+	p_stats->n_q_sleeps += p_th->n_q_sleeps;
+	p_stats->n_q_shared += p_th->n_q_shared;
+	p_stats->n_exclusive += p_th->n_exclusive;
+}
+
+// Sums the counters of finished threads with the current counters of running ones. The counters
+// are read without stopping anyone, so a thread finishing meanwhile may be counted twice or not
+// at all.
+void rlu_get_stats(rlu_stats_t *p_stats) {
+	long th_id;
+	long group_id;
+	long word;
+	long cur_threads;
+	unsigned long group_mask;
+	unsigned long live_mask;
+	rlu_thread_group_t *p_group;
+	volatile rlu_thread_data_t *p_th;
+
+	memset(p_stats, 0, sizeof(rlu_stats_t));
+
+	cur_threads = g_rlu_cur_threads;
+	for (word = 0; word * 64 * RLU_THREAD_GROUP_SIZE < cur_threads; word++) {
+		group_mask = g_rlu_live_groups[word];
+		while (group_mask != 0) {
+			group_id = word * 64 + __builtin_ctzl(group_mask);
+			group_mask &= group_mask - 1;
+
+			p_group = g_rlu_thread_groups[group_id];
+			if (p_group == NULL) {
+				continue;
+			}
+
+			live_mask = p_group->live_mask;
+			while (live_mask != 0) {
+				th_id = group_id * RLU_THREAD_GROUP_SIZE + __builtin_ctzl(live_mask);
+				live_mask &= live_mask - 1;
+
+				p_th = p_group->threads[th_id % RLU_THREAD_GROUP_SIZE];
+				if (p_th != NULL) {
+					rlu_add_thread_stats(p_stats, p_th);
+				}
+			}
+		}
+	}
+
+	p_stats->n_starts += g_rlu_data.n_starts;
+	p_stats->n_finish += g_rlu_data.n_finish;
+	p_stats->n_writers += g_rlu_data.n_writers;
+	p_stats->n_writer_writeback += g_rlu_data.n_writer_writeback;
+	p_stats->n_pure_readers += g_rlu_data.n_pure_readers;
+	p_stats->n_aborts += g_rlu_data.n_aborts;
+	p_stats->n_steals += g_rlu_data.n_steals;
+	p_stats->n_writer_sync_waits += g_rlu_data.n_writer_sync_waits;
+	p_stats->n_writeback_q_iters += g_rlu_data.n_writeback_q_iters;
+	p_stats->n_sync_requests += g_rlu_data.n_sync_requests;
+	p_stats->n_sync_and_writeback += g_rlu_data.n_sync_and_writeback;
+	p_stats->n_writeback_bytes += g_rlu_data.n_writeback_bytes;
+	p_stats->n_writeback_skipped_bytes += g_rlu_data.n_writeback_skipped_bytes;
+	p_stats->n_pool_hits += g_rlu_data.n_pool_hits;
+	p_stats->n_pool_misses += g_rlu_data.n_pool_misses;
+	p_stats->n_q_sleeps += g_rlu_data.n_q_sleeps;
+	p_stats->n_q_shared += g_rlu_data.n_q_shared;
+	p_stats->n_exclusive += g_rlu_data.n_exclusive;
+}
+
+// Returns 0 and zero counters if the thread is not running.
+int rlu_get_thread_stats(long th_id, rlu_stats_t *p_stats) {
+	rlu_thread_group_t *p_group;
+	volatile rlu_thread_data_t *p_th;
+
+	memset(p_stats, 0, sizeof(rlu_stats_t));
+
+	if ((th_id < 0) || (th_id >= g_rlu_cur_threads)) {
+		return 0;
+	}
+
+	p_group = GROUP_OF(th_id);
+	if ((p_group == NULL) || !(p_group->live_mask & THREAD_BIT(th_id))) {
+		return 0;
+	}
+
+	p_th = p_group->threads[th_id % RLU_THREAD_GROUP_SIZE];
+	if (p_th == NULL) {
+		return 0;
+	}
+
+	rlu_add_thread_stats(p_stats, p_th);
+	return 1;
+}
+
 void rlu_print_stats(void) {
 	printf("=================================================\n");
 	printf("RLU statistics:\n");
@@ -658,10 +1356,95 @@ void rlu_print_stats(void) {
 	printf("  t_aborts = %lu\n", g_rlu_data.n_aborts);
 	printf("  t_sync_requests = %lu\n", g_rlu_data.n_sync_requests);
 	printf("  t_sync_and_writeback = %lu\n", g_rlu_data.n_sync_and_writeback);
+	printf("  t_writer_sync_waits = %lu\n", g_rlu_data.n_writer_sync_waits);
+	printf("  t_writeback_bytes = %lu\n", g_rlu_data.n_writeback_bytes);
+	printf("  t_writeback_skipped_bytes = %lu\n", g_rlu_data.n_writeback_skipped_bytes);
+	printf("-------------------------------------------------\n");
+	printf("  t_thread_memory = %lu\n", g_rlu_data.n_thread_memory);
+	if (g_rlu_data.n_threads > 0) {
+		printf("  a_thread_memory = %lu\n", g_rlu_data.n_thread_memory / g_rlu_data.n_threads);
+	} else {
+		printf("  a_thread_memory = 0\n");
+	}
+	printf("  m_thread_memory = %lu\n", g_rlu_data.n_max_thread_memory);
+	printf("  t_pool_hits = %lu\n", g_rlu_data.n_pool_hits);
+	printf("  t_pool_misses = %lu\n", g_rlu_data.n_pool_misses);
+	printf("  t_q_sleeps = %lu\n", g_rlu_data.n_q_sleeps);
+	printf("  t_q_shared = %lu\n", g_rlu_data.n_q_shared);
+	printf("  t_exclusive = %lu\n", g_rlu_data.n_exclusive);
 
 	printf("=================================================\n");
 }
 
+static void rlu_lock_registry(void) {
+	while ((g_rlu_registry_lock != 0) || (CAS(&g_rlu_registry_lock, 0, 1) != 0)) {
+		CPU_RELAX();
+	}
+}
+
+static void rlu_unlock_registry(void) {
+	MEMBARSTLD();
+	g_rlu_registry_lock = 0;
+}
+
+// Takes the lowest id that no live thread has, and registers the thread under it. Writers only
+// look for running threads among live ones, and a new thread cannot be running a section yet, so
+// the thread need not be visible to writers that are already scanning.
+static void rlu_register_thread_data(rlu_thread_data_t *self) {
+	long group_id;
+	long cur_threads;
+	unsigned long free_mask;
+	rlu_thread_group_t *p_group;
+
+	rlu_lock_registry();
+
+	cur_threads = g_rlu_cur_threads;
+	self->uniq_id = cur_threads;
+	for (group_id = 0; group_id * RLU_THREAD_GROUP_SIZE < cur_threads; group_id++) {
+		free_mask = ~g_rlu_thread_groups[group_id]->live_mask;
+		if ((free_mask != 0) &&
+				(group_id * RLU_THREAD_GROUP_SIZE + __builtin_ctzl(free_mask) < cur_threads)) {
+			self->uniq_id = group_id * RLU_THREAD_GROUP_SIZE + __builtin_ctzl(free_mask);
+			break;
+		}
+	}
+	if (self->uniq_id == cur_threads) {
+		FETCH_AND_ADD(&g_rlu_cur_threads, 1);
+	}
+
+	group_id = self->uniq_id / RLU_THREAD_GROUP_SIZE;
+	RLU_ASSERT_MSG(group_id < RLU_MAX_THREAD_GROUPS, self, "too many threads: %ld\n", self->uniq_id);
+
+	if (g_rlu_thread_groups[group_id] == NULL) {
+		p_group = (rlu_thread_group_t *)malloc(sizeof(rlu_thread_group_t));
+		RLU_ASSERT(p_group != NULL);
+		memset(p_group, 0, sizeof(rlu_thread_group_t));
+		g_rlu_thread_groups[group_id] = p_group;
+	}
+
+	GET_THREAD(self->uniq_id) = self;
+	__sync_fetch_and_or(&GROUP_OF(self->uniq_id)->live_mask, THREAD_BIT(self->uniq_id));
+	__sync_fetch_and_or(&g_rlu_live_groups[group_id / 64], GROUP_BIT(group_id));
+
+	rlu_unlock_registry();
+}
+
+// Gives the id of a finished thread back. Writers no longer wait for the thread once it is gone
+// from the live masks, but may still look at its data.
+static void rlu_unregister_thread_data(rlu_thread_data_t *self) {
+	long group_id;
+
+	group_id = self->uniq_id / RLU_THREAD_GROUP_SIZE;
+
+	rlu_lock_registry();
+
+	if (__sync_and_and_fetch(&GROUP_OF(self->uniq_id)->live_mask, ~THREAD_BIT(self->uniq_id)) == 0) {
+		__sync_fetch_and_and(&g_rlu_live_groups[group_id / 64], ~GROUP_BIT(group_id));
+	}
+
+	rlu_unlock_registry();
+}
+
 void rlu_thread_init(rlu_thread_data_t *self) {
 	int ws_counter;
 
@@ -670,24 +1453,39 @@ void rlu_thread_init(rlu_thread_data_t *self) {
 	self->type = g_rlu_type;
 	self->max_write_sets = g_rlu_max_write_sets;
 
-	self->uniq_id = FETCH_AND_ADD(&g_rlu_cur_threads, 1);
-
 	self->local_version = 0;
 	self->writer_version = MAX_VERSION;
 
-	for (ws_counter = 0; ws_counter < RLU_MAX_WRITE_SETS; ws_counter++) {
+	// Twice max_write_sets: one batch being written while the last one may still be read
+	self->n_write_sets = 2 * self->max_write_sets;
+	self->obj_write_set = (volatile obj_list_t *)malloc(sizeof(obj_list_t) * self->n_write_sets);
+	RLU_ASSERT(self->obj_write_set != NULL);
+	memset((void *)self->obj_write_set, 0, sizeof(obj_list_t) * self->n_write_sets);
+
+	for (ws_counter = 0; ws_counter < self->n_write_sets; ws_counter++) {
 		rlu_reset_write_set(self, ws_counter);
 	}
 
-	g_rlu_threads[self->uniq_id] = self;
+	rlu_register_thread_data(self);
+	rlu_pool_start();
 	MEMBARSTLD();
 
+	FETCH_AND_ADD(&g_rlu_live_threads, 1);
+	rlu_wait_for_exclusive_section();
+
 }
 
 void rlu_thread_finish(rlu_thread_data_t *self) {
+	long ws_counter;
+	ws_chunk_t *p_chunk;
+	ws_chunk_t *p_next;
+
 	rlu_sync_and_writeback(self);
 	rlu_sync_and_writeback(self);
 
+	rlu_release_exclusive(self);
+	FETCH_AND_ADD(&g_rlu_live_threads, -1);
+
 	FETCH_AND_ADD(&g_rlu_data.n_starts, self->n_starts);
 	FETCH_AND_ADD(&g_rlu_data.n_finish, self->n_finish);
 	FETCH_AND_ADD(&g_rlu_data.n_writers, self->n_writers);
@@ -698,13 +1496,57 @@ void rlu_thread_finish(rlu_thread_data_t *self) {
 	FETCH_AND_ADD(&g_rlu_data.n_aborts, self->n_aborts);
 	FETCH_AND_ADD(&g_rlu_data.n_sync_requests, self->n_sync_requests);
 	FETCH_AND_ADD(&g_rlu_data.n_sync_and_writeback, self->n_sync_and_writeback);
+	FETCH_AND_ADD(&g_rlu_data.n_writeback_bytes, self->n_writeback_bytes);
+	FETCH_AND_ADD(&g_rlu_data.n_writeback_skipped_bytes, self->n_writeback_skipped_bytes);
+	FETCH_AND_ADD(&g_rlu_data.n_writer_sync_waits, self->n_writer_sync_waits);
+
+	rlu_pool_flush(self);
+	FETCH_AND_ADD(&g_rlu_data.n_pool_hits, self->n_pool_hits);
+	FETCH_AND_ADD(&g_rlu_data.n_pool_misses, self->n_pool_misses);
+
+	FETCH_AND_ADD(&g_rlu_data.n_q_sleeps, self->n_q_sleeps);
+	FETCH_AND_ADD(&g_rlu_data.n_q_shared, self->n_q_shared);
+	FETCH_AND_ADD(&g_rlu_data.n_exclusive, self->n_exclusive);
+
+	rlu_record_thread_memory(self);
+
+	// Readers that were running may still hold copies of the thread, and look the thread up by its
+	// id, so the id is only given back once they have left their sections
+	rlu_init_quiescence(self);
+	rlu_wait_for_quiescence(self, 0);
+	rlu_unregister_thread_data(self);
+
+	for (ws_counter = 0; ws_counter < self->n_write_sets; ws_counter++) {
+		p_chunk = self->obj_write_set[ws_counter].p_first_chunk;
+		while (p_chunk != NULL) {
+			p_next = p_chunk->p_next;
+			free(p_chunk);
+			p_chunk = p_next;
+		}
+	}
+	free((void *)self->obj_write_set);
+	self->obj_write_set = NULL;
+	self->n_write_sets = 0;
+
+	free(self->free_nodes);
+	self->free_nodes = NULL;
+	self->free_nodes_capacity = 0;
+
+	free(self->q_threads);
+	self->q_threads = NULL;
+	self->q_threads_capacity = 0;
+	self->q_threads_size = 0;
 }
 
 intptr_t *rlu_alloc(obj_size_t obj_size) {
+	return rlu_alloc_level(obj_size, 0);
+}
+
+intptr_t *rlu_alloc_level(obj_size_t obj_size, unsigned long level) {
 	intptr_t *ptr;
 	rlu_obj_header_t *p_obj_h;
 
-	ptr = (intptr_t *)malloc(OBJ_HEADER_SIZE + obj_size);
+	ptr = rlu_pool_alloc(OBJ_HEADER_SIZE + obj_size, level);
 	if (ptr == NULL) {
 		return NULL;
 	}
@@ -722,8 +1564,8 @@ void rlu_free(rlu_thread_data_t *self, intptr_t *p_obj) {
 		return;
 	}
 
-	if (self == NULL) {
-		free((intptr_t *)OBJ_TO_H(p_obj));
+	if ((self == NULL) || self->is_exclusive) {
+		rlu_pool_free((intptr_t *)OBJ_TO_H(p_obj));
 		return;
 	}
 	
@@ -731,11 +1573,13 @@ void rlu_free(rlu_thread_data_t *self, intptr_t *p_obj) {
 	
 	p_obj = (intptr_t *)FORCE_ACTUAL(p_obj);
 
+	if (self->free_nodes_size == self->free_nodes_capacity) {
+		rlu_grow_free_nodes(self);
+	}
+
 	self->free_nodes[self->free_nodes_size] = p_obj;
 	self->free_nodes_size++;
 
-	RLU_ASSERT(self->free_nodes_size < RLU_MAX_FREE_NODES);
-
 }
 
 void rlu_sync_checkpoint(rlu_thread_data_t *self) {
@@ -749,11 +1593,21 @@ void rlu_sync_checkpoint(rlu_thread_data_t *self) {
 
 }
 
+void rlu_force_sync(rlu_thread_data_t *self) {
+
+	rlu_sync_and_writeback(self);
+
+}
+
 void rlu_reader_lock(rlu_thread_data_t *self) {
 	self->n_starts++;
 
 	rlu_sync_checkpoint(self);
 
+	if (rlu_enter_exclusive(self)) {
+		return;
+	}
+
 	rlu_reset(self);
 
 	rlu_register_thread(self);
@@ -770,6 +1624,30 @@ void rlu_reader_lock(rlu_thread_data_t *self) {
 	}
 }
 
+int rlu_exclusive_lock(rlu_thread_data_t *self) {
+	if (self == NULL) {
+		return 0;
+	}
+
+	if (self->is_exclusive) {
+		self->exclusive_depth++;
+		return 1;
+	}
+
+	if (!rlu_enter_exclusive(self)) {
+		return 0;
+	}
+
+	self->exclusive_depth = 1;
+	return 1;
+}
+
+void rlu_exclusive_unlock(rlu_thread_data_t *self) {
+	if (--self->exclusive_depth == 0) {
+		rlu_leave_exclusive(self);
+	}
+}
+
 int rlu_try_writer_lock(rlu_thread_data_t *self, int writer_lock_id) {
 	RLU_ASSERT(self->type == RLU_TYPE_COARSE_GRAINED);
 	
@@ -785,12 +1663,17 @@ int rlu_try_writer_lock(rlu_thread_data_t *self, int writer_lock_id) {
 void rlu_reader_unlock(rlu_thread_data_t *self) {
 	self->n_finish++;
 
+	if (self->is_exclusive) {
+		rlu_leave_exclusive(self);
+		return;
+	}
+
 	rlu_unregister_thread(self);
 
 	if (self->is_write_detected) {
 		self->is_write_detected = 0;
 		rlu_commit_write_set(self);
-		rlu_release_writer_locks(self, WS_INDEX(self->ws_tail_counter - 1));
+		rlu_release_writer_locks(self, WS_INDEX(self, self->ws_tail_counter - 1));
 	} else {
 		rlu_release_writer_locks(self, self->ws_cur_id);
 		rlu_reset_writer_locks(self, self->ws_cur_id);
@@ -833,7 +1716,7 @@ intptr_t *rlu_deref_slow_path(rlu_thread_data_t *self, intptr_t *p_obj) {
 
 	// p_obj is locked by another thread
 	if ((self->is_steal) &&
-		(g_rlu_threads[th_id]->writer_version <= self->local_version)) {
+		(GET_THREAD(th_id)->writer_version <= self->local_version)) {
 		// This thread started after the other thread updated g_writer_version.
 		// and this thread observed a valid p_obj_copy (!= NULL)
 		// => The other thread is going to wait for this thread to finish before reusing the write-set log
@@ -857,6 +1740,11 @@ int rlu_try_lock(rlu_thread_data_t *self, intptr_t **p_p_obj, size_t obj_size) {
 
 	RLU_ASSERT_MSG(p_obj != NULL, self, "[%ld] rlu_try_lock: tried to lock a NULL pointer\n", self->writer_version);
 
+	if (self->is_exclusive) {
+		self->is_write_detected = 1;
+		return 1;
+	}
+
 	p_obj_copy = (intptr_t *)GET_COPY(p_obj);
 
 	if (PTR_IS_COPY(p_obj_copy)) {
@@ -945,6 +1833,13 @@ void rlu_lock(rlu_thread_data_t *self, intptr_t **p_p_obj, unsigned int obj_size
 void rlu_abort(rlu_thread_data_t *self) {
 	self->n_aborts++;
 
+	if (self->is_exclusive) {
+		// Writes made in place cannot be undone
+		RLU_ASSERT(!self->is_write_detected);
+		rlu_leave_exclusive(self);
+		return;
+	}
+
 	rlu_unregister_thread(self);
 
 	if (self->is_write_detected) {
@@ -23,12 +23,24 @@ typedef long intptr_t; // Hack for kernel that does not have intptr_t
 #define RLU_TYPE_FINE_GRAINED (1)
 #define RLU_TYPE_COARSE_GRAINED (2)
 
-#define RLU_MAX_THREADS (128)
+#define RLU_THREAD_GROUP_SIZE (64) // Threads are registered in groups of this many
+#define RLU_MAX_THREAD_GROUPS (1024)
 
-#define RLU_MAX_WRITE_SETS (200) // Minimum value is 2
-#define RLU_MAX_FREE_NODES (100000)
+#define RLU_Q_SPIN_ITERS (1024) // Spins on a reader before sleeping until it leaves its section
+#define RLU_Q_SLEEP_NS (1000000) // Bounds a sleep whose wake-up was missed
 
-#define RLU_MAX_WRITE_SET_BUFFER_SIZE (100000)
+#define RLU_INIT_FREE_NODES (1024) // Grows by doubling
+
+#define RLU_DEFAULT_MAX_WRITE_SETS (8) // Write-sets a writer defers before synchronizing once
+
+#define RLU_WRITE_SET_CHUNK_SIZE (4096) // Write-sets grow by chunks of at least this size
+#define RLU_FIELD_WRITEBACK_MIN_SIZE (64) // Smaller objects are written back whole
+
+#define RLU_POOL_GRANULE (16) // Objects are pooled by size in granules of this many bytes
+#define RLU_POOL_CLASSES (32) // Larger objects are not pooled
+#define RLU_POOL_MAX_OBJS (1024) // Per thread and size class
+#define RLU_POOL_BATCH (256) // Objects moved between a thread pool and the shared depot at once
+#define RLU_POOL_DEPOT_BATCHES (64) // Per size class
 
 #define RLU_MAX_NESTED_WRITER_LOCKS (20)
 #define RLU_MAX_WRITER_LOCKS (20000)
@@ -77,14 +89,26 @@ typedef struct writer_locks {
 	long ids[RLU_MAX_NESTED_WRITER_LOCKS];
 } writer_locks_t;
 
+typedef struct ws_chunk {
+	struct ws_chunk *p_next;
+	volatile intptr_t *p_end; // NULL while the chunk is the one being written
+	obj_size_t size;
+	volatile unsigned char buffer[] __attribute__((aligned(8)));
+} ws_chunk_t;
+
 typedef struct obj_list {
 	volatile writer_locks_t writer_locks;
 	unsigned int num_of_objs;
 	volatile intptr_t *p_cur;
-	volatile unsigned char buffer[RLU_MAX_WRITE_SET_BUFFER_SIZE];
+	ws_chunk_t *p_first_chunk; // NULL until the write-set is first used
+	ws_chunk_t *p_cur_chunk;
 } obj_list_t;
 
+struct rlu_thread_data;
+
 typedef struct wait_entry {
+	long th_id;
+	volatile struct rlu_thread_data *p_th;
 	volatile unsigned char is_wait;
 	volatile unsigned long run_counter;
 } wait_entry_t;
@@ -98,6 +122,9 @@ typedef struct rlu_thread_data {
 	char is_check_locks;
 	char is_write_detected;
 	char is_steal;
+	char is_exclusive; // In a section run while no other thread is registered
+	char is_exclusive_owner; // Sections may run exclusively until another thread registers
+	int exclusive_depth; // Nesting of rlu_exclusive_lock within the current exclusive section
 	int type;
 	int max_write_sets;
 
@@ -108,6 +135,8 @@ typedef struct rlu_thread_data {
 	volatile long local_commit_version;
 	volatile long is_no_quiescence;
 	volatile long is_sync;
+	volatile int q_futex; // Bumped when leaving a section while writers sleep on the thread
+	volatile int q_waiters;
 
 	long padding_2[RLU_DEFAULT_PADDING];
 
@@ -115,18 +144,22 @@ typedef struct rlu_thread_data {
 
 	long padding_3[RLU_DEFAULT_PADDING];
 
-	wait_entry_t q_threads[RLU_MAX_THREADS];
+	long q_threads_size;
+	long q_threads_capacity;
+	wait_entry_t *q_threads;
 
 	long ws_head_counter;
 	long ws_wb_counter;
 	long ws_tail_counter;
 	long ws_cur_id;
-	volatile obj_list_t obj_write_set[RLU_MAX_WRITE_SETS];
+	long n_write_sets;
+	volatile obj_list_t *obj_write_set;
 
 	long padding_4[RLU_DEFAULT_PADDING];
 
 	long free_nodes_size;
-	intptr_t *free_nodes[RLU_MAX_FREE_NODES];
+	long free_nodes_capacity;
+	intptr_t **free_nodes;
 
 	long padding_5[RLU_DEFAULT_PADDING];
 
@@ -141,11 +174,41 @@ typedef struct rlu_thread_data {
 	long n_writeback_q_iters;
 	long n_sync_requests;
 	long n_sync_and_writeback;
+	long n_writeback_bytes;
+	long n_writeback_skipped_bytes;
+	long n_pool_hits;
+	long n_pool_misses;
+	long n_q_sleeps;
+	long n_q_shared;
+	long n_exclusive;
 
 	long padding_6[RLU_DEFAULT_PADDING];
 
 } rlu_thread_data_t;
 
+// A snapshot of the counters of one thread, or of every thread. Pool counters are only added to a
+// thread's counters when it finishes.
+typedef struct rlu_stats {
+	long n_starts;
+	long n_finish;
+	long n_writers;
+	long n_writer_writeback;
+	long n_pure_readers;
+	long n_aborts;
+	long n_steals;
+	long n_writer_sync_waits;
+	long n_writeback_q_iters;
+	long n_sync_requests;
+	long n_sync_and_writeback;
+	long n_writeback_bytes;
+	long n_writeback_skipped_bytes;
+	long n_pool_hits;
+	long n_pool_misses;
+	long n_q_sleeps;
+	long n_q_shared;
+	long n_exclusive;
+} rlu_stats_t;
+
 /////////////////////////////////////////////////////////////////////////////////////////
 // EXTERNAL FUNCTIONS
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -154,16 +217,39 @@ void rlu_init(int type, int max_write_sets);
 void rlu_finish(void);
 void rlu_print_stats(void);
 
+long rlu_get_n_threads(void);
+void rlu_get_stats(rlu_stats_t *p_stats);
+int rlu_get_thread_stats(long th_id, rlu_stats_t *p_stats);
+
+// While a single thread is registered, its sections run exclusively: they skip registration, locks
+// never fail and write to the objects themselves, and frees are immediate. A thread registering
+// waits for the exclusive section running, if any, to end, and later sections are instrumented
+// again.
 void rlu_thread_init(rlu_thread_data_t *self);
 void rlu_thread_finish(rlu_thread_data_t *self);
 
 intptr_t *rlu_alloc(obj_size_t obj_size);
+// Allocates an object for the given level of a tree, which decides its placement with NUMA_POOLS
+intptr_t *rlu_alloc_level(obj_size_t obj_size, unsigned long level);
 void rlu_free(rlu_thread_data_t *self, intptr_t *p_obj);
 
 void rlu_reader_lock(rlu_thread_data_t *self);
 void rlu_reader_unlock(rlu_thread_data_t *self);
 
+// Exclusive sections for code that synchronizes without RLU, but whose threads are registered with
+// it: rlu_exclusive_lock returns 1 if the section it starts, or the one it nests in, is exclusive,
+// in which case the caller may skip its own locks, fences and deferred frees until the matching
+// rlu_exclusive_unlock, and 0 if other threads are registered. Unlock only after a 1.
+//
+// Exclusive sections write to the objects themselves, which cannot be undone, so aborting one
+// after it has locked an object is forbidden and stops the program in rlu_abort. Locks never fail
+// in an exclusive section, so only sections that abort for reasons of their own need care; build
+// with RLU_NO_EXCLUSIVE if they must abort after writing.
+int rlu_exclusive_lock(rlu_thread_data_t *self);
+void rlu_exclusive_unlock(rlu_thread_data_t *self);
+
 int rlu_try_lock(rlu_thread_data_t *self, intptr_t **p_p_obj, size_t obj_size);
+// Aborts the section, undoing its locks. In an exclusive section, only allowed before any lock.
 void rlu_abort(rlu_thread_data_t *self);
 
 int rlu_try_writer_lock(rlu_thread_data_t *self, int writer_lock_id);
@@ -175,6 +261,9 @@ int rlu_cmp_ptrs(intptr_t *p_obj_1, intptr_t *p_obj_2);
 void rlu_assign_pointer(intptr_t **p_ptr, intptr_t *p_obj);
 
 void rlu_sync_checkpoint(rlu_thread_data_t *self);
+// Writes back the write sets this thread has deferred, without waiting for a sync request or for
+// rlu_thread_finish. Call it outside of any section.
+void rlu_force_sync(rlu_thread_data_t *self);
 
 /////////////////////////////////////////////////////////////////////////////////////////
 // EXTERNAL MACROS
@@ -190,7 +279,12 @@ void rlu_sync_checkpoint(rlu_thread_data_t *self);
 #define RLU_READER_LOCK(self) rlu_reader_lock(self)
 #define RLU_READER_UNLOCK(self) rlu_reader_unlock(self)
 
+#define RLU_EXCLUSIVE_LOCK(self) rlu_exclusive_lock(self)
+#define RLU_EXCLUSIVE_UNLOCK(self) rlu_exclusive_unlock(self)
+#define RLU_IS_EXCLUSIVE(self) (((self) != NULL) && (self)->is_exclusive)
+
 #define RLU_ALLOC(obj_size) ((void *)rlu_alloc(obj_size))
+#define RLU_ALLOC_LEVEL(obj_size, level) ((void *)rlu_alloc_level(obj_size, level))
 #define RLU_FREE(self, p_obj) rlu_free(self, (intptr_t *)p_obj)
 
 #define RLU_TRY_WRITER_LOCK(self, writer_lock_id) rlu_try_writer_lock(self, writer_lock_id)
@@ -2,10 +2,14 @@
 Testing suite for correctness of Quadtrees
 */
 
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
 #include "test.h"
 
 //extern __thread rlu_thread_data_t *rlu_self;
-extern bool in_range(const Node*, const Point*);
+extern safe bool in_range(const Node*, const Point*);
 extern void Point_string(const Point*, char*);
 
 /*
@@ -144,6 +148,16 @@ void test_get_quadrant() {
         assertLong(i, get_quadrant(&point1, &point2), buffer);
     }
 
+    end_test();
+    start_test("point just below the origin");
+
+    // Such a point is outside of every upper square in_range bounds at the origin.
+    Point point3 = uniform_point(-PRECISION / 2);
+    Point_string(&point1, origin_buffer);
+    Point_string(&point3, point_buffer);
+    sprintf(buffer, "get_quadrant(%s, %s)", origin_buffer, point_buffer);
+    assertLong(0, get_quadrant(&point1, &point3), buffer);
+
     end_test();
 }
 
@@ -399,8 +413,22 @@ void test_quadtree_add() {
         assertFalse(Quadtree_add(tree1, point6), buffer);
     }
 
+    end_test();
+    start_test("adding to two trees in turn");
+
+    // Each switch from one tree to the other must not cost the thread anything in either tree.
+    Quadtree *tree2 = Quadtree_init(2, uniform_point(0));
+    Point point7 = uniform_point(0);
+    uint64_t added = 0;
+    for (i = 0; i < 256; i++) {
+        point7.data[0] = (i + 0.5) / 256 - 0.5;
+        added += Quadtree_add(tree1, point7) + Quadtree_add(tree2, point7);
+    }
+    assertLong(512, added, "every point added to both trees");
+
     end_test();
 
+    Quadtree_free(tree2);
     Quadtree_free(tree1);
 }
 
@@ -808,6 +836,1047 @@ void test_randomized() {
 
 }
 
+#ifdef QUADTREE_CONCURRENT
+/*
+ * struct Handover_t
+ *
+ * What the main thread shares with the second thread of test_thread_handover.
+ *
+ * tree - the tree both threads use
+ * points - the points the threads add and remove
+ * barrier - where the threads take turns
+ * results - what the second thread saw
+ */
+typedef struct Handover_t {
+    Quadtree *tree;
+    Point points[3];
+    pthread_barrier_t barrier;
+    bool results[4];
+} Handover;
+
+/*
+ * handover_thread
+ *
+ * Registers a second RLU thread while the main one is registered, then takes turns with it.
+ */
+static void* handover_thread(void *arg) {
+    Handover * const handover = (Handover*)arg;
+    rlu_self = (rlu_thread_data_t*)malloc(sizeof(*rlu_self));
+    RLU_THREAD_INIT(rlu_self);
+
+    handover->results[0] = Quadtree_search(handover->tree, handover->points[0]);
+    handover->results[1] = Quadtree_add(handover->tree, handover->points[1]);
+    // Deferred updates are only seen by other threads, and only unlocked, once written back.
+    Quadtree_flush(handover->tree);
+    pthread_barrier_wait(&handover->barrier);
+    pthread_barrier_wait(&handover->barrier);
+    handover->results[2] = Quadtree_search(handover->tree, handover->points[2]);
+    handover->results[3] = Quadtree_remove(handover->tree, handover->points[0]);
+
+    RLU_THREAD_FINISH(rlu_self);
+    free(rlu_self);
+    return NULL;
+}
+
+void test_thread_handover() {
+    char buffer[256 + 30 * D];
+    uint64_t i;
+
+    start_test("a second thread registering while the main thread is alone");
+
+    Handover handover;
+    handover.tree = Quadtree_init(2, uniform_point(1));
+    for (i = 0; i < 3; i++) {
+        handover.points[i] = uniform_point(0.25 + 0.5 * i);
+    }
+    pthread_barrier_init(&handover.barrier, NULL, 2);
+
+    // Alone, then with the second thread registered, then alone again once it has finished.
+    assertTrue(Quadtree_add(handover.tree, handover.points[0]), "first point added alone");
+    // Without exclusive sections, the add is deferred, and its locks would keep the second thread
+    // retrying while this one waits at the barrier.
+    Quadtree_flush(handover.tree);
+    pthread_t thread;
+    pthread_create(&thread, NULL, handover_thread, &handover);
+    pthread_barrier_wait(&handover.barrier);
+    assertTrue(Quadtree_search(handover.tree, handover.points[1]),
+        "point added by the second thread found");
+    assertTrue(Quadtree_add(handover.tree, handover.points[2]),
+        "third point added while the second thread is registered");
+    Quadtree_flush(handover.tree);
+    pthread_barrier_wait(&handover.barrier);
+    pthread_join(thread, NULL);
+
+    const char * const results[4] = {
+        "first point found by the second thread",
+        "second point added by the second thread",
+        "third point found by the second thread",
+        "first point removed by the second thread"
+    };
+    for (i = 0; i < 4; i++) {
+        sprintf(buffer, "%s", results[i]);
+        assertTrue(handover.results[i], buffer);
+    }
+    assertFalse(Quadtree_search(handover.tree, handover.points[0]),
+        "first point no longer found once the second thread finished");
+    assertTrue(Quadtree_remove(handover.tree, handover.points[1]),
+        "second point removed alone");
+    assertTrue(Quadtree_search(handover.tree, handover.points[2]), "third point found alone");
+
+    end_test();
+
+    pthread_barrier_destroy(&handover.barrier);
+    Quadtree_free(handover.tree);
+}
+
+/*
+ * struct Updater_t
+ *
+ * What a thread of test_concurrent_updates is given, and what it reports back.
+ *
+ * tree - the tree every thread updates
+ * points - the points the thread picks from
+ * npoints - the number of points
+ * operations - the number of operations the thread applies
+ * seed - the seed the thread picks its operations with
+ * barrier - where every thread waits until all of them have started
+ * changes - changes[i] is the number of times the thread added points[i] minus the number of
+ *     times it removed it
+ */
+typedef struct Updater_t {
+    Quadtree *tree;
+    const Point *points;
+    uint64_t npoints, operations;
+    uint32_t seed;
+    pthread_barrier_t *barrier;
+    int64_t *changes;
+} Updater;
+
+/*
+ * updater_thread
+ *
+ * Adds, removes and searches for random points of its set, counting the adds and removes that
+ * changed the tree.
+ */
+static void* updater_thread(void *arg) {
+    Updater * const updater = (Updater*)arg;
+    rlu_self = (rlu_thread_data_t*)malloc(sizeof(*rlu_self));
+    RLU_THREAD_INIT(rlu_self);
+    pthread_barrier_wait(updater->barrier);
+
+    uint64_t i;
+    for (i = 0; i < updater->operations; i++) {
+        const uint64_t index = Marsaglia_rands(&updater->seed) % updater->npoints;
+        const Point point = updater->points[index];
+        switch (Marsaglia_rands(&updater->seed) % 3) {
+        case 0:
+            updater->changes[index] += Quadtree_add(updater->tree, point);
+            break;
+        case 1:
+            updater->changes[index] -= Quadtree_remove(updater->tree, point);
+            break;
+        default:
+            Quadtree_search(updater->tree, point);
+        }
+    }
+
+    Quadtree_flush(updater->tree);
+    RLU_THREAD_FINISH(rlu_self);
+    free(rlu_self);
+    return NULL;
+}
+
+/*
+ * run_updaters
+ *
+ * Runs threads of random updates on a tree, each picking from its own slice of the points, then
+ * checks that every point is in the tree exactly when the changes made to it add up to one.
+ *
+ * tree - the tree to update, holding the points that initial says it does
+ * points - the points
+ * npoints - the number of points
+ * initial - initial[i] is whether points[i] is in the tree to begin with
+ * nthreads - the number of threads
+ * slice - the number of points each thread picks from
+ * stride - how far apart the slices of consecutive threads start, so that slices overlap if it is
+ *     less than slice
+ * operations - the number of operations each thread applies
+ */
+static void run_updaters(Quadtree * const tree, const Point * const points,
+        const uint64_t npoints, const bool * const initial, const uint64_t nthreads,
+        const uint64_t slice, const uint64_t stride, const uint64_t operations) {
+    char buffer[256 + 30 * D];
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, nthreads);
+    pthread_t threads[nthreads];
+    Updater updaters[nthreads];
+    uint64_t i, j;
+    for (i = 0; i < nthreads; i++) {
+        updaters[i] = (Updater){
+            .tree = tree,
+            .points = points + i * stride,
+            .npoints = slice,
+            .operations = operations,
+            .seed = 1 + i,
+            .barrier = &barrier,
+            .changes = (int64_t*)calloc(slice, sizeof(int64_t))
+        };
+        pthread_create(threads + i, NULL, updater_thread, updaters + i);
+    }
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_barrier_destroy(&barrier);
+
+    int64_t *totals = (int64_t*)malloc(sizeof(*totals) * npoints);
+    for (j = 0; j < npoints; j++) {
+        totals[j] = initial[j];
+    }
+    for (i = 0; i < nthreads; i++) {
+        for (j = 0; j < slice; j++) {
+            totals[i * stride + j] += updaters[i].changes[j];
+        }
+        free(updaters[i].changes);
+    }
+
+    // Report only the first point found wrong, as every later one would likely be too.
+    uint64_t wrong = 0;
+    for (j = 0; j < npoints; j++) {
+        const bool consistent = (0 == totals[j] || 1 == totals[j]);
+        if (!consistent || (1 == totals[j]) != Quadtree_search(tree, points[j])) {
+            if (0 == wrong++) {
+                sprintf(buffer, "point %llu added %lld more times than removed, but %s",
+                    (unsigned long long)j, (long long)totals[j],
+                    Quadtree_search(tree, points[j]) ? "found" : "not found");
+                assertTrue(false, buffer);
+            }
+        }
+    }
+    sprintf(buffer, "every one of %llu points found exactly when added once more than removed",
+        (unsigned long long)npoints);
+    assertLong(0, wrong, buffer);
+    free(totals);
+}
+#endif
+
+/*
+ * random_points
+ *
+ * Draws distinct random points within a tree of side 2 centered on (1, ..., 1).
+ *
+ * points - filled with the points
+ * npoints - the number of points
+ */
+static void random_points(Point * const points, const uint64_t npoints) {
+    uint64_t i, j;
+    for (i = 0; i < npoints; i++) {
+        do {
+            for (j = 0; j < D; j++) {
+                points[i].data[j] = 2 * random();
+            }
+            for (j = 0; j < i && !Point_equals(points + i, points + j); j++);
+        } while (j < i);
+    }
+}
+
+void test_quadtree_stats() {
+    const uint64_t npoints = 500;
+    Point *points = (Point*)malloc(sizeof(*points) * npoints);
+    uint64_t i;
+
+    start_test("counts of a tree as points are added and removed");
+
+    Quadtree *tree = Quadtree_init(2, uniform_point(1));
+    QuadtreeStats stats = Quadtree_stats(tree);
+    assertLong(0, stats.size, "no points in an empty tree");
+    assertLong(0, stats.height, "empty tree has no levels above the bottom one");
+    assertTrue(0 < stats.nodes, "empty tree still has its roots");
+    const uint64_t empty_nodes = stats.nodes;
+
+    random_points(points, npoints);
+    for (i = 0; i < npoints; i++) {
+        Quadtree_add(tree, points[i]);
+    }
+    Quadtree_flush(tree);
+    stats = Quadtree_stats(tree);
+    assertLong(npoints, stats.size, "every point added counted");
+    assertTrue(stats.nodes >= empty_nodes + npoints, "a node counted for every point added");
+    assertTrue(stats.height < QUADTREE_LEVELS, "height within the levels of the tree");
+#ifdef QUADTREE_SHARDED
+    QuadtreeShardStats shard_stats = Quadtree_shard_stats(tree);
+    assertLong(stats.size, shard_stats.points, "points of every shard sum to the size of the tree");
+    assertTrue(shard_stats.min * shard_stats.shards <= shard_stats.points
+        && shard_stats.points <= shard_stats.max * shard_stats.shards,
+        "emptiest and fullest shards around the mean");
+#endif
+
+    for (i = 0; i < npoints / 2; i++) {
+        Quadtree_remove(tree, points[i]);
+    }
+    Quadtree_flush(tree);
+    stats = Quadtree_stats(tree);
+    assertLong(npoints - npoints / 2, stats.size, "points removed no longer counted");
+#ifdef QUADTREE_SHARDED
+    shard_stats = Quadtree_shard_stats(tree);
+    assertLong(stats.size, shard_stats.points, "points removed no longer counted in their shards");
+#endif
+
+    for (i = npoints / 2; i < npoints; i++) {
+        Quadtree_remove(tree, points[i]);
+    }
+    Quadtree_flush(tree);
+    stats = Quadtree_stats(tree);
+    assertLong(0, stats.size, "no points left once every point is removed");
+    assertLong(empty_nodes, stats.nodes, "every square collapsed once every point is removed");
+
+    end_test();
+
+    Quadtree_free(tree);
+    free(points);
+}
+
+#ifdef QUADTREE_CONCURRENT
+void test_concurrent_updates() {
+    const uint64_t nthreads = 4, npoints = 2000;
+    Point *points = (Point*)malloc(sizeof(*points) * npoints);
+    bool *initial = (bool*)malloc(sizeof(*initial) * npoints);
+    uint64_t i;
+
+    start_test("threads adding and removing one shared set of points");
+
+    // Removes collapse squares that other threads are walking through, which every thread is
+    // likely to be doing at once when they all pick from the same points.
+    Quadtree *tree1 = Quadtree_init(2, uniform_point(1));
+    random_points(points, npoints);
+    for (i = 0; i < npoints; i++) {
+        initial[i] = Quadtree_add(tree1, points[i]);
+    }
+    Quadtree_flush(tree1);
+    run_updaters(tree1, points, npoints, initial, nthreads, npoints, 0, 20000);
+
+    end_test();
+    start_test("threads adding and removing disjoint sets of points");
+
+    // No point is updated by two threads, but the points of every thread are spread over the whole
+    // tree, so the threads still split and collapse the squares that the others pass through.
+    Quadtree *tree2 = Quadtree_init(2, uniform_point(1));
+    for (i = 0; i < npoints; i++) {
+        initial[i] = false;
+    }
+    run_updaters(tree2, points, npoints, initial, nthreads, npoints / nthreads,
+        npoints / nthreads, 20000);
+
+    end_test();
+    start_test("threads adding and removing overlapping sets of points");
+
+    // Each thread shares half of its points with the thread before it and half with the one after.
+    Quadtree *tree3 = Quadtree_init(2, uniform_point(1));
+    for (i = 0; i < npoints; i++) {
+        initial[i] = (0 == i % 2) && Quadtree_add(tree3, points[i]);
+    }
+    Quadtree_flush(tree3);
+    run_updaters(tree3, points, npoints, initial, nthreads, 2 * npoints / (nthreads + 1),
+        npoints / (nthreads + 1), 20000);
+
+    end_test();
+
+    Quadtree_free(tree1);
+    Quadtree_free(tree2);
+    Quadtree_free(tree3);
+    free(points);
+    free(initial);
+}
+#endif
+
+#ifdef QUADTREE_TXN
+/*
+ * struct TxnReader_t
+ *
+ * What a thread of test_quadtree_txn is given, and what it reports back.
+ *
+ * tree - the tree the groups are committed to
+ * points - the points, group after group
+ * size - the number of points in every group
+ * seed - the seed the thread picks groups with
+ * barrier - where the readers and the committer wait until all of them have started
+ * committing - the group being committed, or the number of groups once every one has been
+ * done - set once every group has been committed
+ * seen - the number of groups the thread saw committed
+ * partial - the number of groups the thread saw only some points of
+ */
+typedef struct TxnReader_t {
+    Quadtree *tree;
+    const Point *points;
+    uint64_t size;
+    uint32_t seed;
+    pthread_barrier_t *barrier;
+    volatile uint64_t *committing;
+    volatile bool *done;
+    uint64_t seen, partial;
+} TxnReader;
+
+/*
+ * txn_reader_thread
+ *
+ * Searches for the points of the group being committed, or of the one before it, in the order
+ * they are added in. Once the first point of a group is found, the group has been committed, so
+ * every other point must be found as well.
+ */
+static void* txn_reader_thread(void *arg) {
+    TxnReader * const reader = (TxnReader*)arg;
+    rlu_self = (rlu_thread_data_t*)malloc(sizeof(*rlu_self));
+    RLU_THREAD_INIT(rlu_self);
+    pthread_barrier_wait(reader->barrier);
+
+    while (!*reader->done) {
+        const uint64_t committing = *reader->committing;
+        const uint64_t index = committing - (0 < committing && Marsaglia_rands(&reader->seed) % 2);
+        const Point * const group = reader->points + index * reader->size;
+        if (!Quadtree_search(reader->tree, group[0])) {
+            continue;
+        }
+        uint64_t i;
+        for (i = 1; i < reader->size && Quadtree_search(reader->tree, group[i]); i++);
+        reader->seen++;
+        reader->partial += (i < reader->size);
+    }
+
+    RLU_THREAD_FINISH(rlu_self);
+    free(rlu_self);
+    return NULL;
+}
+
+void test_quadtree_txn() {
+    Point points[4];
+    uint64_t i;
+
+    start_test("a group applies its updates in order once it commits");
+
+    Quadtree *tree1 = Quadtree_init(2, uniform_point(1));
+    for (i = 0; i < 3; i++) {
+        points[i] = uniform_point(0.25 + 0.5 * i);
+    }
+    points[3] = uniform_point(3);
+    assertTrue(Quadtree_add(tree1, points[2]), "third point added alone");
+
+    QuadtreeTxn *txn = Quadtree_txn_begin(tree1);
+    Quadtree_txn_add(txn, points[0]);
+    Quadtree_txn_add(txn, points[1]);
+    Quadtree_txn_add(txn, points[0]);
+    Quadtree_txn_remove(txn, points[1]);
+    Quadtree_txn_remove(txn, points[2]);
+    Quadtree_txn_add(txn, points[3]);
+    assertFalse(Quadtree_search(tree1, points[0]), "first point not found before the commit");
+    assertLong(4, Quadtree_txn_commit(txn),
+        "two adds and two removes applied, but not the repeated add or the add out of range");
+    Quadtree_flush(tree1);
+    assertTrue(Quadtree_search(tree1, points[0]), "first point found");
+    assertFalse(Quadtree_search(tree1, points[1]), "second point added then removed");
+    assertFalse(Quadtree_search(tree1, points[2]), "third point removed");
+    assertFalse(Quadtree_search(tree1, points[3]), "point out of range not found");
+
+    txn = Quadtree_txn_begin(tree1);
+    assertLong(0, Quadtree_txn_commit(txn), "empty group changed nothing");
+
+    end_test();
+
+#ifdef PARALLEL
+    start_test("readers see every committed group whole or not at all");
+
+    // Each group is spread over the whole tree, so it touches most shards and squares at once. The
+    // points are drawn one group more than committed, so that readers may look at one past the end.
+    char buffer[256];
+    const uint64_t nreaders = 3, ngroups = 200, size = 32;
+    Point *group_points = (Point*)malloc(sizeof(*group_points) * (ngroups + 1) * size);
+    random_points(group_points, (ngroups + 1) * size);
+    Quadtree *tree2 = Quadtree_init(2, uniform_point(1));
+
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, nreaders + 1);
+    volatile uint64_t committing = 0;
+    volatile bool done = false;
+    pthread_t threads[nreaders];
+    TxnReader readers[nreaders];
+    for (i = 0; i < nreaders; i++) {
+        readers[i] = (TxnReader){
+            .tree = tree2,
+            .points = group_points,
+            .size = size,
+            .seed = 1 + i,
+            .barrier = &barrier,
+            .committing = &committing,
+            .done = &done,
+            .seen = 0,
+            .partial = 0
+        };
+        pthread_create(threads + i, NULL, txn_reader_thread, readers + i);
+    }
+    pthread_barrier_wait(&barrier);
+
+    uint64_t applied = 0, j;
+    for (i = 0; i < ngroups; i++) {
+        txn = Quadtree_txn_begin(tree2);
+        for (j = 0; j < size; j++) {
+            Quadtree_txn_add(txn, group_points[i * size + j]);
+        }
+        committing = i;
+        applied += Quadtree_txn_commit(txn);
+        sched_yield();
+    }
+    committing = ngroups;
+    Quadtree_flush(tree2);
+    done = true;
+
+    uint64_t seen = 0, partial = 0;
+    for (i = 0; i < nreaders; i++) {
+        pthread_join(threads[i], NULL);
+        seen += readers[i].seen;
+        partial += readers[i].partial;
+    }
+    pthread_barrier_destroy(&barrier);
+
+    sprintf(buffer, "all %llu adds applied", (unsigned long long)(ngroups * size));
+    assertLong(ngroups * size, applied, buffer);
+    sprintf(buffer, "none of %llu committed groups seen by readers was seen in part",
+        (unsigned long long)seen);
+    assertLong(0, partial, buffer);
+
+    end_test();
+
+    Quadtree_free(tree2);
+    free(group_points);
+#endif
+
+    Quadtree_free(tree1);
+}
+#endif
+
+#ifdef QUADTREE_COW
+/*
+ * struct SnapshotReader_t
+ *
+ * What a thread of test_quadtree_snapshot is given, and what it reports back.
+ *
+ * tree - the tree to take snapshots of
+ * points - the points, in the order they are added and then removed in
+ * npoints - the number of points
+ * barrier - where the readers and the writer wait until all of them have started
+ * done - set once the writer has finished
+ * snapshots - the number of snapshots the thread took
+ * inconsistent - the number of snapshots that were not a run of consecutive points, did not hold
+ *     as many points as their size, or changed while the thread searched them
+ */
+typedef struct SnapshotReader_t {
+    Quadtree *tree;
+    const Point *points;
+    uint64_t npoints;
+    pthread_barrier_t *barrier;
+    volatile bool *done;
+    uint64_t snapshots, inconsistent;
+} SnapshotReader;
+
+/*
+ * snapshot_reader_thread
+ *
+ * Takes snapshots while the points are added and removed in the same order, so that every version
+ * of the tree holds one run of consecutive points. Every snapshot is searched for every point
+ * twice, and must give the same run both times.
+ */
+static void* snapshot_reader_thread(void *arg) {
+    SnapshotReader * const reader = (SnapshotReader*)arg;
+    bool *found = (bool*)malloc(sizeof(*found) * reader->npoints);
+    rlu_self = (rlu_thread_data_t*)malloc(sizeof(*rlu_self));
+    RLU_THREAD_INIT(rlu_self);
+    pthread_barrier_wait(reader->barrier);
+
+    while (!*reader->done) {
+        QuadtreeSnapshot * const snapshot = Quadtree_snapshot(reader->tree);
+        uint64_t i, size = 0, runs = 0, changed = 0;
+        for (i = 0; i < reader->npoints; i++) {
+            found[i] = QuadtreeSnapshot_search(snapshot, reader->points[i]);
+            size += found[i];
+            runs += found[i] && (0 == i || !found[i - 1]);
+        }
+        // Give the writer time to publish a few more versions before searching again.
+        sched_yield();
+        for (i = 0; i < reader->npoints; i++) {
+            changed += found[i] != QuadtreeSnapshot_search(snapshot, reader->points[i]);
+        }
+        reader->snapshots++;
+        reader->inconsistent += (1 < runs || size != snapshot->size || 0 != changed);
+        QuadtreeSnapshot_free(snapshot);
+    }
+
+    RLU_THREAD_FINISH(rlu_self);
+    free(rlu_self);
+    free(found);
+    return NULL;
+}
+
+void test_quadtree_snapshot() {
+    const uint64_t npoints = 200;
+    Point *points = (Point*)malloc(sizeof(*points) * npoints);
+    char buffer[256];
+    uint64_t i, found;
+
+    start_test("a snapshot keeps the points the tree had when it was taken");
+
+    Quadtree *tree1 = Quadtree_init(2, uniform_point(1));
+    random_points(points, npoints);
+    for (i = 0; i < npoints / 2; i++) {
+        Quadtree_add(tree1, points[i]);
+    }
+    QuadtreeSnapshot *snapshot1 = Quadtree_snapshot(tree1);
+    for (i = npoints / 2; i < npoints; i++) {
+        Quadtree_add(tree1, points[i]);
+    }
+    for (i = 0; i < npoints / 4; i++) {
+        Quadtree_remove(tree1, points[i]);
+    }
+    assertLong(npoints / 2, snapshot1->size, "size of the snapshot unchanged by later updates");
+    for (i = 0, found = 0; i < npoints / 2; i++) {
+        found += QuadtreeSnapshot_search(snapshot1, points[i]);
+    }
+    sprintf(buffer, "all %llu points added before the snapshot found in it, removed or not",
+        (unsigned long long)(npoints / 2));
+    assertLong(npoints / 2, found, buffer);
+    for (i = npoints / 2, found = 0; i < npoints; i++) {
+        found += QuadtreeSnapshot_search(snapshot1, points[i]);
+    }
+    assertLong(0, found, "no point added after the snapshot found in it");
+    for (i = 0, found = 0; i < npoints; i++) {
+        found += Quadtree_search(tree1, points[i]);
+    }
+    assertLong(npoints - npoints / 4, found, "tree itself has every update");
+
+    QuadtreeSnapshot *snapshot2 = Quadtree_snapshot(tree1);
+    assertLong(npoints - npoints / 4, snapshot2->size, "a later snapshot has every update");
+    assertFalse(QuadtreeSnapshot_search(snapshot2, points[0]), "removed point absent from it");
+    assertTrue(QuadtreeSnapshot_search(snapshot2, points[npoints - 1]),
+        "point added last found in it");
+
+    end_test();
+    start_test("a snapshot outlives later versions and the tree");
+
+    // The remove publishes a new version, so the tree no longer holds the version of snapshot2
+    // when it is freed.
+    Quadtree_remove(tree1, points[npoints - 1]);
+    Quadtree_free(tree1);
+    for (i = 0, found = 0; i < npoints; i++) {
+        found += QuadtreeSnapshot_search(snapshot1, points[i]);
+    }
+    assertLong(npoints / 2, found, "first snapshot unchanged once the tree is freed");
+    QuadtreeSnapshot_free(snapshot1);
+    for (i = 0, found = 0; i < npoints; i++) {
+        found += QuadtreeSnapshot_search(snapshot2, points[i]);
+    }
+    assertLong(npoints - npoints / 4, found, "second snapshot unchanged once the first is freed");
+    assertTrue(QuadtreeSnapshot_search(snapshot2, points[npoints - 1]),
+        "point removed after the second snapshot still found in it");
+    QuadtreeSnapshot_free(snapshot2);
+
+    end_test();
+
+#ifdef PARALLEL
+    start_test("snapshots taken during updates are consistent");
+
+    // The writer adds the points in order, and removes each one once window more have been added,
+    // so every version holds the points of one run, never more than window of them.
+    const uint64_t nreaders = 3, window = npoints / 4, rounds = 20;
+    Quadtree *tree2 = Quadtree_init(2, uniform_point(1));
+
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, nreaders + 1);
+    volatile bool done = false;
+    pthread_t threads[nreaders];
+    SnapshotReader readers[nreaders];
+    for (i = 0; i < nreaders; i++) {
+        readers[i] = (SnapshotReader){
+            .tree = tree2,
+            .points = points,
+            .npoints = npoints,
+            .barrier = &barrier,
+            .done = &done,
+            .snapshots = 0,
+            .inconsistent = 0
+        };
+        pthread_create(threads + i, NULL, snapshot_reader_thread, readers + i);
+    }
+    pthread_barrier_wait(&barrier);
+
+    uint64_t round;
+    for (round = 0; round < rounds; round++) {
+        for (i = 0; i < npoints + window; i++) {
+            if (i < npoints) {
+                Quadtree_add(tree2, points[i]);
+            }
+            if (i >= window) {
+                Quadtree_remove(tree2, points[i - window]);
+            }
+        }
+    }
+    done = true;
+
+    uint64_t snapshots = 0, inconsistent = 0;
+    for (i = 0; i < nreaders; i++) {
+        pthread_join(threads[i], NULL);
+        snapshots += readers[i].snapshots;
+        inconsistent += readers[i].inconsistent;
+    }
+    pthread_barrier_destroy(&barrier);
+
+    sprintf(buffer, "none of %llu snapshots taken during updates was inconsistent",
+        (unsigned long long)snapshots);
+    assertLong(0, inconsistent, buffer);
+    assertTrue(0 < snapshots, "readers took snapshots");
+
+    end_test();
+
+    Quadtree_free(tree2);
+#endif
+
+    free(points);
+}
+#endif
+
+#ifdef QUADTREE_ASYNC
+/*
+ * receive_replies
+ *
+ * Receives replies to operations sent with Quadtree_send until the expected number of them has
+ * arrived, or until the owners have had long enough to apply every operation.
+ *
+ * tree - the tree the operations were sent to
+ * replies - filled with the replies
+ * expected - the number of replies expected
+ *
+ * Returns the number of replies received.
+ */
+static uint64_t receive_replies(Quadtree * const tree, QuadtreeReply * const replies,
+        const uint64_t expected) {
+    uint64_t received = 0, tries;
+    for (tries = 0; received < expected && tries < 10000000; tries++) {
+        received += Quadtree_receive(tree, replies + received, expected - received);
+        sched_yield();
+    }
+    return received;
+}
+
+/*
+ * check_replies
+ *
+ * Checks that the replies are for the points sent, that there are as many replies to each
+ * operation sent as there are points, and that each reply has the result expected for its
+ * operation.
+ *
+ * replies - the replies received
+ * nreplies - the number of replies
+ * points - the points the operations were sent for
+ * npoints - the number of points
+ * expected - the result expected for each operation, indexed by QuadtreeOperation
+ * sent - whether each operation was sent, indexed by QuadtreeOperation
+ */
+static void check_replies(const QuadtreeReply * const replies, const uint64_t nreplies,
+        const Point * const points, const uint64_t npoints, const bool expected[3],
+        const bool sent[3]) {
+    char buffer[256];
+    uint64_t counts[3] = {0, 0, 0}, wrong = 0, unknown = 0, i, j;
+    for (i = 0; i < nreplies; i++) {
+        for (j = 0; j < npoints && !Point_equals(&replies[i].point, points + j); j++);
+        unknown += (j == npoints);
+        counts[replies[i].operation]++;
+        wrong += (expected[replies[i].operation] != replies[i].result);
+    }
+    assertLong(0, unknown, "every reply is for a point sent");
+    assertLong(0, wrong, "every reply has the result of its operation");
+    for (i = 0; i < 3; i++) {
+        sprintf(buffer, "a reply to operation %llu for every point", (unsigned long long)i);
+        assertLong(sent[i] ? npoints : 0, counts[i], buffer);
+    }
+}
+
+#ifdef PARALLEL
+// The tree that client_thread searches, and the number of client threads that have searched it.
+static Quadtree *clients_tree;
+static volatile uint64_t clients_started = 0;
+
+/*
+ * client_thread
+ *
+ * Becomes a client of clients_tree with a search, counts itself, then waits forever, so that the
+ * next thread started cannot take its place.
+ */
+static void* client_thread(void *unused) {
+    rlu_self = (rlu_thread_data_t*)malloc(sizeof(*rlu_self));
+    RLU_THREAD_INIT(rlu_self);
+    Quadtree_search(clients_tree, uniform_point(1));
+    __sync_fetch_and_add(&clients_started, 1);
+    while (true) {
+        pause();
+    }
+    return NULL;
+}
+#endif
+
+void test_quadtree_send() {
+    const uint64_t npoints = 24;
+    Point points[npoints];
+    QuadtreeReply replies[2 * npoints];
+    uint64_t i;
+
+    start_test("every operation sent is applied and replied to once");
+
+    // Operations for one point go to one owner, which applies them in the order they were sent, so
+    // an operation sees every earlier one for the same point. No owner has more than 2 * npoints
+    // replies waiting, well within the room for them.
+    Quadtree *tree = Quadtree_init(2, uniform_point(1));
+    random_points(points, npoints);
+    uint64_t sent = 0;
+    for (i = 0; i < npoints; i++) {
+        sent += Quadtree_send(tree, QUADTREE_ADD, points[i]);
+    }
+    assertLong(npoints, sent, "every add sent");
+    assertLong(npoints, receive_replies(tree, replies, npoints), "a reply to every add");
+    check_replies(replies, npoints, points, npoints,
+        (bool[3]){ false, true, false }, (bool[3]){ false, true, false });
+
+    for (i = 0; i < npoints; i++) {
+        Quadtree_send(tree, QUADTREE_ADD, points[i]);
+        Quadtree_send(tree, QUADTREE_SEARCH, points[i]);
+    }
+    assertLong(2 * npoints, receive_replies(tree, replies, 2 * npoints),
+        "a reply to every repeated add and search");
+    check_replies(replies, 2 * npoints, points, npoints,
+        (bool[3]){ true, false, false }, (bool[3]){ true, true, false });
+
+    for (i = 0; i < npoints; i++) {
+        Quadtree_send(tree, QUADTREE_REMOVE, points[i]);
+        Quadtree_send(tree, QUADTREE_SEARCH, points[i]);
+    }
+    assertLong(2 * npoints, receive_replies(tree, replies, 2 * npoints),
+        "a reply to every remove and search");
+    check_replies(replies, 2 * npoints, points, npoints,
+        (bool[3]){ false, false, true }, (bool[3]){ true, false, true });
+    assertLong(0, Quadtree_receive(tree, replies, 2 * npoints), "no reply left over");
+
+    assertFalse(Quadtree_send(tree, QUADTREE_ADD, uniform_point(3)),
+        "add of a point out of range not sent");
+
+    end_test();
+    start_test("sends are refused while too many replies wait to be received");
+
+    // The point never changes owner, so the replies all pile up in one ring.
+    for (sent = 0; sent < 100000 && Quadtree_send(tree, QUADTREE_SEARCH, points[0]); sent++);
+    assertTrue(0 < sent && sent < 100000, "sends refused after a while");
+    Quadtree_flush(tree);
+    assertFalse(Quadtree_send(tree, QUADTREE_SEARCH, points[0]),
+        "send still refused once every operation is applied");
+
+    uint64_t received = 0, n;
+    while (0 < (n = Quadtree_receive(tree, replies, 2 * npoints))) {
+        received += n;
+    }
+    assertLong(sent, received, "a reply to every operation sent before the refusal");
+    assertTrue(Quadtree_send(tree, QUADTREE_SEARCH, points[0]), "sent again once received");
+    assertLong(1, receive_replies(tree, replies, 1), "reply to it received");
+
+    end_test();
+
+#ifdef PARALLEL
+    start_test("one thread more than QUADTREE_CLIENTS stops the program");
+
+    // Clients are never given up while their thread lives, so the child runs out of them with the
+    // thread it starts after the first QUADTREE_CLIENTS.
+    fflush(stdout);
+    fflush(stderr);
+    const pid_t child = fork();
+    if (0 == child) {
+        freopen("/dev/null", "w", stderr);
+        clients_tree = Quadtree_init(2, uniform_point(1));
+        pthread_attr_t attributes;
+        pthread_attr_init(&attributes);
+        pthread_attr_setstacksize(&attributes, 1 << 16);
+        pthread_t thread;
+        for (i = 0; i < 1000; i++) {
+            pthread_create(&thread, &attributes, client_thread, NULL);
+            while (clients_started == i) {
+                sched_yield();
+            }
+        }
+        _exit(0);
+    }
+    int status;
+    waitpid(child, &status, 0);
+    char buffer[256];
+    sprintf(buffer, "threads stopped by SIGABRT (wait status %d)", status);
+    assertTrue(WIFSIGNALED(status) && SIGABRT == WTERMSIG(status), buffer);
+
+    end_test();
+#endif
+
+    Quadtree_free(tree);
+}
+#endif
+
+void test_quadtree_freeze() {
+    char buffer[256 + 30 * D];
+    char tree_buffer[128 + 15 * D], point_buffer[15 * D];
+    uint64_t i, j;
+
+    start_test("empty tree");
+
+    Point point1 = uniform_point(1);
+    float64_t length1 = 2;
+    Quadtree *tree1 = Quadtree_init(length1, point1);
+
+    Quadtree_string(tree1, tree_buffer);
+
+    FrozenQuadtree *frozen1 = Quadtree_freeze(tree1);
+    sprintf(buffer, "snapshot of %s", tree_buffer);
+    assertTrue(NULL != frozen1, buffer);
+    assertLong(1, frozen1->nsquares, "number of squares in snapshot");
+    assertLong(0, frozen1->npoints, "number of points in snapshot");
+
+    Point_string(&point1, point_buffer);
+    sprintf(buffer, "searching for non-existent %s in snapshot of %s", point_buffer, tree_buffer);
+    assertFalse(FrozenQuadtree_search(frozen1, point1), buffer);
+
+    end_test();
+
+    FrozenQuadtree_free(frozen1);
+
+    start_test("100 random points within bounds, 100 random points out of bounds");
+
+    Point points1[200];
+    // Points are constructed to not coincide.
+    for (i = 0; i < 100; i++) {
+        for (j = 0; j< D; j++) {
+            float64_t value = 2 * random() - 1;
+            float64_t sign = (value < 0 ? -1 : 1);
+            points1[i].data[j] = 1 + (value + sign * i) * length1 / 200.1;
+        }
+        Point_string(&points1[i], point_buffer);
+        sprintf(buffer, "point %s successfully added to %s", point_buffer, tree_buffer);
+        assertTrue(Quadtree_add(tree1, points1[i]), buffer);
+    }
+    for (i = 100; i < 200; i++) {
+        for (j = 0; j< D; j++) {
+            float64_t value = 2 * random() - 1;
+            float64_t sign = (value < 0 ? -1 : 1);
+            points1[i].data[j] = 1 + (value + sign * i) * length1 / 199.9;
+        }
+    }
+
+    Quadtree_flush(tree1);
+    frozen1 = Quadtree_freeze(tree1);
+    sprintf(buffer, "snapshot of %s", tree_buffer);
+    assertTrue(NULL != frozen1, buffer);
+    assertLong(100, frozen1->npoints, "number of points in snapshot");
+
+    for (i = 0; i < 100; i++) {
+        Point_string(&points1[i], point_buffer);
+        sprintf(buffer, "point %s exists in snapshot of %s", point_buffer, tree_buffer);
+        assertTrue(FrozenQuadtree_search(frozen1, points1[i]), buffer);
+    }
+    for (i = 100; i < 200; i++) {
+        Point_string(&points1[i], point_buffer);
+        sprintf(buffer, "point %s absent from snapshot of %s", point_buffer, tree_buffer);
+        assertFalse(FrozenQuadtree_search(frozen1, points1[i]), buffer);
+    }
+
+    end_test();
+    start_test("snapshot independent of tree");
+
+    Quadtree_free(tree1);
+
+    for (i = 0; i < 100; i++) {
+        Point_string(&points1[i], point_buffer);
+        sprintf(buffer, "point %s exists in snapshot of freed tree", point_buffer);
+        assertTrue(FrozenQuadtree_search(frozen1, points1[i]), buffer);
+    }
+
+    end_test();
+
+    FrozenQuadtree_free(frozen1);
+}
+
+void test_quadtree_learn() {
+    char buffer[256 + 30 * D];
+    char tree_buffer[128 + 15 * D], point_buffer[15 * D];
+    uint64_t i, j;
+
+    start_test("empty tree");
+
+    Point point1 = uniform_point(1);
+    float64_t length1 = 2;
+    Quadtree *tree1 = Quadtree_init(length1, point1);
+
+    Quadtree_string(tree1, tree_buffer);
+
+    LearnedIndex *index1 = Quadtree_learn(tree1);
+    sprintf(buffer, "learned index of %s", tree_buffer);
+    assertTrue(NULL != index1, buffer);
+    assertLong(0, index1->npoints, "number of points in learned index");
+
+    Point_string(&point1, point_buffer);
+    sprintf(buffer, "searching for non-existent %s in learned index of %s", point_buffer, tree_buffer);
+    assertFalse(LearnedIndex_search(index1, point1), buffer);
+
+    end_test();
+
+    LearnedIndex_free(index1);
+
+    start_test("100 random points within bounds, 100 random points out of bounds");
+
+    Point points1[200];
+    // Points are constructed to not coincide.
+    for (i = 0; i < 100; i++) {
+        for (j = 0; j< D; j++) {
+            float64_t value = 2 * random() - 1;
+            float64_t sign = (value < 0 ? -1 : 1);
+            points1[i].data[j] = 1 + (value + sign * i) * length1 / 200.1;
+        }
+        Point_string(&points1[i], point_buffer);
+        sprintf(buffer, "point %s successfully added to %s", point_buffer, tree_buffer);
+        assertTrue(Quadtree_add(tree1, points1[i]), buffer);
+    }
+    for (i = 100; i < 200; i++) {
+        for (j = 0; j< D; j++) {
+            float64_t value = 2 * random() - 1;
+            float64_t sign = (value < 0 ? -1 : 1);
+            points1[i].data[j] = 1 + (value + sign * i) * length1 / 199.9;
+        }
+    }
+
+    Quadtree_flush(tree1);
+    index1 = Quadtree_learn(tree1);
+    sprintf(buffer, "learned index of %s", tree_buffer);
+    assertTrue(NULL != index1, buffer);
+    assertLong(100, index1->npoints, "number of points in learned index");
+
+    bool sorted = true;
+    for (i = 1; i < index1->npoints; i++) {
+        sorted = sorted && index1->keys[i - 1] <= index1->keys[i];
+    }
+    assertTrue(sorted, "learned index keys are sorted");
+
+    for (i = 0; i < 100; i++) {
+        Point_string(&points1[i], point_buffer);
+        sprintf(buffer, "point %s exists in learned index of %s", point_buffer, tree_buffer);
+        assertTrue(LearnedIndex_search(index1, points1[i]), buffer);
+    }
+    for (i = 100; i < 200; i++) {
+        Point_string(&points1[i], point_buffer);
+        sprintf(buffer, "point %s absent from learned index of %s", point_buffer, tree_buffer);
+        assertFalse(LearnedIndex_search(index1, points1[i]), buffer);
+    }
+
+    end_test();
+
+    LearnedIndex_free(index1);
+    Quadtree_free(tree1);
+}
+
 /*
  * prepare_assertions
  *
@@ -873,6 +1942,573 @@ static bool prepare_assertions(const int length, char * const args[]) {
     return false;
 }
 
+/*
+ * struct RluObject_t
+ *
+ * An object shared through RLU in test_rlu.
+ *
+ * values - the values of the object
+ */
+typedef struct RluObject_t {
+    uint64_t values[16];
+} RluObject;
+
+/*
+ * struct RluFields_t
+ *
+ * An object shared through RLU in test_rlu, whose size is not a whole number of words.
+ *
+ * fields - the fields of the object, two to a word but the last
+ */
+typedef struct RluFields_t {
+    uint32_t fields[17];
+} RluFields;
+
+#ifdef PARALLEL
+/*
+ * rlu_idle_thread
+ *
+ * Stays registered with RLU, without running any section, from the first wait on the barrier to
+ * the second, so that the sections of the main thread do not run exclusively in the meantime.
+ *
+ * barrier - the barrier to wait on, shared with the main thread
+ */
+static void* rlu_idle_thread(void *barrier) {
+    rlu_self = (rlu_thread_data_t*)malloc(sizeof(*rlu_self));
+    RLU_THREAD_INIT(rlu_self);
+    pthread_barrier_wait((pthread_barrier_t*)barrier);
+    pthread_barrier_wait((pthread_barrier_t*)barrier);
+    RLU_THREAD_FINISH(rlu_self);
+    free(rlu_self);
+    return NULL;
+}
+
+/*
+ * rlu_id_thread
+ *
+ * Registers with RLU, records the id it is given and finishes.
+ *
+ * id - where to store the id, a long
+ */
+static void* rlu_id_thread(void *id) {
+    rlu_self = (rlu_thread_data_t*)malloc(sizeof(*rlu_self));
+    RLU_THREAD_INIT(rlu_self);
+    *(long*)id = rlu_self->uniq_id;
+    RLU_THREAD_FINISH(rlu_self);
+    free(rlu_self);
+    return NULL;
+}
+
+/*
+ * struct RluDeferred_t
+ *
+ * What the main thread shares with rlu_deferred_thread.
+ *
+ * objects - the objects the thread writes, one a section
+ * unwritten - how many of them were not written back yet when the thread started to finish
+ */
+typedef struct RluDeferred_t {
+    RluObject *objects[RLU_DEFAULT_MAX_WRITE_SETS - 1];
+    uint64_t unwritten;
+} RluDeferred;
+
+/*
+ * rlu_deferred_thread
+ *
+ * Writes fewer objects than it takes to fill its deferred write sets, then finishes.
+ */
+static void* rlu_deferred_thread(void *arg) {
+    RluDeferred * const deferred = (RluDeferred*)arg;
+    const uint64_t nobjects = sizeof(deferred->objects) / sizeof(deferred->objects[0]);
+    rlu_self = (rlu_thread_data_t*)malloc(sizeof(*rlu_self));
+    RLU_THREAD_INIT(rlu_self);
+
+    for (uint64_t i = 0; i < nobjects; i++) {
+        RLU_READER_LOCK(rlu_self);
+        RluObject *copy = deferred->objects[i];
+        RLU_TRY_LOCK(rlu_self, &copy);
+        copy->values[0] = i + 1;
+        RLU_READER_UNLOCK(rlu_self);
+    }
+    deferred->unwritten = 0;
+    for (uint64_t i = 0; i < nobjects; i++) {
+        deferred->unwritten += (0 == deferred->objects[i]->values[0]);
+    }
+
+    RLU_THREAD_FINISH(rlu_self);
+    free(rlu_self);
+    return NULL;
+}
+#endif
+
+void test_rlu() {
+    char buffer[256];
+    uint64_t i, found;
+
+    start_test("a section aborted before it writes");
+
+    // Only the main thread is registered, so its sections run exclusively wherever membarrier is
+    // available.
+    RluObject *object = (RluObject*)RLU_ALLOC(sizeof(*object));
+    for (i = 0; i < 16; i++) {
+        object->values[i] = i;
+    }
+    RLU_READER_LOCK(rlu_self);
+    const bool exclusive = RLU_IS_EXCLUSIVE(rlu_self);
+    assertLong(0, ((RluObject*)RLU_DEREF(rlu_self, object))->values[0], "object read");
+    RLU_ABORT(rlu_self);
+    assertFalse(RLU_IS_EXCLUSIVE(rlu_self), "abort ends the section");
+
+    RLU_READER_LOCK(rlu_self);
+    RluObject *copy = object;
+    assertTrue(RLU_TRY_LOCK(rlu_self, &copy), "object locked by the next section");
+    copy->values[0] = 100;
+    RLU_READER_UNLOCK(rlu_self);
+    rlu_force_sync(rlu_self);
+    assertLong(100, object->values[0], "next section written back");
+
+    end_test();
+
+    if (exclusive) {
+        start_test("an exclusive section aborted after it writes stops the program");
+
+        // The writes were made to the object itself, and there is nothing to undo them from.
+        fflush(stdout);
+        const pid_t child = fork();
+        if (0 == child) {
+            freopen("/dev/null", "w", stdout);
+            RLU_READER_LOCK(rlu_self);
+            copy = object;
+            RLU_TRY_LOCK(rlu_self, &copy);
+            copy->values[0] = 200;
+            RLU_ABORT(rlu_self);
+            _exit(0);
+        }
+        int status;
+        waitpid(child, &status, 0);
+        sprintf(buffer, "section aborted by SIGABRT (wait status %d)", status);
+        assertTrue(WIFSIGNALED(status) && SIGABRT == WTERMSIG(status), buffer);
+    } else {
+        start_test("a section aborted after it writes");
+
+        RLU_READER_LOCK(rlu_self);
+        copy = object;
+        RLU_TRY_LOCK(rlu_self, &copy);
+        copy->values[0] = 200;
+        RLU_ABORT(rlu_self);
+        assertLong(100, object->values[0], "write of the aborted section undone");
+    }
+
+    end_test();
+
+    start_test("counters after a known number of sections");
+
+    // Every object is written by a section of its own, and is large enough to be written back
+    // word by word.
+    const uint64_t nwrites = 20, nreads = 5;
+    RluObject *objects[nwrites];
+    for (i = 0; i < nwrites; i++) {
+        objects[i] = (RluObject*)RLU_ALLOC(sizeof(*objects[i]));
+        memset(objects[i], 0, sizeof(*objects[i]));
+    }
+#ifdef PARALLEL
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, 2);
+    pthread_t idle;
+    pthread_create(&idle, NULL, rlu_idle_thread, &barrier);
+    pthread_barrier_wait(&barrier);
+#endif
+    rlu_stats_t before, after, total_before, total_after;
+    assertTrue(rlu_get_thread_stats(rlu_self->uniq_id, &before), "counters of the main thread");
+    rlu_get_stats(&total_before);
+
+    bool exclusive_sections = false;
+    for (i = 0; i < nwrites; i++) {
+        RLU_READER_LOCK(rlu_self);
+        exclusive_sections = RLU_IS_EXCLUSIVE(rlu_self);
+        copy = objects[i];
+        RLU_TRY_LOCK(rlu_self, &copy);
+        copy->values[i % 16] = i + 1;
+        RLU_READER_UNLOCK(rlu_self);
+    }
+    rlu_force_sync(rlu_self);
+    for (i = 0; i < nreads; i++) {
+        RLU_READER_LOCK(rlu_self);
+        RLU_DEREF(rlu_self, objects[i]);
+        RLU_READER_UNLOCK(rlu_self);
+    }
+
+    rlu_get_thread_stats(rlu_self->uniq_id, &after);
+    rlu_get_stats(&total_after);
+
+    assertLong(nwrites + nreads, after.n_starts - before.n_starts, "every section started");
+    assertLong(nwrites + nreads, after.n_finish - before.n_finish, "every section finished");
+    assertLong(0, after.n_aborts - before.n_aborts, "no section aborted");
+    if (exclusive_sections) {
+        assertLong(nwrites + nreads, after.n_exclusive - before.n_exclusive,
+            "every section exclusive");
+        assertLong(0, after.n_writers - before.n_writers, "no write set in exclusive sections");
+    } else {
+        // A write set is synchronized once max_write_sets are deferred, and rlu_force_sync
+        // synchronizes the rest.
+        const uint64_t syncs = (nwrites + rlu_self->max_write_sets - 1) / rlu_self->max_write_sets;
+        assertLong(0, after.n_exclusive - before.n_exclusive, "no section exclusive");
+        assertLong(nwrites, after.n_writers - before.n_writers, "a writer for every write");
+        assertLong(nwrites, after.n_writer_writeback - before.n_writer_writeback,
+            "a write set written back for every write");
+        sprintf(buffer, "%llu writes synchronized %llu write sets at a time",
+            (unsigned long long)nwrites, (unsigned long long)rlu_self->max_write_sets);
+        assertLong(syncs, after.n_sync_and_writeback - before.n_sync_and_writeback, buffer);
+        assertLong(0, after.n_sync_requests - before.n_sync_requests, "no sync requested");
+        // Sections are counted as pure readers when they start with no write set deferred: the
+        // reads, and the first write after each sync.
+        assertLong(nreads + syncs, after.n_pure_readers - before.n_pure_readers,
+            "sections starting with no write set deferred counted as pure readers");
+    }
+    assertLong(after.n_starts - before.n_starts, total_after.n_starts - total_before.n_starts,
+        "sections of the main thread are all the sections counted");
+    assertLong(after.n_writers - before.n_writers, total_after.n_writers - total_before.n_writers,
+        "writers of the main thread are all the writers counted");
+    assertFalse(rlu_get_thread_stats(-1, &after), "no counters for a thread that does not exist");
+
+    for (i = 0, found = 0; i < nwrites; i++) {
+        found += (i + 1 == objects[i]->values[i % 16]);
+    }
+    assertLong(nwrites, found, "every write written back");
+
+    end_test();
+
+    start_test("a write set that crosses a chunk boundary");
+
+    // The idle thread is still registered, and one section locks more objects than a chunk of its
+    // write set can copy.
+    const uint64_t nlocked = 2 * RLU_WRITE_SET_CHUNK_SIZE / sizeof(RluObject);
+    RluObject *locked[nlocked];
+    for (i = 0; i < nlocked; i++) {
+        locked[i] = (RluObject*)RLU_ALLOC(sizeof(*locked[i]));
+        memset(locked[i], 0, sizeof(*locked[i]));
+    }
+
+    RLU_READER_LOCK(rlu_self);
+    exclusive_sections = RLU_IS_EXCLUSIVE(rlu_self);
+    for (i = 0; i < nlocked; i++) {
+        copy = locked[i];
+        assertTrue(RLU_TRY_LOCK(rlu_self, &copy), "object locked");
+        copy->values[i % 16] = i + 1;
+    }
+    if (!exclusive_sections) {
+        assertTrue(NULL != rlu_self->obj_write_set[rlu_self->ws_cur_id].p_first_chunk->p_next,
+            "write set spread over more than one chunk");
+    }
+    for (i = 0, found = 0; i < nlocked; i++) {
+        found += (i + 1 == ((RluObject*)RLU_DEREF(rlu_self, locked[i]))->values[i % 16]);
+    }
+    assertLong(nlocked, found, "every copy read back by the section that wrote it");
+    RLU_READER_UNLOCK(rlu_self);
+    rlu_force_sync(rlu_self);
+
+    for (i = 0, found = 0; i < nlocked; i++) {
+        found += (i + 1 == locked[i]->values[i % 16]);
+    }
+    assertLong(nlocked, found, "every copy written back");
+
+    end_test();
+
+#ifndef NUMA_POOLS
+    start_test("an object freed is handed out again by the pool");
+
+    // Frees are only processed when a write set is written back, so the object is freed by a
+    // section that writes it.
+    RluObject * const freed = (RluObject*)RLU_ALLOC(sizeof(*freed));
+    RLU_READER_LOCK(rlu_self);
+    exclusive_sections = RLU_IS_EXCLUSIVE(rlu_self);
+    copy = freed;
+    RLU_TRY_LOCK(rlu_self, &copy);
+    copy->values[0] = 1;
+    RLU_FREE(rlu_self, freed);
+    RLU_READER_UNLOCK(rlu_self);
+
+    RluObject * const fresh = (RluObject*)RLU_ALLOC(sizeof(*fresh));
+    if (exclusive_sections) {
+        assertTrue(freed == fresh, "object handed out again once the exclusive section frees it");
+    } else {
+        assertTrue(freed != fresh, "object not handed out again before its write set is written back");
+        rlu_force_sync(rlu_self);
+        RluObject * const recycled = (RluObject*)RLU_ALLOC(sizeof(*recycled));
+        assertTrue(freed == recycled, "object handed out again once its write set is written back");
+        RLU_FREE(NULL, recycled);
+    }
+    RLU_FREE(NULL, fresh);
+
+    end_test();
+#endif
+
+    start_test("a thread that finishes and registers again reuses its id");
+
+    const long main_id = rlu_self->uniq_id;
+    long n_threads = rlu_get_n_threads();
+    RLU_THREAD_FINISH(rlu_self);
+    RLU_THREAD_INIT(rlu_self);
+    assertLong(main_id, rlu_self->uniq_id, "id of the main thread reused");
+    assertLong(n_threads, rlu_get_n_threads(), "no new id taken by the main thread");
+
+#ifdef PARALLEL
+    // The main and idle threads keep their ids, and every other thread gets the same one.
+    long first_id, second_id;
+    pthread_t worker;
+    pthread_create(&worker, NULL, rlu_id_thread, &first_id);
+    pthread_join(worker, NULL);
+    n_threads = rlu_get_n_threads();
+    pthread_create(&worker, NULL, rlu_id_thread, &second_id);
+    pthread_join(worker, NULL);
+    assertTrue(main_id != first_id, "id of the main thread not given to another thread");
+    assertLong(first_id, second_id, "id of the exited thread reused");
+    assertLong(n_threads, rlu_get_n_threads(), "no new id taken by the second thread");
+#endif
+
+    end_test();
+
+#ifdef PARALLEL
+    start_test("write sets deferred by a thread written back when it finishes");
+
+    // The main and idle threads are registered, so the sections of the thread do not run
+    // exclusively, and no other thread asks it to sync.
+    RluDeferred deferred;
+    const uint64_t ndeferred = sizeof(deferred.objects) / sizeof(deferred.objects[0]);
+    for (i = 0; i < ndeferred; i++) {
+        deferred.objects[i] = (RluObject*)RLU_ALLOC(sizeof(*deferred.objects[i]));
+        memset(deferred.objects[i], 0, sizeof(*deferred.objects[i]));
+    }
+    pthread_create(&worker, NULL, rlu_deferred_thread, &deferred);
+    pthread_join(worker, NULL);
+
+    sprintf(buffer, "%llu write sets deferred, one fewer than RLU_DEFAULT_MAX_WRITE_SETS",
+        (unsigned long long)ndeferred);
+    assertLong(ndeferred, deferred.unwritten, buffer);
+    for (i = 0, found = 0; i < ndeferred; i++) {
+        found += (i + 1 == deferred.objects[i]->values[0]);
+    }
+    assertLong(ndeferred, found, "every deferred write set written back by rlu_thread_finish");
+
+    RLU_READER_LOCK(rlu_self);
+    for (i = 0; i < ndeferred; i++) {
+        RLU_FREE(rlu_self, deferred.objects[i]);
+    }
+    RLU_READER_UNLOCK(rlu_self);
+
+    end_test();
+#endif
+
+    start_test("a partial-word writeback leaves neighbouring fields alone");
+
+    // Only one field of a word and the field of the trailing half word change, and the object is
+    // large enough to be written back word by word.
+    RluFields * const fields = (RluFields*)RLU_ALLOC(sizeof(*fields));
+    for (i = 0; i < 17; i++) {
+        fields->fields[i] = i + 1;
+    }
+    rlu_get_thread_stats(rlu_self->uniq_id, &before);
+    RLU_READER_LOCK(rlu_self);
+    exclusive_sections = RLU_IS_EXCLUSIVE(rlu_self);
+    RluFields *fields_copy = fields;
+    RLU_TRY_LOCK(rlu_self, &fields_copy);
+    fields_copy->fields[5] = 100;
+    fields_copy->fields[16] = 200;
+    RLU_READER_UNLOCK(rlu_self);
+    rlu_force_sync(rlu_self);
+    rlu_get_thread_stats(rlu_self->uniq_id, &after);
+
+    assertLong(100, fields->fields[5], "field in a word written back");
+    assertLong(200, fields->fields[16], "field in the trailing half word written back");
+    for (i = 0, found = 0; i < 17; i++) {
+        found += (i + 1 == fields->fields[i]);
+    }
+    assertLong(15, found, "every other field unchanged");
+    if (!exclusive_sections) {
+        assertLong(sizeof(intptr_t) + sizeof(uint32_t),
+            after.n_writeback_bytes - before.n_writeback_bytes,
+            "only the changed word and the trailing half word written back");
+        assertLong(sizeof(*fields) - sizeof(intptr_t) - sizeof(uint32_t),
+            after.n_writeback_skipped_bytes - before.n_writeback_skipped_bytes,
+            "every other word skipped");
+    }
+
+    end_test();
+
+#ifdef PARALLEL
+    pthread_barrier_wait(&barrier);
+    pthread_join(idle, NULL);
+    pthread_barrier_destroy(&barrier);
+#endif
+
+    RLU_READER_LOCK(rlu_self);
+    RLU_FREE(rlu_self, object);
+    for (i = 0; i < nwrites; i++) {
+        RLU_FREE(rlu_self, objects[i]);
+    }
+    for (i = 0; i < nlocked; i++) {
+        RLU_FREE(rlu_self, locked[i]);
+    }
+    RLU_FREE(rlu_self, fields);
+    RLU_READER_UNLOCK(rlu_self);
+}
+
+#ifdef PARALLEL
+/*
+ * epoch_retire_thread
+ *
+ * Allocates an object, retires it and exits before it can be reclaimed.
+ *
+ * object - where to store the object retired
+ */
+static void* epoch_retire_thread(void *object) {
+    void * const retired = Epoch_alloc(500, 0);
+    Epoch_enter();
+    Epoch_retire(retired, 500);
+    Epoch_exit();
+    *(void**)object = retired;
+    return NULL;
+}
+#endif
+
+void test_epoch() {
+    // Objects of this size are in a recycle class of their own, which no tree node falls into.
+    const size_t size = 500;
+
+    start_test("retired objects are reclaimed once every thread has moved on");
+
+    void * const object = Epoch_alloc(size, 0);
+    Epoch_enter();
+    Epoch_retire(object, size);
+    void * const fresh = Epoch_alloc(size, 0);
+    assertTrue(object != fresh, "object not handed out again while it may still be read");
+    Epoch_exit();
+    node_free(fresh);
+
+    Epoch_synchronize();
+    void * const recycled = Epoch_alloc(size, 0);
+#ifndef NUMA_POOLS
+    assertTrue(object == recycled, "object handed out again after Epoch_synchronize");
+#endif
+    node_free(recycled);
+
+    end_test();
+
+#ifdef PARALLEL
+    start_test("objects retired by an exited thread are adopted");
+
+    void *orphaned = NULL;
+    pthread_t thread;
+    pthread_create(&thread, NULL, epoch_retire_thread, &orphaned);
+    pthread_join(thread, NULL);
+
+    Epoch_synchronize();
+    void * const adopted = Epoch_alloc(size, 0);
+#ifndef NUMA_POOLS
+    assertTrue(orphaned == adopted, "object of the exited thread handed out again");
+#endif
+    node_free(adopted);
+
+    end_test();
+#endif
+}
+
+#ifdef PARALLEL
+/*
+ * contention_record_thread
+ *
+ * Counts 300 conflicts over a square of level 3, and 200 and 100 over two squares of level 1.
+ */
+static void* contention_record_thread(void *unused) {
+    const Point center1 = uniform_point(0.5), center2 = uniform_point(-0.5);
+    uint64_t i;
+    for (i = 0; i < 300; i++) {
+        Contention_record(3, 0.25, &center1);
+        if (i < 200) {
+            Contention_record(1, 1, &center1);
+        }
+        if (i < 100) {
+            Contention_record(1, 1, &center2);
+        }
+    }
+    return unused;
+}
+#endif
+
+void test_contention() {
+    char buffer[256];
+    char *report;
+    size_t length;
+    FILE *out;
+
+    start_test("no conflicts once reset");
+
+    Contention_reset();
+    out = open_memstream(&report, &length);
+    Contention_report(out, 10);
+    fclose(out);
+    assertTrue(NULL != strstr(report, "Conflicts:                   0\n"), "no conflicts reported");
+    assertTrue(NULL == strstr(report, "Hottest squares"), "no squares reported");
+    free(report);
+
+    end_test();
+
+#ifdef PARALLEL
+    start_test("conflicts counted by concurrent threads, hottest squares first");
+
+    const uint64_t nthreads = 4;
+    pthread_t threads[nthreads];
+    uint64_t i;
+    for (i = 0; i < nthreads; i++) {
+        pthread_create(threads + i, NULL, contention_record_thread, NULL);
+    }
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    out = open_memstream(&report, &length);
+    Contention_report(out, 2);
+    fclose(out);
+
+    // The report lists the total, each level, then the squares, one per line.
+    unsigned long long total = 0, levels[QUADTREE_LEVELS] = {0}, rank, level, conflicts;
+    uint64_t nsquares = 0;
+    uint64_t square_levels[3] = {0}, square_conflicts[3] = {0};
+    float64_t square_length;
+    char *line, *save;
+    for (line = strtok_r(report, "\n", &save); NULL != line; line = strtok_r(NULL, "\n", &save)) {
+        if (1 == sscanf(line, "Conflicts: %llu", &total)) {
+            continue;
+        }
+        if (2 == sscanf(line, " level %llu: %llu", &level, &conflicts) && level < QUADTREE_LEVELS) {
+            levels[level] = conflicts;
+            continue;
+        }
+        if (3 == sscanf(line, " %llu. level %llu, length %lf", &rank, &level, &square_length) &&
+                nsquares < 3 && 1 == sscanf(strrchr(line, ':') + 1, "%llu", &conflicts)) {
+            square_levels[nsquares] = level;
+            square_conflicts[nsquares] = conflicts;
+            nsquares++;
+        }
+    }
+    free(report);
+
+    sprintf(buffer, "all %llu conflicts counted", (unsigned long long)(600 * nthreads));
+    assertLong(600 * nthreads, total, buffer);
+    assertLong(300 * nthreads, levels[3], "conflicts on level 3 counted");
+    assertLong(300 * nthreads, levels[1], "conflicts on level 1 counted");
+    assertLong(2, nsquares, "only as many squares as asked for reported");
+    assertLong(3, square_levels[0], "hottest square reported first");
+    assertLong(300 * nthreads, square_conflicts[0], "conflicts over the hottest square counted");
+    assertLong(1, square_levels[1], "second hottest square reported second");
+    assertLong(200 * nthreads, square_conflicts[1], "conflicts over the second square counted");
+
+    end_test();
+
+    Contention_reset();
+#endif
+}
+
 int main(int argc, char *argv[]) {
     setbuf(stdout, 0);
 
@@ -888,8 +2524,9 @@ int main(int argc, char *argv[]) {
     printf("[Beginning tests]\n");
 
     // Initialize RLU
-    RLU_INIT(RLU_TYPE_FINE_GRAINED, 8);
+    RLU_INIT(RLU_TYPE_FINE_GRAINED, RLU_DEFAULT_MAX_WRITE_SETS);
     rlu_self = (rlu_thread_data_t*)malloc(sizeof(*rlu_self));
+    RLU_THREAD_INIT(rlu_self);
 
     start_suite(test_sizes, "Struct sizes");
     start_suite(test_in_range, "in_range");
@@ -902,8 +2539,28 @@ int main(int argc, char *argv[]) {
     start_suite(test_quadtree_search, "Quadtree_search");
     start_suite(test_quadtree_remove, "Quadtree_remove");
     start_suite(test_randomized, "Randomized input");
+    start_suite(test_quadtree_stats, "Quadtree_stats");
+#if defined(PARALLEL) && defined(QUADTREE_CONCURRENT)
+    start_suite(test_thread_handover, "Thread handover");
+    start_suite(test_concurrent_updates, "Concurrent updates");
+#endif
+#ifdef QUADTREE_TXN
+    start_suite(test_quadtree_txn, "Quadtree_txn");
+#endif
+#ifdef QUADTREE_COW
+    start_suite(test_quadtree_snapshot, "Quadtree_snapshot");
+#endif
+#ifdef QUADTREE_ASYNC
+    start_suite(test_quadtree_send, "Quadtree_send");
+#endif
+    start_suite(test_quadtree_freeze, "Quadtree_freeze");
+    start_suite(test_quadtree_learn, "Quadtree_learn");
+    start_suite(test_rlu, "RLU");
+    start_suite(test_epoch, "Epoch");
+    start_suite(test_contention, "Contention");
 
     // End RLU
+    RLU_THREAD_FINISH(rlu_self);
     free(rlu_self);
 
     printf("\n[Ending tests]\n");
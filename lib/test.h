@@ -6,6 +6,7 @@ Testing suite utilities header
 #define QUADTREE_TEST_H
 
 #include <omp.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
@@ -17,9 +18,12 @@ Testing suite utilities header
 #include "types.h"
 #include "util.h"
 #include "Quadtree.h"
+#include "FrozenQuadtree.h"
+#include "LearnedIndex.h"
+#include "Epoch.h"
+#include "Contention.h"
 
 extern __thread rlu_thread_data_t *rlu_self;
-extern uint32_t Marsaglia_rand();
 #define rand() Marsaglia_rand()
 #define random() Marsaglia_random()
 
@@ -4,9 +4,14 @@ Some utility functions
 
 #include "./util.h"
 
+#include <linux/mempolicy.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 /*******************************
 ** Marsaglia RNG
@@ -180,3 +185,443 @@ void pthread_mutex_attr_destroy() {
     lock_attr_ptr = NULL;
     pthread_mutexattr_destroy((pthread_mutexattr_t*)&lock_attr);
 }
+
+/*******************************
+** NUMA node pools
+*******************************/
+
+// Most NUMA nodes told apart; threads on higher nodes share pools with lower ones.
+#define NUMA_POOL_NODES 64
+// Size of the chunks that pools take from the kernel.
+#define NUMA_POOL_CHUNK (1ULL << 21)
+// Blocks are rounded up to whole granules, and pooled if they are at most NUMA_POOL_CLASSES long.
+#define NUMA_POOL_GRANULE 16
+#define NUMA_POOL_CLASSES 32
+// Number of allocations a thread makes before checking which NUMA node it runs on again.
+#define NUMA_POOL_REFRESH 256
+// Smallest page size, at which blocks are checked for the NUMA node their memory is on.
+#define NUMA_POOL_PAGE 4096
+// Number of times a thread spins on a pool lock before letting other threads run.
+#define NUMA_POOL_SPINS 64
+// Most free blocks of one size a thread keeps to itself, and how many it moves to or from a pool
+// at a time.
+#define NUMA_CACHE_SIZE 64
+#define NUMA_CACHE_BATCH 32
+
+// Pool numbers of the interleaved pool, and of blocks allocated with malloc.
+#define NUMA_POOL_INTERLEAVED NUMA_POOL_NODES
+#define NUMA_POOL_UNPOOLED (NUMA_POOL_NODES + 1)
+
+/**
+ * struct NumaBlock_t
+ *
+ * The header in front of every block, a granule long so that blocks stay aligned to granules. A
+ * free block keeps the next free block of its size where its data goes.
+ *
+ * pool - the number of the pool the block belongs to
+ * granules - the length of the block in granules, not counting the header
+ * node - the pool of the NUMA node the block's memory is on, which binding only prefers
+ */
+typedef struct NumaBlock_t {
+    uint32_t pool, granules, node;
+} __attribute__((aligned(NUMA_POOL_GRANULE))) NumaBlock;
+
+/**
+ * struct NumaPool_t
+ *
+ * The blocks of one NUMA node, or of the interleaved memory.
+ *
+ * lock - held while using the pool
+ * free - the free blocks of each length in granules
+ * chunk - the unused part of the current chunk
+ * left - the length of the unused part of the current chunk
+ * page - the page of the chunk that blocks were last cut from
+ * page_node - the pool of the NUMA node that page is on
+ * allocations - the number of blocks allocated from the pool
+ * remote_allocations - the number of those blocks whose memory is on another node
+ * remote_frees - the number of blocks freed by threads on other nodes
+ */
+typedef struct NumaPool_t {
+    volatile uint32_t lock;
+    NumaBlock *free[NUMA_POOL_CLASSES + 1];
+    char *chunk;
+    size_t left;
+    char *page;
+    uint32_t page_node;
+    uint64_t allocations, remote_allocations, remote_frees;
+} __attribute__((aligned(64))) NumaPool;
+
+/**
+ * struct NumaCache_t
+ *
+ * The free blocks a thread keeps from one pool, so that it takes the lock of the pool only once
+ * per batch of blocks.
+ *
+ * pool - the number of the pool the blocks belong to
+ * free - the free blocks of each length in granules
+ * count - the number of free blocks of each length
+ * allocations - the number of blocks allocated from the cache and not yet added to the pool's
+ * remote_allocations - the number of those blocks whose memory is on another node
+ */
+typedef struct NumaCache_t {
+    uint32_t pool;
+    NumaBlock *free[NUMA_POOL_CLASSES + 1];
+    uint32_t count[NUMA_POOL_CLASSES + 1];
+    uint64_t allocations, remote_allocations;
+} NumaCache;
+
+static NumaPool numa_pools[NUMA_POOL_NODES + 1];
+static volatile uint64_t numa_unpooled = 0;
+static __thread uint32_t numa_node = 0, numa_countdown = 0;
+
+// Each thread caches blocks of the pool of its node, and of the interleaved pool.
+static pthread_once_t numa_cache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t numa_cache_key;
+static __thread NumaCache numa_caches[2];
+static __thread bool numa_cache_ready = false;
+
+/**
+ * NumaPool_node
+ *
+ * Returns the pool of the NUMA node the calling thread runs on, as of its last check.
+ */
+static uint32_t NumaPool_node() {
+    if (0 == numa_countdown) {
+        unsigned int cpu, node;
+        if (0 != syscall(SYS_getcpu, &cpu, &node, NULL)) {
+            node = 0;
+        }
+        numa_node = node % NUMA_POOL_NODES;
+        numa_countdown = NUMA_POOL_REFRESH;
+    }
+    numa_countdown--;
+    return numa_node;
+}
+
+/**
+ * NumaPool_online
+ *
+ * Returns the mask of the NUMA nodes that are online, as listed by sysfs.
+ */
+static unsigned long NumaPool_online() {
+    unsigned long mask = 0;
+    FILE * const online = fopen("/sys/devices/system/node/online", "r");
+    if (NULL == online) {
+        return 1;
+    }
+    unsigned int low, high;
+    while (1 == fscanf(online, "%u", &low)) {
+        high = low;
+        if (1 != fscanf(online, "-%u", &high)) {
+            high = low;
+        }
+        for (; low <= high && low < NUMA_POOL_NODES; low++) {
+            mask |= 1UL << low;
+        }
+        if (',' != fgetc(online)) {
+            break;
+        }
+    }
+    fclose(online);
+    return (0 == mask ? 1 : mask);
+}
+
+/**
+ * NumaPool_grow
+ *
+ * Gives a pool a new chunk, bound to its node or interleaved across every node. The binding is
+ * only a preference, and without it pages land on the node of the thread that first touches them,
+ * which for node pools is the same node.
+ *
+ * pool - the pool to grow, whose lock the caller holds
+ *
+ * Returns whether the pool has a new chunk.
+ */
+static bool NumaPool_grow(NumaPool * const pool) {
+    void * const chunk = mmap(NULL, NUMA_POOL_CHUNK, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == chunk) {
+        return false;
+    }
+
+    const uint64_t index = pool - numa_pools;
+    const unsigned long mask = (NUMA_POOL_INTERLEAVED == index ? NumaPool_online() : 1UL << index);
+    syscall(SYS_mbind, chunk, NUMA_POOL_CHUNK,
+        NUMA_POOL_INTERLEAVED == index ? MPOL_INTERLEAVE : MPOL_PREFERRED,
+        &mask, 8 * sizeof(mask) + 1, 0);
+
+    pool->chunk = (char*)chunk;
+    pool->left = NUMA_POOL_CHUNK;
+    return true;
+}
+
+/**
+ * NumaPool_locate
+ *
+ * Returns the pool of the NUMA node a new block's memory is on, asking the kernel once per page.
+ * Without NUMA support in the kernel, the memory is taken to be where the pool bound it.
+ *
+ * pool - the pool the block is cut from, whose lock the caller holds
+ * block - the block, whose header has been written so that its page is in memory
+ */
+static uint32_t NumaPool_locate(NumaPool * const pool, NumaBlock * const block) {
+    const uint32_t index = pool - numa_pools;
+    if (NUMA_POOL_INTERLEAVED == index) {
+        return index;
+    }
+
+    char * const page = (char*)((uintptr_t)block & ~(uintptr_t)(NUMA_POOL_PAGE - 1));
+    if (page != pool->page) {
+        void *pages[1] = { page };
+        int status[1] = { -1 };
+        pool->page = page;
+        pool->page_node = index;
+        if (0 == syscall(SYS_move_pages, 0, 1UL, pages, NULL, status, 0) && 0 <= status[0]) {
+            pool->page_node = status[0] % NUMA_POOL_NODES;
+        }
+    }
+    return pool->page_node;
+}
+
+static inline void NumaPool_lock(NumaPool * const pool) {
+    uint64_t spins = 0;
+    while (__sync_lock_test_and_set(&pool->lock, 1)) {
+        while (pool->lock) {
+            if (0 == ++spins % NUMA_POOL_SPINS) {
+                sched_yield();
+            }
+        }
+    }
+}
+
+static inline void NumaPool_unlock(NumaPool * const pool) {
+    __sync_lock_release(&pool->lock);
+}
+
+/**
+ * NumaCache_count
+ *
+ * Adds the allocations counted by a cache to its pool, whose lock the caller holds.
+ *
+ * cache - the cache whose counts to move
+ * pool - the pool of the cache
+ */
+static inline void NumaCache_count(NumaCache * const cache, NumaPool * const pool) {
+    pool->allocations += cache->allocations;
+    pool->remote_allocations += cache->remote_allocations;
+    cache->allocations = 0;
+    cache->remote_allocations = 0;
+}
+
+/**
+ * NumaCache_refill
+ *
+ * Moves up to NUMA_CACHE_BATCH blocks of one length into a cache, taking free blocks of the pool
+ * first and cutting the rest from its chunk.
+ *
+ * cache - the cache to refill
+ * granules - the length of the blocks in granules
+ */
+static void NumaCache_refill(NumaCache * const cache, const uint32_t granules) {
+    NumaPool * const pool = numa_pools + cache->pool;
+    const size_t length = sizeof(NumaBlock) + granules * NUMA_POOL_GRANULE;
+    uint32_t moved;
+    NumaPool_lock(pool);
+    for (moved = 0; moved < NUMA_CACHE_BATCH; moved++) {
+        NumaBlock *block = pool->free[granules];
+        if (NULL != block) {
+            pool->free[granules] = *(NumaBlock**)(block + 1);
+        } else if (pool->left >= length || NumaPool_grow(pool)) {
+            block = (NumaBlock*)pool->chunk;
+            *block = (NumaBlock){ .pool = cache->pool, .granules = granules };
+            block->node = NumaPool_locate(pool, block);
+            pool->chunk += length;
+            pool->left -= length;
+        } else {
+            break;
+        }
+        *(NumaBlock**)(block + 1) = cache->free[granules];
+        cache->free[granules] = block;
+    }
+    cache->count[granules] += moved;
+    NumaCache_count(cache, pool);
+    NumaPool_unlock(pool);
+}
+
+/**
+ * NumaCache_give
+ *
+ * Moves free blocks of one length from a cache back to its pool, whose lock the caller holds.
+ *
+ * cache - the cache to take the blocks from
+ * pool - the pool of the cache
+ * granules - the length of the blocks in granules
+ * keep - the number of blocks of that length to leave in the cache
+ */
+static inline void NumaCache_give(NumaCache * const cache, NumaPool * const pool,
+        const uint32_t granules, const uint32_t keep) {
+    while (cache->count[granules] > keep) {
+        NumaBlock * const block = cache->free[granules];
+        cache->free[granules] = *(NumaBlock**)(block + 1);
+        *(NumaBlock**)(block + 1) = pool->free[granules];
+        pool->free[granules] = block;
+        cache->count[granules]--;
+    }
+}
+
+/**
+ * NumaCache_drain
+ *
+ * Moves free blocks of one length from a cache back to its pool, down to a number to keep.
+ *
+ * cache - the cache to drain
+ * granules - the length of the blocks in granules
+ * keep - the number of blocks of that length to leave in the cache
+ */
+static void NumaCache_drain(NumaCache * const cache, const uint32_t granules, const uint32_t keep) {
+    NumaPool * const pool = numa_pools + cache->pool;
+    NumaPool_lock(pool);
+    NumaCache_give(cache, pool, granules, keep);
+    NumaCache_count(cache, pool);
+    NumaPool_unlock(pool);
+}
+
+/**
+ * NumaCache_flush
+ *
+ * Moves every free block of a cache back to its pool.
+ *
+ * cache - the cache to flush
+ */
+static void NumaCache_flush(NumaCache * const cache) {
+    NumaPool * const pool = numa_pools + cache->pool;
+    uint32_t granules;
+    NumaPool_lock(pool);
+    for (granules = 1; granules <= NUMA_POOL_CLASSES; granules++) {
+        NumaCache_give(cache, pool, granules, 0);
+    }
+    NumaCache_count(cache, pool);
+    NumaPool_unlock(pool);
+}
+
+/**
+ * NumaCache_release
+ *
+ * Flushes the caches of a thread that is exiting. Blocks freed after this go to fresh caches,
+ * which are flushed again.
+ *
+ * caches - the caches of the thread
+ */
+static void NumaCache_release(void * const caches) {
+    NumaCache_flush((NumaCache*)caches);
+    NumaCache_flush((NumaCache*)caches + 1);
+    numa_cache_ready = false;
+}
+
+static void NumaCache_init() {
+    pthread_key_create(&numa_cache_key, NumaCache_release);
+}
+
+/**
+ * NumaCache_get
+ *
+ * Returns the cache of the calling thread for the pool of its node, or for the interleaved pool.
+ * A thread that has moved to another node first flushes its cache back to the old node's pool.
+ *
+ * interleaved - whether to return the cache of the interleaved pool
+ */
+static NumaCache* NumaCache_get(const bool interleaved) {
+    if (!numa_cache_ready) {
+        pthread_once(&numa_cache_once, NumaCache_init);
+        numa_caches[0].pool = NumaPool_node();
+        numa_caches[1].pool = NUMA_POOL_INTERLEAVED;
+        pthread_setspecific(numa_cache_key, numa_caches);
+        numa_cache_ready = true;
+    }
+    if (interleaved) {
+        return numa_caches + 1;
+    }
+
+    const uint32_t node = NumaPool_node();
+    if (node != numa_caches[0].pool) {
+        NumaCache_flush(numa_caches);
+        numa_caches[0].pool = node;
+    }
+    return numa_caches;
+}
+
+void* NumaPool_alloc(const size_t size, const bool interleaved) {
+    const uint32_t granules = max((size + NUMA_POOL_GRANULE - 1) / NUMA_POOL_GRANULE, 1);
+    NumaBlock *block;
+    if (granules > NUMA_POOL_CLASSES) {
+        block = (NumaBlock*)malloc(sizeof(*block) + size);
+        if (NULL == block) {
+            return NULL;
+        }
+        *block = (NumaBlock){ .pool = NUMA_POOL_UNPOOLED, .granules = granules,
+            .node = NUMA_POOL_UNPOOLED };
+        __sync_fetch_and_add(&numa_unpooled, 1);
+        return block + 1;
+    }
+
+    NumaCache * const cache = NumaCache_get(interleaved);
+    if (NULL == cache->free[granules]) {
+        NumaCache_refill(cache, granules);
+        if (NULL == cache->free[granules]) {
+            return NULL;
+        }
+    }
+    block = cache->free[granules];
+    cache->free[granules] = *(NumaBlock**)(block + 1);
+    cache->count[granules]--;
+    cache->allocations++;
+    cache->remote_allocations += (block->node != cache->pool);
+    return block + 1;
+}
+
+void NumaPool_free(void * const p) {
+    if (NULL == p) {
+        return;
+    }
+
+    NumaBlock * const block = (NumaBlock*)p - 1;
+    if (NUMA_POOL_UNPOOLED == block->pool) {
+        free(block);
+        return;
+    }
+
+    // Blocks of the pool of another node go straight back to it
+    NumaCache * const cache = NumaCache_get(NUMA_POOL_INTERLEAVED == block->pool);
+    if (cache->pool != block->pool) {
+        NumaPool * const pool = numa_pools + block->pool;
+        NumaPool_lock(pool);
+        *(NumaBlock**)p = pool->free[block->granules];
+        pool->free[block->granules] = block;
+        pool->remote_frees++;
+        NumaPool_unlock(pool);
+        return;
+    }
+
+    *(NumaBlock**)p = cache->free[block->granules];
+    cache->free[block->granules] = block;
+    if (++cache->count[block->granules] > NUMA_CACHE_SIZE) {
+        NumaCache_drain(cache, block->granules, NUMA_CACHE_SIZE - NUMA_CACHE_BATCH);
+    }
+}
+
+NumaPoolStats NumaPool_stats() {
+    NumaPoolStats stats = (NumaPoolStats){
+        .local = 0,
+        .interleaved = numa_pools[NUMA_POOL_INTERLEAVED].allocations,
+        .unpooled = numa_unpooled,
+        .remote = 0,
+        .remote_frees = 0
+    };
+    uint64_t i;
+    for (i = 0; i < NUMA_POOL_NODES; i++) {
+        stats.local += numa_pools[i].allocations - numa_pools[i].remote_allocations;
+        stats.remote += numa_pools[i].remote_allocations;
+        stats.remote_frees += numa_pools[i].remote_frees;
+    }
+    return stats;
+}
@@ -6,6 +6,8 @@ Some utility functions
 #define UTIL_H
 
 #include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
 
 #include "types.h"
 
@@ -113,4 +115,73 @@ pthread_mutexattr_t* pthread_mutex_attr();
 
 void pthread_mutex_attr_destroy();
 
+/*******************************
+** NUMA node pools
+*******************************/
+
+// Levels from which tree nodes are interleaved across NUMA nodes instead of placed on the node of
+// the thread creating them; by default, no level is.
+#ifndef NUMA_INTERLEAVE_LEVEL
+#define NUMA_INTERLEAVE_LEVEL 64
+#endif
+
+/**
+ * struct NumaPoolStats_t
+ *
+ * Counts of what the NUMA pools have done so far.
+ *
+ * local - blocks allocated on the NUMA node of the allocating thread
+ * remote - blocks allocated from the pool of the allocating thread's node, but whose memory the
+ *     kernel placed on another node, as when that node ran out of memory
+ * interleaved - blocks allocated from memory interleaved across every NUMA node
+ * unpooled - blocks too large for the pools, allocated with malloc
+ * remote_frees - blocks freed by a thread on another NUMA node than the one they were allocated on
+ */
+typedef struct NumaPoolStats_t {
+    uint64_t local, remote, interleaved, unpooled, remote_frees;
+} NumaPoolStats;
+
+/**
+ * NumaPool_alloc
+ *
+ * Allocates a block from the pool of the NUMA node the calling thread is running on, or from the
+ * interleaved pool. Pools take memory from the kernel in large chunks bound to their node, and keep
+ * freed blocks for reuse by size. Each thread keeps a cache of free blocks in front of the pools,
+ * and takes the lock of a pool only to move a batch of blocks in or out of its cache.
+ *
+ * size - the size of the block
+ * interleaved - whether to allocate from the interleaved pool, for memory read by every node
+ *
+ * Returns the block, which must be freed with NumaPool_free.
+ */
+void* NumaPool_alloc(const size_t size, const bool interleaved);
+
+/**
+ * NumaPool_free
+ *
+ * Returns a block to the cache of the calling thread, or straight to the pool it was allocated from
+ * if that is the pool of another node.
+ *
+ * p - the block to free, which may be NULL
+ */
+void NumaPool_free(void * const p);
+
+/**
+ * NumaPool_stats
+ *
+ * Returns the counts of every pool, added up. Allocations a thread serves from its cache are only
+ * counted once it next moves blocks to or from the pool, or exits.
+ */
+NumaPoolStats NumaPool_stats();
+
+// Tree nodes come from the NUMA pools if NUMA_POOLS is defined, and from malloc otherwise. level is
+// the level of the tree the node is created on.
+#ifdef NUMA_POOLS
+#define node_alloc(size, level) NumaPool_alloc((size), (level) >= NUMA_INTERLEAVE_LEVEL)
+#define node_free(p) NumaPool_free(p)
+#else
+#define node_alloc(size, level) malloc(size)
+#define node_free(p) free(p)
+#endif
+
 #endif